@@ -51,7 +51,6 @@ LOCAL_SRC_FILES := \
     Ov5642Csi.cpp \
     Max9286Mipi.cpp \
     YuvToJpegEncoder.cpp \
-    NV12_resize.c \
     USPStream.cpp \
     DMAStream.cpp \
     UvcDevice.cpp \
@@ -60,13 +59,17 @@ LOCAL_SRC_FILES := \
     TVIN8DvDevice.cpp \
     VADCTVINDevice.cpp \
     MMAPStream.cpp \
-    TinyExif.cpp
-
-ifeq ($(BOARD_HAVE_VPU),true)
-    LOCAL_SRC_FILES += \
+    TinyExif.cpp \
+    FrameTrace.cpp \
     UvcMJPGDevice.cpp \
-    MJPGStream.cpp
-endif
+    MJPGStream.cpp \
+    Deinterlacer.cpp \
+    V4l2JpegEncoder.cpp \
+    CropScaler.cpp \
+    FrameRotator.cpp \
+    WorkerThread.cpp \
+    ConvertQueue.cpp \
+    ScratchBuffer.cpp
 
 LOCAL_SHARED_LIBRARIES := \
     libcamera_metadata \
@@ -115,5 +118,14 @@ LOCAL_CFLAGS += -Wall -Wextra -fvisibility=hidden
 
 LOCAL_MODULE_TAGS := optional
 
+# benchmarks build HAL sources themselves, symbols are hidden in the module.
+CAMERA3_SRC_FILES := $(LOCAL_SRC_FILES)
+CAMERA3_C_INCLUDES := $(LOCAL_C_INCLUDES)
+CAMERA3_SHARED_LIBRARIES := $(LOCAL_SHARED_LIBRARIES)
+CAMERA3_CFLAGS := $(LOCAL_CFLAGS)
+CAMERA3_CPPFLAGS := $(LOCAL_CPPFLAGS)
+
 include $(BUILD_SHARED_LIBRARY)
+
+include $(call all-makefiles-under,$(LOCAL_PATH))
 endif
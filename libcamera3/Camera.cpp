@@ -34,6 +34,7 @@
 
 #include "Camera.h"
 #include "CameraUtils.h"
+#include "FrameRotator.h"
 #include "Max9286Mipi.h"
 #include "Ov5640Csi.h"
 #include "Ov5640Csi8MQ.h"
@@ -80,7 +81,6 @@ Camera* Camera::createCamera(int32_t id, char* name, int32_t facing,
         device = new Ov5640Csi(id, facing, orientation, path);
     }
     else if (strstr(name, UVC_SENSOR_NAME)) {
-#ifdef BOARD_HAVE_VPU
         char uvcMJPGStr[92];
         int configUseMJPG = 0;
 
@@ -91,22 +91,19 @@ Camera* Camera::createCamera(int32_t id, char* name, int32_t facing,
         else
             configUseMJPG = atoi(uvcMJPGStr);
 
-        if(configUseMJPG == 0) {
-            ALOGI("create id:%d usb camera device", id);
-            device = UvcDevice::newInstance(id, name, facing, orientation, path);
-        } else {
+        // MJPEG is decoded by VPU, or by libjpeg without VPU.
+        if (configUseMJPG != 0) {
             ALOGI("DeviceAdapter: Create uvc device, config to use MJPG");
             device = new UvcMJPGDevice(id, facing, orientation, path);
-        }
-#else
+        } else {
 #ifdef IMX7ULP_UVC
-        ALOGI("create id:%d imx7ulp usb camera device", id);
-        device = Uvc7ulpDevice::newInstance(id, name, facing, orientation, path);
+            ALOGI("create id:%d imx7ulp usb camera device", id);
+            device = Uvc7ulpDevice::newInstance(id, name, facing, orientation, path);
 #else
-        ALOGI("create id:%d usb camera device", id);
-        device = UvcDevice::newInstance(id, name, facing, orientation, path);
-#endif
+            ALOGI("create id:%d usb camera device", id);
+            device = UvcDevice::newInstance(id, name, facing, orientation, path);
 #endif
+        }
     }
     else if (strstr(name, OV5640_SENSOR_NAME)) {
 #ifdef VADC_TVIN
@@ -150,12 +147,14 @@ Camera* Camera::createCamera(int32_t id, char* name, int32_t facing,
 }
 
 Camera::Camera(int32_t id, int32_t facing, int32_t orientation, char *path)
-    : mId(id), mStaticInfo(NULL), mBusy(false), mCallbackOps(NULL), mStreams(NULL), mNumStreams(0), mTmpBuf(NULL), usemx6s(0)
+    : mId(id), mStaticInfo(NULL), mBusy(false), mCallbackOps(NULL), mStreams(NULL), mNumStreams(0), mLastSettingsSize(0), mModeWidth(0), mModeHeight(0), mTmpBuf(NULL), usemx6s(0), mTransform(0)
 {
     ALOGI("%s:%d: new camera device", __func__, mId);
     android::Mutex::Autolock al(mDeviceLock);
 
     camera_info::facing = facing;
+    // frames rotated in HAL are reported upright.
+    mTransform = FrameRotator::getConfiguredTransform(&orientation);
     camera_info::orientation = orientation;
     strncpy(SensorData::mDevPath, path, CAMAERA_FILENAME_LENGTH);
 
@@ -214,6 +213,10 @@ int32_t Camera::openDev(const hw_module_t *module, hw_device_t **device)
         return BAD_VALUE;
     }
 
+    char value[PROPERTY_VALUE_MAX];
+    property_get(CAMERA_TRACE, value, "0");
+    mTrace.setEnabled(atoi(value) != 0);
+
     mBusy = true;
     mDevice.common.module = const_cast<hw_module_t*>(module);
     *device = &mDevice.common;
@@ -232,6 +235,7 @@ int32_t Camera::getInfo(struct camera_info *info)
         if (ret != 0) {
             ALOGW("%s initSensorStaticData failed", __func__);
         }
+        initSensorModes();
         setPreviewPixelFormat();
         setPicturePixelFormat();
         mStaticInfo = Metadata::createStaticInfo(*this, *this);
@@ -252,6 +256,8 @@ int32_t Camera::closeDev()
 
     // close camera dev nodes, etc
     mVideoStream->closeDev();
+    mModeWidth = 0;
+    mModeHeight = 0;
 
     mBusy = false;
     return 0;
@@ -441,7 +447,19 @@ int32_t Camera::processCaptureRequest(camera3_capture_request_t *request)
     // NULL indicates use last settings
     if (request->settings != NULL) {
         android::Mutex::Autolock al(mDeviceLock);
-        mSettings = new Metadata(request->settings);
+        // framework resends identical settings, reuse last copy then.
+        size_t size = get_camera_metadata_size(request->settings);
+        if ((mSettings == NULL) || (size != mLastSettingsSize) ||
+            memcmp(mLastSettings.data(), request->settings, size)) {
+            mSettings = new Metadata(request->settings);
+            if (mLastSettings.reserve(size) != NULL) {
+                memcpy(mLastSettings.data(), request->settings, size);
+                mLastSettingsSize = size;
+            }
+            else {
+                mLastSettingsSize = 0;
+            }
+        }
     }
 
     if (request->input_buffer != NULL) {
@@ -475,6 +493,7 @@ int32_t Camera::processCaptureRequest(camera3_capture_request_t *request)
     sp<VideoStream> devStream = NULL;
     camera3_callback_ops* callback = NULL;
     uint32_t fps = 30;
+    bool zsl = false;
     {
         android::Mutex::Autolock al(mDeviceLock);
         for (int32_t i = 0; i < mNumStreams; i++) {
@@ -509,12 +528,22 @@ int32_t Camera::processCaptureRequest(camera3_capture_request_t *request)
         meta = mSettings;
         devStream = mVideoStream;
         callback = (camera3_callback_ops*)mCallbackOps;
+        // zero shutter lag keeps sensor at still capture resolution.
+        zsl = (stillcap != NULL) && (devStream->getZslDepth() > 0);
     }
     sp<CaptureRequest> capture = new CaptureRequest();
+    if (capture == NULL) {
+        ALOGE("%s:%d: alloc capture request failed", __func__, mId);
+        return -ENOMEM;
+    }
 
     // configure VideoStream according to request type.
+    int32_t ret = NO_ERROR;
     if (request->settings != NULL) {
-        if (meta->getRequestType() == TYPE_STILLCAP) {
+        if (zsl) {
+            stillcap->setFps(fps);
+            ret = configureDevStream(devStream, stillcap, MODE_ZSL);
+        } else if (meta->getRequestType() == TYPE_STILLCAP) {
             if (stillcap == NULL) {
                 ALOGE("still capture intent but without jpeg stream");
                 if (preview != NULL) {
@@ -525,22 +554,27 @@ int32_t Camera::processCaptureRequest(camera3_capture_request_t *request)
             }
             if (stillcap != NULL) {
                 stillcap->setFps(fps);
-                devStream->configure(stillcap);
+                ret = configureDevStream(devStream, stillcap, MODE_STILL);
             }
         } else if (preview != NULL) {
             if (meta->getRequestType() != TYPE_SNAPSHOT) {
                 preview->setFps(fps);
             }
-            devStream->configure(preview);
+            ret = configureDevStream(devStream, preview, MODE_PREVIEW);
         } else if (callbackStream != NULL) {
             callbackStream->setFps(fps);
-            devStream->configure(callbackStream);
+            ret = configureDevStream(devStream, callbackStream, MODE_PREVIEW);
         } else {
             ALOGI("%s: RequestType = %d, but preview and callback stream is null", __func__, meta->getRequestType());
         }
     }
 
     capture->init(request, callback, meta);
+    if (ret != NO_ERROR) {
+        ALOGE("%s:%d: configure device stream failed %d", __func__, mId, ret);
+        capture->onRequestError();
+        return 0;
+    }
 
     return devStream->requestCapture(capture);
 
@@ -549,6 +583,22 @@ err_out:
     return -EINVAL;
 }
 
+int32_t Camera::flush()
+{
+    ALOGI("%s:%d", __func__, mId);
+    sp<VideoStream> devStream = NULL;
+    {
+        android::Mutex::Autolock al(mDeviceLock);
+        devStream = mVideoStream;
+    }
+
+    if (devStream == NULL) {
+        return 0;
+    }
+
+    return devStream->flush();
+}
+
 bool Camera::isValidReprocessSettings(const camera_metadata_t* /*settings*/)
 {
     // TODO: reject settings that cannot be reprocessed
@@ -651,6 +701,12 @@ void Camera::dumpDev(int32_t fd)
         dprintf(fd, "Stream %d/%d:\n", i, mNumStreams);
         mStreams[i]->dump(fd);
     }
+
+    mTrace.dump(fd);
+    char file[PROPERTY_VALUE_MAX];
+    if (property_get(CAMERA_TRACE_FILE, file, NULL) > 0) {
+        mTrace.exportJson(file, mId);
+    }
 }
 
 const char* Camera::templateToString(int32_t type)
@@ -828,6 +884,143 @@ bool Camera::isValidCaptureSettings(const camera_metadata_t* settings)
     return true;
 }
 
+int64_t Camera::getSensorModeCostLocked(const SensorMode& mode, bool withJpeg)
+{
+    uint64_t pixels = (uint64_t)mode.width * mode.height;
+    // capture bandwidth, then one scale pass per stream of other size.
+    uint64_t cost = pixels;
+    for (int32_t i = 0; i < mNumStreams; i++) {
+        sp<Stream>& stream = mStreams[i];
+        if (stream->isJpeg() && !withJpeg) {
+            continue;
+        }
+
+        uint32_t width = stream->width();
+        uint32_t height = stream->height();
+        if ((mode.width < width) || (mode.height < height)) {
+            return -1;
+        }
+        if ((mode.width == width) && (mode.height == height)) {
+            continue;
+        }
+
+        // converters scale without crop, aspect ratio must match in 2%.
+        uint64_t a = (uint64_t)mode.width * height;
+        uint64_t b = (uint64_t)width * mode.height;
+        if (((a > b) ? a - b : b - a) * 50 > a) {
+            return -1;
+        }
+
+        uint32_t weight = stream->scaleCost();
+        if (weight == 0) {
+            return -1;
+        }
+        cost += pixels * weight;
+    }
+
+    return (int64_t)cost;
+}
+
+int32_t Camera::findSensorModeLocked(bool withJpeg, uint32_t fps)
+{
+    int32_t best = -1;
+    int64_t bestCost = 0;
+    for (uint32_t i = 0; i < mSensorModeCount; i++) {
+        if (mSensorModes[i].maxFps < fps) {
+            continue;
+        }
+
+        int64_t cost = getSensorModeCostLocked(mSensorModes[i], withJpeg);
+        if ((cost >= 0) && ((best < 0) || (cost < bestCost))) {
+            best = i;
+            bestCost = cost;
+        }
+    }
+
+    return best;
+}
+
+int32_t Camera::selectSensorMode(int32_t usage, uint32_t fps,
+                                 uint32_t *pWidth, uint32_t *pHeight)
+{
+    android::Mutex::Autolock al(mDeviceLock);
+    bool hasJpeg = false;
+    for (int32_t i = 0; i < mNumStreams; i++) {
+        hasJpeg |= mStreams[i]->isJpeg();
+    }
+
+    int32_t idx = -1;
+    if (usage == MODE_STILL) {
+        // sensor restart costs more than scaling one capture.
+        uint32_t cur = mSensorModeCount;
+        for (uint32_t i = 0; i < mSensorModeCount; i++) {
+            if ((mSensorModes[i].width == mModeWidth) &&
+                (mSensorModes[i].height == mModeHeight)) {
+                cur = i;
+            }
+        }
+        if ((cur < mSensorModeCount) &&
+            (getSensorModeCostLocked(mSensorModes[cur], true) >= 0)) {
+            idx = cur;
+        }
+        else {
+            idx = findSensorModeLocked(true, 0);
+        }
+    }
+    else if (usage == MODE_ZSL) {
+        idx = findSensorModeLocked(true, fps);
+        if (idx < 0) {
+            idx = findSensorModeLocked(true, 0);
+        }
+    }
+    else {
+        idx = findSensorModeLocked(false, fps);
+        // a mode which also feeds jpeg avoids restart at each still capture,
+        // take it unless it costs more than twice the preview only mode.
+        int32_t shared = hasJpeg ? findSensorModeLocked(true, fps) : -1;
+        if ((shared >= 0) && ((idx < 0) ||
+            (getSensorModeCostLocked(mSensorModes[shared], false) <=
+             2 * getSensorModeCostLocked(mSensorModes[idx], false)))) {
+            idx = shared;
+        }
+    }
+
+    if (idx < 0) {
+        return BAD_VALUE;
+    }
+
+    if ((mModeWidth != mSensorModes[idx].width) ||
+        (mModeHeight != mSensorModes[idx].height)) {
+        ALOGI("%s usage:%d, fps:%d, sensor mode %dx%d", __func__, usage, fps,
+              mSensorModes[idx].width, mSensorModes[idx].height);
+    }
+    mModeWidth = mSensorModes[idx].width;
+    mModeHeight = mSensorModes[idx].height;
+    *pWidth = mModeWidth;
+    *pHeight = mModeHeight;
+
+    return NO_ERROR;
+}
+
+int32_t Camera::configureDevStream(sp<VideoStream>& devStream,
+                                   sp<Stream>& stream, int32_t usage)
+{
+    uint32_t width = stream->width();
+    uint32_t height = stream->height();
+    if (selectSensorMode(usage, stream->fps(), &width, &height) != NO_ERROR) {
+        // keep stream size, same as before mode selection.
+        android::Mutex::Autolock al(mDeviceLock);
+        if ((mModeWidth != width) || (mModeHeight != height)) {
+            ALOGW("%s no sensor mode for streams, use %dx%d", __func__,
+                  width, height);
+        }
+        mModeWidth = width;
+        mModeHeight = height;
+    }
+
+    return devStream->configure(stream, width, height);
+}
+
 int32_t Camera::getV4l2Res(uint32_t streamWidth, uint32_t streamHeight, uint32_t *pV4l2Width, uint32_t *pV4l2Height)
 {
     if ((pV4l2Width == NULL) || (pV4l2Height == NULL)) {
@@ -883,10 +1076,9 @@ static void dump(const camera3_device_t *dev, int32_t fd)
     camdev_to_camera(dev)->dumpDev(fd);
 }
 
-static int32_t flush(const camera3_device_t*)
+static int32_t flush(const camera3_device_t *dev)
 {
-    ALOGE("%s: unimplemented.", __func__);
-    return -1;
+    return camdev_to_camera(dev)->flush();
 }
 
 } // extern "C"
@@ -23,6 +23,7 @@
 #include "Metadata.h"
 #include "Stream.h"
 #include "CameraUtils.h"
+#include "FrameTrace.h"
 
 class VideoStream;
 // Camera represents a physical camera on a device.
@@ -55,6 +56,7 @@ public:
     int32_t registerStreamBuffers(const camera3_stream_buffer_set_t *buf_set);
     const camera_metadata_t *constructDefaultRequestSettings(int32_t type);
     int32_t processCaptureRequest(camera3_capture_request_t *request);
+    int32_t flush();
     void dumpDev(int32_t fd);
     int32_t usemx6s;
 
@@ -73,6 +75,19 @@ public:
         return mTmpBuf;
     }
 
+    FrameTrace& getTrace() {return mTrace;}
+    // HAL_TRANSFORM_* applied to frames while converting, see FrameRotator.
+    int32_t getTransform() {return mTransform;}
+
+    // sensor mode selection usage.
+    static const int32_t MODE_PREVIEW = 0;
+    static const int32_t MODE_STILL = 1;
+    static const int32_t MODE_ZSL = 2;
+    // select sensor mode for configured streams, it returns BAD_VALUE
+    // when no mode can feed all of them.
+    int32_t selectSensorMode(int32_t usage, uint32_t fps,
+                             uint32_t *pWidth, uint32_t *pHeight);
+
 protected:
     // Initialize static camera characteristics for individual device
     virtual status_t initSensorStaticData() = 0;
@@ -112,6 +127,12 @@ private:
     void notifyShutter(uint32_t frame_number, uint64_t timestamp);
     // Is type a valid template type (and valid index int32_to mTemplates)
     bool isValidTemplateType(int32_t type);
+    // relative cost to feed configured streams from mode, -1 if it can't.
+    int64_t getSensorModeCostLocked(const SensorMode& mode, bool withJpeg);
+    int32_t findSensorModeLocked(bool withJpeg, uint32_t fps);
+    // configure device stream to the mode selected for stream.
+    int32_t configureDevStream(sp<VideoStream>& devStream,
+                               sp<Stream>& stream, int32_t usage);
 
     // Identifier used by framework to distinguish cameras
     const int32_t mId;
@@ -136,11 +157,20 @@ private:
     sp<Metadata> mTemplates[CAMERA3_TEMPLATE_COUNT];
     // Most recent request settings seen, memoized to be reused
     sp<Metadata> mSettings;
+    // raw settings which mSettings is created from, to detect change.
+    ScratchBuffer mLastSettings;
+    size_t mLastSettingsSize;
+    // sensor mode which device stream is configured to.
+    uint32_t mModeWidth;
+    uint32_t mModeHeight;
 
 protected:
     sp<VideoStream> mVideoStream;
     autoState m3aState;
     uint8_t *mTmpBuf;  // used for soft csc temp buffer
+    // per frame latency of capture pipeline.
+    FrameTrace mTrace;
+    int32_t mTransform;
 };
 
 #endif // CAMERA_H_
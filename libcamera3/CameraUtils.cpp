@@ -15,6 +15,10 @@
  * limitations under the License.
  */
 
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 #include "CameraUtils.h"
 #include <linux/videodev2.h>
 #include "Metadata.h"
@@ -68,6 +72,7 @@ int convertPixelFormatToV4L2Format(PixelFormat format, bool invert)
 }
 
 StreamBuffer::StreamBuffer()
+    : mFd(-1), mInterlaced(false)
 {
 }
 
@@ -86,6 +91,7 @@ void StreamBuffer::initialize(buffer_handle_t* buf_h)
     mVirtAddr  = (void *)handle->base;
     mPhyAddr   = handle->phys;
     mSize      = handle->size;
+    mFd        = handle->fd;
 
     //for uvc jpeg stream
     mpFrameBuf  = NULL;
@@ -93,6 +99,21 @@ void StreamBuffer::initialize(buffer_handle_t* buf_h)
 }
 
 //--------------------CaptureRequest----------------------
+static ObjectPool<CaptureRequest, REQUEST_POOL_SIZE> sRequestPool;
+static ObjectPool<StreamBuffer, REQUEST_BUFFER_POOL_SIZE> sRequestBufferPool;
+
+void* CaptureRequest::operator new(size_t /*size*/) noexcept
+{
+    return sRequestPool.alloc();
+}
+
+void CaptureRequest::operator delete(void* ptr)
+{
+    if (ptr != NULL) {
+        sRequestPool.release(ptr);
+    }
+}
+
 CaptureRequest::CaptureRequest()
     : mOutBuffersNumber(0)
 {
@@ -104,8 +125,10 @@ CaptureRequest::CaptureRequest()
 CaptureRequest::~CaptureRequest()
 {
     for (uint32_t i = 0; i < mOutBuffersNumber; i++) {
-        if (mOutBuffers[i] != NULL)
-            delete mOutBuffers[i];
+        if (mOutBuffers[i] != NULL) {
+            mOutBuffers[i]->~StreamBuffer();
+            sRequestBufferPool.release(mOutBuffers[i]);
+        }
     }
 }
 
@@ -121,7 +144,13 @@ void CaptureRequest::init(camera3_capture_request* request,
 
     ALOGV("CaptureRequest fm:%d, bn:%d", mFrameNumber, mOutBuffersNumber);
     for (uint32_t i = 0; i < request->num_output_buffers; i++) {
-        mOutBuffers[i] = new StreamBuffer();
+        void* mem = sRequestBufferPool.alloc();
+        if (mem == NULL) {
+            ALOGE("%s alloc stream buffer failed", __func__);
+            mOutBuffersNumber = i;
+            break;
+        }
+        mOutBuffers[i] = new (mem) StreamBuffer();
         mOutBuffers[i]->mStream = reinterpret_cast<Stream*>(
                             request->output_buffers[i].stream->priv);
         mOutBuffers[i]->mAcquireFence = request->output_buffers[i].acquire_fence;
@@ -136,7 +165,6 @@ int32_t CaptureRequest::onCaptureError()
 
     cameraBuffer.status = CAMERA3_BUFFER_STATUS_ERROR;
     cameraBuffer.acquire_fence = -1;
-    cameraBuffer.release_fence = -1;
 
     memset(&result, 0, sizeof(result));
     result.frame_number = mFrameNumber;
@@ -148,6 +176,46 @@ int32_t CaptureRequest::onCaptureError()
         StreamBuffer* out = mOutBuffers[i];
         cameraBuffer.stream = out->mStream->stream();
         cameraBuffer.buffer = out->mBufHandle;
+        // acquire fence which is not waited goes back as release fence.
+        cameraBuffer.release_fence = out->mAcquireFence;
+        out->mAcquireFence = -1;
+        mCallbackOps->process_capture_result(mCallbackOps, &result);
+    }
+
+    return 0;
+}
+
+int32_t CaptureRequest::onRequestError()
+{
+    if (mCallbackOps == NULL) {
+        return 0;
+    }
+
+    camera3_notify_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = CAMERA3_MSG_ERROR;
+    msg.message.error.frame_number = mFrameNumber;
+    msg.message.error.error_stream = NULL;
+    msg.message.error.error_code = CAMERA3_MSG_ERROR_REQUEST;
+    mCallbackOps->notify(mCallbackOps, &msg);
+
+    // acquire fences are not waited, return them to framework.
+    camera3_stream_buffer_t cameraBuffer;
+    camera3_capture_result_t result;
+    memset(&result, 0, sizeof(result));
+    result.frame_number = mFrameNumber;
+    result.result = NULL;
+    result.num_output_buffers = 1;
+    result.output_buffers = &cameraBuffer;
+
+    for (uint32_t i=0; i<mOutBuffersNumber; i++) {
+        StreamBuffer* out = mOutBuffers[i];
+        cameraBuffer.stream = out->mStream->stream();
+        cameraBuffer.buffer = out->mBufHandle;
+        cameraBuffer.status = CAMERA3_BUFFER_STATUS_ERROR;
+        cameraBuffer.acquire_fence = -1;
+        cameraBuffer.release_fence = out->mAcquireFence;
+        out->mAcquireFence = -1;
         mCallbackOps->process_capture_result(mCallbackOps, &result);
     }
 
@@ -183,6 +251,41 @@ int32_t CaptureRequest::onCaptureDone(StreamBuffer* buffer)
     return 0;
 }
 
+int32_t CaptureRequest::onBufferError(StreamBuffer* buffer)
+{
+    if (buffer == NULL || buffer->mBufHandle == NULL || mCallbackOps == NULL) {
+        return 0;
+    }
+
+    camera3_notify_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = CAMERA3_MSG_ERROR;
+    msg.message.error.frame_number = mFrameNumber;
+    msg.message.error.error_stream = buffer->mStream->stream();
+    msg.message.error.error_code = CAMERA3_MSG_ERROR_BUFFER;
+    mCallbackOps->notify(mCallbackOps, &msg);
+
+    camera3_stream_buffer_t cameraBuffer;
+    cameraBuffer.stream = buffer->mStream->stream();
+    cameraBuffer.buffer = buffer->mBufHandle;
+    cameraBuffer.status = CAMERA3_BUFFER_STATUS_ERROR;
+    cameraBuffer.acquire_fence = -1;
+    // acquire fence which is not waited goes back as release fence.
+    cameraBuffer.release_fence = buffer->mAcquireFence;
+    buffer->mAcquireFence = -1;
+
+    camera3_capture_result_t result;
+    memset(&result, 0, sizeof(result));
+    result.frame_number = mFrameNumber;
+    result.result = NULL;
+    result.num_output_buffers = 1;
+    result.output_buffers = &cameraBuffer;
+
+    ALOGW("onBufferError fm:%d", mFrameNumber);
+    mCallbackOps->process_capture_result(mCallbackOps, &result);
+    return 0;
+}
+
 int32_t CaptureRequest::onSettingsDone(sp<Metadata> meta)
 {
     if (meta == NULL || (meta->get() == NULL) || mCallbackOps == NULL) {
@@ -225,6 +328,8 @@ SensorData::SensorData()
 
     memset(mPreviewResolutions, 0, sizeof(mPreviewResolutions));
     memset(mPictureResolutions, 0, sizeof(mPictureResolutions));
+    memset(mSensorModes, 0, sizeof(mSensorModes));
+    mSensorModeCount = 0;
 }
 
 SensorData::~SensorData()
@@ -371,6 +476,86 @@ status_t SensorData::setMaxPictureResolutions()
     return 0;
 }
 
+static uint32_t findSensorMode(SensorMode* modes, uint32_t count,
+                               uint32_t width, uint32_t height)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if ((modes[i].width == width) && (modes[i].height == height)) {
+            return i;
+        }
+    }
+
+    return count;
+}
+
+void SensorData::initSensorModes()
+{
+    mSensorModeCount = 0;
+    int fd = open(mDevPath, O_RDWR | O_NONBLOCK);
+    uint32_t format = convertPixelFormatToV4L2Format(mSensorFormats[0]);
+
+    // resolution tables are already filtered by device, frame intervals
+    // are enumerated where driver supports it.
+    for (int i = 0; i < mPictureResolutionCount + mPreviewResolutionCount;
+         i += 2) {
+        bool preview = (i >= mPictureResolutionCount);
+        int* res = preview ? &mPreviewResolutions[i - mPictureResolutionCount]
+                           : &mPictureResolutions[i];
+        if ((res[0] <= 0) || (res[1] <= 0)) {
+            continue;
+        }
+
+        uint32_t idx = findSensorMode(mSensorModes, mSensorModeCount,
+                                      res[0], res[1]);
+        if (idx == mSensorModeCount) {
+            if (mSensorModeCount >= MAX_SENSOR_MODES) {
+                continue;
+            }
+            mSensorModes[idx].width = res[0];
+            mSensorModes[idx].height = res[1];
+            mSensorModes[idx].maxFps = 0;
+            mSensorModeCount++;
+        }
+
+        SensorMode& mode = mSensorModes[idx];
+        uint32_t maxFps = 0;
+        struct v4l2_frmivalenum frmival;
+        for (uint32_t n = 0; fd >= 0; n++) {
+            memset(&frmival, 0, sizeof(frmival));
+            frmival.index = n;
+            frmival.pixel_format = format;
+            frmival.width = mode.width;
+            frmival.height = mode.height;
+            if ((ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &frmival) != 0) ||
+                (frmival.type != V4L2_FRMIVAL_TYPE_DISCRETE)) {
+                break;
+            }
+            if ((frmival.discrete.numerator > 0) &&
+                (frmival.discrete.denominator / frmival.discrete.numerator > maxFps)) {
+                maxFps = frmival.discrete.denominator / frmival.discrete.numerator;
+            }
+        }
+
+        // same rule as device tables when driver can't enumerate,
+        // preview sizes run above 15fps.
+        if (maxFps == 0) {
+            maxFps = preview ? 30 : 15;
+        }
+        if (maxFps > mode.maxFps) {
+            mode.maxFps = maxFps;
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    for (uint32_t i = 0; i < mSensorModeCount; i++) {
+        ALOGI("sensor mode %dx%d, max fps %d", mSensorModes[i].width,
+              mSensorModes[i].height, mSensorModes[i].maxFps);
+    }
+}
+
 PixelFormat SensorData::getMatchFormat(int *sfmt, int  slen,
                                          int *dfmt, int  dlen)
 {
@@ -45,6 +45,7 @@
 #include <graphics_ext.h>
 #include <hardware/camera3.h>
 #include "gralloc_priv.h"
+#include "ScratchBuffer.h"
 
 #define MAX_CAMERAS 2
 
@@ -70,6 +71,7 @@
 
 #define MAX_RESOLUTION_SIZE   64
 #define MAX_FPS_RANGE 6
+#define MAX_SENSOR_MODES (MAX_RESOLUTION_SIZE / 2)
 #define MAX_SENSOR_FORMAT 20
 
 #define MAX_VPU_SUPPORT_FORMAT 2
@@ -93,6 +95,10 @@
 #define NUM_PREVIEW_BUFFER      2
 #define NUM_CAPTURE_BUFFER      1
 
+// in-flight capture requests and their output buffers kept in pools.
+#define REQUEST_POOL_SIZE        16
+#define REQUEST_BUFFER_POOL_SIZE (REQUEST_POOL_SIZE * 4)
+
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 #define  ALIGN_PIXEL_4(x)  ((x+ 3) & ~3)
 #define  ALIGN_PIXEL_16(x)  ((x+ 15) & ~15)
@@ -138,6 +144,15 @@ struct autoState
     int32_t aeTriggerId;
 };
 
+// rectangle of a frame in pixels.
+struct CropRect
+{
+    uint32_t left;
+    uint32_t top;
+    uint32_t width;
+    uint32_t height;
+};
+
 class StreamBuffer
 {
 public:
@@ -156,6 +171,53 @@ public:
 
     //for uvc jpeg stream
     void *mpFrameBuf;
+
+    // frame holds two fields which are not deinterlaced yet.
+    bool mInterlaced;
+};
+
+// fixed-capacity object storage for hot path allocations,
+// it falls back to heap when all objects are in use.
+template <typename T, uint32_t N>
+class ObjectPool
+{
+public:
+    ObjectPool() : mFreeCount(N)
+    {
+        for (uint32_t i = 0; i < N; i++) {
+            mFree[i] = mStorage + i * sizeof(T);
+        }
+    }
+
+    void* alloc()
+    {
+        {
+            Mutex::Autolock lock(mLock);
+            if (mFreeCount > 0) {
+                return mFree[--mFreeCount];
+            }
+        }
+
+        return malloc(sizeof(T));
+    }
+
+    void release(void* ptr)
+    {
+        uint8_t* p = (uint8_t*)ptr;
+        if ((p < mStorage) || (p >= mStorage + sizeof(mStorage))) {
+            free(ptr);
+            return;
+        }
+
+        Mutex::Autolock lock(mLock);
+        mFree[mFreeCount++] = p;
+    }
+
+private:
+    Mutex mLock;
+    alignas(T) uint8_t mStorage[N * sizeof(T)];
+    void* mFree[N];
+    uint32_t mFreeCount;
 };
 
 enum RequestType {
@@ -170,11 +232,19 @@ public:
     CaptureRequest();
     ~CaptureRequest();
 
+    // requests are allocated from pool.
+    static void* operator new(size_t size) noexcept;
+    static void operator delete(void* ptr);
+
     void init(camera3_capture_request* request, camera3_callback_ops* callback,
               sp<Metadata> settings);
     int32_t onCaptureDone(StreamBuffer* buffer);
+    // buffer is not filled, it's returned with error status.
+    int32_t onBufferError(StreamBuffer* buffer);
     int32_t onSettingsDone(sp<Metadata> meta);
     int32_t onCaptureError();
+    // request is dropped before any result, such as flush.
+    int32_t onRequestError();
 
 public:
     uint32_t mFrameNumber;
@@ -186,6 +256,14 @@ public:
     camera3_callback_ops *mCallbackOps;
 };
 
+// output mode of sensor, device stream is configured to one of them.
+struct SensorMode
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t maxFps;
+};
+
 class SensorData
 {
 public:
@@ -212,6 +290,8 @@ protected:
     int32_t changeSensorFormats(int *src, int *dst, int len);
     status_t adjustPreviewResolutions();
     status_t setMaxPictureResolutions();
+    // build sensor modes from enumerated resolutions and frame intervals.
+    void initSensorModes();
 
 public:
     int mPreviewResolutions[MAX_RESOLUTION_SIZE];
@@ -246,6 +326,9 @@ public:
     int mSensorFormats[MAX_SENSOR_FORMAT];
     int mSensorFormatCount;
     char mDevPath[CAMAERA_FILENAME_LENGTH];
+
+    SensorMode mSensorModes[MAX_SENSOR_MODES];
+    uint32_t mSensorModeCount;
 };
 
 #endif
@@ -0,0 +1,618 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CameraHAL"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <cutils/properties.h>
+#include <system/graphics.h>
+#include <utils/Log.h>
+#include <utils/Errors.h>
+#include "ConvertQueue.h"
+#include "FrameRotator.h"
+
+#ifdef TARGET_FSL_IMX_2D
+#include "g2d.h"
+#endif
+
+static void YUYVCopyByLine(uint8_t *dst, uint32_t dstWidth, uint32_t dstHeight, uint8_t *src, uint32_t srcWidth, uint32_t srcHeight)
+{
+    uint32_t i;
+    int BytesPerPixel = 2;
+    uint8_t *pDstLine = dst;
+    uint8_t *pSrcLine = src;
+    uint32_t bytesPerSrcLine = BytesPerPixel * srcWidth;
+    uint32_t bytesPerDstLine = BytesPerPixel * dstWidth;
+    uint32_t marginWidh = dstWidth - srcWidth;
+    uint16_t *pYUV;
+
+    if ((srcWidth > dstWidth) || (srcHeight > dstHeight)) {
+        ALOGW("%s, para error");
+        return;
+    }
+
+    for (i = 0; i < srcHeight; i++) {
+        memcpy(pDstLine, pSrcLine, bytesPerSrcLine);
+
+        // black margin, Y:0, U:128, V:128
+        for (uint32_t j = 0; j < marginWidh; j++) {
+            pYUV = (uint16_t *)(pDstLine + bytesPerSrcLine + j * BytesPerPixel);
+            *pYUV = 0x8000;
+        }
+
+        pSrcLine += bytesPerSrcLine;
+        pDstLine += bytesPerDstLine;
+    }
+
+    return;
+}
+
+static void convertYUYVtoNV12SP(uint8_t *inputBuffer, uint8_t *outputBuffer, int width, int height)
+{
+#define u32 unsigned int
+#define u8 unsigned char
+
+    u32 h, w;
+    u32 nHeight = height;
+    u32 nWidthDiv4 = width / 4;
+
+    u8 *pYSrcOffset = inputBuffer;
+    u8 *pUSrcOffset = inputBuffer + 1;
+    u8 *pVSrcOffset = inputBuffer + 3;
+
+    u32 *pYDstOffset = (u32 *)outputBuffer;
+    u32 *pUVDstOffset = (u32 *)(((u8 *)(outputBuffer)) + width * height);
+
+    for (h = 0; h < nHeight; h++) {
+        if (!(h & 0x1)) {
+            for (w = 0; w < nWidthDiv4; w++) {
+                *pYDstOffset = (((u32)(*(pYSrcOffset + 0))) << 0) +
+                               (((u32)(*(pYSrcOffset + 2))) << 8) +
+                               (((u32)(*(pYSrcOffset + 4))) << 16) +
+                               (((u32)(*(pYSrcOffset + 6))) << 24);
+                pYSrcOffset += 8;
+                pYDstOffset += 1;
+
+#ifdef PLATFORM_VERSION_4
+                // seems th encoder use VUVU planner
+                *pUVDstOffset = (((u32)(*(pVSrcOffset + 0))) << 0) +
+                                (((u32)(*(pUSrcOffset + 0))) << 8) +
+                                (((u32)(*(pVSrcOffset + 4))) << 16) +
+                                (((u32)(*(pUSrcOffset + 4))) << 24);
+#else
+                *pUVDstOffset = (((u32)(*(pUSrcOffset + 0))) << 0) +
+                                (((u32)(*(pVSrcOffset + 0))) << 8) +
+                                (((u32)(*(pUSrcOffset + 4))) << 16) +
+                                (((u32)(*(pVSrcOffset + 4))) << 24);
+#endif
+                pUSrcOffset += 8;
+                pVSrcOffset += 8;
+                pUVDstOffset += 1;
+            }
+        } else {
+            pUSrcOffset += nWidthDiv4 * 8;
+            pVSrcOffset += nWidthDiv4 * 8;
+            for (w = 0; w < nWidthDiv4; w++) {
+                *pYDstOffset = (((u32)(*(pYSrcOffset + 0))) << 0) +
+                               (((u32)(*(pYSrcOffset + 2))) << 8) +
+                               (((u32)(*(pYSrcOffset + 4))) << 16) +
+                               (((u32)(*(pYSrcOffset + 6))) << 24);
+                pYSrcOffset += 8;
+                pYDstOffset += 1;
+            }
+        }
+    }
+}
+
+static void bufferDump(StreamBuffer *frame, bool in)
+{
+    // for test code
+    char value[100];
+    char name[100];
+    memset(value, 0, sizeof(value));
+    bool vflg = false;
+    static int dump_num = 1;
+    property_get("rw.camera.test", value, "");
+    if (strcmp(value, "true") == 0)
+        vflg = true;
+
+    if (vflg) {
+        FILE *pf = NULL;
+        memset(name, 0, sizeof(name));
+        snprintf(name, 100, "/data/dump/camera_dump_%s_%d.data",
+                   in ? "in" : "out", dump_num++);
+        pf = fopen(name, "wb");
+        if (pf == NULL) {
+            ALOGI("open %s failed", name);
+        }
+        else {
+            ALOGV("write yuv data");
+            fwrite(frame->mVirtAddr, frame->mSize, 1, pf);
+            fclose(pf);
+        }
+    }
+}
+
+#ifdef TARGET_FSL_IMX_2D
+static int32_t setG2dSurface(struct g2d_surface& surface, int32_t format,
+                             int32_t phys, uint32_t width, uint32_t height,
+                             const CropRect& rect)
+{
+    memset(&surface, 0, sizeof(surface));
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YCbCr_420_888:
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+            surface.format = G2D_NV12;
+            break;
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+            surface.format = G2D_NV21;
+            break;
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+            surface.format = G2D_NV16;
+            break;
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+            surface.format = G2D_YUYV;
+            break;
+        default:
+            return BAD_VALUE;
+    }
+
+    surface.planes[0] = phys;
+    if (surface.format != G2D_YUYV) {
+        surface.planes[1] = phys + width * height;
+    }
+    surface.left = rect.left;
+    surface.top = rect.top;
+    surface.right = rect.left + rect.width;
+    surface.bottom = rect.top + rect.height;
+    surface.stride = width;
+    surface.width = width;
+    surface.height = height;
+    surface.global_alpha = 0xff;
+    surface.rot = G2D_ROTATION_0;
+
+    return NO_ERROR;
+}
+
+// same mapping as display composer, rotation with flip needs both surfaces.
+static void convertTransformToG2dRotation(int32_t transform,
+                                          struct g2d_surface& src,
+                                          struct g2d_surface& dst)
+{
+    switch (transform) {
+        case HAL_TRANSFORM_FLIP_H:
+            dst.rot = G2D_FLIP_H;
+            break;
+        case HAL_TRANSFORM_FLIP_V:
+            dst.rot = G2D_FLIP_V;
+            break;
+        case HAL_TRANSFORM_ROT_180:
+            dst.rot = G2D_ROTATION_180;
+            break;
+        case HAL_TRANSFORM_ROT_90:
+            dst.rot = G2D_ROTATION_90;
+            break;
+        case HAL_TRANSFORM_ROT_90 | HAL_TRANSFORM_FLIP_H:
+            dst.rot = G2D_ROTATION_90;
+            src.rot = G2D_FLIP_H;
+            break;
+        case HAL_TRANSFORM_ROT_90 | HAL_TRANSFORM_FLIP_V:
+            dst.rot = G2D_ROTATION_90;
+            src.rot = G2D_FLIP_V;
+            break;
+        case HAL_TRANSFORM_ROT_270:
+            dst.rot = G2D_ROTATION_270;
+            break;
+        default:
+            dst.rot = G2D_ROTATION_0;
+            break;
+    }
+}
+#endif
+
+ConvertJob::ConvertJob()
+    : mPath(TRACE_PATH_NONE), mResult(NO_ERROR), mSrc(NULL), mOut(NULL),
+      mSrcFormat(0), mSrcWidth(0), mSrcHeight(0), mV4l2Width(0),
+      mV4l2Height(0), mOutFormat(0), mOutWidth(0), mOutHeight(0),
+      mCropped(false), mTransform(0), mFd(-1), mListener(NULL),
+      mCookie(NULL), mBegin(0)
+{
+    memset(&mCrop, 0, sizeof(mCrop));
+    memset(&mIpuTask, 0, sizeof(mIpuTask));
+    memset(&mPxpConf, 0, sizeof(mPxpConf));
+}
+
+//--------------------SoftwareBackend----------------------
+void SoftwareBackend::convertNV12toNV21(const uint8_t* src, uint8_t* dst,
+                                        uint32_t width, uint32_t height)
+{
+    uint32_t ySize = width * height;
+    memcpy(dst, src, ySize);
+
+    // swap U and V of each chroma pair while copying.
+    const uint16_t* uvIn = (const uint16_t*)(src + ySize);
+    uint16_t* uvOut = (uint16_t*)(dst + ySize);
+    for (uint32_t i = 0; i < ySize / 4; i++) {
+        uint16_t uv = uvIn[i];
+        uvOut[i] = (uint16_t)((uv << 8) | (uv >> 8));
+    }
+}
+
+int32_t SoftwareBackend::cropAndRotate(ConvertJob& job)
+{
+    CropRect crop = {0, 0, job.mSrcWidth, job.mSrcHeight};
+    if (job.mCropped) {
+        crop = job.mCrop;
+    }
+
+    // scale to stream size before transform, so rotation only
+    // touches output sized frame.
+    bool rotate = (job.mTransform & HAL_TRANSFORM_ROT_90) != 0;
+    uint32_t width = rotate ? job.mOutHeight : job.mOutWidth;
+    uint32_t height = rotate ? job.mOutWidth : job.mOutHeight;
+    bool scale = job.mCropped || (crop.width != width) ||
+                 (crop.height != height);
+    const uint8_t *frame = (const uint8_t *)job.mSrc->mVirtAddr;
+    uint8_t *dst = (uint8_t *)job.mOut->mVirtAddr;
+    if (scale && (job.mTransform != 0)) {
+        dst = mTransformFrame.reserve(
+                FrameRotator::getFrameSize(job.mOutFormat, width, height));
+        if (dst == NULL) {
+            ALOGE("%s reserve transform frame failed", __func__);
+            return NO_MEMORY;
+        }
+    }
+
+    int32_t ret = 0;
+    if (scale) {
+        ret = mCropScaler.process(job.mOutFormat, frame, job.mSrcWidth,
+                                  job.mSrcHeight, crop, dst, width, height);
+        frame = dst;
+    }
+    if ((ret == 0) && (job.mTransform != 0)) {
+        ret = FrameRotator::process(job.mOutFormat, frame, width, height,
+                                    job.mTransform,
+                                    (uint8_t *)job.mOut->mVirtAddr);
+    }
+    if (ret != 0) {
+        ALOGE("%s scale/rotate failed, ret %d", __func__, ret);
+    }
+
+    return ret;
+}
+
+int32_t SoftwareBackend::process(ConvertJob& job)
+{
+    uint32_t width = job.mOutWidth;
+    uint32_t height = job.mOutHeight;
+    uint8_t *src = (uint8_t *)job.mSrc->mVirtAddr;
+    uint8_t *out = (uint8_t *)job.mOut->mVirtAddr;
+
+    ALOGV("res, stream %dx%d, v4l2 %dx%d", width, height, job.mV4l2Width,
+          job.mV4l2Height);
+
+    if ((job.mSrcFormat == job.mOutFormat) &&
+        CropScaler::isSupported(job.mOutFormat) &&
+        (job.mCropped || (job.mTransform != 0) ||
+         (job.mSrcWidth != width) || (job.mSrcHeight != height))) {
+        return cropAndRotate(job);
+    }
+
+    if ((job.mSrcWidth != width) || (job.mSrcHeight != height)) {
+        ALOGE("%s:%d, Software don't support resize, src format:0x%x, out format:0x%x", __FUNCTION__, __LINE__, job.mSrcFormat, job.mOutFormat);
+        return BAD_VALUE;
+    }
+
+    if ((job.mOutFormat == HAL_PIXEL_FORMAT_YCbCr_420_888) &&
+        (job.mSrcFormat == HAL_PIXEL_FORMAT_YCbCr_422_I)) {
+        uint8_t *pTmpBuf = src;
+        if ((job.mV4l2Width != width) || (job.mV4l2Height != height)) {
+            pTmpBuf = mPadFrame.reserve(width * height * 2);
+            if (pTmpBuf == NULL) {
+                ALOGE("%s reserve pad frame failed", __func__);
+                return NO_MEMORY;
+            }
+            YUYVCopyByLine(pTmpBuf, width, height, src, job.mV4l2Width,
+                           job.mV4l2Height);
+        }
+        convertYUYVtoNV12SP(pTmpBuf, out, width, height);
+    } else if ((job.mOutFormat == HAL_PIXEL_FORMAT_YCbCr_420_SP) &&
+               (job.mSrcFormat == HAL_PIXEL_FORMAT_YCbCr_422_I)) {
+        convertYUYVtoNV12SP(src, out, width, height);
+    } else if ((job.mSrcFormat == HAL_PIXEL_FORMAT_YCbCr_420_SP) &&
+               (job.mOutFormat == HAL_PIXEL_FORMAT_YCrCb_420_SP)) {
+        size_t size = width * height * 3 / 2;
+        if ((job.mSrc->mSize < size) || (job.mOut->mSize < size)) {
+            ALOGE("%s buffer too small for %dx%d", __func__, width, height);
+            return BAD_VALUE;
+        }
+        convertNV12toNV21(src, out, width, height);
+    } else if (job.mSrcFormat == job.mOutFormat) {
+        YUYVCopyByLine(out, width, height, src, job.mV4l2Width,
+                       job.mV4l2Height);
+    } else {
+        ALOGE("%s:%d, Software don't support format convert from 0x%x to 0x%x", __FUNCTION__, __LINE__, job.mSrcFormat, job.mOutFormat);
+        return BAD_VALUE;
+    }
+
+    return 0;
+}
+
+//--------------------PxpBackend----------------------
+int32_t PxpBackend::process(ConvertJob& job)
+{
+    int32_t ret = ioctl(job.mFd, PXP_IOC_CONFIG_CHAN, &job.mPxpConf);
+    if (ret < 0) {
+        ALOGE("%s:%d, PXP_IOC_CONFIG_CHAN failed %d", __FUNCTION__, __LINE__ ,ret);
+        return ret;
+    }
+
+    ret = ioctl(job.mFd, PXP_IOC_START_CHAN, &(job.mPxpConf.handle));
+    if (ret < 0) {
+        ALOGE("%s:%d, PXP_IOC_START_CHAN failed %d", __FUNCTION__, __LINE__ ,ret);
+        return ret;
+    }
+
+    struct pxp_config_data pxp_conf;
+    memset(&pxp_conf, 0, sizeof(pxp_conf));
+    pxp_conf.handle = job.mPxpConf.handle;
+    ret = ioctl(job.mFd, PXP_IOC_WAIT4CMPLT, &pxp_conf);
+    if (ret < 0) {
+        ALOGE("%s:%d, PXP_IOC_WAIT4CMPLT failed %d", __FUNCTION__, __LINE__ ,ret);
+    }
+
+    return ret;
+}
+
+//--------------------IpuBackend----------------------
+int32_t IpuBackend::process(ConvertJob& job)
+{
+    // task is checked by stream, queue blocks until it is done.
+    int32_t ret = ioctl(job.mFd, IPU_QUEUE_TASK, &job.mIpuTask);
+    if (ret < 0) {
+        ALOGE("%s:%d, IPU_QUEUE_TASK failed %d", __FUNCTION__, __LINE__ ,ret);
+    }
+
+    return ret;
+}
+
+//--------------------G2dBackend----------------------
+void G2dBackend::attach()
+{
+#ifdef TARGET_FSL_IMX_2D
+    if (g2d_open(&mHandle) != 0) {
+        ALOGW("%s g2d_open failed, convert on CPU", __func__);
+        mHandle = NULL;
+    }
+#endif
+}
+
+void G2dBackend::detach()
+{
+#ifdef TARGET_FSL_IMX_2D
+    if (mHandle != NULL) {
+        g2d_close(mHandle);
+        mHandle = NULL;
+    }
+#endif
+}
+
+int32_t G2dBackend::process(ConvertJob& job)
+{
+    StreamBuffer* src = job.mSrc;
+    StreamBuffer* out = job.mOut;
+    size_t size = (src->mSize > out->mSize) ? out->mSize : src->mSize;
+    bool blit = job.mCropped || (job.mTransform != 0);
+
+#ifdef TARGET_FSL_IMX_2D
+    int32_t ret = -1;
+    if ((mHandle != NULL) && blit) {
+        // crop, scale and rotate in one blit.
+        struct g2d_surface s_surface, d_surface;
+        CropRect full = {0, 0, job.mOutWidth, job.mOutHeight};
+        CropRect crop = {0, 0, job.mSrcWidth, job.mSrcHeight};
+        if (job.mCropped) {
+            crop = job.mCrop;
+        }
+        if ((setG2dSurface(s_surface, job.mSrcFormat, src->mPhyAddr,
+                           job.mSrcWidth, job.mSrcHeight, crop) == 0) &&
+            (setG2dSurface(d_surface, job.mOutFormat, out->mPhyAddr,
+                           job.mOutWidth, job.mOutHeight, full) == 0)) {
+            convertTransformToG2dRotation(job.mTransform, s_surface,
+                                          d_surface);
+            ret = g2d_blit(mHandle, &s_surface, &d_surface);
+        }
+    }
+    else if (mHandle != NULL) {
+        struct g2d_buf s_buf, d_buf;
+        s_buf.buf_paddr = src->mPhyAddr;
+        s_buf.buf_vaddr = src->mVirtAddr;
+        d_buf.buf_paddr = out->mPhyAddr;
+        d_buf.buf_vaddr = out->mVirtAddr;
+        ret = g2d_copy(mHandle, &d_buf, &s_buf, size);
+    }
+
+    if (ret == 0) {
+        g2d_finish(mHandle);
+        bufferDump(src, true);
+        bufferDump(out, false);
+        return 0;
+    }
+#endif
+
+    // blitter can't output this format, scale on CPU.
+    if (blit) {
+        return mFallback->process(job);
+    }
+
+    ALOGV("%s if board don't support g2d_copy, use memcpy", __func__);
+    memcpy(out->mVirtAddr, src->mVirtAddr, size);
+    bufferDump(src, true);
+    bufferDump(out, false);
+
+    return 0;
+}
+
+//--------------------ConvertQueue----------------------
+ConvertQueue::ConvertQueue()
+    : mHead(0), mCount(0), mSubmitted(0), mCompleted(0), mBusy(false),
+      mExit(false),
+      mG2d(&mSoftware)
+{
+    mThread = new QueueThread(this);
+}
+
+ConvertQueue::~ConvertQueue()
+{
+    stop();
+}
+
+ConvertBackend* ConvertQueue::getBackend(int32_t path)
+{
+    switch (path) {
+        case TRACE_PATH_PXP:
+            return &mPxp;
+        case TRACE_PATH_IPU:
+            return &mIpu;
+        case TRACE_PATH_GPU:
+            return &mG2d;
+        case TRACE_PATH_CPU:
+            return &mSoftware;
+        default:
+            return NULL;
+    }
+}
+
+int32_t ConvertQueue::submit(ConvertJob& job)
+{
+    Mutex::Autolock lock(mLock);
+    while ((mCount >= QUEUE_SIZE) && !mExit) {
+        mCondition.wait(mLock);
+    }
+
+    if (mExit) {
+        return INVALID_OPERATION;
+    }
+
+    mJobs[(mHead + mCount) % QUEUE_SIZE] = job;
+    mCount++;
+    mSubmitted++;
+    mCondition.broadcast();
+
+    return NO_ERROR;
+}
+
+void ConvertQueue::drain()
+{
+    Mutex::Autolock lock(mLock);
+    uint64_t target = mSubmitted;
+    while (mCompleted < target) {
+        mCondition.wait(mLock);
+    }
+}
+
+int32_t ConvertQueue::drain(nsecs_t timeout)
+{
+    Mutex::Autolock lock(mLock);
+    uint64_t target = mSubmitted;
+    nsecs_t deadline = systemTime() + timeout;
+    while (mCompleted < target) {
+        nsecs_t left = deadline - systemTime();
+        if ((left <= 0) ||
+            (mCondition.waitRelative(mLock, left) == TIMED_OUT)) {
+            break;
+        }
+    }
+
+    if (mCompleted >= target) {
+        return NO_ERROR;
+    }
+
+    // the running job can't be stopped, the ones behind it skip backend.
+    uint32_t first = mBusy ? 1 : 0;
+    uint32_t cancelled = 0;
+    for (uint32_t i = first; i < mCount; i++) {
+        if (mCompleted + i >= target) {
+            break;
+        }
+        ConvertJob& job = mJobs[(mHead + i) % QUEUE_SIZE];
+        if (job.mResult == NO_ERROR) {
+            job.mResult = TIMED_OUT;
+            cancelled++;
+        }
+    }
+
+    ALOGW("%s timeout, %u jobs left, %u cancelled", __func__,
+          (uint32_t)(target - mCompleted), cancelled);
+    return TIMED_OUT;
+}
+
+void ConvertQueue::stop()
+{
+    {
+        Mutex::Autolock lock(mLock);
+        mExit = true;
+        mCondition.broadcast();
+    }
+
+    // queued jobs are still completed, thread exits when queue is empty.
+    if (mThread != NULL) {
+        mThread->join();
+        mThread.clear();
+    }
+}
+
+bool ConvertQueue::processJob()
+{
+    ConvertJob* job = NULL;
+    {
+        Mutex::Autolock lock(mLock);
+        while ((mCount == 0) && !mExit) {
+            mCondition.wait(mLock);
+        }
+
+        if (mCount == 0) {
+            return false;
+        }
+        // slot is not reused until the job is popped.
+        job = &mJobs[mHead];
+        mBusy = true;
+    }
+
+    ConvertBackend* backend = getBackend(job->mPath);
+    if ((backend != NULL) && (job->mResult == NO_ERROR)) {
+        job->mResult = backend->process(*job);
+        if (job->mResult != NO_ERROR) {
+            ALOGE("%s %s job failed %d", __func__, backend->name(),
+                  job->mResult);
+        }
+    }
+
+    if (job->mListener != NULL) {
+        job->mListener->onConvertDone(*job);
+    }
+
+    Mutex::Autolock lock(mLock);
+    mBusy = false;
+    mHead = (mHead + 1) % QUEUE_SIZE;
+    mCount--;
+    mCompleted++;
+    mCondition.broadcast();
+
+    return true;
+}
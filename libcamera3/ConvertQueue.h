@@ -0,0 +1,209 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CONVERT_QUEUE_H
+#define _CONVERT_QUEUE_H
+
+#include <stdint.h>
+#include <utils/threads.h>
+#include <linux/ipu.h>
+#include "CameraUtils.h"
+#include "CropScaler.h"
+#include "FrameTrace.h"
+
+extern "C" {
+#include "pxp_lib.h"
+}
+
+using namespace android;
+
+class ConvertJob;
+
+class ConvertListener
+{
+public:
+    virtual ~ConvertListener() {}
+    // called on queue thread in submit order, job result is set.
+    virtual void onConvertDone(ConvertJob& job) = 0;
+};
+
+// conversion of one device frame into one stream buffer.
+class ConvertJob
+{
+public:
+    ConvertJob();
+
+    // TRACE_PATH_* backend of the job, TRACE_PATH_NONE completes as is.
+    int32_t mPath;
+    int32_t mResult;
+
+    StreamBuffer* mSrc;
+    StreamBuffer* mOut;
+    int32_t mSrcFormat;
+    uint32_t mSrcWidth;
+    uint32_t mSrcHeight;
+    // V4L2 frame size, it's smaller than source when sensor pads lines.
+    uint32_t mV4l2Width;
+    uint32_t mV4l2Height;
+    int32_t mOutFormat;
+    uint32_t mOutWidth;
+    uint32_t mOutHeight;
+    CropRect mCrop;
+    bool mCropped;
+    int32_t mTransform;
+
+    // hardware task filled by stream, mFd is the IPU or PXP device.
+    int32_t mFd;
+    struct ipu_task mIpuTask;
+    struct pxp_config_data mPxpConf;
+
+    ConvertListener* mListener;
+    void* mCookie;
+    nsecs_t mBegin;
+};
+
+// converter behind the queue, jobs run on queue thread in submit order.
+class ConvertBackend
+{
+public:
+    virtual ~ConvertBackend() {}
+    virtual const char* name() = 0;
+    virtual int32_t process(ConvertJob& job) = 0;
+    // called on queue thread when it starts and exits.
+    virtual void attach() {}
+    virtual void detach() {}
+};
+
+// CPU fallback, it converts any job whose formats it can handle.
+class SoftwareBackend : public ConvertBackend
+{
+public:
+    virtual const char* name() {return "cpu";}
+    virtual int32_t process(ConvertJob& job);
+
+private:
+    int32_t cropAndRotate(ConvertJob& job);
+    static void convertNV12toNV21(const uint8_t* src, uint8_t* dst,
+                                  uint32_t width, uint32_t height);
+
+    CropScaler mCropScaler;
+    // scaled frame before transform.
+    ScratchBuffer mTransformFrame;
+    // YUYV frame padded to stream size.
+    ScratchBuffer mPadFrame;
+};
+
+class PxpBackend : public ConvertBackend
+{
+public:
+    virtual const char* name() {return "pxp";}
+    virtual int32_t process(ConvertJob& job);
+};
+
+class IpuBackend : public ConvertBackend
+{
+public:
+    virtual const char* name() {return "ipu";}
+    virtual int32_t process(ConvertJob& job);
+};
+
+// g2d handle belongs to queue thread, jobs fall back to CPU without it.
+class G2dBackend : public ConvertBackend
+{
+public:
+    G2dBackend(SoftwareBackend* fallback)
+        : mHandle(NULL), mFallback(fallback) {}
+    virtual const char* name() {return "g2d";}
+    virtual int32_t process(ConvertJob& job);
+    virtual void attach();
+    virtual void detach();
+
+private:
+    void* mHandle;
+    SoftwareBackend* mFallback;
+};
+
+// bounded FIFO of conversion jobs run by one thread, so a frame is
+// converted while the next one is captured and encoded.
+class ConvertQueue
+{
+public:
+    static const uint32_t QUEUE_SIZE = 8;
+
+    ConvertQueue();
+    ~ConvertQueue();
+
+    // queue job, blocks while the queue is full.
+    int32_t submit(ConvertJob& job);
+    // wait until jobs submitted before are done.
+    void drain();
+    // same as above but waits at most timeout, jobs which are not started
+    // then are cancelled and complete with TIMED_OUT.
+    int32_t drain(nsecs_t timeout);
+    void stop();
+
+private:
+    ConvertBackend* getBackend(int32_t path);
+    bool processJob();
+
+    class QueueThread : public Thread
+    {
+    public:
+        QueueThread(ConvertQueue* queue)
+            : Thread(false), mQueue(queue)
+            {}
+
+        virtual void onFirstRef() {
+            run("ConvertThread", PRIORITY_URGENT_DISPLAY);
+        }
+
+        virtual status_t readyToRun() {
+            mQueue->mG2d.attach();
+            return 0;
+        }
+
+        virtual bool threadLoop() {
+            if (!mQueue->processJob()) {
+                mQueue->mG2d.detach();
+                return false;
+            }
+
+            return true;
+        }
+
+    private:
+        ConvertQueue* mQueue;
+    };
+
+    Mutex mLock;
+    Condition mCondition;
+    ConvertJob mJobs[QUEUE_SIZE];
+    uint32_t mHead;
+    uint32_t mCount;
+    uint64_t mSubmitted;
+    uint64_t mCompleted;
+    // job at mHead is taken by queue thread.
+    bool mBusy;
+    bool mExit;
+
+    SoftwareBackend mSoftware;
+    PxpBackend mPxp;
+    IpuBackend mIpu;
+    G2dBackend mG2d;
+    sp<QueueThread> mThread;
+};
+
+#endif
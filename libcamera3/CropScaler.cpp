@@ -0,0 +1,247 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CameraHAL"
+
+#include <string.h>
+#include <system/graphics.h>
+#include <utils/Log.h>
+#include <utils/Errors.h>
+#include "CropScaler.h"
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace android;
+
+// bilinear weights are 7 bits so that products fit in 16 bits.
+#define WEIGHT_BITS 7
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+
+// dst = a * (1 - w) + b * w, w in 1/128 units.
+static void blendRow(uint8_t* dst, const uint8_t* a, const uint8_t* b,
+                     uint32_t size, uint32_t w)
+{
+    uint32_t i = 0;
+#ifdef __ARM_NEON
+    uint8x8_t wa = vdup_n_u8((uint8_t)(WEIGHT_ONE - w));
+    uint8x8_t wb = vdup_n_u8((uint8_t)w);
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t va = vld1q_u8(a + i);
+        uint8x16_t vb = vld1q_u8(b + i);
+        uint16x8_t lo = vmull_u8(vget_low_u8(va), wa);
+        uint16x8_t hi = vmull_u8(vget_high_u8(va), wa);
+        lo = vmlal_u8(lo, vget_low_u8(vb), wb);
+        hi = vmlal_u8(hi, vget_high_u8(vb), wb);
+        vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, WEIGHT_BITS),
+                                      vrshrn_n_u16(hi, WEIGHT_BITS)));
+    }
+#endif
+    for (; i < size; i++) {
+        dst[i] = (uint8_t)((a[i] * (WEIGHT_ONE - w) + b[i] * w +
+                            (WEIGHT_ONE >> 1)) >> WEIGHT_BITS);
+    }
+}
+
+// source position of each output sample in 16.16 fixed point,
+// pixel centers are aligned and edges are clamped.
+static void mapAxis(uint32_t first, uint32_t count, uint32_t dstCount,
+                    uint32_t index, uint32_t* pos, uint32_t* weight)
+{
+    int64_t step = ((int64_t)count << 16) / dstCount;
+    int64_t p = ((int64_t)first << 16) + (step >> 1) - (1 << 15) +
+                step * index;
+    int64_t last = (int64_t)(first + count - 1) << 16;
+    if (p < ((int64_t)first << 16)) {
+        p = (int64_t)first << 16;
+    }
+    if (p > last) {
+        p = last;
+    }
+
+    *pos = (uint32_t)(p >> 16);
+    *weight = (uint32_t)(p & 0xffff) >> (16 - WEIGHT_BITS);
+}
+
+bool CropScaler::isSupported(int32_t format)
+{
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YCbCr_420_888:
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void CropScaler::getPlanes(int32_t format, uint8_t* base, uint32_t width,
+                           uint32_t height, Plane* planes)
+{
+    Plane* p = planes;
+    if (format == HAL_PIXEL_FORMAT_YCbCr_422_I) {
+        // Y0 U Y1 V, all components share the same rows.
+        p[0].base = base;
+        p[0].offset = 0;
+        p[0].step = 2;
+        p[0].width = width;
+        p[1].base = base;
+        p[1].offset = 1;
+        p[1].step = 4;
+        p[1].width = width / 2;
+        p[2].base = base;
+        p[2].offset = 3;
+        p[2].step = 4;
+        p[2].width = width / 2;
+        for (uint32_t i = 0; i < MAX_PLANES; i++) {
+            p[i].stride = width * 2;
+            p[i].height = height;
+        }
+        return;
+    }
+
+    // semi-planar, interleaved chroma follows luma.
+    uint32_t chromaHeight = (format == HAL_PIXEL_FORMAT_YCbCr_422_SP) ?
+                            height : height / 2;
+    p[0].base = base;
+    p[0].offset = 0;
+    p[0].step = 1;
+    p[0].width = width;
+    p[0].height = height;
+    for (uint32_t i = 1; i < MAX_PLANES; i++) {
+        p[i].base = base + width * height;
+        p[i].offset = i - 1;
+        p[i].step = 2;
+        p[i].width = width / 2;
+        p[i].height = chromaHeight;
+    }
+    for (uint32_t i = 0; i < MAX_PLANES; i++) {
+        p[i].stride = width;
+    }
+}
+
+int32_t CropScaler::process(int32_t format, const uint8_t* src,
+                            uint32_t srcWidth, uint32_t srcHeight,
+                            const CropRect& crop, uint8_t* dst,
+                            uint32_t dstWidth, uint32_t dstHeight)
+{
+    if (!isSupported(format) || src == NULL || dst == NULL) {
+        ALOGE("%s unsupported format 0x%x", __func__, format);
+        return BAD_VALUE;
+    }
+
+    if (crop.width < 4 || crop.height < 4 || (crop.left & 1) ||
+            (crop.top & 1) || (crop.width & 1) || (crop.height & 1) ||
+            crop.left + crop.width > srcWidth ||
+            crop.top + crop.height > srcHeight ||
+            dstWidth < 2 || dstHeight < 2) {
+        ALOGE("%s invalid crop %u,%u %ux%u of %ux%u", __func__, crop.left,
+              crop.top, crop.width, crop.height, srcWidth, srcHeight);
+        return BAD_VALUE;
+    }
+
+    Plane in[MAX_PLANES];
+    Plane out[MAX_PLANES];
+    getPlanes(format, (uint8_t*)src, srcWidth, srcHeight, in);
+    getPlanes(format, dst, dstWidth, dstHeight, out);
+
+    // column tables: byte index into blended row and weight per sample.
+    size_t entries = 0;
+    for (uint32_t i = 0; i < MAX_PLANES; i++) {
+        entries += out[i].width;
+    }
+    uint8_t* tables = mTables.reserve(entries * (sizeof(uint32_t) + 1));
+    uint8_t* row = mRow.reserve(srcWidth * 2);
+    if (tables == NULL || row == NULL) {
+        return NO_MEMORY;
+    }
+
+    uint32_t i = 0;
+    while (i < MAX_PLANES) {
+        // components sharing rows are blended vertically once.
+        uint32_t end = i + 1;
+        while (end < MAX_PLANES && in[end].base == in[i].base) {
+            end++;
+        }
+
+        uint32_t ys = srcHeight / in[i].height;
+        uint32_t top = crop.top / ys;
+        uint32_t rows = crop.height / ys;
+
+        uint32_t first = in[i].stride;
+        uint32_t last = 0;
+        uint32_t* index = (uint32_t*)tables;
+        uint8_t* weight = tables + entries * sizeof(uint32_t);
+        uint32_t* idx = index;
+        uint8_t* wgt = weight;
+        for (uint32_t c = i; c < end; c++) {
+            uint32_t xs = srcWidth / in[c].width;
+            uint32_t cx = crop.left / xs;
+            uint32_t cw = crop.width / xs;
+            uint32_t lo = in[c].offset + cx * in[c].step;
+            uint32_t hi = in[c].offset + (cx + cw - 1) * in[c].step + 1;
+            first = (lo < first) ? lo : first;
+            last = (hi > last) ? hi : last;
+
+            for (int32_t x = 0; x < out[c].width; x++) {
+                uint32_t pos, w;
+                mapAxis(cx, cw, out[c].width, x, &pos, &w);
+                // last sample blends from its left neighbour at full weight,
+                // so the pair never reads past the crop.
+                if (pos + 1 >= cx + cw) {
+                    pos--;
+                    w = WEIGHT_ONE;
+                }
+                *idx++ = in[c].offset + pos * in[c].step;
+                *wgt++ = (uint8_t)w;
+            }
+        }
+
+        for (int32_t y = 0; y < out[i].height; y++) {
+            uint32_t pos, w;
+            mapAxis(top, rows, out[i].height, y, &pos, &w);
+            const uint8_t* a = in[i].base + pos * in[i].stride;
+            const uint8_t* line = a;
+            if (w > 0 && pos + 1 < top + rows) {
+                blendRow(row + first, a + first, a + in[i].stride + first,
+                         last - first, w);
+                line = row;
+            }
+
+            idx = index;
+            wgt = weight;
+            for (uint32_t c = i; c < end; c++) {
+                uint8_t* d = out[c].base + y * out[c].stride + out[c].offset;
+                uint32_t step = in[c].step;
+                for (int32_t x = 0; x < out[c].width; x++) {
+                    const uint8_t* s = line + idx[x];
+                    uint32_t v = s[0] * (WEIGHT_ONE - wgt[x]) + s[step] * wgt[x];
+                    d[x * out[c].step] =
+                        (uint8_t)((v + (WEIGHT_ONE >> 1)) >> WEIGHT_BITS);
+                }
+                idx += out[c].width;
+                wgt += out[c].width;
+            }
+        }
+
+        i = end;
+    }
+
+    return NO_ERROR;
+}
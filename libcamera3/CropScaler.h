@@ -0,0 +1,58 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CROP_SCALER_H
+#define _CROP_SCALER_H
+
+#include <stdint.h>
+#include "CameraUtils.h"
+
+// bilinear crop and scale between packed frames of the same format,
+// used for digital zoom when no hardware converter can do it.
+class CropScaler
+{
+public:
+    CropScaler() {}
+
+    static bool isSupported(int32_t format);
+
+    // crop of src is scaled to the whole dst.
+    int32_t process(int32_t format, const uint8_t* src, uint32_t srcWidth,
+                    uint32_t srcHeight, const CropRect& crop, uint8_t* dst,
+                    uint32_t dstWidth, uint32_t dstHeight);
+
+private:
+    static const uint32_t MAX_PLANES = 3;
+
+    // samples (x, y) of a component are at base[y * stride + offset + x * step].
+    struct Plane {
+        uint8_t* base;
+        int32_t offset;
+        int32_t stride;
+        int32_t step;
+        int32_t width;
+        int32_t height;
+    };
+
+    static void getPlanes(int32_t format, uint8_t* base, uint32_t width,
+                          uint32_t height, Plane* planes);
+
+    // blended rows and column tables.
+    ScratchBuffer mRow;
+    ScratchBuffer mTables;
+};
+
+#endif
@@ -57,8 +57,9 @@ int32_t DMAStream::onDeviceStartLocked()
 
     int32_t ret = 0;
     //----------qbuf----------
+    // in zero-copy mode buffers are queued per request.
     struct v4l2_buffer cfilledbuffer;
-    for (uint32_t i = 0; i < mNumBuffers; i++) {
+    for (uint32_t i = 0; i < mNumBuffers && !mZeroCopy; i++) {
         memset(&cfilledbuffer, 0, sizeof (struct v4l2_buffer));
         cfilledbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         cfilledbuffer.memory = V4L2_MEMORY_DMABUF;
@@ -120,6 +121,7 @@ int32_t DMAStream::onFrameAcquireLocked()
         ALOGE("%s: VIDIOC_DQBUF Failed: %s", __func__, strerror(errno));
         return -1;
     }
+    accountFrameLocked(cfilledbuffer);
 
     int32_t index = cfilledbuffer.index;
     ALOGV("acquire index:%d", cfilledbuffer.index);
@@ -152,6 +154,19 @@ int32_t DMAStream::getDeviceBufferSize()
     return getFormatSize();
 }
 
+bool DMAStream::isZeroCopySupported()
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get(DMA_ZERO_COPY, value, "0");
+
+    return atoi(value) != 0;
+}
+
+bool DMAStream::isImportableLocked(StreamBuffer& buf)
+{
+    return (buf.mFd > 0) && (buf.mSize >= (size_t)mStreamSize);
+}
+
 int32_t DMAStream::allocateBuffersLocked()
 {
     ALOGI("%s", __func__);
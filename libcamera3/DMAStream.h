@@ -19,6 +19,9 @@
 
 #include "USPStream.h"
 
+// set to 1 to queue framework buffers to V4L2 directly when possible.
+#define DMA_ZERO_COPY "rw.camera.zerocopy"
+
 // stream uses DMABUF buffers which allcated in user space.
 // that exports DMABUF handle.
 class DMAStream : public USPStream
@@ -47,6 +50,10 @@ public:
     // get device buffer required size.
     virtual int32_t getDeviceBufferSize();
 
+    // zero-copy: framework buffers are imported as DMABUF.
+    virtual bool isZeroCopySupported();
+    virtual bool isImportableLocked(StreamBuffer& buf);
+
 private:
     int32_t mStreamSize;
 };
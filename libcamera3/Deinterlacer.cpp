@@ -0,0 +1,309 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <linux/videodev2.h>
+#include <cutils/properties.h>
+#include <system/graphics.h>
+#include <utils/Log.h>
+#include <utils/Errors.h>
+#include "Deinterlacer.h"
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace android;
+
+// dst = rounded average of a and b.
+static void interpolateRow(uint8_t* dst, const uint8_t* a,
+                           const uint8_t* b, uint32_t size)
+{
+    uint32_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 16 <= size; i += 16) {
+        vst1q_u8(dst + i, vrhaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+#endif
+    for (; i < size; i++) {
+        dst[i] = (uint8_t)((a[i] + b[i] + 1) >> 1);
+    }
+}
+
+// interpolate only where neighbour rows changed against last frame,
+// dst keeps the woven row elsewhere.
+static void motionRow(uint8_t* dst, const uint8_t* a, const uint8_t* b,
+                      const uint8_t* pa, const uint8_t* pb,
+                      uint32_t size, uint8_t threshold)
+{
+    uint32_t i = 0;
+#ifdef __ARM_NEON
+    uint8x16_t th = vdupq_n_u8(threshold);
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t va = vld1q_u8(a + i);
+        uint8x16_t vb = vld1q_u8(b + i);
+        uint8x16_t diff = vmaxq_u8(vabdq_u8(va, vld1q_u8(pa + i)),
+                                   vabdq_u8(vb, vld1q_u8(pb + i)));
+        uint8x16_t moved = vcgtq_u8(diff, th);
+        vst1q_u8(dst + i, vbslq_u8(moved, vrhaddq_u8(va, vb),
+                                   vld1q_u8(dst + i)));
+    }
+#endif
+    for (; i < size; i++) {
+        int32_t da = abs(a[i] - pa[i]);
+        int32_t db = abs(b[i] - pb[i]);
+        if (da > threshold || db > threshold) {
+            dst[i] = (uint8_t)((a[i] + b[i] + 1) >> 1);
+        }
+    }
+}
+
+Deinterlacer::Deinterlacer()
+    : mWorkers(this, "DeinterlaceThread", WORKER_THREADS),
+      mMode(DEINTERLACE_NONE), mFormat(0), mWidth(0), mHeight(0),
+      mField(V4L2_FIELD_INTERLACED), mBottomFirst(false),
+      mReplaceParity(0), mPlaneCount(0), mHistoryValid(false)
+{
+    memset(mPlanes, 0, sizeof(mPlanes));
+}
+
+Deinterlacer::~Deinterlacer()
+{
+    mWorkers.stop();
+}
+
+int32_t Deinterlacer::getConfiguredMode()
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get(CAMERA_DEINTERLACE, value, "none");
+
+    if (!strcmp(value, "weave")) {
+        return DEINTERLACE_WEAVE;
+    }
+    else if (!strcmp(value, "bob")) {
+        return DEINTERLACE_BOB;
+    }
+    else if (!strcmp(value, "motion")) {
+        return DEINTERLACE_MOTION;
+    }
+
+    return DEINTERLACE_NONE;
+}
+
+void Deinterlacer::configure(int32_t mode, int32_t format, uint32_t width,
+                             uint32_t height, uint32_t field, bool bottomFirst)
+{
+    mFormat = format;
+    mWidth = width;
+    mHeight = height;
+    // fields of other layouts are stored interleaved, so they are
+    // already woven and there is nothing to do.
+    if ((mode == DEINTERLACE_WEAVE) && (field != V4L2_FIELD_SEQ_TB) &&
+            (field != V4L2_FIELD_SEQ_BT)) {
+        ALOGW("%s weave needs sequential fields, disabled for field %d",
+              __func__, field);
+        mode = DEINTERLACE_NONE;
+    }
+
+    mMode = mode;
+    mField = field;
+    mBottomFirst = bottomFirst;
+    // keep the later field, rows of the earlier field are rebuilt.
+    mReplaceParity = bottomFirst ? 1 : 0;
+    mHistoryValid = false;
+
+    ALOGI("%s mode:%d, field:%d, bottom first:%d", __func__,
+          mode, field, bottomFirst);
+}
+
+int32_t Deinterlacer::setupPlanes(StreamBuffer& buf)
+{
+    uint8_t* base = (uint8_t*)buf.mVirtAddr;
+    uint32_t size = mWidth * mHeight;
+    if (base == NULL) {
+        return BAD_VALUE;
+    }
+
+    switch (mFormat) {
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+            mPlaneCount = 1;
+            mPlanes[0].data = base;
+            mPlanes[0].stride = mWidth * 2;
+            break;
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+            // chroma rows are shared by both fields, only luma is processed.
+            mPlaneCount = 1;
+            mPlanes[0].data = base;
+            mPlanes[0].stride = mWidth;
+            break;
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+            mPlaneCount = 2;
+            mPlanes[0].data = base;
+            mPlanes[0].stride = mWidth;
+            mPlanes[1].data = base + size;
+            mPlanes[1].stride = mWidth;
+            break;
+        default:
+            ALOGE("%s unsupported format 0x%x", __func__, mFormat);
+            return BAD_VALUE;
+    }
+
+    size_t total = 0;
+    for (uint32_t i = 0; i < mPlaneCount; i++) {
+        mPlanes[i].rows = mHeight;
+        total += mPlanes[i].stride * mPlanes[i].rows;
+    }
+
+    Plane& tail = mPlanes[mPlaneCount - 1];
+    if (buf.mSize > 0 &&
+            (size_t)(tail.data - base) + tail.stride * tail.rows > buf.mSize) {
+        ALOGE("%s buffer size %zu too small", __func__, buf.mSize);
+        return BAD_VALUE;
+    }
+
+    uint8_t* history = NULL;
+    if (mMode == DEINTERLACE_MOTION) {
+        history = mHistory.reserve(total);
+        if (history == NULL) {
+            return NO_MEMORY;
+        }
+    }
+
+    for (uint32_t i = 0; i < mPlaneCount; i++) {
+        mPlanes[i].history = history;
+        if (history != NULL) {
+            history += mPlanes[i].stride * mPlanes[i].rows;
+        }
+    }
+
+    return 0;
+}
+
+void Deinterlacer::weaveSequential(Plane& plane)
+{
+    uint32_t half = plane.rows / 2;
+    uint32_t bytes = plane.stride * half * 2;
+    uint8_t* scratch = mScratch.reserve(bytes);
+    if (scratch == NULL) {
+        return;
+    }
+
+    memcpy(scratch, plane.data, bytes);
+    // first stored field goes to even rows for SEQ_TB, odd rows for SEQ_BT.
+    uint32_t first = (mField == V4L2_FIELD_SEQ_BT) ? 1 : 0;
+    for (uint32_t i = 0; i < half; i++) {
+        memcpy(plane.data + (2 * i + first) * plane.stride,
+               scratch + i * plane.stride, plane.stride);
+        memcpy(plane.data + (2 * i + 1 - first) * plane.stride,
+               scratch + (half + i) * plane.stride, plane.stride);
+    }
+}
+
+void Deinterlacer::processRow(Plane& plane, uint32_t y)
+{
+    // neighbour rows belong to the kept field, mirror them at the edges.
+    uint32_t above = (y > 0) ? y - 1 : y + 1;
+    uint32_t below = (y + 1 < plane.rows) ? y + 1 : y - 1;
+    uint8_t* dst = plane.data + y * plane.stride;
+    const uint8_t* a = plane.data + above * plane.stride;
+    const uint8_t* b = plane.data + below * plane.stride;
+
+    if (mMode == DEINTERLACE_MOTION && mHistoryValid) {
+        motionRow(dst, a, b, plane.history + above * plane.stride,
+                  plane.history + below * plane.stride,
+                  plane.stride, MOTION_THRESHOLD);
+    }
+    else {
+        interpolateRow(dst, a, b, plane.stride);
+    }
+}
+
+void Deinterlacer::processBand(uint32_t first, uint32_t last)
+{
+    // replaced rows only read kept rows, so bands are independent.
+    for (uint32_t i = 0; i < mPlaneCount; i++) {
+        Plane& plane = mPlanes[i];
+        uint32_t end = (last < plane.rows) ? last : plane.rows;
+        uint32_t y = first + ((first & 1) != mReplaceParity ? 1 : 0);
+        for (; y < end; y += 2) {
+            processRow(plane, y);
+        }
+    }
+}
+
+void Deinterlacer::updateHistory()
+{
+    for (uint32_t i = 0; i < mPlaneCount; i++) {
+        Plane& plane = mPlanes[i];
+        for (uint32_t y = 1 - mReplaceParity; y < plane.rows; y += 2) {
+            memcpy(plane.history + y * plane.stride,
+                   plane.data + y * plane.stride, plane.stride);
+        }
+    }
+    mHistoryValid = true;
+}
+
+int32_t Deinterlacer::process(StreamBuffer& buf)
+{
+    if (mMode == DEINTERLACE_NONE) {
+        return 0;
+    }
+
+    int32_t ret = setupPlanes(buf);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (mField == V4L2_FIELD_SEQ_TB || mField == V4L2_FIELD_SEQ_BT) {
+        for (uint32_t i = 0; i < mPlaneCount; i++) {
+            weaveSequential(mPlanes[i]);
+        }
+    }
+
+    if (mMode == DEINTERLACE_WEAVE) {
+        return 0;
+    }
+
+    // even band size keeps row parity of each band aligned.
+    const uint32_t count = WORKER_THREADS + 1;
+    uint32_t step = ((mHeight + count - 1) / count + 1) & ~1;
+    Band bands[count];
+    void* args[count];
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t last = (first + step < mHeight) ? first + step : mHeight;
+        bands[i].first = first;
+        bands[i].last = (i + 1 < count) ? last : mHeight;
+        args[i] = &bands[i];
+        first = last;
+    }
+    mWorkers.run(args, count);
+
+    if (mMode == DEINTERLACE_MOTION) {
+        updateHistory();
+    }
+
+    return 0;
+}
+
+status_t Deinterlacer::handleWork(void* arg)
+{
+    Band* band = (Band*)arg;
+    processBand(band->first, band->last);
+    return NO_ERROR;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _DEINTERLACER_H
+#define _DEINTERLACER_H
+
+#include <stdint.h>
+#include <utils/threads.h>
+#include "CameraUtils.h"
+#include "WorkerThread.h"
+
+// deinterlace mode of TV-in streams: weave, bob or motion.
+#define CAMERA_DEINTERLACE "rw.camera.deinterlace"
+
+enum {
+    DEINTERLACE_NONE = 0,
+    // interleave both fields, only reorders sequential field layouts.
+    DEINTERLACE_WEAVE,
+    // interpolate the earlier field from the later one.
+    DEINTERLACE_BOB,
+    // bob where the field moved since last frame, weave elsewhere.
+    DEINTERLACE_MOTION,
+};
+
+// in-place deinterlacer for interlaced frames captured from TV decoders.
+// the frame is processed in row bands by worker threads.
+class Deinterlacer : public WorkerThread::Handler
+{
+public:
+    Deinterlacer();
+    ~Deinterlacer();
+
+    // mode selected by CAMERA_DEINTERLACE property.
+    static int32_t getConfiguredMode();
+
+    // field is v4l2 field layout of frames, bottomFirst is field order.
+    void configure(int32_t mode, int32_t format, uint32_t width,
+                   uint32_t height, uint32_t field, bool bottomFirst);
+    int32_t mode() {return mMode;}
+    bool isBottomFirst() {return mBottomFirst;}
+
+    // deinterlace frame in place.
+    int32_t process(StreamBuffer& buf);
+
+private:
+    static const uint32_t MAX_PLANES = 2;
+    static const uint32_t WORKER_THREADS = 2;
+    // luma/chroma difference treated as motion.
+    static const uint8_t MOTION_THRESHOLD = 10;
+
+    // rows [first, last) of every plane.
+    struct Band {
+        uint32_t first;
+        uint32_t last;
+    };
+
+    struct Plane {
+        uint8_t* data;
+        uint8_t* history;
+        uint32_t stride;
+        uint32_t rows;
+    };
+
+    int32_t setupPlanes(StreamBuffer& buf);
+    void weaveSequential(Plane& plane);
+    // process rows [first, last) of every plane.
+    void processBand(uint32_t first, uint32_t last);
+    void processRow(Plane& plane, uint32_t y);
+    void updateHistory();
+    // process posted band on worker thread.
+    virtual status_t handleWork(void* arg);
+
+    WorkerPool mWorkers;
+
+    int32_t mMode;
+    int32_t mFormat;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint32_t mField;
+    bool mBottomFirst;
+    // parity of rows which come from the earlier field.
+    uint32_t mReplaceParity;
+
+    Plane mPlanes[MAX_PLANES];
+    uint32_t mPlaneCount;
+    // rows of the kept field in last frame, used by motion mode.
+    ScratchBuffer mHistory;
+    bool mHistoryValid;
+    // sequential fields are copied here before interleaving.
+    ScratchBuffer mScratch;
+};
+
+#endif
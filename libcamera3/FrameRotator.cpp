@@ -0,0 +1,387 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CameraHAL"
+
+#include <stdlib.h>
+#include <string.h>
+#include <cutils/properties.h>
+#include <system/graphics.h>
+#include <utils/Log.h>
+#include <utils/Errors.h>
+#include "FrameRotator.h"
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace android;
+
+// rotated planes are processed in square tiles.
+#define TILE 8
+
+#ifdef __ARM_NEON
+// transpose 8x8 block of bytes, rows are loaded from src[0..7].
+static inline void transposeTile(const uint8_t* const* src, uint8_t* const* dst)
+{
+    uint8x8x2_t a01 = vtrn_u8(vld1_u8(src[0]), vld1_u8(src[1]));
+    uint8x8x2_t a23 = vtrn_u8(vld1_u8(src[2]), vld1_u8(src[3]));
+    uint8x8x2_t a45 = vtrn_u8(vld1_u8(src[4]), vld1_u8(src[5]));
+    uint8x8x2_t a67 = vtrn_u8(vld1_u8(src[6]), vld1_u8(src[7]));
+
+    uint16x4x2_t b02 = vtrn_u16(vreinterpret_u16_u8(a01.val[0]),
+                                vreinterpret_u16_u8(a23.val[0]));
+    uint16x4x2_t b13 = vtrn_u16(vreinterpret_u16_u8(a01.val[1]),
+                                vreinterpret_u16_u8(a23.val[1]));
+    uint16x4x2_t b46 = vtrn_u16(vreinterpret_u16_u8(a45.val[0]),
+                                vreinterpret_u16_u8(a67.val[0]));
+    uint16x4x2_t b57 = vtrn_u16(vreinterpret_u16_u8(a45.val[1]),
+                                vreinterpret_u16_u8(a67.val[1]));
+
+    uint32x2x2_t c04 = vtrn_u32(vreinterpret_u32_u16(b02.val[0]),
+                                vreinterpret_u32_u16(b46.val[0]));
+    uint32x2x2_t c15 = vtrn_u32(vreinterpret_u32_u16(b13.val[0]),
+                                vreinterpret_u32_u16(b57.val[0]));
+    uint32x2x2_t c26 = vtrn_u32(vreinterpret_u32_u16(b02.val[1]),
+                                vreinterpret_u32_u16(b46.val[1]));
+    uint32x2x2_t c37 = vtrn_u32(vreinterpret_u32_u16(b13.val[1]),
+                                vreinterpret_u32_u16(b57.val[1]));
+
+    vst1_u8(dst[0], vreinterpret_u8_u32(c04.val[0]));
+    vst1_u8(dst[1], vreinterpret_u8_u32(c15.val[0]));
+    vst1_u8(dst[2], vreinterpret_u8_u32(c26.val[0]));
+    vst1_u8(dst[3], vreinterpret_u8_u32(c37.val[0]));
+    vst1_u8(dst[4], vreinterpret_u8_u32(c04.val[1]));
+    vst1_u8(dst[5], vreinterpret_u8_u32(c15.val[1]));
+    vst1_u8(dst[6], vreinterpret_u8_u32(c26.val[1]));
+    vst1_u8(dst[7], vreinterpret_u8_u32(c37.val[1]));
+}
+
+// transpose 8x8 block of 16 bit elements, such as interleaved chroma.
+static inline void transposeTile(const uint16_t* const* src,
+                                 uint16_t* const* dst)
+{
+    uint16x8x2_t a01 = vtrnq_u16(vld1q_u16(src[0]), vld1q_u16(src[1]));
+    uint16x8x2_t a23 = vtrnq_u16(vld1q_u16(src[2]), vld1q_u16(src[3]));
+    uint16x8x2_t a45 = vtrnq_u16(vld1q_u16(src[4]), vld1q_u16(src[5]));
+    uint16x8x2_t a67 = vtrnq_u16(vld1q_u16(src[6]), vld1q_u16(src[7]));
+
+    uint32x4x2_t b02 = vtrnq_u32(vreinterpretq_u32_u16(a01.val[0]),
+                                 vreinterpretq_u32_u16(a23.val[0]));
+    uint32x4x2_t b13 = vtrnq_u32(vreinterpretq_u32_u16(a01.val[1]),
+                                 vreinterpretq_u32_u16(a23.val[1]));
+    uint32x4x2_t b46 = vtrnq_u32(vreinterpretq_u32_u16(a45.val[0]),
+                                 vreinterpretq_u32_u16(a67.val[0]));
+    uint32x4x2_t b57 = vtrnq_u32(vreinterpretq_u32_u16(a45.val[1]),
+                                 vreinterpretq_u32_u16(a67.val[1]));
+
+    // swap 64 bit halves to finish the transpose.
+    uint32x4_t r[8];
+    r[0] = vcombine_u32(vget_low_u32(b02.val[0]), vget_low_u32(b46.val[0]));
+    r[1] = vcombine_u32(vget_low_u32(b13.val[0]), vget_low_u32(b57.val[0]));
+    r[2] = vcombine_u32(vget_low_u32(b02.val[1]), vget_low_u32(b46.val[1]));
+    r[3] = vcombine_u32(vget_low_u32(b13.val[1]), vget_low_u32(b57.val[1]));
+    r[4] = vcombine_u32(vget_high_u32(b02.val[0]), vget_high_u32(b46.val[0]));
+    r[5] = vcombine_u32(vget_high_u32(b13.val[0]), vget_high_u32(b57.val[0]));
+    r[6] = vcombine_u32(vget_high_u32(b02.val[1]), vget_high_u32(b46.val[1]));
+    r[7] = vcombine_u32(vget_high_u32(b13.val[1]), vget_high_u32(b57.val[1]));
+
+    for (int32_t i = 0; i < TILE; i++) {
+        vst1q_u16(dst[i], vreinterpretq_u16_u32(r[i]));
+    }
+}
+#else
+template <typename T>
+static inline void transposeTile(const T* const* src, T* const* dst)
+{
+    for (int32_t i = 0; i < TILE; i++) {
+        for (int32_t k = 0; k < TILE; k++) {
+            dst[k][i] = src[i][k];
+        }
+    }
+}
+#endif
+
+// out[y][x] = in[fv ? x : h - 1 - x][fh ? w - 1 - y : y], strides are in
+// elements. full tiles are transposed in registers, edges per element.
+template <typename T>
+static void rotatePlane(const T* src, uint32_t srcStride, uint32_t width,
+                        uint32_t height, int32_t transform, T* dst,
+                        uint32_t dstStride)
+{
+    bool fh = (transform & HAL_TRANSFORM_FLIP_H) != 0;
+    bool fv = (transform & HAL_TRANSFORM_FLIP_V) != 0;
+    uint32_t outWidth = height;
+    uint32_t outHeight = width;
+    uint32_t tileWidth = outWidth - outWidth % TILE;
+    uint32_t tileHeight = outHeight - outHeight % TILE;
+
+    const T* rows[TILE];
+    T* outs[TILE];
+    for (uint32_t y0 = 0; y0 < tileHeight; y0 += TILE) {
+        // tile columns are source columns, reversed when flipped.
+        uint32_t col = fh ? width - TILE - y0 : y0;
+        for (uint32_t k = 0; k < TILE; k++) {
+            uint32_t y = fh ? y0 + TILE - 1 - k : y0 + k;
+            outs[k] = dst + y * dstStride;
+        }
+
+        for (uint32_t x0 = 0; x0 < tileWidth; x0 += TILE) {
+            for (uint32_t i = 0; i < TILE; i++) {
+                uint32_t row = fv ? x0 + i : height - 1 - x0 - i;
+                rows[i] = src + row * srcStride + col;
+            }
+            transposeTile(rows, outs);
+            for (uint32_t k = 0; k < TILE; k++) {
+                outs[k] += TILE;
+            }
+        }
+    }
+
+    // right and bottom edges which don't fill a tile.
+    for (uint32_t y = 0; y < outHeight; y++) {
+        uint32_t col = fh ? width - 1 - y : y;
+        uint32_t x = (y < tileHeight) ? tileWidth : 0;
+        for (; x < outWidth; x++) {
+            uint32_t row = fv ? x : height - 1 - x;
+            dst[y * dstStride + x] = src[row * srcStride + col];
+        }
+    }
+}
+
+// out[y][x] = in[fv ? h - 1 - y : y][fh ? w - 1 - x : x].
+template <typename T>
+static void flipPlane(const T* src, uint32_t srcStride, uint32_t width,
+                      uint32_t height, int32_t transform, T* dst,
+                      uint32_t dstStride)
+{
+    bool fh = (transform & HAL_TRANSFORM_FLIP_H) != 0;
+    bool fv = (transform & HAL_TRANSFORM_FLIP_V) != 0;
+
+    for (uint32_t y = 0; y < height; y++) {
+        const T* in = src + (fv ? height - 1 - y : y) * srcStride;
+        T* out = dst + y * dstStride;
+        if (!fh) {
+            memcpy(out, in, width * sizeof(T));
+            continue;
+        }
+
+        for (uint32_t x = 0; x < width; x++) {
+            out[x] = in[width - 1 - x];
+        }
+    }
+}
+
+template <typename T>
+static void transformPlane(const uint8_t* src, uint32_t width,
+                           uint32_t height, int32_t transform, uint8_t* dst)
+{
+    if (transform & HAL_TRANSFORM_ROT_90) {
+        rotatePlane((const T*)src, width, width, height, transform,
+                    (T*)dst, height);
+    }
+    else {
+        flipPlane((const T*)src, width, width, height, transform,
+                  (T*)dst, width);
+    }
+}
+
+int32_t FrameRotator::getConfiguredTransform(int32_t *orientation)
+{
+    char value[PROPERTY_VALUE_MAX];
+    int32_t transform = 0;
+
+    property_get(CAMERA_ROTATE, value, "0");
+    if (atoi(value) != 0) {
+        switch (*orientation) {
+            case 90:
+                transform = HAL_TRANSFORM_ROT_90;
+                break;
+            case 180:
+                transform = HAL_TRANSFORM_ROT_180;
+                break;
+            case 270:
+                transform = HAL_TRANSFORM_ROT_270;
+                break;
+            default:
+                break;
+        }
+        *orientation = 0;
+    }
+
+    int32_t mirror = 0;
+    property_get(CAMERA_MIRROR, value, "none");
+    if (!strcmp(value, "h")) {
+        mirror = HAL_TRANSFORM_FLIP_H;
+    }
+    else if (!strcmp(value, "v")) {
+        mirror = HAL_TRANSFORM_FLIP_V;
+    }
+
+    // mirror of the rotated frame is the other flip before rotation.
+    if ((mirror != 0) && (transform & HAL_TRANSFORM_ROT_90)) {
+        mirror ^= HAL_TRANSFORM_FLIP_H | HAL_TRANSFORM_FLIP_V;
+    }
+
+    transform ^= mirror;
+    ALOGI("%s transform:%d, orientation:%d", __func__, transform,
+          *orientation);
+    return transform;
+}
+
+bool FrameRotator::isSupported(int32_t format)
+{
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YCbCr_420_888:
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t FrameRotator::getFrameSize(int32_t format, uint32_t width,
+                                  uint32_t height)
+{
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YCbCr_420_888:
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+            return width * height * 3 / 2;
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+            return width * height * 2;
+        default:
+            return 0;
+    }
+}
+
+// nearest sample of each component, used where chroma subsampling
+// doesn't rotate with the frame.
+void FrameRotator::transformSampled(const Plane& in, uint32_t width,
+                                    uint32_t height, int32_t transform,
+                                    const Plane& out)
+{
+    bool rot = (transform & HAL_TRANSFORM_ROT_90) != 0;
+    bool fh = (transform & HAL_TRANSFORM_FLIP_H) != 0;
+    bool fv = (transform & HAL_TRANSFORM_FLIP_V) != 0;
+    uint32_t inXs = width / in.width;
+    uint32_t inYs = height / in.height;
+    uint32_t outXs = (rot ? height : width) / out.width;
+    uint32_t outYs = (rot ? width : height) / out.height;
+
+    for (uint32_t v = 0; v < out.height; v++) {
+        uint8_t* d = out.base + v * out.stride + out.offset;
+        uint32_t y = v * outYs;
+        for (uint32_t u = 0; u < out.width; u++) {
+            uint32_t x = u * outXs;
+            uint32_t sx, sy;
+            if (rot) {
+                sy = fv ? x : height - 1 - x;
+                sx = fh ? width - 1 - y : y;
+            }
+            else {
+                sy = fv ? height - 1 - y : y;
+                sx = fh ? width - 1 - x : x;
+            }
+            d[u * out.step] = in.base[(sy / inYs) * in.stride + in.offset +
+                                      (sx / inXs) * in.step];
+        }
+    }
+}
+
+int32_t FrameRotator::process(int32_t format, const uint8_t* src,
+                              uint32_t width, uint32_t height,
+                              int32_t transform, uint8_t* dst)
+{
+    if (!isSupported(format) || src == NULL || dst == NULL ||
+            (width & 1) || (height & 1)) {
+        ALOGE("%s unsupported format 0x%x %ux%u", __func__, format,
+              width, height);
+        return BAD_VALUE;
+    }
+
+    bool rot = (transform & HAL_TRANSFORM_ROT_90) != 0;
+    uint32_t outWidth = rot ? height : width;
+    uint32_t outHeight = rot ? width : height;
+    uint32_t size = width * height;
+
+    if (format == HAL_PIXEL_FORMAT_YCbCr_422_I) {
+        // Y0 U Y1 V, pixel pairs share chroma along rows.
+        Plane in[3] = {
+            {(uint8_t*)src, 0, width * 2, 2, width, height},
+            {(uint8_t*)src, 1, width * 2, 4, width / 2, height},
+            {(uint8_t*)src, 3, width * 2, 4, width / 2, height},
+        };
+        Plane out[3] = {
+            {dst, 0, outWidth * 2, 2, outWidth, outHeight},
+            {dst, 1, outWidth * 2, 4, outWidth / 2, outHeight},
+            {dst, 3, outWidth * 2, 4, outWidth / 2, outHeight},
+        };
+        for (uint32_t i = 0; i < 3; i++) {
+            transformSampled(in[i], width, height, transform, out[i]);
+        }
+        return NO_ERROR;
+    }
+
+    transformPlane<uint8_t>(src, width, height, transform, dst);
+
+    if (format != HAL_PIXEL_FORMAT_YCbCr_422_SP) {
+        // 4:2:0 chroma rotates with the frame, pairs move as one element.
+        transformPlane<uint16_t>(src + size, width / 2, height / 2,
+                                 transform, dst + size);
+    }
+    else if (!rot) {
+        transformPlane<uint16_t>(src + size, width / 2, height, transform,
+                                 dst + size);
+    }
+    else {
+        for (uint32_t i = 0; i < 2; i++) {
+            Plane in = {(uint8_t*)src + size, i, width, 2, width / 2, height};
+            Plane out = {dst + size, i, outWidth, 2, outWidth / 2, outHeight};
+            transformSampled(in, width, height, transform, out);
+        }
+    }
+
+    return NO_ERROR;
+}
+
+CropRect FrameRotator::mapToSource(int32_t transform, uint32_t width,
+                                   uint32_t height, const CropRect& rect)
+{
+    bool fh = (transform & HAL_TRANSFORM_FLIP_H) != 0;
+    bool fv = (transform & HAL_TRANSFORM_FLIP_V) != 0;
+    CropRect source;
+
+    if (transform & HAL_TRANSFORM_ROT_90) {
+        // rows of transformed frame are source columns.
+        source.left = fh ? width - rect.top - rect.height : rect.top;
+        source.top = fv ? rect.left : height - rect.left - rect.width;
+        source.width = rect.height;
+        source.height = rect.width;
+    }
+    else {
+        source.left = fh ? width - rect.left - rect.width : rect.left;
+        source.top = fv ? height - rect.top - rect.height : rect.top;
+        source.width = rect.width;
+        source.height = rect.height;
+    }
+
+    return source;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAME_ROTATOR_H
+#define _FRAME_ROTATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "CameraUtils.h"
+
+// rotate frames upright by sensor mount orientation, 0 or 1.
+#define CAMERA_ROTATE "rw.camera.rotate"
+// mirror upright frames: none, h or v.
+#define CAMERA_MIRROR "rw.camera.mirror"
+
+// rotation and mirroring of frames on CPU, transform is HAL_TRANSFORM_*
+// value: flips are applied first, then clockwise rotation.
+class FrameRotator
+{
+public:
+    // transform selected by properties, orientation is updated to the
+    // rotation which is still left to display.
+    static int32_t getConfiguredTransform(int32_t *orientation);
+
+    static bool isSupported(int32_t format);
+    static size_t getFrameSize(int32_t format, uint32_t width,
+                               uint32_t height);
+
+    // dst is height x width when transform has HAL_TRANSFORM_ROT_90.
+    static int32_t process(int32_t format, const uint8_t* src,
+                           uint32_t width, uint32_t height,
+                           int32_t transform, uint8_t* dst);
+
+    // rect of transformed frame back to source frame of width x height.
+    static CropRect mapToSource(int32_t transform, uint32_t width,
+                                uint32_t height, const CropRect& rect);
+
+private:
+    // component samples (x, y) are at base[y * stride + offset + x * step].
+    struct Plane {
+        uint8_t* base;
+        uint32_t offset;
+        uint32_t stride;
+        uint32_t step;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    static void transformSampled(const Plane& in, uint32_t width,
+                                 uint32_t height, int32_t transform,
+                                 const Plane& out);
+};
+
+#endif
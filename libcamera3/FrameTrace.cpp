@@ -0,0 +1,226 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <utils/Log.h>
+#include <utils/Errors.h>
+#include "FrameTrace.h"
+
+using namespace android;
+
+FrameTrace::FrameTrace()
+    : mNext(0), mEnabled(false)
+{
+    for (uint32_t i = 0; i < TRACE_SIZE; i++) {
+        mEvents[i].seq.store(0, std::memory_order_relaxed);
+        memset(&mEvents[i].span, 0, sizeof(Span));
+    }
+}
+
+void FrameTrace::setEnabled(bool enable)
+{
+    mEnabled.store(enable, std::memory_order_relaxed);
+}
+
+bool FrameTrace::isEnabled()
+{
+    return mEnabled.load(std::memory_order_relaxed);
+}
+
+void FrameTrace::record(uint32_t frame, int32_t stage, int32_t path,
+                        nsecs_t begin, nsecs_t end)
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    uint32_t index = mNext.fetch_add(1, std::memory_order_relaxed);
+    Event& event = mEvents[index & TRACE_MASK];
+    // seq 0 marks event is being written.
+    event.seq.store(0, std::memory_order_release);
+    event.span.frame = frame;
+    event.span.stage = stage;
+    event.span.path = path;
+    event.span.begin = begin;
+    event.span.end = end;
+    event.seq.store(index + 1, std::memory_order_release);
+}
+
+uint32_t FrameTrace::snapshot(Span* spans, uint32_t max)
+{
+    uint32_t next = mNext.load(std::memory_order_acquire);
+    uint32_t count = (next < TRACE_SIZE) ? next : TRACE_SIZE;
+    if (count > max) {
+        count = max;
+    }
+
+    uint32_t copied = 0;
+    for (uint32_t index = next - count; index != next; index++) {
+        Event& event = mEvents[index & TRACE_MASK];
+        uint32_t seq = event.seq.load(std::memory_order_acquire);
+        Span span = event.span;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // skip event which is being written or overwritten.
+        if ((seq != index + 1) ||
+            (event.seq.load(std::memory_order_relaxed) != seq)) {
+            continue;
+        }
+        spans[copied++] = span;
+    }
+
+    return copied;
+}
+
+const char* FrameTrace::stageName(int32_t stage)
+{
+    switch (stage) {
+        case TRACE_DQBUF:
+            return "dqbuf";
+        case TRACE_SETTINGS:
+            return "settings";
+        case TRACE_PROCESS:
+            return "process";
+        case TRACE_DONE:
+            return "done";
+        case TRACE_QBUF:
+            return "qbuf";
+        default:
+            return "unknown";
+    }
+}
+
+const char* FrameTrace::pathName(int32_t path)
+{
+    switch (path) {
+        case TRACE_PATH_PXP:
+            return "pxp";
+        case TRACE_PATH_IPU:
+            return "ipu";
+        case TRACE_PATH_GPU:
+            return "gpu";
+        case TRACE_PATH_CPU:
+            return "cpu";
+        case TRACE_PATH_JPEG:
+            return "jpeg";
+        default:
+            return "";
+    }
+}
+
+void FrameTrace::dump(int32_t fd)
+{
+    dprintf(fd, "Frame trace: %s\n", isEnabled() ? "enabled" : "disabled");
+
+    Span* spans = (Span*)malloc(sizeof(Span) * TRACE_SIZE);
+    if (spans == NULL) {
+        return;
+    }
+
+    uint32_t count = snapshot(spans, TRACE_SIZE);
+    uint32_t num[TRACE_STAGE_MAX][TRACE_PATH_MAX];
+    nsecs_t total[TRACE_STAGE_MAX][TRACE_PATH_MAX];
+    nsecs_t peak[TRACE_STAGE_MAX][TRACE_PATH_MAX];
+    memset(num, 0, sizeof(num));
+    memset(total, 0, sizeof(total));
+    memset(peak, 0, sizeof(peak));
+
+    for (uint32_t i = 0; i < count; i++) {
+        Span& span = spans[i];
+        if ((span.stage < 0) || (span.stage >= TRACE_STAGE_MAX) ||
+            (span.path < 0) || (span.path >= TRACE_PATH_MAX)) {
+            continue;
+        }
+
+        nsecs_t duration = span.end - span.begin;
+        num[span.stage][span.path]++;
+        total[span.stage][span.path] += duration;
+        if (duration > peak[span.stage][span.path]) {
+            peak[span.stage][span.path] = duration;
+        }
+    }
+
+    dprintf(fd, "  stage          count   avg(us)   max(us)\n");
+    for (int32_t stage = 0; stage < TRACE_STAGE_MAX; stage++) {
+        for (int32_t path = 0; path < TRACE_PATH_MAX; path++) {
+            if (num[stage][path] == 0) {
+                continue;
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "%s%s%s", stageName(stage),
+                     (path != TRACE_PATH_NONE) ? ":" : "", pathName(path));
+            dprintf(fd, "  %-12s %7u %9lld %9lld\n", name, num[stage][path],
+                    (long long)(total[stage][path] / num[stage][path] / 1000),
+                    (long long)(peak[stage][path] / 1000));
+        }
+    }
+
+    uint32_t first = (count > TRACE_DUMP_SPANS) ? count - TRACE_DUMP_SPANS : 0;
+    dprintf(fd, "  latest spans:\n");
+    for (uint32_t i = first; i < count; i++) {
+        Span& span = spans[i];
+        dprintf(fd, "    frame %u %s%s%s begin %lld us dur %lld us\n",
+                span.frame, stageName(span.stage),
+                (span.path != TRACE_PATH_NONE) ? ":" : "",
+                pathName(span.path), (long long)(span.begin / 1000),
+                (long long)((span.end - span.begin) / 1000));
+    }
+
+    free(spans);
+}
+
+int32_t FrameTrace::exportJson(const char* file, int32_t id)
+{
+    if (file == NULL) {
+        return BAD_VALUE;
+    }
+
+    FILE* fp = fopen(file, "w");
+    if (fp == NULL) {
+        ALOGE("%s open %s failed: %s", __func__, file, strerror(errno));
+        return BAD_VALUE;
+    }
+
+    Span* spans = (Span*)malloc(sizeof(Span) * TRACE_SIZE);
+    if (spans == NULL) {
+        fclose(fp);
+        return NO_MEMORY;
+    }
+
+    uint32_t count = snapshot(spans, TRACE_SIZE);
+    // chrome trace event format, complete events in us.
+    fprintf(fp, "{\"traceEvents\":[");
+    for (uint32_t i = 0; i < count; i++) {
+        Span& span = spans[i];
+        fprintf(fp, "%s\n{\"name\":\"%s%s%s\",\"cat\":\"camera\",\"ph\":\"X\","
+                "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"frame\":%u}}", (i > 0) ? "," : "",
+                stageName(span.stage),
+                (span.path != TRACE_PATH_NONE) ? ":" : "",
+                pathName(span.path), span.begin / 1000.0,
+                (span.end - span.begin) / 1000.0, id, span.stage,
+                span.frame);
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    free(spans);
+    fclose(fp);
+    ALOGI("%s %d spans to %s", __func__, count, file);
+
+    return 0;
+}
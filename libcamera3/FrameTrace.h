@@ -0,0 +1,97 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAME_TRACE_H
+#define _FRAME_TRACE_H
+
+#include <stdint.h>
+#include <utils/Timers.h>
+#include <atomic>
+
+// enable per frame latency trace.
+#define CAMERA_TRACE "rw.camera.trace"
+// trace is exported to this file as systrace json when dump.
+#define CAMERA_TRACE_FILE "rw.camera.trace.file"
+
+// pipeline stage of a frame.
+enum {
+    TRACE_DQBUF = 0,
+    TRACE_SETTINGS,
+    TRACE_PROCESS,
+    TRACE_DONE,
+    TRACE_QBUF,
+    TRACE_STAGE_MAX
+};
+
+// path used to process stream buffer.
+enum {
+    TRACE_PATH_NONE = 0,
+    TRACE_PATH_PXP,
+    TRACE_PATH_IPU,
+    TRACE_PATH_GPU,
+    TRACE_PATH_CPU,
+    TRACE_PATH_JPEG,
+    TRACE_PATH_MAX
+};
+
+// FrameTrace keeps the latest stage spans in a lock-free ring.
+// record may be called from any thread, dump reads a snapshot.
+class FrameTrace
+{
+public:
+    FrameTrace();
+
+    void setEnabled(bool enable);
+    bool isEnabled();
+
+    void record(uint32_t frame, int32_t stage, int32_t path,
+                nsecs_t begin, nsecs_t end);
+
+    // print statistics and latest spans.
+    void dump(int32_t fd);
+    // write systrace/perfetto json to file.
+    int32_t exportJson(const char* file, int32_t id);
+
+private:
+    struct Span {
+        uint32_t frame;
+        int32_t stage;
+        int32_t path;
+        nsecs_t begin;
+        nsecs_t end;
+    };
+
+    struct Event {
+        std::atomic<uint32_t> seq;
+        Span span;
+    };
+
+    // copy spans in record order, return count.
+    uint32_t snapshot(Span* spans, uint32_t max);
+
+    static const char* stageName(int32_t stage);
+    static const char* pathName(int32_t path);
+
+    static const uint32_t TRACE_SIZE = 1024;
+    static const uint32_t TRACE_MASK = TRACE_SIZE - 1;
+    static const uint32_t TRACE_DUMP_SPANS = 16;
+
+    Event mEvents[TRACE_SIZE];
+    std::atomic<uint32_t> mNext;
+    std::atomic<bool> mEnabled;
+};
+
+#endif
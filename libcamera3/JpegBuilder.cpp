@@ -26,9 +26,12 @@
 #include <errno.h>
 #include <math.h>
 
+#include <cutils/properties.h>
+
 #include "JpegBuilder.h"
 #include "Metadata.h"
 #include "Stream.h"
+#include "V4l2JpegEncoder.h"
 
 extern "C" {
     #include "jpeglib.h"
@@ -134,15 +137,24 @@ status_t JpegBuilder::insertElement(uint16_t tag,
     table[position].val5 = val5;
     table[position].val6 = val6;
 
+    table[position].strVal = NULL;
+
     if (strVal) {
+        // strings are kept in the builder, nothing to free per shot.
         if (table[position].tag == TAG_GPS_PROCESSING_METHOD) {
             value_length = sizeof(ExifAsciiPrefix) +
                            strlen(strVal + sizeof(ExifAsciiPrefix));
-            table[position].strVal = (char *)malloc(sizeof(char) * (value_length + 1));
-            memcpy(table[position].strVal, strVal, value_length + 1);
         } else {
-            table[position].strVal = strdup(strVal);
+            value_length = strlen(strVal);
+        }
+
+        if (mStringsUsed + value_length + 1 > EXIF_STRING_POOL_SIZE) {
+            ALOGE("EXIF string pool is full");
+            return NO_MEMORY;
         }
+        table[position].strVal = mStrings + mStringsUsed;
+        memcpy(table[position].strVal, strVal, value_length + 1);
+        mStringsUsed += value_length + 1;
     }
 
     position++;
@@ -151,17 +163,26 @@ status_t JpegBuilder::insertElement(uint16_t tag,
 }
 
 JpegBuilder::JpegBuilder()
-    : position(0), has_datetime_tag(false)
+    : mHwEncoder(NULL), mHwProbed(false), mStatsCount(0), position(0),
+      has_datetime_tag(false)
 {
+    for (int32_t i = 0; i < ENCODER_COUNT; i++) {
+        mEncoders[i] = new SoftwareJpegEncoder();
+    }
+    // EXIF template lives as long as the stream, reset() keeps it.
+    memset(&mExifTemplate, 0, sizeof(mExifTemplate));
     reset();
 }
 
 void JpegBuilder::reset()
 {
     position         = 0;
+    mStringsUsed     = 0;
     has_datetime_tag = false;
     mMainInput       = NULL;
     mThumbnailInput  = NULL;
+    mOutputOffset    = 0;
+    mThumbReserve    = 0;
     mCancelEncoding  = false;
     memset(&mEXIFData, 0, sizeof(mEXIFData));
     memset(table, 0, sizeof(table));
@@ -169,6 +190,50 @@ void JpegBuilder::reset()
 
 JpegBuilder::~JpegBuilder()
 {
+    if (mEncodeThread != NULL) {
+        mEncodeThread->stop();
+        mEncodeThread.clear();
+    }
+    releaseEncoders();
+}
+
+JpegEncoderBackend* JpegBuilder::getHwEncoder()
+{
+    if (mHwProbed) {
+        return mHwEncoder;
+    }
+    mHwProbed = true;
+
+    char value[PROPERTY_VALUE_MAX];
+    property_get(CAMERA_JPEG_ENCODER, value, "auto");
+    if (!strcmp(value, "software")) {
+        return NULL;
+    }
+
+    if (strcmp(value, "hardware")) {
+        char boardName[PROPERTY_VALUE_MAX];
+        property_get("ro.board.platform", boardName, DEFAULT_ERROR_NAME_str);
+        if (!strstr(boardName, IMX8_BOARD_NAME)) {
+            return NULL;
+        }
+    }
+
+    mHwEncoder = V4l2JpegEncoder::probe();
+    if (mHwEncoder == NULL) {
+        ALOGI("%s no hardware jpeg encoder, use software", __func__);
+    }
+
+    return mHwEncoder;
+}
+
+void JpegBuilder::releaseEncoders()
+{
+    for (int32_t i = 0; i < ENCODER_COUNT; i++) {
+        delete mEncoders[i];
+        mEncoders[i] = NULL;
+    }
+    delete mHwEncoder;
+    mHwEncoder = NULL;
 }
 
 status_t JpegBuilder::prepareImage(const StreamBuffer *streamBuf)
@@ -477,49 +542,125 @@ void JpegBuilder::setMetadata(sp<Metadata> meta)
     mEXIFData.mMakeValid               = true;
 }
 
+status_t JpegBuilder::prepareHeader(bool hasThumb)
+{
+    // tag layout rarely changes within a session, so the head is
+    // serialized once and later shots only patch values like datetime.
+    if (MatchEXIFTemplate(&mExifTemplate, table, position, hasThumb)) {
+        return (PatchEXIFTemplate(&mExifTemplate, table, position) == 0) ?
+               NO_ERROR : BAD_VALUE;
+    }
+
+    ALOGI("%s build EXIF template, %d tags", __func__, position);
+    if (BuildEXIFTemplate(table, position, hasThumb, &mExifTemplate)) {
+        return BAD_VALUE;
+    }
+
+    return NO_ERROR;
+}
+
+status_t JpegBuilder::prepareOutput(const StreamBuffer *streamBuf,
+                                    JpegParams *mainJpeg,
+                                    JpegParams *thumbNail)
+{
+    uint32_t reserve = 0;
+
+    mOutputOffset = 0;
+    mThumbReserve = 0;
+    if (!streamBuf || !mainJpeg || !streamBuf->mVirtAddr || position == 0) {
+        return BAD_VALUE;
+    }
+
+    status_t ret = prepareHeader(thumbNail != NULL);
+    if (ret != NO_ERROR) {
+        return ret;
+    }
+
+    uint32_t headSize = mExifTemplate.size;
+    if (thumbNail) {
+        // thumbnail size is unknown before encoding, reserve one byte per
+        // pixel up to the 64KB APP1 limit.
+        reserve = thumbNail->out_width * thumbNail->out_height;
+        if (reserve > MAX_EXIF_MAIN_OFFSET - headSize) {
+            reserve = MAX_EXIF_MAIN_OFFSET - headSize;
+        }
+    }
+
+    uint32_t mainOffset = headSize + reserve;
+    if (mainOffset < 2 || mainOffset >= streamBuf->mSize) {
+        return BAD_VALUE;
+    }
+
+    // encoder writes SOI then tables, SOI is overwritten by EXIF header.
+    mainJpeg->dst = (uint8_t *)streamBuf->mVirtAddr + mainOffset - 2;
+    mainJpeg->dst_size = streamBuf->mSize - mainOffset + 2;
+    mOutputOffset = mainOffset;
+    mThumbReserve = reserve;
+
+    return NO_ERROR;
+}
+
 status_t JpegBuilder::encodeImage(JpegParams *mainJpeg,
                                   JpegParams *thumbNail)
 {
     status_t ret = NO_ERROR;
+    status_t thumbRet = NO_ERROR;
+    bool thumbPosted = false;
 
     mMainInput      = mainJpeg;
     mThumbnailInput = thumbNail;
     if (thumbNail) {
-        ret = encodeJpeg(thumbNail);
+        // thumbnail is encoded on worker thread while main image is
+        // encoded on current thread.
+        if (mEncodeThread == NULL) {
+            mEncodeThread = new WorkerThread(this, "JpegEncodeThread");
+        }
+
+        thumbPosted = (mEncodeThread->post(thumbNail) == NO_ERROR);
+        if (!thumbPosted) {
+            thumbRet = encodeJpeg(thumbNail, ENCODER_THUMB);
+        }
     }
 
-    if (ret != NO_ERROR) {
-        ALOGE("%s encodeJpeg failed", __FUNCTION__);
-        return ret;
+    ret = encodeJpeg(mainJpeg, ENCODER_MAIN);
+
+    if (thumbPosted) {
+        thumbRet = mEncodeThread->waitDone();
+    }
+
+    if (thumbRet != NO_ERROR) {
+        ALOGE("%s encode thumbnail failed", __FUNCTION__);
+        return thumbRet;
     }
 
-    return encodeJpeg(mainJpeg);
+    return ret;
 }
 
-status_t JpegBuilder::encodeJpeg(JpegParams *input)
+status_t JpegBuilder::encodeJpeg(JpegParams *input, int32_t slot)
 {
-    PixelFormat format = input->format;
-    YuvToJpegEncoder *encoder = YuvToJpegEncoder::create(format);
+    int res = 0;
+    nsecs_t begin = systemTime();
+
+    // thumbnail is scaled and always goes to software encoder, so only
+    // main image uses hardware encoder.
+    JpegEncoderBackend *hw = (slot == ENCODER_MAIN) ? getHwEncoder() : NULL;
+    JpegEncoderBackend *used = hw;
+    if ((hw != NULL) && hw->isSupported(input)) {
+        res = hw->encode(input);
+        if (res == 0) {
+            ALOGW("%s %s encode failed, use software", __FUNCTION__, hw->name());
+            begin = systemTime();
+        }
+    }
 
-    if (encoder == NULL) {
-        ALOGE("%s YuvToJpegEncoder::create failed", __FUNCTION__);
-        return BAD_VALUE;
+    if ((res == 0) && (mEncoders[slot] != NULL)) {
+        used = mEncoders[slot];
+        res = used->encode(input);
     }
 
-    int res = 0;
-    res = encoder->encode(input->src,
-                          input->srcPhy,
-                          input->in_width,
-                          input->in_height,
-                          input->quality,
-                          input->dst,
-                          input->dst_size,
-                          input->out_width,
-                          input->out_height);
-
-    delete encoder;
     if (res) {
         input->jpeg_size = res;
+        accountEncode(used->name(), input, systemTime() - begin);
         return NO_ERROR;
     }
     else {
@@ -527,6 +668,108 @@ status_t JpegBuilder::encodeJpeg(JpegParams *input)
     }
 }
 
+void JpegBuilder::accountEncode(const char *backend, const JpegParams *input,
+                                nsecs_t duration)
+{
+    // same frame size as hardware encoder takes, buffer size otherwise.
+    uint64_t inBytes = V4l2JpegEncoder::getFrameSize(
+            convertPixelFormatToV4L2Format(input->format),
+            input->in_width, input->in_height);
+    if ((inBytes == 0) && (input->src_size > 0)) {
+        inBytes = input->src_size;
+    }
+    int64_t us = (duration > 1000) ? duration / 1000 : 1;
+
+    ALOGV("%s %s %dx%d q%d: %lld ms, %zu bytes, %lld MB/s", __func__,
+          backend, input->out_width, input->out_height, input->quality,
+          (long long)(duration / 1000000), input->jpeg_size,
+          (long long)(inBytes / us));
+
+    Mutex::Autolock lock(mStatsLock);
+    EncodeStats *stats = NULL;
+    for (uint32_t i = 0; i < mStatsCount; i++) {
+        if ((mStats[i].backend == backend) &&
+            (mStats[i].quality == input->quality)) {
+            stats = &mStats[i];
+            break;
+        }
+    }
+
+    if (stats == NULL) {
+        if (mStatsCount >= MAX_ENCODE_STATS) {
+            return;
+        }
+        stats = &mStats[mStatsCount++];
+        memset(stats, 0, sizeof(EncodeStats));
+        stats->backend = backend;
+        stats->quality = input->quality;
+    }
+
+    stats->count++;
+    stats->total += duration;
+    if (duration > stats->peak) {
+        stats->peak = duration;
+    }
+    stats->inBytes += inBytes;
+    stats->outBytes += input->jpeg_size;
+}
+
+void JpegBuilder::dump(int fd)
+{
+    Mutex::Autolock lock(mStatsLock);
+
+    dprintf(fd, "JPEG encode:\n");
+    dprintf(fd, "  backend    quality   count   avg(ms)   max(ms)   avg(KB)    MB/s\n");
+    for (uint32_t i = 0; i < mStatsCount; i++) {
+        EncodeStats& stats = mStats[i];
+        int64_t us = (stats.total > 1000) ? stats.total / 1000 : 1;
+        dprintf(fd, "  %-10s %7d %7u %9lld %9lld %9llu %7llu\n",
+                stats.backend, stats.quality, stats.count,
+                (long long)(stats.total / stats.count / 1000000),
+                (long long)(stats.peak / 1000000),
+                (unsigned long long)(stats.outBytes / stats.count / 1024),
+                (unsigned long long)(stats.inBytes / us));
+    }
+}
+
+//--------------------SoftwareJpegEncoder----------------------
+SoftwareJpegEncoder::~SoftwareJpegEncoder()
+{
+    delete mEncoder;
+}
+
+bool SoftwareJpegEncoder::isSupported(const JpegParams *params)
+{
+    return (params->format == HAL_PIXEL_FORMAT_YCbCr_420_SP) ||
+           (params->format == HAL_PIXEL_FORMAT_YCbCr_422_I) ||
+           (params->format == HAL_PIXEL_FORMAT_YCbCr_422_SP);
+}
+
+int SoftwareJpegEncoder::encode(JpegParams *input)
+{
+    if ((mEncoder == NULL) || (mEncoder->getPixelFormat() != input->format)) {
+        delete mEncoder;
+        mEncoder = YuvToJpegEncoder::create(input->format);
+    }
+
+    if (mEncoder == NULL) {
+        ALOGE("%s YuvToJpegEncoder::create failed", __FUNCTION__);
+        return 0;
+    }
+
+    return mEncoder->encode(input->src,
+                            input->srcPhy,
+                            input->in_width,
+                            input->in_height,
+                            input->quality,
+                            input->dst,
+                            input->dst_size,
+                            input->out_width,
+                            input->out_height,
+                            input->scratch,
+                            input->scratch_size);
+}
+
 status_t JpegBuilder::buildImage(const StreamBuffer *streamBuf)
 {
     int ret = 0;
@@ -544,29 +787,42 @@ status_t JpegBuilder::buildImage(const StreamBuffer *streamBuf)
         dwThumbSize = mThumbnailInput->jpeg_size;
     }
 
-    ret = InsertEXIFAndThumbnail(table,
-                                 position,
-                                 pThumb,
-                                 dwThumbSize,
-                                 mMainInput->dst,
-                                 mMainInput->jpeg_size,
-                                 (uint8_t *)streamBuf->mVirtAddr,
-                                 streamBuf->mSize);
-
-    // clean IDF table
-    unsigned int i;
-    for (i = 0; i < position; i++) {
-        if (table[i].strVal) {
-            free(table[i].strVal);
-        }
+    if (mOutputOffset > 0) {
+        ret = WriteEXIFTemplate(&mExifTemplate,
+                                pThumb,
+                                dwThumbSize,
+                                mThumbReserve,
+                                mMainInput->jpeg_size - 2,
+                                (uint8_t *)streamBuf->mVirtAddr,
+                                streamBuf->mSize);
+        ret = (ret < 0) ? ret : 0;
     }
+    else {
+        ret = InsertEXIFAndThumbnail(table,
+                                     position,
+                                     pThumb,
+                                     dwThumbSize,
+                                     mMainInput->dst,
+                                     mMainInput->jpeg_size,
+                                     (uint8_t *)streamBuf->mVirtAddr,
+                                     streamBuf->mSize);
+    }
+    mOutputOffset = 0;
+    mThumbReserve = 0;
 
+    // clean IDF table
     memset(table, 0, sizeof(table));
     position = 0;
+    mStringsUsed = 0;
 
     return ret;
 }
 
+status_t JpegBuilder::handleWork(void *arg)
+{
+    return encodeJpeg((JpegParams *)arg, ENCODER_THUMB);
+}
+
 status_t JpegBuilder::convertGPSCoord(double coord,
                                       int  & deg,
                                       int  & min,
@@ -20,13 +20,20 @@
 
 #include "CameraUtils.h"
 #include <utils/RefBase.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
 #include "TinyExif.h"
 #include "YuvToJpegEncoder.h"
+#include "WorkerThread.h"
 
 namespace android {
 #define EXIF_MAKENOTE "fsl_makernote"
 #define EXIF_MODEL    "fsl_model"
 
+// still capture encoder: auto, software or hardware.
+// auto uses hardware encoder on i.MX8 when one is found.
+#define CAMERA_JPEG_ENCODER "rw.camera.jpeg.encoder"
+
 //static const char TAG_GPS_PROCESSING_METHOD[] = "GPSProcessingMethod";
 /*static const char TAG_GPS_LAT[]               = "GPSLatitude";
 static const char TAG_GPS_LAT_REF[]           = "GPSLatitudeRef";
@@ -41,6 +48,7 @@ static const char TAG_GPS_TIMESTAMP[]         = "GPSTimeStamp";
 static const char TAG_GPS_DATESTAMP[]         = "GPSDateStamp";**/
 
 #define MAX_EXIF_TAGS_SUPPORTED 30
+#define EXIF_STRING_POOL_SIZE   1024
 #define GPS_MIN_DIV                 60
 #define GPS_SEC_DIV                 60
 #define GPS_SEC_ACCURACY            1000
@@ -105,7 +113,7 @@ struct JpegParams {
         : src(uSrc), srcPhy(uSrcPhy),src_size(srcSize), dst(uDst), dst_size(dstSize),
           quality(quality), in_width(inWidth), in_height(inHeight),
           out_width(outWidth), out_height(outHeight), format(format),
-          jpeg_size(0)
+          jpeg_size(0), scratch(NULL), scratch_size(0), src_fd(-1)
     {}
 
     uint8_t    *src;
@@ -120,22 +128,63 @@ struct JpegParams {
     int         out_height;
     int         format;
     size_t      jpeg_size;
+    uint8_t    *scratch;
+    int         scratch_size;
+    // dmabuf of src, hardware encoders import it instead of copying.
+    int         src_fd;
 };
 
+// encoder backend of JpegBuilder. output starts with SOI followed by
+// tables, it has no APPn segment so EXIF header can go in front of it.
+class JpegEncoderBackend
+{
+public:
+    virtual ~JpegEncoderBackend() {}
+    virtual const char* name() = 0;
+    // hardware encoders can't handle every input, such as scaled ones.
+    virtual bool isSupported(const JpegParams *params) = 0;
+    // returns encoded size, 0 on failure.
+    virtual int encode(JpegParams *params) = 0;
+};
 
-class JpegBuilder : public LightRefBase<JpegBuilder> {
+// libjpeg encoder, VPU is used inside when it's available.
+class SoftwareJpegEncoder : public JpegEncoderBackend
+{
+public:
+    SoftwareJpegEncoder() : mEncoder(NULL) {}
+    virtual ~SoftwareJpegEncoder();
+
+    virtual const char* name() {return "software";}
+    virtual bool isSupported(const JpegParams *params);
+    virtual int encode(JpegParams *params);
+
+private:
+    // kept across captures, recreated when pixel format changes.
+    YuvToJpegEncoder *mEncoder;
+};
+
+
+class JpegBuilder : public LightRefBase<JpegBuilder>,
+                    public WorkerThread::Handler {
 public:
     JpegBuilder();
     ~JpegBuilder();
 
     status_t prepareImage(const StreamBuffer *streamBuf);
 
+    // main image is encoded straight into streamBuf after EXIF header,
+    // thumbNail is NULL if no thumbnail.
+    status_t prepareOutput(const StreamBuffer *streamBuf,
+                           JpegParams *mainJpeg,
+                           JpegParams *thumbNail);
     status_t encodeImage(JpegParams *mainJpeg,
                          JpegParams *thumbNail);
     size_t   getImageSize();
     status_t buildImage(const StreamBuffer *streamBuf);
     void     reset();
     void setMetadata(sp<Metadata> meta);
+    // print encode statistics per backend and quality.
+    void     dump(int fd);
 
 private:
     status_t insertElement(uint16_t tag,
@@ -154,7 +203,19 @@ private:
                       size_t         jpeg_size);
 
 private:
-    status_t    encodeJpeg(JpegParams *input);
+    // main image and thumbnail are encoded in parallel by own encoder.
+    static const int32_t ENCODER_MAIN = 0;
+    static const int32_t ENCODER_THUMB = 1;
+    static const int32_t ENCODER_COUNT = 2;
+
+    status_t    encodeJpeg(JpegParams *input, int32_t slot);
+    // hardware encoder picked by CAMERA_JPEG_ENCODER, probed once.
+    JpegEncoderBackend* getHwEncoder();
+    void        accountEncode(const char *backend, const JpegParams *input,
+                              nsecs_t duration);
+    // build or patch mExifTemplate from current tag table.
+    status_t    prepareHeader(bool hasThumb);
+    void        releaseEncoders();
     const char* degreesToExifOrientation(const char *);
     void        stringToRational(const    char *,
                                  unsigned int *,
@@ -166,15 +227,47 @@ private:
                                 int  & sec,
                                 int  & secDivisor);
 
+private:
+    // encode thumbnail in parallel with main image.
+    virtual status_t handleWork(void *arg);
+
+    sp<WorkerThread> mEncodeThread;
+    // software encoders stay open across captures.
+    JpegEncoderBackend *mEncoders[ENCODER_COUNT];
+    JpegEncoderBackend *mHwEncoder;
+    bool mHwProbed;
+
+    static const uint32_t MAX_ENCODE_STATS = 16;
+    struct EncodeStats {
+        const char *backend;
+        int32_t  quality;
+        uint32_t count;
+        nsecs_t  total;
+        nsecs_t  peak;
+        uint64_t inBytes;
+        uint64_t outBytes;
+    };
+    // main image and thumbnail are accounted from different threads.
+    Mutex mStatsLock;
+    EncodeStats mStats[MAX_ENCODE_STATS];
+    uint32_t mStatsCount;
+
 private:
     JpegParams *mMainInput;
     JpegParams *mThumbnailInput;
+    // main image data offset in output buffer, 0 if encoded to scratch.
+    uint32_t mOutputOffset;
+    uint32_t mThumbReserve;
 
     bool mCancelEncoding;
     EXIFData mEXIFData;
 
 private:
     IFDEle table[MAX_EXIF_TAGS_SUPPORTED];
+    // string values of table.
+    char mStrings[EXIF_STRING_POOL_SIZE];
+    uint32_t mStringsUsed;
+    EXIFTemplate mExifTemplate;
     unsigned int  gps_tag_count;
     unsigned int  position;
     bool jpeg_opened;
@@ -14,12 +14,13 @@
  * limitations under the License.
  */
 
+#include <poll.h>
 #include "MJPGStream.h"
 
 unsigned char* VPUptr;
 int32_t mVPUBuffersIndex=0;
 
-static u8 g_hufTab[] = { \
+static const uint8_t g_hufTab[] = { \
     0xff, 0xc4, 0x00, 0x1f,
           0x00, 0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
           0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0xff, 0xc4, 0x00,
@@ -49,138 +50,85 @@ static u8 g_hufTab[] = { \
           0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7,
           0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa };
 
-#define MAX_SERCH_SIZE (u32)(64*1024)
-
-typedef struct tagSecHead {
-    u8 secStart;
-    u8 secID;
-    u8 secLenH;
-    u8 secLenL;
-}TSecHead;
 #define SEC_START   0xff
-
-#define ID_SOI  0xd8
-#define ID_SOF0 0xc0
 #define ID_DHT  0xc4
-#define ID_SOS  0xda
-
-static int SearchHufTabPos(u8 *pSrc, u32 nSrcSize, bool *pbExist, u32 *pdwExptDHTPos) {
-    u32 dwSearchSize = (MAX_SERCH_SIZE < nSrcSize) ? MAX_SERCH_SIZE : nSrcSize;
-    TSecHead tSecHead;
-    u32 pos = 0;
-    bool bSOF0Found = false;
-    u32 dwSecSize = 0;
-    u32 dwExpectedHufTabPos = 0;
-
-    if((pSrc == NULL) || (nSrcSize < 4) || (pbExist == NULL) || (pdwExptDHTPos == NULL)) {
-        ALOGE("SearchHufTabPos, para err");
-        return -1;
-    }
-
-    *pbExist = false;
-
-    if( ! ((pSrc[0] == SEC_START) && (pSrc[1] == ID_SOI)) ) {
-        return -1;
-    }
-    pos = 2;
-
-    while(pos + 4 <= dwSearchSize) {
-        tSecHead.secStart = pSrc[pos++];
-        tSecHead.secID = pSrc[pos++];
-        tSecHead.secLenH = pSrc[pos++];
-        tSecHead.secLenL = pSrc[pos++];
-
-        if(tSecHead.secStart != SEC_START) {
-            ALOGE("SearchHufTabPos, error format, no SEC_START 0x%x in pos 0x%x", SEC_START, pos - 4);
-            return -1;
-        }
-
-        ALOGI("secID 0x%x at sec pos 0x%x", tSecHead.secID, pos-4);
-
-        if(tSecHead.secID == ID_SOS) {
-            ALOGI("SearchHufTabPos, ID_SOS 0x%x found at sec pos 0x%x, break", ID_SOS, pos-4);
-            break;
-        }
 
-        if(tSecHead.secID == ID_SOF0) {
-            ALOGI("SearchHufTabPos, ID_SOF0 0x%x found at sec pos 0x%x", ID_SOF0, pos-4);
-            bSOF0Found = true;
-
-        }
-
-        if(tSecHead.secID == ID_DHT) {
-            ALOGI("SearchHufTabPos, huf tab found");
-            *pbExist = true;
-            return 0;
-        }
-
-        dwSecSize = (tSecHead.secLenH << 8) | tSecHead.secLenL;
-        ALOGI("secID size 0x%x, h 0x%x, l 0x%x", dwSecSize, tSecHead.secLenH, tSecHead.secLenL);
-
-        if(dwSecSize < 2) {
-            ALOGE("SearchHufTabPos, err sec size %d < 2, at pos 0x%x", dwSecSize, pos-2);
-            return -1;
-        }
-        pos += dwSecSize - 2;
-        ALOGI("pos set to 0x%x", pos);
-
-        if(bSOF0Found)
-            dwExpectedHufTabPos = pos;
-    }
-
-    if(bSOF0Found == false) {
-        ALOGI("SearchHufTabPos, err, no SOF0 found");
-        return -1;
-    }
-
-    *pdwExptDHTPos = dwExpectedHufTabPos;
-    ALOGI("SearchHufTabPos, huf not found, expected pos 0x%x", dwExpectedHufTabPos);
-
-    return 0;
+// frame data is decoded from memory without copy.
+static void mjpgSrc_init(j_decompress_ptr /*cinfo*/)
+{
+}
 
+static boolean mjpgSrc_fill(j_decompress_ptr cinfo)
+{
+    // truncated frame, insert fake EOI marker.
+    static const JOCTET eoi[2] = {0xFF, JPEG_EOI};
+    WARNMS(cinfo, JWRN_JPEG_EOF);
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
 }
 
-static int CheckAndInsertHufTab(u8 *pDst, u8 *pSrc, u32 nDstSize, u32 nSrcSize) {
-    bool bExist = 0;
-    u32 dwExptDHTPos = 0;
-    int ret;
-    ret = SearchHufTabPos(pSrc, nSrcSize, &bExist, &dwExptDHTPos);
-    if(ret) {
-        ALOGE("CheckAndInsertHufTab, SearchHufTabPos failed, ret %d", ret);
-        return ret;
+static void mjpgSrc_skip(j_decompress_ptr cinfo, long num)
+{
+    if (num <= 0) {
+        return;
     }
 
-    u32 nCopySize = (nDstSize < nSrcSize) ? nDstSize : nSrcSize;
-    if(bExist) {
-        memcpy(pDst, pSrc, nCopySize);
-        return 0;
-    }
-
-    //insert huf tab
-    if(dwExptDHTPos + sizeof(g_hufTab) > nCopySize) {
-        ALOGE("%s, dwExptDHTPos (%d) + sizeof(g_hufTab) (%d) > nCopySize (%d)",
-                __FUNCTION__, dwExptDHTPos, sizeof(g_hufTab), nCopySize);
-        return -1;
+    if ((size_t)num > cinfo->src->bytes_in_buffer) {
+        num = (long)cinfo->src->bytes_in_buffer;
     }
+    cinfo->src->next_input_byte += num;
+    cinfo->src->bytes_in_buffer -= num;
+}
 
-    memcpy(pDst, pSrc, dwExptDHTPos);
-    memcpy(pDst + dwExptDHTPos, g_hufTab, sizeof(g_hufTab));
-    u32 dwLeftSize = nCopySize - (dwExptDHTPos + sizeof(g_hufTab));
-    memcpy(pDst + dwExptDHTPos + sizeof(g_hufTab), pSrc + dwExptDHTPos, dwLeftSize);
+static void mjpgSrc_term(j_decompress_ptr /*cinfo*/)
+{
+}
 
-    return 0;
+static void mjpgError_exit(j_common_ptr cinfo)
+{
+    MJPGErrorMgr *error = (MJPGErrorMgr *)cinfo->err;
+    (*error->output_message)(cinfo);
+    longjmp(error->fJmpBuf, -1);
 }
 
-MJPGStream::MJPGStream(Camera* device): DMAStream(device), mStreamSize(0)
+MJPGStream::MJPGStream(Camera* device)
+    : DMAStream(device), mStreamSize(0), mUseVpu(false), mDecoding(false),
+      mReadyHead(0), mReadyCount(0), mDecodeDropped(0),
+      mOutputAllocated(false), mHuffCount(0)
 {
+#ifdef BOARD_HAVE_VPU
     mVPUHandle = 0;
     memset(&mDecMemInfo,0,sizeof(DecMemInfo));
     memset(&mDecContxt, 0, sizeof(mDecContxt));
+#endif
+    memset(mSensorBuffers, 0, sizeof(mSensorBuffers));
+    memset(mOutputBusy, 0, sizeof(mOutputBusy));
+
+    mJpeg.err = jpeg_std_error(&mJpegErr);
+    mJpegErr.error_exit = mjpgError_exit;
+    jpeg_create_decompress(&mJpeg);
+
+    mJpegSrc.init_source = mjpgSrc_init;
+    mJpegSrc.fill_input_buffer = mjpgSrc_fill;
+    mJpegSrc.skip_input_data = mjpgSrc_skip;
+    mJpegSrc.resync_to_restart = jpeg_resync_to_restart;
+    mJpegSrc.term_source = mjpgSrc_term;
+    mJpegSrc.next_input_byte = NULL;
+    mJpegSrc.bytes_in_buffer = 0;
+    mJpeg.src = &mJpegSrc;
+
+    parseHuffTables();
 }
 
 MJPGStream::~MJPGStream()
 {
+    if (mDecodeThread != NULL) {
+        mDecodeThread->requestExitAndWait();
+        mDecodeThread.clear();
+    }
 
+    jpeg_destroy_decompress(&mJpeg);
 }
 
 // configure device.
@@ -256,16 +204,33 @@ int32_t MJPGStream::onDeviceStartLocked()
     }
 
     int32_t ret = allocateSensorBuffersLocked();
+    if (ret != 0) {
+        ALOGE("%s allocateSensorBuffersLocked failed", __func__);
+        return ret;
+    }
+
+    mUseVpu = false;
+#ifdef BOARD_HAVE_VPU
     //-------init vpu----------
     int vpuRet;
     vpuRet = VPUInit();
     if(vpuRet) {
-        ALOGE("VPUInit failed, vpuRet %d", vpuRet);
-        return BAD_VALUE;
+        ALOGW("VPUInit failed, vpuRet %d, use software decode", vpuRet);
+    }
+    else {
+        mUseVpu = true;
+    }
+#endif
+
+    if (!mUseVpu) {
+        ret = allocateOutputBuffersLocked();
+        if (ret != 0) {
+            ALOGE("%s allocateOutputBuffersLocked failed", __func__);
+            return ret;
+        }
     }
 
     //-------register buffers----------
-    struct v4l2_buffer buf;
     struct v4l2_requestbuffers req;
 
     memset(&req, 0, sizeof (req));
@@ -304,7 +269,7 @@ int32_t MJPGStream::onDeviceStartLocked()
         return ret;
     }
 
-    return 0;
+    return startDecodeLocked();
 }
 
 int32_t MJPGStream::onDeviceStopLocked()
@@ -317,6 +282,9 @@ int32_t MJPGStream::onDeviceStopLocked()
         return BAD_VALUE;
     }
 
+    // decode thread must not touch device after stream off.
+    stopDecodeLocked();
+
     enum v4l2_buf_type bufType;
     bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     ret = ioctl(mDev, VIDIOC_STREAMOFF, &bufType);
@@ -331,56 +299,243 @@ int32_t MJPGStream::onDeviceStopLocked()
         return -1;
     }
 
+    freeOutputBuffersLocked();
 
     return 0;
 }
 
-int32_t MJPGStream::onFrameAcquireLocked()
+int32_t MJPGStream::startDecodeLocked()
 {
-    ALOGV("%s", __func__);
-    int32_t ret = 0;
-    int32_t ret2 = 0;
-    struct v4l2_buffer cfilledbuffer;
-    memset(&cfilledbuffer, 0, sizeof (cfilledbuffer));
-    cfilledbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    cfilledbuffer.memory = V4L2_MEMORY_DMABUF;
-    ret = ioctl(mDev, VIDIOC_DQBUF, &cfilledbuffer);
-    if (ret < 0) {
-        ALOGE("%s: VIDIOC_DQBUF Failed: %s", __func__, strerror(errno));
+    {
+        Mutex::Autolock lock(mDecodeLock);
+        mReadyHead = 0;
+        mReadyCount = 0;
+        mDecodeDropped = 0;
+        mDecoding = true;
+    }
+
+    mDecodeThread = new DecodeThread(this);
+    status_t ret = mDecodeThread->run("MJPGDecode", PRIORITY_URGENT_DISPLAY);
+    if (ret != NO_ERROR) {
+        ALOGE("%s run decode thread failed:%d", __func__, ret);
+        mDecodeThread.clear();
+        Mutex::Autolock lock(mDecodeLock);
+        mDecoding = false;
+        return ret;
+    }
+
+    return 0;
+}
+
+void MJPGStream::stopDecodeLocked()
+{
+    if (mDecodeThread != NULL) {
+        mDecodeThread->requestExitAndWait();
+        mDecodeThread.clear();
+    }
+
+    {
+        Mutex::Autolock lock(mDecodeLock);
+        mDecoding = false;
+        mDecodeCond.broadcast();
+    }
+
+    int32_t index;
+    while ((index = popReadyFrame(NULL)) >= 0) {
+        releaseOutput(index);
+    }
+
+    ALOGI("%s %s decode, dropped %d frames", __func__,
+          mUseVpu ? "vpu" : "software", mDecodeDropped);
+}
+
+bool MJPGStream::decodeFrame()
+{
+    struct pollfd pfd;
+    pfd.fd = mDev;
+    pfd.events = POLLIN | POLLPRI;
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, DECODE_POLL_MS);
+    if ((ret < 0) && (errno != EINTR)) {
+        ALOGE("%s poll failed: %s", __func__, strerror(errno));
+        goto fatal;
+    }
+    if (ret <= 0) {
+        return true;
+    }
+    if (pfd.revents & POLLERR) {
+        ALOGE("%s poll error, revents:0x%x", __func__, pfd.revents);
+        goto fatal;
+    }
+
+    {
+        struct v4l2_buffer cfilledbuffer;
+        memset(&cfilledbuffer, 0, sizeof (cfilledbuffer));
+        cfilledbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        cfilledbuffer.memory = V4L2_MEMORY_DMABUF;
+        ret = ioctl(mDev, VIDIOC_DQBUF, &cfilledbuffer);
+        if (ret < 0) {
+            ALOGE("%s: VIDIOC_DQBUF Failed: %s", __func__, strerror(errno));
+            return true;
+        }
+
+        int32_t index = cfilledbuffer.index;
+        ALOGV("decode index:%d", index);
+        uint32_t len = (cfilledbuffer.bytesused > 0) ?
+                        cfilledbuffer.bytesused : cfilledbuffer.length;
+        uint8_t* data = (uint8_t*)mSensorBuffers[index]->mVirtAddr;
+        int32_t out = -1;
+#ifdef BOARD_HAVE_VPU
+        if (mUseVpu) {
+            out = VPUDec(data, len, index);
+        }
+        else
+#endif
+        {
+            out = JPEGDec(data, len);
+        }
+
+        ret = ioctl(mDev, VIDIOC_QBUF, &cfilledbuffer);
+        if (ret < 0) {
+            ALOGE("%s: VIDIOC_QBUF Failed: %s", __func__, strerror(errno));
+        }
+
+        if (out < 0 || out >= (int32_t)mNumBuffers) {
+            Mutex::Autolock lock(mDecodeLock);
+            mDecodeDropped++;
+            return true;
+        }
+
+        pushReadyFrame(out, cfilledbuffer);
+    }
+
+    return true;
+
+fatal:
+    Mutex::Autolock lock(mDecodeLock);
+    mDecoding = false;
+    mDecodeCond.broadcast();
+    return false;
+}
+
+void MJPGStream::pushReadyFrame(int32_t index, const struct v4l2_buffer& info)
+{
+    Mutex::Autolock lock(mDecodeLock);
+    uint32_t pos = (mReadyHead + mReadyCount) % MAX_STREAM_BUFFERS;
+    mReadyIndex[pos] = index;
+    mReadyInfo[pos] = info;
+    mReadyCount++;
+    mDecodeCond.signal();
+}
+
+int32_t MJPGStream::popReadyFrame(struct v4l2_buffer* info)
+{
+    Mutex::Autolock lock(mDecodeLock);
+    if (mReadyCount == 0) {
         return -1;
     }
 
-    int32_t index = cfilledbuffer.index;
-    ALOGV("acquire index:%d", cfilledbuffer.index);
-    int JPGLen;
-    int VPUIndex;
-    JPGLen = cfilledbuffer.length;
-    VPUIndex = VPUDec((u8 *)mSensorBuffers[index]->mVirtAddr, JPGLen, index);
-    ret2 = ioctl(mDev, VIDIOC_QBUF, &cfilledbuffer);
-    if (ret < 0) {
-        ALOGE("%s: VIDIOC_QBUF Failed: %s", __func__, strerror(errno));
-        return BAD_VALUE;
+    int32_t index = mReadyIndex[mReadyHead];
+    if (info != NULL) {
+        *info = mReadyInfo[mReadyHead];
     }
-    return VPUIndex;
+    mReadyHead = (mReadyHead + 1) % MAX_STREAM_BUFFERS;
+    mReadyCount--;
 
+    return index;
 }
 
-int32_t MJPGStream::onFrameReturnLocked(int32_t index, StreamBuffer& buf)
+void MJPGStream::releaseOutput(int32_t index)
 {
-    ALOGV("%s: index:%d", __func__, index);
-    int32_t ret = 0;
+#ifdef BOARD_HAVE_VPU
+    if (mUseVpu) {
+        Mutex::Autolock lock(mVPULock);
+        StreamBuffer* buf = mBuffers[index];
+        if ((buf != NULL) && (buf->mpFrameBuf != NULL)) {
+            VpuDecRetCode retCode;
+            retCode = VPU_DecOutFrameDisplayed(mVPUHandle, (VpuFrameBuffer *)buf->mpFrameBuf);
+            if(VPU_DEC_RET_SUCCESS != retCode) {
+                ALOGI("%s: vpu clear frame display failure: ret=%d \r\n",__FUNCTION__,retCode);
+            }
+        }
+        return;
+    }
+#endif
+
+    Mutex::Autolock lock(mDecodeLock);
+    mOutputBusy[index] = false;
+}
+
+bool MJPGStream::recycleReadyFrame()
+{
+    int32_t index = popReadyFrame(NULL);
+    if (index < 0) {
+        return false;
+    }
+
+    {
+        Mutex::Autolock lock(mDecodeLock);
+        mDecodeDropped++;
+    }
+    releaseOutput(index);
+    return true;
+}
+
+// mLock is released when wait, decode thread signals decoded frame.
+int32_t MJPGStream::waitFrame()
+{
+    int32_t timeout = 0;
+    {
+        Mutex::Autolock lock(mLock);
+        timeout = getFrameTimeoutLocked();
+    }
+
+    {
+        Mutex::Autolock lock(mDecodeLock);
+        nsecs_t deadline = systemTime() + ms2ns(timeout);
+        while (mDecoding && (mReadyCount == 0)) {
+            nsecs_t rel = deadline - systemTime();
+            if (rel <= 0) {
+                break;
+            }
+            mDecodeCond.waitRelative(mDecodeLock, rel);
+        }
 
-    Mutex::Autolock lock(mVPULock);
+        if (mReadyCount > 0) {
+            return 0;
+        }
 
-    if(buf.mpFrameBuf) {
-        VpuDecRetCode retCode;
-        retCode = VPU_DecOutFrameDisplayed(mVPUHandle, (VpuFrameBuffer *)buf.mpFrameBuf);
-        if(VPU_DEC_RET_SUCCESS != retCode) {
-            ALOGI("%s: vpu clear frame display failure: ret=%d \r\n",__FUNCTION__,ret);
-            ret = BAD_VALUE;
+        if (!mDecoding) {
+            ALOGE("%s decoder is stopped", __func__);
+            return BAD_VALUE;
         }
     }
 
+    Mutex::Autolock lock(mLock);
+    mTimeoutFrames++;
+    ALOGW("%s no frame in %d ms", __func__, timeout);
+    return TIMED_OUT;
+}
+
+int32_t MJPGStream::onFrameAcquireLocked()
+{
+    ALOGV("%s", __func__);
+    struct v4l2_buffer info;
+    int32_t index = popReadyFrame(&info);
+    if (index < 0) {
+        ALOGE("%s: no decoded frame", __func__);
+        return -1;
+    }
+
+    accountFrameLocked(info);
+    ALOGV("acquire index:%d", index);
+    return index;
+}
+
+int32_t MJPGStream::onFrameReturnLocked(int32_t index, StreamBuffer& /*buf*/)
+{
+    ALOGV("%s: index:%d", __func__, index);
+    releaseOutput(index);
 
     return 0;
 }
@@ -390,6 +545,67 @@ int32_t MJPGStream::getDeviceBufferSize()
     return getFormatSize();
 }
 
+StreamBuffer* MJPGStream::allocIonBufferLocked(int32_t ionSize)
+{
+    unsigned char *ptr = NULL;
+    int32_t sharedFd = -1;
+    int32_t phyAddr;
+    ion_user_handle_t ionHandle = -1;
+
+    int32_t err = ion_alloc(mIonFd, ionSize, 8, 1, 0, &ionHandle);
+    if (err) {
+        ALOGE("ion_alloc failed.");
+        return NULL;
+    }
+
+    err = ion_map(mIonFd,
+            ionHandle,
+            ionSize,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            0,
+            &ptr,
+            &sharedFd);
+    if (err) {
+        ALOGE("ion_map failed.");
+        ion_free(mIonFd, ionHandle);
+        if (sharedFd > 0) {
+            close(sharedFd);
+        }
+        return NULL;
+    }
+
+    phyAddr = ion_phys(mIonFd, ionSize, sharedFd);
+    if (phyAddr == 0) {
+        ALOGE("ion_phys failed.");
+        munmap(ptr, ionSize);
+        close(sharedFd);
+        ion_free(mIonFd, ionHandle);
+        return NULL;
+    }
+
+    StreamBuffer* buf = new StreamBuffer();
+    buf->mVirtAddr  = ptr;
+    buf->mPhyAddr   = phyAddr;
+    buf->mSize      = ionSize;
+    buf->mBufHandle = (buffer_handle_t*)(uintptr_t)ionHandle;
+    buf->mFd = sharedFd;
+    buf->mStream = this;
+    buf->mpFrameBuf  = NULL;
+
+    return buf;
+}
+
+void MJPGStream::freeIonBufferLocked(StreamBuffer* buf)
+{
+    ion_user_handle_t ionHandle =
+        (ion_user_handle_t)(uintptr_t)buf->mBufHandle;
+    munmap(buf->mVirtAddr, buf->mSize);
+    close(buf->mFd);
+    ion_free(mIonFd, ionHandle);
+    delete buf;
+}
+
 int32_t MJPGStream::allocateSensorBuffersLocked()
 {
     ALOGV("%s", __func__);
@@ -409,59 +625,12 @@ int32_t MJPGStream::allocateSensorBuffersLocked()
         return BAD_VALUE;
     }
 
-
     mStreamSize = getDeviceBufferSize();
-    unsigned char *Sensorptr = NULL;
-    int32_t sharedFd;
-    int32_t phyAddr;
-    ion_user_handle_t ionHandle;
-    int32_t ionSize = mStreamSize;
     for (uint32_t i = 0; i < mNumBuffers; i++) {
-        ionHandle = -1;
-        int32_t err = ion_alloc(mIonFd, ionSize, 8, 1, 0, &ionHandle);
-        if (err) {
-            ALOGE("ion_alloc failed.");
-            return BAD_VALUE;
-        }
-
-        err = ion_map(mIonFd,
-                ionHandle,
-                ionSize,
-                PROT_READ | PROT_WRITE,
-                MAP_SHARED,
-                0,
-                &Sensorptr,
-                &sharedFd);
-
-        if (err) {
-            ALOGE("ion_map failed.");
-            ion_free(mIonFd, ionHandle);
-            if (VPUptr != MAP_FAILED) {
-                munmap(Sensorptr, ionSize);
-            }
-            if (sharedFd > 0) {
-                close(sharedFd);
-            }
-            goto err;
-        }
-        phyAddr = ion_phys(mIonFd, ionSize, sharedFd);
-        if (phyAddr == 0) {
-            ALOGE("ion_phys failed.");
-            ion_free(mIonFd, ionHandle);
-            if (VPUptr != MAP_FAILED) {
-                munmap(Sensorptr, ionSize);
-            }
-            close(sharedFd);
+        mSensorBuffers[i] = allocIonBufferLocked(mStreamSize);
+        if (mSensorBuffers[i] == NULL) {
             goto err;
         }
-        mSensorBuffers[i] = new StreamBuffer();
-        mSensorBuffers[i]->mVirtAddr  = Sensorptr;
-        mSensorBuffers[i]->mPhyAddr   = phyAddr;
-        mSensorBuffers[i]->mSize      = ionSize;
-        mSensorBuffers[i]->mBufHandle = (buffer_handle_t*)(uintptr_t)ionHandle;
-        mSensorBuffers[i]->mFd = sharedFd;
-        mSensorBuffers[i]->mStream = this;
-        mSensorBuffers[i]->mpFrameBuf  = NULL;
     }
 
     mRegistered = true;
@@ -475,12 +644,7 @@ err:
             continue;
         }
 
-        ion_user_handle_t ionHandle =
-            (ion_user_handle_t)(uintptr_t)mSensorBuffers[i]->mBufHandle;
-        munmap(mSensorBuffers[i]->mVirtAddr, mSensorBuffers[i]->mSize);
-        close(mSensorBuffers[i]->mFd);
-        ion_free(mIonFd, ionHandle);
-        delete mSensorBuffers[i];
+        freeIonBufferLocked(mSensorBuffers[i]);
         mSensorBuffers[i] = NULL;
     }
 
@@ -502,12 +666,7 @@ int32_t MJPGStream::freeSensorBuffersLocked()
 
     ALOGI("freeSensorBufferToIon buffer num:%d", mAllocatedBuffers);
     for (uint32_t i = 0; i < mNumBuffers; i++) {
-        ion_user_handle_t ionHandle =
-            (ion_user_handle_t)(uintptr_t)mSensorBuffers[i]->mBufHandle;
-        munmap(mSensorBuffers[i]->mVirtAddr, mSensorBuffers[i]->mSize);
-        close(mSensorBuffers[i]->mFd);
-        ion_free(mIonFd, ionHandle);
-        delete mSensorBuffers[i];
+        freeIonBufferLocked(mSensorBuffers[i]);
         mSensorBuffers[i] = NULL;
     }
 
@@ -517,7 +676,229 @@ int32_t MJPGStream::freeSensorBuffersLocked()
     return 0;
 }
 
+// software decoder outputs NV16 as VPU does.
+int32_t MJPGStream::allocateOutputBuffersLocked()
+{
+    if (mOutputAllocated) {
+        return 0;
+    }
+
+    int32_t size = mWidth * mHeight * 2;
+    for (uint32_t i = 0; i < mNumBuffers; i++) {
+        mBuffers[i] = allocIonBufferLocked(size);
+        mOutputBusy[i] = false;
+        if (mBuffers[i] == NULL) {
+            for (uint32_t j = 0; j < i; j++) {
+                freeIonBufferLocked(mBuffers[j]);
+                mBuffers[j] = NULL;
+            }
+            return BAD_VALUE;
+        }
+    }
+
+    mOutputAllocated = true;
+    return 0;
+}
+
+int32_t MJPGStream::freeOutputBuffersLocked()
+{
+    if (!mOutputAllocated) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < mNumBuffers; i++) {
+        freeIonBufferLocked(mBuffers[i]);
+        mBuffers[i] = NULL;
+    }
+
+    mOutputAllocated = false;
+    return 0;
+}
+
+int32_t MJPGStream::acquireOutput()
+{
+    for (int32_t retry = 0; retry < DECODE_RETRY; retry++) {
+        {
+            Mutex::Autolock lock(mDecodeLock);
+            for (uint32_t i = 0; i < mNumBuffers; i++) {
+                if (!mOutputBusy[i]) {
+                    mOutputBusy[i] = true;
+                    return i;
+                }
+            }
+        }
+
+        // newer frame is preferred to the undelivered one.
+        if (!recycleReadyFrame()) {
+            usleep(DECODE_RETRY_US);
+        }
+    }
+
+    return -1;
+}
+
+// MJPEG frames usually omit DHT segment, parse the default one once
+// and install it to decoder instead of inserting it into each frame.
+void MJPGStream::parseHuffTables()
+{
+    uint32_t pos = 0;
+    mHuffCount = 0;
+    while ((pos + 4 <= sizeof(g_hufTab)) && (mHuffCount < ARRAY_SIZE(mHuffTables))) {
+        if ((g_hufTab[pos] != SEC_START) || (g_hufTab[pos + 1] != ID_DHT)) {
+            break;
+        }
+
+        uint32_t end = pos + 2 + ((g_hufTab[pos + 2] << 8) | g_hufTab[pos + 3]);
+        if (end > sizeof(g_hufTab)) {
+            break;
+        }
+
+        pos += 4;
+        while ((pos + 17 <= end) && (mHuffCount < ARRAY_SIZE(mHuffTables))) {
+            MJPGHuffTable& table = mHuffTables[mHuffCount];
+            table.cls = g_hufTab[pos] >> 4;
+            table.id = g_hufTab[pos] & 0x0f;
+            pos++;
+
+            uint32_t count = 0;
+            table.bits[0] = 0;
+            for (uint32_t i = 1; i <= 16; i++) {
+                table.bits[i] = g_hufTab[pos++];
+                count += table.bits[i];
+            }
+
+            if ((count > sizeof(table.huffval)) || (pos + count > end)) {
+                ALOGE("%s invalid huffman table", __func__);
+                return;
+            }
+
+            memset(table.huffval, 0, sizeof(table.huffval));
+            memcpy(table.huffval, &g_hufTab[pos], count);
+            pos += count;
+            mHuffCount++;
+        }
+
+        pos = end;
+    }
+}
+
+// done before each header read: a frame with its own DHT overwrites
+// the slots, so a later frame without DHT must get the default back.
+void MJPGStream::installHuffTables()
+{
+    for (uint32_t i = 0; i < mHuffCount; i++) {
+        MJPGHuffTable& table = mHuffTables[i];
+        if (table.id >= NUM_HUFF_TBLS) {
+            continue;
+        }
+
+        JHUFF_TBL** slot = table.cls ? &mJpeg.ac_huff_tbl_ptrs[table.id] :
+                                       &mJpeg.dc_huff_tbl_ptrs[table.id];
+        if (*slot == NULL) {
+            *slot = jpeg_alloc_huff_table((j_common_ptr)&mJpeg);
+        }
+        memcpy((*slot)->bits, table.bits, sizeof((*slot)->bits));
+        memcpy((*slot)->huffval, table.huffval, sizeof((*slot)->huffval));
+    }
+}
+
+// decode YCbCr 4:2:2 or 4:2:0 frame as raw data, then pack it to NV16.
+int32_t MJPGStream::JPEGDec(uint8_t* InVirAddr, uint32_t inLen)
+{
+    int32_t out = acquireOutput();
+    if (out < 0) {
+        ALOGW("%s no output buffer", __func__);
+        return -1;
+    }
+
+    StreamBuffer* dst = mBuffers[out];
+    uint8_t* dstY = (uint8_t*)dst->mVirtAddr;
+    uint8_t* dstUV = dstY + mWidth * mHeight;
+
+    if (setjmp(mJpegErr.fJmpBuf)) {
+        jpeg_abort_decompress(&mJpeg);
+        releaseOutput(out);
+        return -1;
+    }
+
+    mJpegSrc.next_input_byte = InVirAddr;
+    mJpegSrc.bytes_in_buffer = inLen;
+    installHuffTables();
+    jpeg_read_header(&mJpeg, TRUE);
+
+    if ((mJpeg.num_components != 3) ||
+        ((int32_t)mJpeg.image_width != mWidth) ||
+        ((int32_t)mJpeg.image_height != mHeight) ||
+        (mJpeg.comp_info[0].h_samp_factor != 2) ||
+        (mJpeg.comp_info[0].v_samp_factor > 2) ||
+        (mJpeg.comp_info[1].h_samp_factor != 1) ||
+        (mJpeg.comp_info[1].v_samp_factor != 1) ||
+        (mJpeg.comp_info[2].h_samp_factor != 1) ||
+        (mJpeg.comp_info[2].v_samp_factor != 1)) {
+        ALOGE("%s unsupported frame %dx%d, components %d", __func__,
+              mJpeg.image_width, mJpeg.image_height, mJpeg.num_components);
+        jpeg_abort_decompress(&mJpeg);
+        releaseOutput(out);
+        return -1;
+    }
 
+    mJpeg.raw_data_out = TRUE;
+    mJpeg.do_fancy_upsampling = FALSE;
+    mJpeg.dct_method = JDCT_IFAST;
+    jpeg_start_decompress(&mJpeg);
+
+    // one iMCU row is decoded each time into band buffer.
+    int32_t vSamp = mJpeg.comp_info[0].v_samp_factor;
+    int32_t lines = vSamp * DCTSIZE;
+    int32_t yStride = mJpeg.comp_info[0].width_in_blocks * DCTSIZE;
+    int32_t cStride = mJpeg.comp_info[1].width_in_blocks * DCTSIZE;
+    uint8_t* band = mBand.reserve(lines * yStride + 2 * DCTSIZE * cStride);
+    if (band == NULL) {
+        ALOGE("%s alloc band buffer failed", __func__);
+        jpeg_abort_decompress(&mJpeg);
+        releaseOutput(out);
+        return -1;
+    }
+
+    JSAMPROW yRows[2 * DCTSIZE];
+    JSAMPROW cbRows[DCTSIZE];
+    JSAMPROW crRows[DCTSIZE];
+    JSAMPARRAY planes[3] = {yRows, cbRows, crRows};
+    for (int32_t i = 0; i < lines; i++) {
+        yRows[i] = band + i * yStride;
+    }
+    for (int32_t i = 0; i < DCTSIZE; i++) {
+        cbRows[i] = band + lines * yStride + i * cStride;
+        crRows[i] = cbRows[i] + DCTSIZE * cStride;
+    }
+
+    while (mJpeg.output_scanline < mJpeg.output_height) {
+        int32_t top = mJpeg.output_scanline;
+        jpeg_read_raw_data(&mJpeg, planes, lines);
+        int32_t rows = mHeight - top;
+        if (rows > lines) {
+            rows = lines;
+        }
+
+        for (int32_t i = 0; i < rows; i++) {
+            memcpy(dstY + (top + i) * mWidth, yRows[i], mWidth);
+
+            // 4:2:0 chroma row is shared by two luma rows.
+            uint8_t* cb = cbRows[i / vSamp];
+            uint8_t* cr = crRows[i / vSamp];
+            uint8_t* uv = dstUV + (top + i) * mWidth;
+            for (int32_t x = 0; x < mWidth / 2; x++) {
+                uv[2 * x] = cb[x];
+                uv[2 * x + 1] = cr[x];
+            }
+        }
+    }
+
+    jpeg_finish_decompress(&mJpeg);
+    return out;
+}
+
+#ifdef BOARD_HAVE_VPU
 int MJPGStream::VPUInit()
 {
     VpuVersionInfo ver;
@@ -659,79 +1040,85 @@ int MJPGStream::VPUExit()
     return 0;
 }
 
-int MJPGStream::VPUDec(u8 *InVirAddr, u32 inLen, unsigned int nUVCBufIdx)
+int MJPGStream::VPUDec(u8 *InVirAddr, u32 inLen, unsigned int /*nUVCBufIdx*/)
 {
-DecLogic:
     VpuDecRetCode ret;
     int bufRetCode = 0;
-    int err = 0;
-
-    //DecContxt * decContxt;
     DecMemInfo pDecMemInfo;
-
     VpuBufferNode InData;
+    int retry = 0;
 
-    unsigned int outIdx = 0;
-    unsigned int VPUIndex = 0;
-
-    Mutex::Autolock lock(mVPULock);
-
-    memset(&InData, 0, sizeof(InData));
-    InData.nSize = inLen;
-    InData.pPhyAddr = NULL;
-    InData.pVirAddr = InVirAddr;
-    InData.sCodecData.pData = NULL;
-    InData.sCodecData.nSize = 0;
-
-    ret = VPU_DecDecodeBuf(mVPUHandle, &InData, &bufRetCode);
+    while (true) {
+        {
+            Mutex::Autolock lock(mVPULock);
+
+            memset(&InData, 0, sizeof(InData));
+            InData.nSize = inLen;
+            InData.pPhyAddr = NULL;
+            InData.pVirAddr = InVirAddr;
+            InData.sCodecData.pData = NULL;
+            InData.sCodecData.nSize = 0;
+
+            ret = VPU_DecDecodeBuf(mVPUHandle, &InData, &bufRetCode);
+            if (ret != VPU_DEC_RET_SUCCESS) {
+                ALOGE("%s: vpu decode failure: ret=%d \r\n", __FUNCTION__, ret);
+                return -1;
+            }
 
-    // check init info
-    if(bufRetCode & VPU_DEC_INIT_OK) {
-        ALOGI("%s: vpu & VPU_DEC_INIT_OK \r\n", __FUNCTION__);
-        int nFrmNum;
-        VpuDecInitInfo InitInfo;
+            // check init info
+            if(bufRetCode & VPU_DEC_INIT_OK) {
+                ALOGI("%s: vpu & VPU_DEC_INIT_OK \r\n", __FUNCTION__);
+                int nFrmNum;
+                VpuDecInitInfo InitInfo;
 
-        //process init info
-        if(ProcessInitInfo(&InitInfo, &pDecMemInfo, &nFrmNum, &VPUptr, &mVPUBuffersIndex) == 0)
-        {
-        ALOGI("%s: vpu process init info failure: \r\n", __FUNCTION__);
-            return 0;
-        }
+                //process init info
+                if(ProcessInitInfo(&InitInfo, &pDecMemInfo, &nFrmNum, &VPUptr, &mVPUBuffersIndex) == 0)
+                {
+                    ALOGI("%s: vpu process init info failure: \r\n", __FUNCTION__);
+                    return -1;
+                }
 
-        goto DecLogic;
-    }
+                continue;
+            }
 
-    //check output buff
-    if((bufRetCode & VPU_DEC_OUTPUT_DIS) ||(bufRetCode & VPU_DEC_OUTPUT_MOSAIC_DIS))
-    {
-        VpuDecOutFrameInfo frameInfo;
+            //check output buff
+            if((bufRetCode & VPU_DEC_OUTPUT_DIS) ||(bufRetCode & VPU_DEC_OUTPUT_MOSAIC_DIS))
+            {
+                VpuDecOutFrameInfo frameInfo;
+
+                // get output frame
+                ret = VPU_DecGetOutputFrame(mVPUHandle, &frameInfo);
+                if(ret != VPU_DEC_RET_SUCCESS)
+                {
+                    ALOGE("%s: vpu get output frame failure: ret=%d \r\n",__FUNCTION__,ret);
+                    return -1;
+                }
+
+                for(uint32_t i = 0; i < mNumBuffers; i++) {
+                    if(frameInfo.pDisplayFrameBuf->pbufY == (unsigned char* )(uintptr_t)mBuffers[i]->mPhyAddr) {
+                        mBuffers[i]->mpFrameBuf = (void *)frameInfo.pDisplayFrameBuf;
+                        return i;
+                    }
+                }
+
+                ALOGE("%s: unknown output frame", __FUNCTION__);
+                return -1;
+            }
 
-        // get output frame
-        ret = VPU_DecGetOutputFrame(mVPUHandle, &frameInfo);
-        if(ret != VPU_DEC_RET_SUCCESS)
-        {
-            ALOGE("%s: vpu get output frame failure: ret=%d \r\n",__FUNCTION__,ret);
-            return 0;
+            if (!(bufRetCode & VPU_DEC_NO_ENOUGH_BUF)) {
+                return -1;
+            }
         }
 
-        unsigned int i;
-        for(i = 0; i < mNumBuffers; i++) {
-            if(frameInfo.pDisplayFrameBuf->pbufY == (unsigned char* )(uintptr_t)mBuffers[i]->mPhyAddr) {
-                VPUIndex = i;
-                break;
+        // all frames are held, take back the oldest undelivered one.
+        if (!recycleReadyFrame()) {
+            if (++retry > DECODE_RETRY) {
+                ALOGW("VPU_DEC_NO_ENOUGH_BUF, drop frame");
+                return -1;
             }
+            usleep(DECODE_RETRY_US);
         }
-
-            mBuffers[VPUIndex]->mpFrameBuf = (void *)frameInfo.pDisplayFrameBuf;
-
-    } else if(bufRetCode & VPU_DEC_NO_ENOUGH_BUF) {
-        mVPULock.unlock();
-        usleep(10000);
-        ALOGI("VPU_DEC_NO_ENOUGH_BUF, wait 10ms, goto DecLogic");
-        goto DecLogic;
     }
-
-      return VPUIndex;
 }
 
 int  MJPGStream::ProcessInitInfo(VpuDecInitInfo* pInitInfo, DecMemInfo* /*pDecMemInfo*/, int*pOutFrmNum, unsigned char** rptr, int32_t* vpuindex)
@@ -1125,4 +1512,4 @@ int MJPGStream::ConvertCodecFormat(int codec, VpuCodStd* pCodec)
     }
     return 1;
 }
-
+#endif
@@ -16,10 +16,19 @@
 #ifndef _UVCMJPEG_H
 #define _UVCMJPEG_H
 
+#include <stdio.h>
+#include <setjmp.h>
 #include "USPStream.h"
+#ifdef BOARD_HAVE_VPU
 #include "vpu_wrapper.h"
+#endif
 #include "DMAStream.h"
 
+extern "C" {
+    #include "jpeglib.h"
+    #include "jerror.h"
+}
+
 #define UVC_USE_MJPG "uvc_mjpg"
 
 #define VPU_DEC_MAX_NUM_MEM_NUM 20
@@ -31,6 +40,7 @@
 #define FRAME_SURPLUS                (0)
 #define FRAME_ALIGN          (16)
 
+#ifdef BOARD_HAVE_VPU
 typedef struct
 {
     //virtual mem info
@@ -70,9 +80,24 @@ typedef struct
     int nMapType;
     int nTile2LinearEnable;
 }DecContxt;
+#endif
+
+struct MJPGErrorMgr : jpeg_error_mgr {
+    jmp_buf fJmpBuf;
+};
+
+// default huffman table which is omitted by MJPEG frames.
+struct MJPGHuffTable {
+    uint8_t cls;
+    uint8_t id;
+    UINT8 bits[17];
+    UINT8 huffval[256];
+};
 
 // stream uses DMABUF buffers which allcated in user space.
 // that exports DMABUF handle.
+// compressed frames are decoded in decode thread by VPU, or by libjpeg
+// if VPU is not available, message thread only gets decoded frames.
 class MJPGStream : public DMAStream
 {
 public:
@@ -87,11 +112,16 @@ public:
     // stop device.
     virtual int32_t onDeviceStopLocked();
 
-    // get buffer from V4L2.
+    // wait decoded frame without lock.
+    virtual int32_t waitFrame();
+    // get decoded buffer.
     virtual int32_t onFrameAcquireLocked();
-    // put buffer back to V4L2.
+    // put decoded buffer back to decoder.
     virtual int32_t onFrameReturnLocked(int32_t index, StreamBuffer& buf);
 
+    // compressed frames can't be passed to framework.
+    virtual bool isZeroCopySupported() {return false;}
+
     // allocate buffers.
     virtual int32_t allocateBuffersLocked(){return 0;}
     int32_t allocateSensorBuffersLocked();
@@ -102,30 +132,100 @@ public:
     // get device buffer required size.
     virtual int32_t getDeviceBufferSize();
 
+    // decode one frame from V4L2 in decode thread.
+    bool decodeFrame();
 
+#ifdef BOARD_HAVE_VPU
     int VPUDec( unsigned char *InVirAddr, unsigned int inLen, unsigned int nUVCBufIdx);
     int ProcessInitInfo(VpuDecInitInfo* pInitInfo, DecMemInfo* pDecMemInfo, int*pOutFrmNum, unsigned char**, int32_t*);
     int FreeMemBlock(DecMemInfo* pDecMem);
 
     int MallocMemBlock(VpuMemInfo* pMemBlock,DecMemInfo* pDecMem);
     int ConvertCodecFormat(int codec, VpuCodStd* pCodec);
+#endif
 
-
+    // software decode to NV16.
+    int32_t JPEGDec(uint8_t* InVirAddr, uint32_t inLen);
 
     unsigned char *mVPUPhyAddr[MAX_PREVIEW_BUFFER];
     unsigned char *mVPUVirtAddr[MAX_PREVIEW_BUFFER];
 
 private:
+    class DecodeThread : public Thread
+    {
+    public:
+        DecodeThread(MJPGStream* stream)
+            : Thread(false), mStream(stream)
+            {}
+
+        virtual bool threadLoop() {
+            return mStream->decodeFrame();
+        }
+
+    private:
+        MJPGStream* mStream;
+    };
+
+    // decode thread polls device up to this time to check exit.
+    static const int32_t DECODE_POLL_MS = 100;
+    // decoder waits output buffer returned by message thread.
+    static const int32_t DECODE_RETRY = 10;
+    static const int32_t DECODE_RETRY_US = 5000;
+
+#ifdef BOARD_HAVE_VPU
     int VPUInit();
     int VPUExit();
+#endif
+
+    int32_t startDecodeLocked();
+    void stopDecodeLocked();
+    // decoded frame queue between decode thread and message thread.
+    void pushReadyFrame(int32_t index, const struct v4l2_buffer& info);
+    int32_t popReadyFrame(struct v4l2_buffer* info);
+    // give decoded buffer back to decoder.
+    void releaseOutput(int32_t index);
+    // drop the oldest undelivered frame to get an output buffer.
+    bool recycleReadyFrame();
+
+    // software decoder output buffers.
+    StreamBuffer* allocIonBufferLocked(int32_t size);
+    void freeIonBufferLocked(StreamBuffer* buf);
+    int32_t allocateOutputBuffersLocked();
+    int32_t freeOutputBuffersLocked();
+    int32_t acquireOutput();
+    void parseHuffTables();
+    void installHuffTables();
 
 private:
     int32_t mStreamSize;
+#ifdef BOARD_HAVE_VPU
     VpuDecHandle mVPUHandle;
     DecMemInfo mDecMemInfo;
     DecContxt mDecContxt;
-    mutable Mutex mVPULock;
     DecOutColorFmt meOutColorFmt;
+#endif
+    mutable Mutex mVPULock;
+    bool mUseVpu;
+
+    sp<DecodeThread> mDecodeThread;
+    Mutex mDecodeLock;
+    Condition mDecodeCond;
+    bool mDecoding;
+    int32_t mReadyIndex[MAX_STREAM_BUFFERS];
+    struct v4l2_buffer mReadyInfo[MAX_STREAM_BUFFERS];
+    uint32_t mReadyHead;
+    uint32_t mReadyCount;
+    uint32_t mDecodeDropped;
+
+    // software decoder state.
+    bool mOutputAllocated;
+    bool mOutputBusy[MAX_STREAM_BUFFERS];
+    struct jpeg_decompress_struct mJpeg;
+    MJPGErrorMgr mJpegErr;
+    struct jpeg_source_mgr mJpegSrc;
+    MJPGHuffTable mHuffTables[4];
+    uint32_t mHuffCount;
+    ScratchBuffer mBand;
 };
 
 #endif
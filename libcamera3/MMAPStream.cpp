@@ -301,6 +301,7 @@ int32_t MMAPStream::onFrameAcquireLocked()
         ALOGE("%s: VIDIOC_DQBUF Failed", __func__);
         return -1;
     }
+    accountFrameLocked(cfilledbuffer);
 
     return cfilledbuffer.index;
 }
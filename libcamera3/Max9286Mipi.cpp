@@ -14,11 +14,16 @@
  * limitations under the License.
  */
 
+#include <poll.h>
 #include "Max9286Mipi.h"
 
+// channel drops up to this number of frames to align with others.
+#define SURROUND_RESYNC 2
+
 Max9286Mipi::Max9286Mipi(int32_t id, int32_t facing, int32_t orientation, char *path)
-    : Camera(id, facing, orientation, path)
+    : Camera(id, facing, orientation, path), mChannelCount(1)
 {
+    parseChannels();
     mVideoStream = new Max9286Stream(this);
 }
 
@@ -26,6 +31,42 @@ Max9286Mipi::~Max9286Mipi()
 {
 }
 
+void Max9286Mipi::parseChannels()
+{
+    char value[PROPERTY_VALUE_MAX];
+    memset(mChannelPaths, 0, sizeof(mChannelPaths));
+    strncpy(mChannelPaths[0], mDevPath, CAMAERA_FILENAME_LENGTH - 1);
+    mChannelCount = 1;
+
+    property_get(MAX9286_SURROUND, value, "");
+    char* name = value;
+    while ((name != NULL) && (*name != '\0') &&
+           (mChannelCount < MAX9286_CHANNELS)) {
+        char* next = strchr(name, ',');
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+
+        if ((strlen(name) > 0) && strcmp(name, mDevPath)) {
+            strncpy(mChannelPaths[mChannelCount++], name,
+                    CAMAERA_FILENAME_LENGTH - 1);
+        }
+        name = next;
+    }
+
+    // stitched frame is 2x2 grid of all channels.
+    if (mChannelCount > 1 && mChannelCount != MAX9286_CHANNELS) {
+        ALOGW("%s surround needs %d channels, got %d", __func__,
+              MAX9286_CHANNELS, mChannelCount);
+        mChannelCount = 1;
+    }
+
+    if (mChannelCount > 1) {
+        ALOGI("%s surround mode: %s %s %s %s", __func__, mChannelPaths[0],
+              mChannelPaths[1], mChannelPaths[2], mChannelPaths[3]);
+    }
+}
+
 status_t Max9286Mipi::initSensorStaticData()
 {
     int32_t fd = open(mDevPath, O_RDWR);
@@ -56,6 +97,8 @@ status_t Max9286Mipi::initSensorStaticData()
     mAvailableFormatCount =
         changeSensorFormats(availFormats, mAvailableFormats, index);
 
+    // stitched frame is twice of channel size in surround mode.
+    int32_t scale = (mChannelCount > 1) ? 2 : 1;
     index = 0;
     char TmpStr[20];
     int previewCnt = 0, pictureCnt = 0;
@@ -92,13 +135,13 @@ status_t Max9286Mipi::initSensorStaticData()
         // 1920x1080 1280x720 is required by CTS.
         if (!(vid_frmsize.discrete.width == 176 &&
               vid_frmsize.discrete.height == 144)) {
-            mPictureResolutions[pictureCnt++] = vid_frmsize.discrete.width;
-            mPictureResolutions[pictureCnt++] = vid_frmsize.discrete.height;
+            mPictureResolutions[pictureCnt++] = vid_frmsize.discrete.width * scale;
+            mPictureResolutions[pictureCnt++] = vid_frmsize.discrete.height * scale;
         }
 
         if (vid_frmval.discrete.denominator / vid_frmval.discrete.numerator > 15) {
-            mPreviewResolutions[previewCnt++] = vid_frmsize.discrete.width;
-            mPreviewResolutions[previewCnt++] = vid_frmsize.discrete.height;
+            mPreviewResolutions[previewCnt++] = vid_frmsize.discrete.width * scale;
+            mPreviewResolutions[previewCnt++] = vid_frmsize.discrete.height * scale;
         }
     }  // end while
 
@@ -130,10 +173,10 @@ status_t Max9286Mipi::initSensorStaticData()
     mFocalLength = 3.37f;
     mPhysicalWidth = 3.6288f;   // 2592 x 1.4u
     mPhysicalHeight = 2.7216f;  // 1944 x 1.4u
-    mActiveArrayWidth = 1280;
-    mActiveArrayHeight = 800;
-    mPixelArrayWidth = 1280;
-    mPixelArrayHeight = 800;
+    mActiveArrayWidth = 1280 * scale;
+    mActiveArrayHeight = 800 * scale;
+    mPixelArrayWidth = 1280 * scale;
+    mPixelArrayHeight = 800 * scale;
 
     ALOGI("ImxdpuCsi, mFocalLength:%f, mPhysicalWidth:%f, mPhysicalHeight %f",
           mFocalLength,
@@ -150,36 +193,100 @@ PixelFormat Max9286Mipi::getPreviewPixelFormat()
     return HAL_PIXEL_FORMAT_YCbCr_422_I;
 }
 
+Max9286Mipi::Max9286Stream::Max9286Stream(Camera *device)
+    : MMAPStream(device, true), mIonFd(-1), mResyncFrames(0)
+{
+    mMax9286 = (Max9286Mipi*)device;
+    for (int32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+        mChannelFd[ch] = -1;
+    }
+    memset(mChannelBuffers, 0, sizeof(mChannelBuffers));
+    memset(mStitchBusy, 0, sizeof(mStitchBusy));
+    memset(mHeld, 0, sizeof(mHeld));
+
+    if (isSurround()) {
+        mIonFd = ion_open();
+    }
+}
+
+Max9286Mipi::Max9286Stream::~Max9286Stream()
+{
+    // channel 0 is mDev, which is closed by VideoStream.
+    for (int32_t ch = 1; ch < MAX9286_CHANNELS; ch++) {
+        if (mChannelFd[ch] > 0) {
+            close(mChannelFd[ch]);
+            mChannelFd[ch] = -1;
+        }
+    }
+
+    if (mIonFd > 0) {
+        close(mIonFd);
+        mIonFd = -1;
+    }
+}
+
+bool Max9286Mipi::Max9286Stream::isSurround()
+{
+    return mMax9286->getChannelCount() > 1;
+}
+
 // configure device.
 int32_t Max9286Mipi::Max9286Stream::onDeviceConfigureLocked()
 {
     ALOGI("%s", __func__);
-    int32_t ret = 0;
     if (mDev <= 0) {
         ALOGE("%s invalid fd handle", __func__);
         return BAD_VALUE;
     }
 
+    if (!isSurround()) {
+        return configureChannelLocked(mDev, mWidth, mHeight);
+    }
+
+    // each channel outputs one quadrant of stitched frame.
+    mChannelFd[0] = mDev;
+    for (int32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+        if (mChannelFd[ch] <= 0) {
+            mChannelFd[ch] = open(mMax9286->getChannelPath(ch), O_RDWR);
+            if (mChannelFd[ch] <= 0) {
+                ALOGE("%s open %s failed", __func__, mMax9286->getChannelPath(ch));
+                return BAD_VALUE;
+            }
+        }
+
+        int32_t ret = configureChannelLocked(mChannelFd[ch], mWidth / 2, mHeight / 2);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int32_t Max9286Mipi::Max9286Stream::configureChannelLocked(int32_t fd,
+                                           int32_t width, int32_t height)
+{
+    int32_t ret = 0;
     int32_t fps = mFps;
     int32_t vformat;
     vformat = convertPixelFormatToV4L2Format(mFormat);
 
-    if ((mWidth > 1920) || (mHeight > 1080)) {
+    if ((width > 1920) || (height > 1080)) {
         fps = 15;
     }
 
-    ALOGI("Width * Height %d x %d format %c%c%c%c, fps: %d", mWidth, mHeight, vformat & 0xFF, (vformat >> 8) & 0xFF, (vformat >> 16) & 0xFF, (vformat >> 24) & 0xFF, fps);
+    ALOGI("Width * Height %d x %d format %c%c%c%c, fps: %d", width, height, vformat & 0xFF, (vformat >> 8) & 0xFF, (vformat >> 16) & 0xFF, (vformat >> 24) & 0xFF, fps);
 
     struct v4l2_format fmt;
     memset(&fmt, 0, sizeof(fmt));
 
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     fmt.fmt.pix_mp.pixelformat = vformat;
-    fmt.fmt.pix_mp.width = mWidth & 0xFFFFFFF8;
-    fmt.fmt.pix_mp.height = mHeight & 0xFFFFFFF8;
+    fmt.fmt.pix_mp.width = width & 0xFFFFFFF8;
+    fmt.fmt.pix_mp.height = height & 0xFFFFFFF8;
     fmt.fmt.pix_mp.num_planes = 1; /* max9286 use YUYV format, is packed storage mode, set num_planes 1*/
 
-    ret = ioctl(mDev, VIDIOC_S_FMT, &fmt);
+    ret = ioctl(fd, VIDIOC_S_FMT, &fmt);
     if (ret < 0) {
         ALOGE("%s: VIDIOC_S_FMT Failed: %s", __func__, strerror(errno));
         return ret;
@@ -187,3 +294,527 @@ int32_t Max9286Mipi::Max9286Stream::onDeviceConfigureLocked()
 
     return 0;
 }
+
+int32_t Max9286Mipi::Max9286Stream::onDeviceStartLocked()
+{
+    ALOGI("%s", __func__);
+    if (!isSurround()) {
+        return MMAPStream::onDeviceStartLocked();
+    }
+
+    if (mDev <= 0) {
+        ALOGE("%s invalid dev node", __func__);
+        return BAD_VALUE;
+    }
+
+    mChannelFd[0] = mDev;
+    int32_t ret = allocateStitchBuffersLocked();
+    if (ret != 0) {
+        return ret;
+    }
+
+    // channels share the deserializer frame sync, start them together.
+    for (int32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+        ret = startChannelLocked(ch);
+        if (ret != 0) {
+            for (int32_t i = 0; i <= ch; i++) {
+                stopChannelLocked(i);
+            }
+            freeStitchBuffersLocked();
+            return ret;
+        }
+    }
+
+    memset(mHeld, 0, sizeof(mHeld));
+    mResyncFrames = 0;
+    return 0;
+}
+
+int32_t Max9286Mipi::Max9286Stream::onDeviceStopLocked()
+{
+    ALOGI("%s", __func__);
+    if (!isSurround()) {
+        return MMAPStream::onDeviceStopLocked();
+    }
+
+    // held frames are taken back by VIDIOC_STREAMOFF.
+    for (int32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+        stopChannelLocked(ch);
+    }
+    memset(mHeld, 0, sizeof(mHeld));
+    freeStitchBuffersLocked();
+    ALOGI("%s surround resync dropped %d frames", __func__, mResyncFrames);
+
+    return 0;
+}
+
+int32_t Max9286Mipi::Max9286Stream::startChannelLocked(int32_t ch)
+{
+    int32_t fd = mChannelFd[ch];
+    struct v4l2_buffer buf;
+    struct v4l2_requestbuffers req;
+    struct v4l2_plane planes;
+
+    memset(&req, 0, sizeof (req));
+    req.count = mNumBuffers;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(fd, VIDIOC_REQBUFS, &req) < 0) {
+        ALOGE("%s channel %d VIDIOC_REQBUFS failed", __func__, ch);
+        return BAD_VALUE;
+    }
+
+    for (uint32_t i = 0; i < mNumBuffers; i++) {
+        memset(&buf, 0, sizeof (buf));
+        memset(&planes, 0, sizeof(planes));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        buf.m.planes = &planes;
+        buf.length = 1; /* plane num */
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (ioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            ALOGE("%s channel %d VIDIOC_QUERYBUF error", __func__, ch);
+            return BAD_VALUE;
+        }
+
+        StreamBuffer* sbuf = new StreamBuffer();
+        sbuf->mPhyAddr = (size_t)buf.m.planes->m.mem_offset;
+        sbuf->mSize = buf.m.planes->length;
+        sbuf->mVirtAddr = (void *)mmap(NULL, sbuf->mSize,
+                    PROT_READ | PROT_WRITE, MAP_SHARED, fd, sbuf->mPhyAddr);
+        sbuf->mStream = this;
+        mChannelBuffers[ch][i] = sbuf;
+        if (sbuf->mVirtAddr == MAP_FAILED) {
+            ALOGE("%s channel %d mmap failed", __func__, ch);
+            sbuf->mVirtAddr = NULL;
+            return BAD_VALUE;
+        }
+
+        if (queueChannelLocked(ch, i) != 0) {
+            return BAD_VALUE;
+        }
+    }
+
+    enum v4l2_buf_type bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (ioctl(fd, VIDIOC_STREAMON, &bufType) < 0) {
+        ALOGE("%s channel %d VIDIOC_STREAMON failed:%s", __func__, ch, strerror(errno));
+        return BAD_VALUE;
+    }
+
+    return 0;
+}
+
+void Max9286Mipi::Max9286Stream::stopChannelLocked(int32_t ch)
+{
+    int32_t fd = mChannelFd[ch];
+    if (fd > 0) {
+        enum v4l2_buf_type bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        if (ioctl(fd, VIDIOC_STREAMOFF, &bufType) < 0) {
+            ALOGE("%s channel %d VIDIOC_STREAMOFF failed: %s", __func__, ch, strerror(errno));
+        }
+    }
+
+    for (uint32_t i = 0; i < MAX_STREAM_BUFFERS; i++) {
+        StreamBuffer* sbuf = mChannelBuffers[ch][i];
+        if (sbuf == NULL) {
+            continue;
+        }
+
+        if (sbuf->mVirtAddr != NULL) {
+            munmap(sbuf->mVirtAddr, sbuf->mSize);
+        }
+        delete sbuf;
+        mChannelBuffers[ch][i] = NULL;
+    }
+}
+
+int32_t Max9286Mipi::Max9286Stream::queueChannelLocked(int32_t ch, int32_t index)
+{
+    StreamBuffer* sbuf = mChannelBuffers[ch][index];
+    struct v4l2_buffer cfilledbuffer;
+    struct v4l2_plane planes;
+
+    memset(&cfilledbuffer, 0, sizeof (cfilledbuffer));
+    memset(&planes, 0, sizeof(planes));
+    cfilledbuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    cfilledbuffer.m.planes = &planes;
+    cfilledbuffer.m.planes->m.mem_offset = sbuf->mPhyAddr;
+    cfilledbuffer.m.planes->length = sbuf->mSize;
+    cfilledbuffer.length = 1;
+    cfilledbuffer.memory = V4L2_MEMORY_MMAP;
+    cfilledbuffer.index = index;
+
+    if (ioctl(mChannelFd[ch], VIDIOC_QBUF, &cfilledbuffer) < 0) {
+        ALOGE("%s channel %d VIDIOC_QBUF Failed", __func__, ch);
+        return BAD_VALUE;
+    }
+
+    return 0;
+}
+
+int32_t Max9286Mipi::Max9286Stream::dequeueChannelLocked(int32_t ch,
+                                               struct v4l2_buffer& buf)
+{
+    struct v4l2_plane planes;
+    memset(&buf, 0, sizeof (buf));
+    memset(&planes, 0, sizeof(planes));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buf.m.planes = &planes;
+    buf.length = 1;
+    buf.memory = V4L2_MEMORY_MMAP;
+    int ret = ioctl(mChannelFd[ch], VIDIOC_DQBUF, &buf);
+    buf.m.planes = NULL;
+    if (ret < 0) {
+        ALOGE("%s channel %d VIDIOC_DQBUF Failed", __func__, ch);
+        return -1;
+    }
+
+    return buf.index;
+}
+
+// channels are requeued until their frames are aligned, the composite
+// is dropped if they still drift after SURROUND_RESYNC tries.
+int32_t Max9286Mipi::Max9286Stream::waitFrame()
+{
+    if (!isSurround()) {
+        return MMAPStream::waitFrame();
+    }
+
+    for (int32_t retry = 0; retry <= SURROUND_RESYNC; retry++) {
+        int32_t ret = waitChannels();
+        Mutex::Autolock lock(mLock);
+        if (ret != 0) {
+            releaseChannelsLocked();
+            return ret;
+        }
+
+        if (alignChannelsLocked()) {
+            mStallCount = 0;
+            return 0;
+        }
+    }
+
+    Mutex::Autolock lock(mLock);
+    ALOGE("%s channels not aligned after %d resyncs, drop frame",
+          __func__, SURROUND_RESYNC);
+    for (int32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+        mResyncFrames += mHeld[ch] ? 1 : 0;
+    }
+    releaseChannelsLocked();
+    return BAD_VALUE;
+}
+
+int32_t Max9286Mipi::Max9286Stream::waitChannels()
+{
+    int32_t timeout = 0;
+    {
+        Mutex::Autolock lock(mLock);
+        timeout = getFrameTimeoutLocked();
+    }
+    nsecs_t deadline = systemTime() + ms2ns(timeout);
+
+    while (true) {
+        struct pollfd pfd[MAX9286_CHANNELS];
+        int32_t chans[MAX9286_CHANNELS];
+        nfds_t count = 0;
+        {
+            Mutex::Autolock lock(mLock);
+            for (int32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+                if (mHeld[ch]) {
+                    continue;
+                }
+                if (mChannelFd[ch] <= 0) {
+                    ALOGE("%s channel %d invalid fd handle", __func__, ch);
+                    return BAD_VALUE;
+                }
+                pfd[count].fd = mChannelFd[ch];
+                pfd[count].events = POLLIN | POLLPRI;
+                pfd[count].revents = 0;
+                chans[count++] = ch;
+            }
+        }
+
+        if (count == 0) {
+            return 0;
+        }
+
+        int32_t rel = (int32_t)ns2ms(deadline - systemTime());
+        int ret = 0;
+        if (rel > 0) {
+            do {
+                ret = poll(pfd, count, rel);
+            } while ((ret < 0) && (errno == EINTR));
+        }
+
+        Mutex::Autolock lock(mLock);
+        if (ret == 0) {
+            mTimeoutFrames++;
+            mStallCount++;
+            ALOGW("%s no frame in %d ms", __func__, timeout);
+            return TIMED_OUT;
+        }
+
+        if (ret < 0) {
+            ALOGE("%s poll failed: %s", __func__, strerror(errno));
+            return BAD_VALUE;
+        }
+
+        for (nfds_t i = 0; i < count; i++) {
+            int32_t ch = chans[i];
+            if (pfd[i].revents & POLLERR) {
+                ALOGE("%s channel %d poll error, revents:0x%x", __func__,
+                      ch, pfd[i].revents);
+                return BAD_VALUE;
+            }
+            if (pfd[i].revents == 0) {
+                continue;
+            }
+
+            if (dequeueChannelLocked(ch, mHeldBufs[ch]) < 0) {
+                return BAD_VALUE;
+            }
+            mHeld[ch] = true;
+        }
+    }
+}
+
+static nsecs_t getBufferStamp(const struct v4l2_buffer& buf)
+{
+    return (nsecs_t)buf.timestamp.tv_sec * 1000000000LL +
+           (nsecs_t)buf.timestamp.tv_usec * 1000LL;
+}
+
+// channels drift less than half period are the same frame, the ones
+// behind the newest frame are requeued to catch up.
+bool Max9286Mipi::Max9286Stream::alignChannelsLocked()
+{
+    int32_t fps = (mFps > 0) ? mFps : 30;
+    nsecs_t window = 1000000000LL / fps / 2;
+    nsecs_t newest = 0;
+    for (int32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+        if (getBufferStamp(mHeldBufs[ch]) > newest) {
+            newest = getBufferStamp(mHeldBufs[ch]);
+        }
+    }
+
+    bool aligned = true;
+    for (int32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+        nsecs_t behind = newest - getBufferStamp(mHeldBufs[ch]);
+        if (behind <= window) {
+            continue;
+        }
+
+        ALOGV("%s channel %d is %lld ns behind", __func__, ch, behind);
+        aligned = false;
+        mHeld[ch] = false;
+        queueChannelLocked(ch, mHeldBufs[ch].index);
+        mResyncFrames++;
+    }
+
+    return aligned;
+}
+
+void Max9286Mipi::Max9286Stream::releaseChannelsLocked()
+{
+    for (int32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+        if (mHeld[ch]) {
+            queueChannelLocked(ch, mHeldBufs[ch].index);
+            mHeld[ch] = false;
+        }
+    }
+}
+
+// stitch aligned channel frames from waitFrame into one frame, channel
+// buffers are queued back then.
+int32_t Max9286Mipi::Max9286Stream::onFrameAcquireLocked()
+{
+    ALOGV("%s", __func__);
+    if (!isSurround()) {
+        return MMAPStream::onFrameAcquireLocked();
+    }
+
+    int32_t out = -1;
+    for (int32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+        if (!mHeld[ch]) {
+            ALOGE("%s channel %d has no frame", __func__, ch);
+            goto done;
+        }
+    }
+
+    for (uint32_t i = 0; i < mNumBuffers; i++) {
+        if (!mStitchBusy[i]) {
+            out = i;
+            break;
+        }
+    }
+
+    if (out < 0) {
+        ALOGE("%s no free stitch buffer", __func__);
+        goto done;
+    }
+
+    {
+        bool g2d = false;
+        for (int32_t ch = 0; ch < MAX9286_CHANNELS; ch++) {
+            g2d |= stitchChannelLocked(ch,
+                        mChannelBuffers[ch][mHeldBufs[ch].index], mBuffers[out]);
+        }
+#ifdef TARGET_FSL_IMX_2D
+        if (g2d) {
+            g2d_finish(getG2dHandle());
+        }
+#else
+        (void)g2d;
+#endif
+    }
+
+    mStitchBusy[out] = true;
+    accountFrameLocked(mHeldBufs[0]);
+
+done:
+    releaseChannelsLocked();
+    return out;
+}
+
+int32_t Max9286Mipi::Max9286Stream::onFrameReturnLocked(int32_t index, StreamBuffer& buf)
+{
+    ALOGV("%s", __func__);
+    if (!isSurround()) {
+        return MMAPStream::onFrameReturnLocked(index, buf);
+    }
+
+    mStitchBusy[index] = false;
+    return 0;
+}
+
+bool Max9286Mipi::Max9286Stream::stitchChannelLocked(int32_t ch,
+                                StreamBuffer* src, StreamBuffer* dst)
+{
+    int32_t width = mWidth / 2;
+    int32_t height = mHeight / 2;
+    int32_t left = (ch % 2) * width;
+    int32_t top = (ch / 2) * height;
+
+#ifdef TARGET_FSL_IMX_2D
+    void* g2dHandle = getG2dHandle();
+    if (g2dHandle != NULL) {
+        struct g2d_surface s, d;
+        memset(&s, 0, sizeof(s));
+        memset(&d, 0, sizeof(d));
+        s.format = G2D_YUYV;
+        s.planes[0] = src->mPhyAddr;
+        s.right = width;
+        s.bottom = height;
+        s.stride = width;
+        s.width = width;
+        s.height = height;
+        s.rot = G2D_ROTATION_0;
+
+        d.format = G2D_YUYV;
+        d.planes[0] = dst->mPhyAddr;
+        d.left = left;
+        d.top = top;
+        d.right = left + width;
+        d.bottom = top + height;
+        d.stride = mWidth;
+        d.width = mWidth;
+        d.height = mHeight;
+        d.rot = G2D_ROTATION_0;
+        if (g2d_blit(g2dHandle, &s, &d) == 0) {
+            return true;
+        }
+    }
+#endif
+
+    // YUYV is 2 bytes per pixel.
+    int32_t srcStride = width * 2;
+    int32_t dstStride = mWidth * 2;
+    uint8_t* srcPtr = (uint8_t*)src->mVirtAddr;
+    uint8_t* dstPtr = (uint8_t*)dst->mVirtAddr + top * dstStride + left * 2;
+    for (int32_t i = 0; i < height; i++) {
+        memcpy(dstPtr, srcPtr, srcStride);
+        srcPtr += srcStride;
+        dstPtr += dstStride;
+    }
+
+    return false;
+}
+
+int32_t Max9286Mipi::Max9286Stream::allocateStitchBuffersLocked()
+{
+    if (mIonFd <= 0) {
+        ALOGE("%s ion invalid", __func__);
+        return BAD_VALUE;
+    }
+
+    int32_t size = mWidth * mHeight * 2;
+    int32_t ionSize = (size + PAGE_SIZE) & (~(PAGE_SIZE - 1));
+    for (uint32_t i = 0; i < mNumBuffers; i++) {
+        unsigned char *ptr = NULL;
+        int32_t sharedFd = -1;
+        int32_t phyAddr;
+        ion_user_handle_t ionHandle = -1;
+
+        int32_t err = ion_alloc(mIonFd, ionSize, 8, 1, 0, &ionHandle);
+        if (err) {
+            ALOGE("ion_alloc failed.");
+            goto err;
+        }
+
+        err = ion_map(mIonFd,
+                      ionHandle,
+                      ionSize,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED,
+                      0,
+                      &ptr,
+                      &sharedFd);
+        if (err) {
+            ALOGE("ion_map failed.");
+            ion_free(mIonFd, ionHandle);
+            goto err;
+        }
+
+        phyAddr = ion_phys(mIonFd, ionSize, sharedFd);
+        if (phyAddr == 0) {
+            ALOGE("ion_phys failed.");
+            munmap(ptr, ionSize);
+            close(sharedFd);
+            ion_free(mIonFd, ionHandle);
+            goto err;
+        }
+
+        mBuffers[i] = new StreamBuffer();
+        mBuffers[i]->mVirtAddr  = ptr;
+        mBuffers[i]->mPhyAddr   = phyAddr;
+        mBuffers[i]->mSize      = ionSize;
+        mBuffers[i]->mBufHandle = (buffer_handle_t*)(uintptr_t)ionHandle;
+        mBuffers[i]->mFd = sharedFd;
+        mBuffers[i]->mStream = this;
+        mStitchBusy[i] = false;
+    }
+
+    return 0;
+
+err:
+    freeStitchBuffersLocked();
+    return BAD_VALUE;
+}
+
+void Max9286Mipi::Max9286Stream::freeStitchBuffersLocked()
+{
+    for (uint32_t i = 0; i < MAX_STREAM_BUFFERS; i++) {
+        if (mBuffers[i] == NULL) {
+            continue;
+        }
+
+        ion_user_handle_t ionHandle =
+            (ion_user_handle_t)(uintptr_t)mBuffers[i]->mBufHandle;
+        munmap(mBuffers[i]->mVirtAddr, mBuffers[i]->mSize);
+        close(mBuffers[i]->mFd);
+        ion_free(mIonFd, ionHandle);
+        delete mBuffers[i];
+        mBuffers[i] = NULL;
+        mStitchBusy[i] = false;
+    }
+}
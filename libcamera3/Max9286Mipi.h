@@ -20,6 +20,12 @@
 #include "Camera.h"
 #include "MMAPStream.h"
 
+// comma separated dev nodes of the other max9286 channels, such as
+// "/dev/video1,/dev/video2,/dev/video3". when set, all channels are
+// captured together and stitched to one 2x2 frame.
+#define MAX9286_SURROUND "rw.camera.surround"
+#define MAX9286_CHANNELS 4
+
 class Max9286Mipi : public Camera
 {
 public:
@@ -29,15 +35,62 @@ public:
     virtual status_t initSensorStaticData();
     virtual PixelFormat getPreviewPixelFormat();
 
+    // channel 0 is the camera dev node.
+    int32_t getChannelCount() {return mChannelCount;}
+    const char* getChannelPath(int32_t ch) {return mChannelPaths[ch];}
+
 private:
+    void parseChannels();
+
+    int32_t mChannelCount;
+    char mChannelPaths[MAX9286_CHANNELS][CAMAERA_FILENAME_LENGTH];
+
     class Max9286Stream : public MMAPStream
     {
     public:
-        Max9286Stream(Camera *device) : MMAPStream(device, true) {}
-        virtual ~Max9286Stream() {}
+        Max9286Stream(Camera *device);
+        virtual ~Max9286Stream();
 
         // configure device.
         virtual int32_t onDeviceConfigureLocked();
+        // start device.
+        virtual int32_t onDeviceStartLocked();
+        // stop device.
+        virtual int32_t onDeviceStopLocked();
+
+        // wait for a frame of every channel in surround mode.
+        virtual int32_t waitFrame();
+        // get stitched buffer in surround mode.
+        virtual int32_t onFrameAcquireLocked();
+        // put buffer back.
+        virtual int32_t onFrameReturnLocked(int32_t index, StreamBuffer& buf);
+
+    private:
+        bool isSurround();
+        int32_t configureChannelLocked(int32_t fd, int32_t width, int32_t height);
+        int32_t startChannelLocked(int32_t ch);
+        void stopChannelLocked(int32_t ch);
+        int32_t dequeueChannelLocked(int32_t ch, struct v4l2_buffer& buf);
+        int32_t queueChannelLocked(int32_t ch, int32_t index);
+        // poll channels without frame, mLock is released when wait.
+        int32_t waitChannels();
+        bool alignChannelsLocked();
+        void releaseChannelsLocked();
+        // copy channel frame to its quadrant of stitched frame.
+        bool stitchChannelLocked(int32_t ch, StreamBuffer* src, StreamBuffer* dst);
+        int32_t allocateStitchBuffersLocked();
+        void freeStitchBuffersLocked();
+
+        Max9286Mipi* mMax9286;
+        int32_t mIonFd;
+        int32_t mChannelFd[MAX9286_CHANNELS];
+        StreamBuffer* mChannelBuffers[MAX9286_CHANNELS][MAX_STREAM_BUFFERS];
+        bool mStitchBusy[MAX_STREAM_BUFFERS];
+        // channel frames dequeued for the next stitched frame.
+        bool mHeld[MAX9286_CHANNELS];
+        struct v4l2_buffer mHeldBufs[MAX9286_CHANNELS];
+        // frames dropped to keep channels aligned.
+        uint32_t mResyncFrames;
     };
 };
 
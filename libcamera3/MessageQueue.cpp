@@ -17,124 +17,252 @@
 
 #include <stdint.h>
 #include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
 #include <sys/types.h>
+#include <sys/eventfd.h>
 
 #include <utils/threads.h>
 #include <utils/Timers.h>
 #include <utils/Log.h>
-#include <binder/IPCThreadState.h>
 
 #include "MessageQueue.h"
 
 using namespace android;
 
-void CMessageList::insert(const sp<CMessage>& node)
+CMessageRing::CMessageRing()
+    : mHead(0), mTail(0), mClearPos(0), mRemoveCount(0), mRemovePending(0)
 {
-    mList.push_back(node);
+    for (uint32_t i = 0; i < RING_SIZE; i++) {
+        mSlots[i].seq.store(i, std::memory_order_relaxed);
+        mSlots[i].what = 0;
+        mSlots[i].arg0 = 0;
+    }
+}
+
+bool CMessageRing::push(int32_t what, uintptr_t arg0)
+{
+    Slot* slot = NULL;
+    uint32_t pos = mHead.load(std::memory_order_relaxed);
+    while (true) {
+        slot = &mSlots[pos & RING_MASK];
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (mHead.compare_exchange_weak(pos, pos + 1,
+                        std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            // ring is full.
+            return false;
+        }
+        else {
+            pos = mHead.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->what = what;
+    slot->arg0 = arg0;
+    slot->seq.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+bool CMessageRing::pop(CMessage& message)
+{
+    while (true) {
+        uint32_t pos = mTail.load(std::memory_order_relaxed);
+        Slot* slot = &mSlots[pos & RING_MASK];
+        uint32_t seq = slot->seq.load(std::memory_order_acquire);
+        if ((int32_t)(seq - (pos + 1)) < 0) {
+            // ring is empty.
+            return false;
+        }
+
+        message.what = slot->what;
+        message.arg0 = slot->arg0;
+        slot->seq.store(pos + RING_SIZE, std::memory_order_release);
+        mTail.store(pos + 1, std::memory_order_relaxed);
+
+        if ((int32_t)(pos - mClearPos.load(std::memory_order_acquire)) < 0) {
+            continue;
+        }
+
+        if ((mRemovePending.load(std::memory_order_acquire) != 0) &&
+            isRemoved(message, pos)) {
+            continue;
+        }
+
+        return true;
+    }
 }
 
-void CMessageList::remove(CMessageList::LIST::iterator pos)
+bool CMessageRing::isRemoved(const CMessage& message, uint32_t pos)
 {
-    mList.erase(pos);
+    Mutex::Autolock lock(mRemoveLock);
+    bool removed = false;
+    uint32_t i = 0;
+    while (i < mRemoveCount) {
+        Remove& remove = mRemoves[i];
+        // messages are popped in order, the later ones are all kept.
+        if ((int32_t)(pos - remove.pos) >= 0) {
+            mRemoves[i] = mRemoves[--mRemoveCount];
+            continue;
+        }
+
+        if (message.what == remove.what) {
+            removed = true;
+        }
+        i++;
+    }
+
+    mRemovePending.store(mRemoveCount, std::memory_order_release);
+    return removed;
 }
 
-void CMessageList::clear()
+void CMessageRing::clear()
 {
-    mList.clear();
+    mClearPos.store(mHead.load(std::memory_order_relaxed),
+                    std::memory_order_release);
+}
+
+void CMessageRing::remove(int32_t what)
+{
+    Mutex::Autolock lock(mRemoveLock);
+    uint32_t pos = mHead.load(std::memory_order_relaxed);
+    uint32_t i = 0;
+    for (; i < mRemoveCount; i++) {
+        if (mRemoves[i].what == what) {
+            break;
+        }
+    }
+
+    if (i == mRemoveCount) {
+        if (mRemoveCount >= MAX_REMOVES) {
+            // each what takes one entry, more whats than that is a bug.
+            ALOGE("%s too many pending removes, what:0x%x not removed",
+                  __func__, what);
+            return;
+        }
+        mRemoveCount++;
+    }
+
+    // later remove of the same what covers the earlier one.
+    mRemoves[i].what = what;
+    mRemoves[i].pos = pos;
+    mRemovePending.store(mRemoveCount, std::memory_order_release);
 }
 
 CMessageQueue::CMessageQueue()
 {
-    Mutex::Autolock _l(mLock);
-    mMessages.clear();
-    mCommands.clear();
+    mEventFd = eventfd(0, EFD_CLOEXEC);
+    if (mEventFd < 0) {
+        ALOGE("%s eventfd failed: %s, wait on condition", __func__,
+              strerror(errno));
+    }
 }
 
 CMessageQueue::~CMessageQueue()
 {
-    Mutex::Autolock _l(mLock);
-
-    mMessages.clear();
-    mCommands.clear();
+    if (mEventFd >= 0) {
+        close(mEventFd);
+        mEventFd = -1;
+    }
 }
+
 void CMessageQueue::clearMessages()
 {
-    Mutex::Autolock _l(mLock);
-
     mMessages.clear();
 }
 
 void CMessageQueue::clearCommands()
 {
-    Mutex::Autolock _l(mLock);
-
     mCommands.clear();
 }
 
-sp<CMessage> CMessageQueue::waitMessage(nsecs_t timeout)
+void CMessageQueue::removeMessages(int32_t what)
+{
+    mMessages.remove(what);
+}
+
+status_t CMessageQueue::waitMessage(CMessage& message, nsecs_t timeout)
 {
-    sp<CMessage>    result;
     nsecs_t timeoutTime = systemTime() + timeout;
     while (true) {
-        Mutex::Autolock _l(mLock);
-        nsecs_t now = systemTime();
-
-        // handle command firstly.
-        LIST::iterator cur(mCommands.begin());
-        if (cur != mCommands.end()) {
-            result = *cur;
+        // handle command firstly, then message.
+        if (mCommands.pop(message) || mMessages.pop(message)) {
+            return NO_ERROR;
         }
 
-        if (result != 0) {
-            mCommands.remove(cur);
-            break;
+        int waitMs = -1;
+        nsecs_t relTime = -1;
+        if (timeout >= 0) {
+            relTime = timeoutTime - systemTime();
+            if (relTime <= 0) {
+                return TIMED_OUT;
+            }
+            waitMs = (int)ns2ms(relTime);
         }
 
-        // handle message secondly.
-        cur = mMessages.begin();
-        if (cur != mMessages.end()) {
-            result = *cur;
+        // producer pushes before signal, so no wakeup is lost.
+        if (mEventFd < 0) {
+            Mutex::Autolock lock(mLock);
+            if (mCommands.pop(message) || mMessages.pop(message)) {
+                return NO_ERROR;
+            }
+
+            if (relTime < 0) {
+                mCondition.wait(mLock);
+            }
+            else {
+                mCondition.waitRelative(mLock, relTime);
+            }
+            continue;
         }
 
-        if (result != 0) {
-            mMessages.remove(cur);
-            break;
+        struct pollfd pfd;
+        pfd.fd = mEventFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int ret = poll(&pfd, 1, waitMs);
+        if (ret < 0 && errno != EINTR) {
+            ALOGE("%s poll failed: %s", __func__, strerror(errno));
+            return UNKNOWN_ERROR;
         }
 
-        if (timeout >= 0) {
-            if (timeoutTime < now) {
-                result = 0;
-                break;
-            }
-            nsecs_t relTime = timeoutTime - systemTime();
-            mCondition.waitRelative(mLock, relTime);
-        } else {
-            mCondition.wait(mLock);
+        if (ret > 0) {
+            eventfd_t value;
+            eventfd_read(mEventFd, &value);
         }
     }
-
-    return result;
 }
 
-status_t CMessageQueue::postMessage(const sp<CMessage> message,
-                                    int32_t             flags)
+status_t CMessageQueue::postMessage(int32_t   what,
+                                    uintptr_t arg0,
+                                    int32_t   flags)
 {
-    return queueMessage(message, flags);
-}
-
-status_t CMessageQueue::queueMessage(const sp<CMessage>& message,
-                                     int32_t             flags)
-{
-    Mutex::Autolock _l(mLock);
-
+    bool ret = false;
     if (flags == 0) {
-        mMessages.insert(message);
+        ret = mMessages.push(what, arg0);
     }
     else {
-        mCommands.insert(message);
+        ret = mCommands.push(what, arg0);
     }
 
-    mCondition.signal();
+    if (!ret) {
+        ALOGE("%s queue is full, what:0x%x", __func__, what);
+        return NO_MEMORY;
+    }
+
+    if (mEventFd < 0) {
+        Mutex::Autolock lock(mLock);
+        mCondition.signal();
+        return NO_ERROR;
+    }
+
+    eventfd_write(mEventFd, 1);
     return NO_ERROR;
 }
-
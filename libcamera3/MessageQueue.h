@@ -23,78 +23,87 @@
 #include <sys/types.h>
 #include <utils/threads.h>
 #include <utils/Timers.h>
-#include <utils/List.h>
-#include <semaphore.h>
+#include <atomic>
 
 using namespace android;
-class CMessage;
-
-class CMessageList {
-    List< sp<CMessage> > mList;
-    typedef List< sp<CMessage> > LIST;
 
+class CMessage {
 public:
-    inline LIST::iterator begin() {
-        return mList.begin();
-    }
-
-    inline LIST::const_iterator begin() const {
-        return mList.begin();
-    }
-
-    inline LIST::iterator end() {
-        return mList.end();
-    }
+    int32_t   what;
+    uintptr_t arg0;
 
-    inline LIST::const_iterator end() const {
-        return mList.end();
-    }
-
-    inline bool isEmpty() const {
-        return mList.empty();
-    }
-
-    void insert(const sp<CMessage>& node);
-    void remove(LIST::iterator pos);
-    void clear();
+    CMessage(int32_t   what = 0,
+             uintptr_t arg0 = 0)
+        : what(what), arg0(arg0) {}
 };
 
-class CMessage : public LightRefBase<CMessage>{
+// bounded lock-free ring, multiple producers and single consumer.
+class CMessageRing {
 public:
-    int32_t what;
-    int32_t arg0;
-
-    CMessage(int32_t what,
-             int32_t arg0 = 0)
-        : what(what), arg0(arg0) {}
+    CMessageRing();
 
-    virtual ~CMessage() {}
+    bool push(int32_t what, uintptr_t arg0);
+    bool pop(CMessage& message);
+    // drop messages posted before now.
+    void clear();
+    // drop messages with what posted before now.
+    void remove(int32_t what);
 
 private:
-    friend class LightRefBase<CMessage>;
+    static const uint32_t RING_SIZE = 64;
+    static const uint32_t RING_MASK = RING_SIZE - 1;
+
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        int32_t   what;
+        uintptr_t arg0;
+    };
+
+    // messages with what before pos are dropped when popped.
+    static const uint32_t MAX_REMOVES = 8;
+    struct Remove {
+        int32_t  what;
+        uint32_t pos;
+    };
+
+    bool isRemoved(const CMessage& message, uint32_t pos);
+
+    Slot mSlots[RING_SIZE];
+    std::atomic<uint32_t> mHead;
+    std::atomic<uint32_t> mTail;
+    // messages before the position are dropped when popped.
+    std::atomic<uint32_t> mClearPos;
+    // removes are rare, pending ones are kept under a lock and pop only
+    // takes it when there are some.
+    Mutex mRemoveLock;
+    Remove mRemoves[MAX_REMOVES];
+    uint32_t mRemoveCount;
+    std::atomic<uint32_t> mRemovePending;
 };
 
 class CMessageQueue {
-    typedef List< sp<CMessage> > LIST;
-
 public:
     CMessageQueue();
     ~CMessageQueue();
 
-    sp<CMessage> waitMessage(nsecs_t timeout = -1);
-    status_t     postMessage(const sp<CMessage> message,
-                             int32_t             flags = 0);
+    // commands are handled before messages.
+    status_t waitMessage(CMessage& message, nsecs_t timeout = -1);
+    status_t postMessage(int32_t   what,
+                         uintptr_t arg0  = 0,
+                         int32_t   flags = 0);
 	void clearMessages();
 	void clearCommands();
+	// remove messages with what.
+	void removeMessages(int32_t what);
 
 private:
-    status_t queueMessage(const sp<CMessage>& message,
-                          int32_t             flags);
-
+    CMessageRing mMessages;
+    CMessageRing mCommands;
+    // signaled when message is posted.
+    int mEventFd;
+    // used instead when eventfd can't be created.
     Mutex mLock;
     Condition mCondition;
-    CMessageList mMessages;
-    CMessageList mCommands;
 };
 
 #endif // ifndef CAMERA_HAL_MESSAGE_QUEUE_H
@@ -162,6 +162,20 @@ int32_t Metadata::getJpegThumbSize(int &width, int &height)
     return NO_ERROR;
 }
 
+int32_t Metadata::getCropRegion(int32_t *region)
+{
+    camera_metadata_entry_t entry;
+    entry = mData.find(ANDROID_SCALER_CROP_REGION);
+    if (entry.count < 4) {
+        return BAD_VALUE;
+    }
+
+    for (int32_t i = 0; i < 4; i++) {
+        region[i] = entry.data.i32[i];
+    }
+    return NO_ERROR;
+}
+
 int32_t Metadata::getFocalLength(float &focalLength)
 {
     camera_metadata_entry_t entry;
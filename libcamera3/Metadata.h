@@ -47,6 +47,8 @@ public:
     int32_t getJpegQuality(int32_t &quality);
     int32_t getJpegThumbQuality(int32_t &thumb);
     int32_t getJpegThumbSize(int &width, int &height);
+    // crop region in active array coordinates: left, top, width, height.
+    int32_t getCropRegion(int32_t *region);
 
     // Initialize with framework metadata
     //int init(const camera_metadata_t *metadata);
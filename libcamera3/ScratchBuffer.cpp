@@ -0,0 +1,61 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// it has no HAL dependency, host benchmark builds it too.
+#define LOG_TAG "FslCameraHAL"
+
+#include <stdlib.h>
+#include <string.h>
+#include <utils/Log.h>
+#include "ScratchBuffer.h"
+
+ScratchBuffer::ScratchBuffer()
+    : mData(NULL), mSize(0)
+{
+}
+
+ScratchBuffer::~ScratchBuffer()
+{
+    release();
+}
+
+uint8_t* ScratchBuffer::reserve(size_t size)
+{
+    if (size <= mSize) {
+        return mData;
+    }
+
+    release();
+    mData = (uint8_t *)malloc(size);
+    if (mData == NULL) {
+        ALOGE("%s malloc %zu failed", __func__, size);
+        return NULL;
+    }
+
+    // touch all pages once, so captures don't take page faults.
+    memset(mData, 0, size);
+    mSize = size;
+    return mData;
+}
+
+void ScratchBuffer::release()
+{
+    if (mData != NULL) {
+        free(mData);
+        mData = NULL;
+    }
+    mSize = 0;
+}
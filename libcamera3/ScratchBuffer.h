@@ -0,0 +1,41 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SCRATCH_BUFFER_H
+#define _SCRATCH_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// grow-only buffer which is reused across captures.
+class ScratchBuffer
+{
+public:
+    ScratchBuffer();
+    ~ScratchBuffer();
+    // make sure buffer is at least size bytes, keep it if already large enough.
+    uint8_t* reserve(size_t size);
+    void release();
+
+    uint8_t* data() {return mData;}
+    size_t size() {return mSize;}
+
+private:
+    uint8_t* mData;
+    size_t   mSize;
+};
+
+#endif
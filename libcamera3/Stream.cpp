@@ -28,102 +28,51 @@
 
 //#define LOG_NDEBUG 0
 
-extern "C" {
-#include "pxp_lib.h"
-}
-
 #include <cutils/log.h>
 #include "Camera.h"
 #include "Stream.h"
 #include "CameraUtils.h"
+#include "ConvertQueue.h"
 
-static void YUYVCopyByLine(uint8_t *dst, uint32_t dstWidth, uint32_t dstHeight, uint8_t *src, uint32_t srcWidth, uint32_t srcHeight)
+// jpeg output buffer size for the picture size.
+static int32_t getJpegBufferSize(int32_t format, uint32_t width, uint32_t height)
 {
-    uint32_t i;
-    int BytesPerPixel = 2;
-    uint8_t *pDstLine = dst;
-    uint8_t *pSrcLine = src;
-    uint32_t bytesPerSrcLine = BytesPerPixel * srcWidth;
-    uint32_t bytesPerDstLine = BytesPerPixel * dstWidth;
-    uint32_t marginWidh = dstWidth - srcWidth;
-    uint16_t *pYUV;
-
-    if ((srcWidth > dstWidth) || (srcHeight > dstHeight)) {
-        ALOGW("%s, para error");
-        return;
-    }
-
-    for (i = 0; i < srcHeight; i++) {
-        memcpy(pDstLine, pSrcLine, bytesPerSrcLine);
-
-        // black margin, Y:0, U:128, V:128
-        for (uint32_t j = 0; j < marginWidh; j++) {
-            pYUV = (uint16_t *)(pDstLine + bytesPerSrcLine + j * BytesPerPixel);
-            *pYUV = 0x8000;
-        }
-
-        pSrcLine += bytesPerSrcLine;
-        pDstLine += bytesPerDstLine;
-    }
+    int32_t size = 0;
+    int alignedw, alignedh, c_stride;
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YCbCr_420_P:
+            alignedw = ALIGN_PIXEL_32(width);
+            alignedh = ALIGN_PIXEL_4(height);
+            c_stride = (alignedw/2+15)/16*16;
+            size = alignedw * alignedh + c_stride * alignedh;
+            break;
+        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
+            alignedw = ALIGN_PIXEL_16(width);
+            alignedh = ALIGN_PIXEL_16(height);
+            size = alignedw * alignedh * 3 / 2;
+            break;
 
-    return;
-}
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+            alignedw = ALIGN_PIXEL_16(width);
+            alignedh = ALIGN_PIXEL_16(height);
+            size = alignedw * alignedh * 2;
+            break;
+        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+            alignedw = ALIGN_PIXEL_16(width);
+            alignedh = ALIGN_PIXEL_16(height);
+            size = alignedw * alignedh * 2;
+            break;
+        case HAL_PIXEL_FORMAT_YCbCr_444_888:
+            alignedw = ALIGN_PIXEL_16(width);
+            alignedh = ALIGN_PIXEL_16(height);
+            size = alignedw * alignedh * 3;
+            break;
 
-static void convertYUYVtoNV12SP(uint8_t *inputBuffer, uint8_t *outputBuffer, int width, int height)
-{
-#define u32 unsigned int
-#define u8 unsigned char
-
-    u32 h, w;
-    u32 nHeight = height;
-    u32 nWidthDiv4 = width / 4;
-
-    u8 *pYSrcOffset = inputBuffer;
-    u8 *pUSrcOffset = inputBuffer + 1;
-    u8 *pVSrcOffset = inputBuffer + 3;
-
-    u32 *pYDstOffset = (u32 *)outputBuffer;
-    u32 *pUVDstOffset = (u32 *)(((u8 *)(outputBuffer)) + width * height);
-
-    for (h = 0; h < nHeight; h++) {
-        if (!(h & 0x1)) {
-            for (w = 0; w < nWidthDiv4; w++) {
-                *pYDstOffset = (((u32)(*(pYSrcOffset + 0))) << 0) +
-                               (((u32)(*(pYSrcOffset + 2))) << 8) +
-                               (((u32)(*(pYSrcOffset + 4))) << 16) +
-                               (((u32)(*(pYSrcOffset + 6))) << 24);
-                pYSrcOffset += 8;
-                pYDstOffset += 1;
-
-#ifdef PLATFORM_VERSION_4
-                // seems th encoder use VUVU planner
-                *pUVDstOffset = (((u32)(*(pVSrcOffset + 0))) << 0) +
-                                (((u32)(*(pUSrcOffset + 0))) << 8) +
-                                (((u32)(*(pVSrcOffset + 4))) << 16) +
-                                (((u32)(*(pUSrcOffset + 4))) << 24);
-#else
-                *pUVDstOffset = (((u32)(*(pUSrcOffset + 0))) << 0) +
-                                (((u32)(*(pVSrcOffset + 0))) << 8) +
-                                (((u32)(*(pUSrcOffset + 4))) << 16) +
-                                (((u32)(*(pVSrcOffset + 4))) << 24);
-#endif
-                pUSrcOffset += 8;
-                pVSrcOffset += 8;
-                pUVDstOffset += 1;
-            }
-        } else {
-            pUSrcOffset += nWidthDiv4 * 8;
-            pVSrcOffset += nWidthDiv4 * 8;
-            for (w = 0; w < nWidthDiv4; w++) {
-                *pYDstOffset = (((u32)(*(pYSrcOffset + 0))) << 0) +
-                               (((u32)(*(pYSrcOffset + 2))) << 8) +
-                               (((u32)(*(pYSrcOffset + 4))) << 16) +
-                               (((u32)(*(pYSrcOffset + 6))) << 24);
-                pYSrcOffset += 8;
-                pYDstOffset += 1;
-            }
-        }
+        default:
+            ALOGE("Error: %s format not supported", __FUNCTION__);
     }
+
+    return size;
 }
 
 Stream::Stream(int id, camera3_stream_t *s, Camera* camera)
@@ -141,7 +90,10 @@ Stream::Stream(int id, camera3_stream_t *s, Camera* camera)
     mFps(30),
     mNumBuffers(0),
     mRegistered(false),
-    mCamera(camera)
+    mCamera(camera),
+    mTracePath(TRACE_PATH_NONE),
+    mCropped(false),
+    mTransform(0)
 {
     if (s->format == HAL_PIXEL_FORMAT_BLOB) {
         ALOGI("%s create capture stream", __func__);
@@ -199,6 +151,12 @@ Stream::Stream(int id, camera3_stream_t *s, Camera* camera)
     }
 
     mJpegBuilder = new JpegBuilder();
+
+    if (mJpeg) {
+        // device stream uses the sensor format for still capture.
+        reserveJpegBuffers(mCamera->getSensorFormat(mFormat), mWidth, mHeight,
+                           0, 0);
+    }
 }
 
 Stream::Stream(Camera* camera)
@@ -215,7 +173,10 @@ Stream::Stream(Camera* camera)
     mFps(30),
     mNumBuffers(0),
     mRegistered(false),
-    mCamera(camera)
+    mCamera(camera),
+    mTracePath(TRACE_PATH_NONE),
+    mCropped(false),
+    mTransform(0)
 {
     mIpuFd = open("/dev/mxc_ipu", O_RDWR, 0);
 
@@ -252,6 +213,7 @@ Stream::~Stream()
 int32_t Stream::processJpegBuffer(StreamBuffer& src,
                                   sp<Metadata> meta)
 {
+    mTracePath = TRACE_PATH_JPEG;
     int32_t ret = 0;
     int32_t encodeQuality = 100, thumbQuality = 100;
     int32_t thumbWidth, thumbHeight;
@@ -284,6 +246,71 @@ int32_t Stream::processJpegBuffer(StreamBuffer& src,
 
     sp<Stream>& capture = dstBuf->mStream;
 
+    if (src.mInterlaced) {
+        srcStream->deinterlaceFrame(src);
+    }
+
+    // encoders read upright frame, it's transformed on CPU first and
+    // has no physical address then.
+    uint8_t *frame = (uint8_t *)src.mVirtAddr;
+    uint8_t *framePhy = (uint8_t *)(uintptr_t)src.mPhyAddr;
+    int32_t frameSize = src.mSize;
+    int32_t frameFd = src.mFd;
+    uint32_t frameWidth = srcStream->mWidth;
+    uint32_t frameHeight = srcStream->mHeight;
+    int32_t transform = mCamera->getTransform();
+    if (transform != 0) {
+        bool rotate = (transform & HAL_TRANSFORM_ROT_90) != 0;
+        size_t size = FrameRotator::getFrameSize(srcStream->format(),
+                                                 frameWidth, frameHeight);
+        uint8_t *buf = mTransformFrame.reserve(size);
+        if (buf == NULL) {
+            ALOGE("%s reserve transform frame failed", __func__);
+            return NO_MEMORY;
+        }
+        ret = FrameRotator::process(srcStream->format(), frame, frameWidth,
+                                    frameHeight, transform, buf);
+        if (ret != 0) {
+            ALOGE("%s transform %d failed %d", __func__, transform, ret);
+            return ret;
+        }
+        frame = buf;
+        framePhy = NULL;
+        frameSize = size;
+        frameFd = -1;
+        frameWidth = rotate ? srcStream->mHeight : srcStream->mWidth;
+        frameHeight = rotate ? srcStream->mWidth : srcStream->mHeight;
+    }
+
+    // digital zoom, crop of upright frame is scaled to capture size on
+    // CPU, so encoders take it without scaling.
+    mTransform = transform;
+    mCropped = getSourceCrop(meta, srcStream, mCrop);
+    if (mCropped) {
+        size_t size = FrameRotator::getFrameSize(srcStream->format(),
+                                                 capture->mWidth,
+                                                 capture->mHeight);
+        uint8_t *buf = mCropFrame.reserve(size);
+        if (buf == NULL) {
+            ALOGE("%s reserve crop frame failed", __func__);
+            return NO_MEMORY;
+        }
+        ret = mCropScaler.process(srcStream->format(), frame, frameWidth,
+                                  frameHeight, mCrop, buf, capture->mWidth,
+                                  capture->mHeight);
+        if (ret != 0) {
+            ALOGE("%s crop %ux%u at %u,%u failed %d", __func__, mCrop.width,
+                  mCrop.height, mCrop.left, mCrop.top, ret);
+            return ret;
+        }
+        frame = buf;
+        framePhy = NULL;
+        frameSize = size;
+        frameFd = -1;
+        frameWidth = capture->mWidth;
+        frameHeight = capture->mHeight;
+    }
+
     ret = meta->getJpegQuality(encodeQuality);
     if (ret != NO_ERROR) {
         ALOGE("%s getJpegQuality failed", __FUNCTION__);
@@ -304,91 +331,64 @@ int32_t Stream::processJpegBuffer(StreamBuffer& src,
         thumbQuality = 100;
     }
 
-    int captureSize = 0;
-    int alignedw, alignedh, c_stride;
-    switch (srcStream->format()) {
-        case HAL_PIXEL_FORMAT_YCbCr_420_P:
-            alignedw = ALIGN_PIXEL_32(capture->mWidth);
-            alignedh = ALIGN_PIXEL_4(capture->mHeight);
-            c_stride = (alignedw/2+15)/16*16;
-            captureSize = alignedw * alignedh + c_stride * alignedh;
-            break;
-        case HAL_PIXEL_FORMAT_YCbCr_420_SP:
-            alignedw = ALIGN_PIXEL_16(capture->mWidth);
-            alignedh = ALIGN_PIXEL_16(capture->mHeight);
-            captureSize = alignedw * alignedh * 3 / 2;
-            break;
+    int captureSize = getJpegBufferSize(srcStream->format(),
+                                        capture->mWidth, capture->mHeight);
 
-        case HAL_PIXEL_FORMAT_YCbCr_422_I:
-            alignedw = ALIGN_PIXEL_16(capture->mWidth);
-            alignedh = ALIGN_PIXEL_16(capture->mHeight);
-            captureSize = alignedw * alignedh * 2;
-            break;
-        case HAL_PIXEL_FORMAT_YCbCr_422_SP:
-            alignedw = ALIGN_PIXEL_16(capture->mWidth);
-            alignedh = ALIGN_PIXEL_16(capture->mHeight);
-            captureSize = alignedw * alignedh * 2;
-            break;
-        case HAL_PIXEL_FORMAT_YCbCr_444_888:
-            alignedw = ALIGN_PIXEL_16(capture->mWidth);
-            alignedh = ALIGN_PIXEL_16(capture->mHeight);
-            captureSize = alignedw * alignedh * 3;
-            break;
-
-        default:
-            ALOGE("Error: %s format not supported", __FUNCTION__);
-    }
-
-    sp<MemoryHeapBase> rawFrame(
-        new MemoryHeapBase(captureSize, 0, "rawFrame"));
-    rawBuf = rawFrame->getBase();
-    if (rawBuf == MAP_FAILED) {
-        ALOGE("%s new MemoryHeapBase failed", __FUNCTION__);
+    ret = meta->getJpegThumbSize(thumbWidth, thumbHeight);
+    if (ret != NO_ERROR) {
+        ALOGE("%s getJpegThumbSize failed", __FUNCTION__);
         return BAD_VALUE;
     }
 
-    sp<MemoryHeapBase> thumbFrame(
-        new MemoryHeapBase(captureSize, 0, "thumbFrame"));
-    thumbBuf = thumbFrame->getBase();
-    if (thumbBuf == MAP_FAILED) {
-        ALOGE("%s new MemoryHeapBase failed", __FUNCTION__);
-        return BAD_VALUE;
+    ret = reserveJpegBuffers(srcStream->format(), frameWidth,
+                             frameHeight, thumbWidth, thumbHeight);
+    if (ret != NO_ERROR) {
+        ALOGE("%s reserveJpegBuffers failed", __FUNCTION__);
+        return ret;
     }
+    rawBuf = mRawFrame.data();
+    thumbBuf = mThumbFrame.data();
 
-    mainJpeg = new JpegParams((uint8_t *)src.mVirtAddr,
-                              (uint8_t *)(uintptr_t)src.mPhyAddr,
-                              src.mSize,
+    mainJpeg = new JpegParams(frame,
+                              framePhy,
+                              frameSize,
                               (uint8_t *)rawBuf,
                               captureSize,
                               encodeQuality,
-                              srcStream->mWidth,
-                              srcStream->mHeight,
+                              frameWidth,
+                              frameHeight,
                               capture->mWidth,
                               capture->mHeight,
                               srcStream->format());
-
-    ret = meta->getJpegThumbSize(thumbWidth, thumbHeight);
-    if (ret != NO_ERROR) {
-        ALOGE("%s getJpegThumbSize failed", __FUNCTION__);
-        goto err_out;
-    }
+    mainJpeg->scratch = mMainScratch.data();
+    mainJpeg->scratch_size = mMainScratch.size();
+    mainJpeg->src_fd = frameFd;
 
     if ((thumbWidth > 0) && (thumbHeight > 0)) {
-        int thumbSize = captureSize;
-        thumbJpeg = new JpegParams((uint8_t *)src.mVirtAddr,
-                           (uint8_t *)(uintptr_t)src.mPhyAddr,
-                           src.mSize,
+        int thumbSize = mThumbFrame.size();
+        thumbJpeg = new JpegParams(frame,
+                           framePhy,
+                           frameSize,
                            (uint8_t *)thumbBuf,
                            thumbSize,
                            thumbQuality,
-                           srcStream->mWidth,
-                           srcStream->mHeight,
+                           frameWidth,
+                           frameHeight,
                            thumbWidth,
                            thumbHeight,
                            srcStream->format());
+        thumbJpeg->scratch = mThumbScratch.data();
+        thumbJpeg->scratch_size = mThumbScratch.size();
+        thumbJpeg->src_fd = frameFd;
     }
 
     mJpegBuilder->prepareImage(&src);
+    // encode main image in place when EXIF header fits output buffer,
+    // otherwise it's encoded to rawBuf and copied.
+    if (mJpegBuilder->prepareOutput(dstBuf, mainJpeg, thumbJpeg) != NO_ERROR) {
+        ALOGW("%s encode main image to scratch", __FUNCTION__);
+    }
+
     ret = mJpegBuilder->encodeImage(mainJpeg, thumbJpeg);
     if (ret != NO_ERROR) {
         ALOGE("%s encodeImage failed", __FUNCTION__);
@@ -413,24 +413,46 @@ err_out:
     return ret;
 }
 
-int32_t Stream::processBufferWithPXP(StreamBuffer& src)
+int32_t Stream::reserveJpegBuffers(int32_t srcFormat, uint32_t srcWidth,
+                                   uint32_t srcHeight, int32_t thumbWidth,
+                                   int32_t thumbHeight)
 {
-    ALOGV("%s", __func__);
-    sp<Stream>& device = src.mStream;
-    if (device == NULL) {
-        ALOGE("%s invalid device stream", __func__);
-        return 0;
+    int32_t size = getJpegBufferSize(srcFormat, mWidth, mHeight);
+    if (size <= 0) {
+        return BAD_VALUE;
     }
 
-    StreamBuffer* out = mCurrent;
-    if (out == NULL || out->mBufHandle == NULL) {
-        ALOGE("%s invalid buffer handle", __func__);
-        return 0;
+    // keep buffers if they are large enough, only grow when needed.
+    if ((mRawFrame.reserve(size) == NULL) ||
+        (mMainScratch.reserve(YuvToJpegEncoder::getScratchSize(
+                srcWidth, srcHeight, mWidth, mHeight)) == NULL)) {
+        ALOGE("%s reserve main buffers failed", __func__);
+        return NO_MEMORY;
+    }
+
+    if ((thumbWidth <= 0) || (thumbHeight <= 0)) {
+        return NO_ERROR;
     }
 
-    struct pxp_config_data pxp_conf;
+    size = getJpegBufferSize(HAL_PIXEL_FORMAT_YCbCr_444_888, thumbWidth,
+                             thumbHeight);
+    if ((mThumbFrame.reserve(size) == NULL) ||
+        (mThumbScratch.reserve(YuvToJpegEncoder::getScratchSize(
+                srcWidth, srcHeight, thumbWidth, thumbHeight)) == NULL)) {
+        ALOGE("%s reserve thumbnail buffers failed", __func__);
+        return NO_MEMORY;
+    }
+
+    return NO_ERROR;
+}
+
+int32_t Stream::processBufferWithPXP(StreamBuffer& src, ConvertJob& job)
+{
+    ALOGV("%s", __func__);
+    sp<Stream>& device = src.mStream;
+    StreamBuffer* out = mCurrent;
+    struct pxp_config_data& pxp_conf = job.mPxpConf;
     struct pxp_layer_param *src_param = NULL, *out_param = NULL;
-    int32_t ret = -1;
 
     memset(&pxp_conf, 0, sizeof(struct pxp_config_data));
 
@@ -446,10 +468,18 @@ int32_t Stream::processBufferWithPXP(StreamBuffer& src)
     src_param->color_key = -1;
     src_param->color_key_enable = 0;
     src_param->pixel_fmt = convertPixelFormatToV4L2Format(device->mFormat);
-    pxp_conf.proc_data.srect.top = 0;
-    pxp_conf.proc_data.srect.left = 0;
-    pxp_conf.proc_data.srect.width = device->mWidth;
-    pxp_conf.proc_data.srect.height = device->mHeight;
+    if (mCropped) {
+        pxp_conf.proc_data.srect.top = mCrop.top;
+        pxp_conf.proc_data.srect.left = mCrop.left;
+        pxp_conf.proc_data.srect.width = mCrop.width;
+        pxp_conf.proc_data.srect.height = mCrop.height;
+    }
+    else {
+        pxp_conf.proc_data.srect.top = 0;
+        pxp_conf.proc_data.srect.left = 0;
+        pxp_conf.proc_data.srect.width = device->mWidth;
+        pxp_conf.proc_data.srect.height = device->mHeight;
+    }
 
     /*
     * Initialize out parameters
@@ -464,53 +494,61 @@ int32_t Stream::processBufferWithPXP(StreamBuffer& src)
     pxp_conf.proc_data.drect.left = 0;
     pxp_conf.proc_data.drect.width = mWidth;
     pxp_conf.proc_data.drect.height = mHeight;
+    pxp_conf.proc_data.hflip = (mTransform & HAL_TRANSFORM_FLIP_H) ? 1 : 0;
+    pxp_conf.proc_data.vflip = (mTransform & HAL_TRANSFORM_FLIP_V) ? 1 : 0;
+    pxp_conf.proc_data.rotate = (mTransform & HAL_TRANSFORM_ROT_90) ? 90 : 0;
 
-    ret = ioctl(mPxpFd, PXP_IOC_CONFIG_CHAN, &pxp_conf);
-    if(ret < 0) {
-        ALOGE("%s:%d, PXP_IOC_CONFIG_CHAN failed %d", __FUNCTION__, __LINE__ ,ret);
-        return ret;
-    }
+    // channel is configured and started on queue thread.
+    job.mFd = mPxpFd;
+    job.mPath = TRACE_PATH_PXP;
 
-    ret = ioctl(mPxpFd, PXP_IOC_START_CHAN, &(pxp_conf.handle));
-    if(ret < 0) {
-        ALOGE("%s:%d, PXP_IOC_START_CHAN failed %d", __FUNCTION__, __LINE__ ,ret);
-        return ret;
-    }
+    return 0;
+}
 
-    ret = ioctl(mPxpFd, PXP_IOC_WAIT4CMPLT, &pxp_conf);
-    if(ret < 0) {
-        ALOGE("%s:%d, PXP_IOC_WAIT4CMPLT failed %d", __FUNCTION__, __LINE__ ,ret);
-        return ret;
+static int32_t convertTransformToIpuRotate(int32_t transform)
+{
+    switch (transform) {
+        case HAL_TRANSFORM_FLIP_H:
+            return IPU_ROTATE_HORIZ_FLIP;
+        case HAL_TRANSFORM_FLIP_V:
+            return IPU_ROTATE_VERT_FLIP;
+        case HAL_TRANSFORM_ROT_180:
+            return IPU_ROTATE_180;
+        case HAL_TRANSFORM_ROT_90:
+            return IPU_ROTATE_90_RIGHT;
+        case HAL_TRANSFORM_ROT_90 | HAL_TRANSFORM_FLIP_H:
+            return IPU_ROTATE_90_RIGHT_HFLIP;
+        case HAL_TRANSFORM_ROT_90 | HAL_TRANSFORM_FLIP_V:
+            return IPU_ROTATE_90_RIGHT_VFLIP;
+        case HAL_TRANSFORM_ROT_270:
+            return IPU_ROTATE_90_LEFT;
+        default:
+            return IPU_ROTATE_NONE;
     }
-
-    return ret;
-
 }
 
-int32_t Stream::processBufferWithIPU(StreamBuffer& src)
+int32_t Stream::processBufferWithIPU(StreamBuffer& src, ConvertJob& job)
 {
     ALOGV("%s", __func__);
     sp<Stream>& device = src.mStream;
-    if (device == NULL) {
-        ALOGE("%s invalid device stream", __func__);
-        return 0;
-    }
-
     StreamBuffer* out = mCurrent;
-    if (out == NULL || out->mBufHandle == NULL) {
-        ALOGE("%s invalid buffer handle", __func__);
-        return 0;
-    }
-
-    struct ipu_task mTask;
+    struct ipu_task& mTask = job.mIpuTask;
     memset(&mTask, 0, sizeof(mTask));
 
     mTask.input.width = device->mWidth;
     mTask.input.height = device->mHeight;
-    mTask.input.crop.pos.x = 0;
-    mTask.input.crop.pos.y = 0;
-    mTask.input.crop.w = device->mWidth;
-    mTask.input.crop.h = device->mHeight;
+    if (mCropped) {
+        mTask.input.crop.pos.x = mCrop.left;
+        mTask.input.crop.pos.y = mCrop.top;
+        mTask.input.crop.w = mCrop.width;
+        mTask.input.crop.h = mCrop.height;
+    }
+    else {
+        mTask.input.crop.pos.x = 0;
+        mTask.input.crop.pos.y = 0;
+        mTask.input.crop.w = device->mWidth;
+        mTask.input.crop.h = device->mHeight;
+    }
     mTask.input.format = convertPixelFormatToV4L2Format(device->mFormat);
     mTask.input.paddr = src.mPhyAddr;
 
@@ -526,16 +564,29 @@ int32_t Stream::processBufferWithIPU(StreamBuffer& src)
     mTask.output.crop.pos.y = 0;
     mTask.output.crop.w = mWidth;
     mTask.output.crop.h = mHeight;
-    mTask.output.rotate = 0;
+    mTask.output.rotate = convertTransformToIpuRotate(mTransform);
     mTask.output.paddr = out->mPhyAddr;
 
     // If after convert, src/dst has same format and resolution, then process with GPU.
     // For exmaple, HAL_PIXEL_FORMAT_YCBCR_420_888, HAL_PIXEL_FORMAT_YCbCr_420_SP
     // both convert to v4l2_fourcc('N', 'V', '1', '2').
-    if( (mTask.output.format == mTask.input.format) &&
+    if( !mCropped && (mTransform == 0) &&
+        (mTask.output.format == mTask.input.format) &&
         (mTask.output.width == mTask.input.width) &&
         (mTask.output.height == mTask.input.height) ) {
-        return processBufferWithGPU(src);
+        if (src.mInterlaced) {
+            device->deinterlaceFrame(src);
+        }
+        job.mPath = TRACE_PATH_GPU;
+        return 0;
+    }
+
+    // bob deinterlace in VDI while converting, it keeps the later field.
+    if (src.mInterlaced) {
+        mTask.input.deinterlace.enable = 1;
+        mTask.input.deinterlace.motion = HIGH_MOTION;
+        mTask.input.deinterlace.field_fmt = device->isBottomFieldFirst() ?
+                IPU_DEINTERLACE_FIELD_BOTTOM : IPU_DEINTERLACE_FIELD_TOP;
     }
 
     int32_t ret = IPU_CHECK_ERR_INPUT_CROP;
@@ -563,201 +614,136 @@ int32_t Stream::processBufferWithIPU(StreamBuffer& src)
         }
     }
 
-    ret = ioctl(mIpuFd, IPU_QUEUE_TASK, &mTask);
-    if(ret < 0) {
-        ALOGE("%s:%d, IPU_QUEUE_TASK failed %d", __FUNCTION__, __LINE__ ,ret);
-        return ret;
+    // fields are resolved in output, the frame has no other reader.
+    if (mTask.input.deinterlace.enable) {
+        src.mInterlaced = false;
     }
 
-    return ret;
-}
-
-static void bufferDump(StreamBuffer *frame, bool in)
-{
-    // for test code
-    char value[100];
-    char name[100];
-    memset(value, 0, sizeof(value));
-    bool vflg = false;
-    static int dump_num = 1;
-    property_get("rw.camera.test", value, "");
-    if (strcmp(value, "true") == 0)
-        vflg = true;
-
-    if (vflg) {
-        FILE *pf = NULL;
-        memset(name, 0, sizeof(name));
-        snprintf(name, 100, "/data/dump/camera_dump_%s_%d.data",
-                   in ? "in" : "out", dump_num++);
-        pf = fopen(name, "wb");
-        if (pf == NULL) {
-            ALOGI("open %s failed", name);
-        }
-        else {
-            ALOGV("write yuv data");
-            fwrite(frame->mVirtAddr, frame->mSize, 1, pf);
-            fclose(pf);
-        }
-    }
-}
-
-int32_t Stream::processBufferWithGPU(StreamBuffer& src)
-{
-    sp<Stream>& device = src.mStream;
-    if (device == NULL) {
-        ALOGE("%s invalid device stream", __func__);
-        return 0;
-    }
-
-    StreamBuffer* out = mCurrent;
-    if (out == NULL || out->mBufHandle == NULL) {
-        ALOGE("%s invalid buffer handle", __func__);
-        return 0;
-    }
-
-    void* g2dHandle = device->getG2dHandle();
-    int size = (src.mSize > out->mSize) ? out->mSize : src.mSize;
-
-    if (g2dHandle == NULL) {
-        ALOGV("%s if board don't support g2d_copy, use memcpy", __func__);
-        memcpy(out->mVirtAddr, src.mVirtAddr, size);
-        return 0;
-    }
-
-#ifdef TARGET_FSL_IMX_2D
-    struct g2d_buf s_buf, d_buf;
-    s_buf.buf_paddr = src.mPhyAddr;
-    s_buf.buf_vaddr = src.mVirtAddr;
-    d_buf.buf_paddr = out->mPhyAddr;
-    d_buf.buf_vaddr = out->mVirtAddr;
-    g2d_copy(g2dHandle, &d_buf, &s_buf, size);
-    g2d_finish(g2dHandle);
-#endif
-
-    bufferDump(&src, true);
-    bufferDump(out, false);
+    // task is queued on queue thread, it blocks until done.
+    job.mFd = mIpuFd;
+    job.mPath = TRACE_PATH_IPU;
 
     return 0;
 }
 
-int32_t Stream::convertNV12toNV21(StreamBuffer& src)
+uint32_t Stream::scaleCost()
 {
-    sp<Stream>& device = src.mStream;
-    if (device == NULL) {
-        ALOGE("%s invalid device stream", __func__);
-        return 0;
+    if (mJpeg) {
+        return SCALE_COST_CPU;
     }
 
-    StreamBuffer* out = mCurrent;
-    if (out == NULL || out->mBufHandle == NULL) {
-        ALOGE("%s invalid buffer handle", __func__);
-        return 0;
-    }
-    int Ysize = 0, UVsize = 0;
-    uint8_t *srcIn, *dstOut;
-    uint32_t *UVout;
-    int size = (src.mSize > out->mSize) ? out->mSize : src.mSize;
-
-    Ysize  = device->mWidth * device->mHeight;
-    UVsize = device->mWidth * device->mHeight >> 2;
-    srcIn = (uint8_t *)src.mVirtAddr;
-    dstOut = (uint8_t *)out->mVirtAddr;
-    UVout = (uint32_t *)(dstOut + Ysize);
-
-    void* g2dHandle = device->getG2dHandle();
-
-    if (g2dHandle != NULL) {
-#ifdef TARGET_FSL_IMX_2D
-        struct g2d_buf s_buf, d_buf;
-        s_buf.buf_paddr = src.mPhyAddr;
-        s_buf.buf_vaddr = src.mVirtAddr;
-        d_buf.buf_paddr = out->mPhyAddr;
-        d_buf.buf_vaddr = out->mVirtAddr;
-        g2d_copy(g2dHandle, &d_buf, &s_buf, size);
-        g2d_finish(g2dHandle);
-#endif
+    // same converter selection as processFrameBuffer.
+    if ((mIpuFd > 0) && (mFormat != HAL_PIXEL_FORMAT_YCrCb_420_SP)) {
+        return SCALE_COST_IPU;
     }
-    else {
-        memcpy(dstOut, srcIn, size);
-    }
-
-    for (int k = 0; k < UVsize/2; k++) {
-        __asm volatile ("rev16 %0, %0" : "+r"(*UVout));
-        UVout += 1;
+    else if (mPxpFd > 0) {
+        return SCALE_COST_PXP;
     }
 
     return 0;
 }
 
-int32_t Stream::processBufferWithCPU(StreamBuffer &src)
+bool Stream::getSourceCrop(sp<Metadata>& meta, sp<Stream>& device,
+                           CropRect& crop)
 {
-    int ret;
-    uint32_t v4l2Width;
-    uint32_t v4l2Height;
-
-    sp<Stream> &device = src.mStream;
-    if (device == NULL) {
-        ALOGE("%s invalid device stream", __func__);
-        return 0;
+    int32_t arrayWidth = mCamera->mActiveArrayWidth;
+    int32_t arrayHeight = mCamera->mActiveArrayHeight;
+    if ((arrayWidth <= 0) || (arrayHeight <= 0)) {
+        return false;
     }
 
-    StreamBuffer *out = mCurrent;
-    if (out == NULL || out->mBufHandle == NULL) {
-        ALOGE("%s invalid buffer handle", __func__);
-        return 0;
+    // templates set empty region, treat it and full array as no zoom.
+    int32_t region[4];
+    int32_t left = 0, top = 0, right = arrayWidth, bottom = arrayHeight;
+    bool zoom = (meta != NULL) && (meta->getCropRegion(region) == NO_ERROR) &&
+                (region[2] > 0) && (region[3] > 0);
+    if (zoom) {
+        left = (region[0] < 0) ? 0 : region[0];
+        top = (region[1] < 0) ? 0 : region[1];
+        right = region[0] + region[2];
+        bottom = region[1] + region[3];
+        right = (right > arrayWidth) ? arrayWidth : right;
+        bottom = (bottom > arrayHeight) ? arrayHeight : bottom;
+        zoom = (left != 0) || (top != 0) || (right != arrayWidth) ||
+               (bottom != arrayHeight);
+    }
+
+    // frame rotated by 90 degrees is fit to stream by cropping it.
+    bool rotate = (mTransform & HAL_TRANSFORM_ROT_90) != 0;
+    if (!zoom && !rotate) {
+        return false;
     }
 
-    ret = mCamera->getV4l2Res(mWidth, mHeight, &v4l2Width, &v4l2Height);
-    if (ret) {
-        ALOGE("%s getV4l2Res failed, ret %d", __func__, ret);
-        return 0;
+    // keep at most max digital zoom.
+    int32_t minWidth = arrayWidth / MAX_DIGITAL_ZOOM;
+    int32_t minHeight = arrayHeight / MAX_DIGITAL_ZOOM;
+    if (zoom && ((right - left < minWidth) || (bottom - top < minHeight))) {
+        ALOGW("%s crop region %dx%d exceeds max zoom", __func__,
+              right - left, bottom - top);
+        int32_t cx = (left + right) / 2;
+        int32_t cy = (top + bottom) / 2;
+        left = cx - minWidth / 2;
+        top = cy - minHeight / 2;
+        left = (left < 0) ? 0 : ((left + minWidth > arrayWidth) ?
+                                  arrayWidth - minWidth : left);
+        top = (top < 0) ? 0 : ((top + minHeight > arrayHeight) ?
+                                arrayHeight - minHeight : top);
+        right = left + minWidth;
+        bottom = top + minHeight;
+    }
+
+    // map active array coordinates to device frame after transform.
+    int64_t w = rotate ? device->mHeight : device->mWidth;
+    int64_t h = rotate ? device->mWidth : device->mHeight;
+    int64_t x0 = left * w / arrayWidth;
+    int64_t y0 = top * h / arrayHeight;
+    int64_t cw = (right - left) * w / arrayWidth;
+    int64_t ch = (bottom - top) * h / arrayHeight;
+
+    // stream keeps its aspect ratio, crop is reduced around its center.
+    if (cw * mHeight > ch * mWidth) {
+        int64_t nw = ch * mWidth / mHeight;
+        x0 += (cw - nw) / 2;
+        cw = nw;
+    }
+    else if (cw * mHeight < ch * mWidth) {
+        int64_t nh = cw * mHeight / mWidth;
+        y0 += (ch - nh) / 2;
+        ch = nh;
+    }
+
+    // chroma is subsampled, keep crop on even pixels.
+    crop.left = (uint32_t)x0 & ~1;
+    crop.top = (uint32_t)y0 & ~1;
+    crop.width = (uint32_t)cw & ~1;
+    crop.height = (uint32_t)ch & ~1;
+    if ((crop.width < MIN_CROP_SIZE) || (crop.height < MIN_CROP_SIZE) ||
+        ((crop.width == w) && (crop.height == h))) {
+        return false;
     }
 
-    ALOGV("res, stream %dx%d, v4l2 %dx%d", mWidth, mHeight, v4l2Width, v4l2Height);
-
-    if ((device->mWidth != mWidth) || (device->mHeight != mHeight)) {
-        ALOGE("%s:%d, Software don't support resize, device->mFormat:0x%d, mFormat:0x%d", __FUNCTION__, __LINE__, device->mFormat, mFormat);
-        return 0;
+    if (crop.left + crop.width > w) {
+        crop.left = w - crop.width;
     }
-
-    if ((mFormat == HAL_PIXEL_FORMAT_YCbCr_420_888) &&
-        (device->mFormat == HAL_PIXEL_FORMAT_YCbCr_422_I)) {
-
-        uint8_t *pTmpBuf = (uint8_t *)src.mVirtAddr;
-        if ((v4l2Width != mWidth) || (v4l2Height != mHeight)) {
-            pTmpBuf = mCamera->getTmpBuf();
-            if (pTmpBuf == NULL) {
-                ALOGE("this %p, %s pTmpBuf null", this, __func__);
-                return 0;
-            }
-            YUYVCopyByLine(pTmpBuf, mWidth, mHeight, (uint8_t *)src.mVirtAddr, v4l2Width, v4l2Height);
-        }
-        convertYUYVtoNV12SP(pTmpBuf, (uint8_t *)out->mVirtAddr, mWidth, mHeight);
-
-    } else if ((mFormat == HAL_PIXEL_FORMAT_YCbCr_420_SP) &&
-               (device->mFormat == HAL_PIXEL_FORMAT_YCbCr_422_I)) {
-        convertYUYVtoNV12SP((uint8_t *)src.mVirtAddr, (uint8_t *)out->mVirtAddr, mWidth, mHeight);
-    } else if ((device->mFormat == HAL_PIXEL_FORMAT_YCbCr_420_SP) &&
-               (mFormat == HAL_PIXEL_FORMAT_YCrCb_420_SP)) {
-        ret = convertNV12toNV21(src);
-    } else if (device->mFormat == mFormat) {
-        YUYVCopyByLine((uint8_t *)out->mVirtAddr, mWidth, mHeight, (uint8_t *)src.mVirtAddr, v4l2Width, v4l2Height);
-    } else {
-        ALOGE("%s:%d, Software don't support format convert from 0x%x to 0x%x", __FUNCTION__, __LINE__, device->mFormat, mFormat);
-        return 0;
+    if (crop.top + crop.height > h) {
+        crop.top = h - crop.height;
     }
 
-    return 0;
+    // converters take the crop in device frame coordinates.
+    crop = FrameRotator::mapToSource(mTransform, device->mWidth,
+                                     device->mHeight, crop);
+    return true;
 }
 
 int32_t Stream::processFrameBuffer(StreamBuffer& src,
-                                   sp<Metadata> meta)
+                                   sp<Metadata> meta,
+                                   ConvertJob& job)
 {
     ALOGV("%s", __func__);
     sp<Stream>& device = src.mStream;
     if (device == NULL) {
         ALOGE("%s invalid device stream", __func__);
-        return 0;
+        return BAD_VALUE;
     }
 
     int32_t ret = 0;
@@ -769,37 +755,72 @@ int32_t Stream::processFrameBuffer(StreamBuffer& src,
         ALOGE("%s getV4l2Res failed, ret %d", __func__, ret);
     }
 
-    if ((mWidth != v4l2Width) || (mHeight != v4l2Height) ||
-            (mFormat != device->mFormat)) {
-        if ((mIpuFd > 0) && (mFormat != HAL_PIXEL_FORMAT_YCrCb_420_SP)) {
-            ret = processBufferWithIPU(src);
+    mTransform = mCamera->getTransform();
+    mCropped = getSourceCrop(meta, device, mCrop);
+    if ((mCropped || (mTransform != 0)) && (mCurrent != NULL) &&
+        (src.mPhyAddr == mCurrent->mPhyAddr)) {
+        // zero-copy frame is already the output, it can't be cropped.
+        ALOGV("%s crop ignored on zero-copy buffer", __func__);
+        mCropped = false;
+        mTransform = 0;
+    }
+    bool convert = (mWidth != v4l2Width) || (mHeight != v4l2Height) ||
+                   (mFormat != device->mFormat) || mCropped ||
+                   (mTransform != 0);
+    bool ipu = convert && (mIpuFd > 0) &&
+               (mFormat != HAL_PIXEL_FORMAT_YCrCb_420_SP);
+    // IPU does bob in VDI, other modes and paths need it done before.
+    if (src.mInterlaced &&
+            !(ipu && device->deinterlaceMode() == DEINTERLACE_BOB)) {
+        device->deinterlaceFrame(src);
+    }
+
+    job.mSrc = &src;
+    job.mOut = mCurrent;
+    job.mSrcFormat = device->mFormat;
+    job.mSrcWidth = device->mWidth;
+    job.mSrcHeight = device->mHeight;
+    job.mOutFormat = mFormat;
+    job.mOutWidth = mWidth;
+    job.mOutHeight = mHeight;
+    job.mCrop = mCrop;
+    job.mCropped = mCropped;
+    job.mTransform = mTransform;
+    // CPU pads V4L2 frame of stream size.
+    if (mCamera->getV4l2Res(mWidth, mHeight, &job.mV4l2Width,
+                            &job.mV4l2Height) != 0) {
+        job.mV4l2Width = mWidth;
+        job.mV4l2Height = mHeight;
+    }
+
+    if (convert) {
+        if (ipu) {
+            ret = processBufferWithIPU(src, job);
         } else if (mPxpFd > 0){
-            ret = processBufferWithPXP(src);
+            ret = processBufferWithPXP(src, job);
+        } else if ((mCropped || (mTransform != 0)) &&
+                   (mFormat == device->mFormat)) {
+            job.mPath = TRACE_PATH_GPU;
         } else {
-            ret = processBufferWithCPU(src);
+            job.mPath = TRACE_PATH_CPU;
         }
+    } else if ((mCurrent != NULL) && (src.mPhyAddr == mCurrent->mPhyAddr)) {
+        // zero-copy: sensor has written into this buffer directly.
+        ALOGV("%s zero-copy buffer", __func__);
     } else {
-        ret = processBufferWithGPU(src);
+        job.mPath = TRACE_PATH_GPU;
     }
 
     return ret;
 }
 
-int32_t Stream::processCaptureBuffer(StreamBuffer& src,
-        sp<Metadata> meta)
+int32_t Stream::waitAcquireFence(StreamBuffer* out)
 {
     int32_t res = 0;
-
-    ALOGV("%s", __func__);
-    StreamBuffer* out = mCurrent;
-    if (out == NULL || out->mBufHandle == NULL) {
-        ALOGE("%s invalid buffer handle", __func__);
-        return 0;
-    }
-
     if (out->mAcquireFence != -1) {
         res = sync_wait(out->mAcquireFence, CAMERA_SYNC_TIMEOUT);
         if (res == -ETIME) {
+            // fence is kept, error result returns it as release fence.
             ALOGE("%s: Timeout waiting on buffer acquire fence",
                     __func__);
             return res;
@@ -809,19 +830,64 @@ int32_t Stream::processCaptureBuffer(StreamBuffer& src,
             ALOGV("fence id:%d", out->mAcquireFence);
         }
         close(out->mAcquireFence);
+        out->mAcquireFence = -1;
     }
 
-    if (mJpeg) {
-        mJpegBuilder->reset();
-        mJpegBuilder->setMetadata(meta);
+    return 0;
+}
 
-        res = processJpegBuffer(src, meta);
-        mJpegBuilder->setMetadata(NULL);
+int32_t Stream::processCaptureBuffer(StreamBuffer& src,
+        sp<Metadata> meta)
+{
+    int32_t res = 0;
+    mTracePath = TRACE_PATH_NONE;
+
+    ALOGV("%s", __func__);
+    StreamBuffer* out = mCurrent;
+    if (out == NULL || out->mBufHandle == NULL) {
+        ALOGE("%s invalid buffer handle", __func__);
+        return 0;
     }
-    else {
-        res = processFrameBuffer(src, meta);
+
+    if (!mJpeg) {
+        ALOGE("%s frame stream converts on queue", __func__);
+        return INVALID_OPERATION;
+    }
+
+    res = waitAcquireFence(out);
+    if (res != 0) {
+        return res;
+    }
+
+    mJpegBuilder->reset();
+    mJpegBuilder->setMetadata(meta);
+
+    res = processJpegBuffer(src, meta);
+    mJpegBuilder->setMetadata(NULL);
+
+    return res;
+}
+
+int32_t Stream::prepareCaptureBuffer(StreamBuffer& src,
+        sp<Metadata> meta, ConvertJob& job)
+{
+    int32_t res = 0;
+
+    ALOGV("%s", __func__);
+    StreamBuffer* out = mCurrent;
+    if (out == NULL || out->mBufHandle == NULL) {
+        ALOGE("%s invalid buffer handle", __func__);
+        return BAD_VALUE;
+    }
+
+    res = waitAcquireFence(out);
+    if (res != 0) {
+        return res;
     }
 
+    res = processFrameBuffer(src, meta, job);
+    mTracePath = job.mPath;
+
     return res;
 }
 
@@ -896,5 +962,9 @@ void Stream::dump(int fd)
         dprintf(fd, "Buffer %d %d : %p\n", i, mNumBuffers,
                 mBuffers[i]->mBufHandle);
     }
+
+    if (mJpeg && mJpegBuilder != NULL) {
+        mJpegBuilder->dump(fd);
+    }
 }
 
@@ -27,6 +27,9 @@
 #include <linux/mxc_ion.h>
 #include <ion_ext.h>
 #include "JpegBuilder.h"
+#include "Deinterlacer.h"
+#include "CropScaler.h"
+#include "FrameRotator.h"
 
 #ifdef TARGET_FSL_IMX_2D
 #include "g2d.h"
@@ -35,6 +38,7 @@
 using namespace android;
 
 class Camera;
+class ConvertJob;
 // Stream represents a single input or output stream for a camera device.
 class Stream : public LightRefBase<Stream>
 {
@@ -46,8 +50,13 @@ public:
     // validate that astream's parameters match this stream's parameters
     bool isValidReuseStream(int id, camera3_stream_t *s);
 
+    // encode jpeg on caller thread.
     int32_t processCaptureBuffer(StreamBuffer& buf,
                                  sp<Metadata> meta);
+    // fill job which converts buf into current buffer, it is run
+    // by a ConvertQueue.
+    int32_t prepareCaptureBuffer(StreamBuffer& buf,
+                                 sp<Metadata> meta, ConvertJob& job);
 
     void setCurrentBuffer(StreamBuffer* out) {mCurrent = out;}
     virtual void* getG2dHandle() {return NULL;}
@@ -62,6 +71,19 @@ public:
     void setReuse(bool reuse) {mReuse = mReuse;}
     void setFps(uint32_t fps) {mFps = fps;}
     uint32_t fps() {return mFps;};
+    // path used by last processed buffer.
+    int32_t tracePath() {return mTracePath;}
+    // relative per pixel cost to scale device frame into this stream,
+    // 0 means no scaler is available for it.
+    uint32_t scaleCost();
+
+    // deinterlace frame of device stream in place.
+    virtual int32_t deinterlaceFrame(StreamBuffer& buf) {
+        buf.mInterlaced = false;
+        return 0;
+    }
+    virtual int32_t deinterlaceMode() {return DEINTERLACE_NONE;}
+    virtual bool isBottomFieldFirst() {return false;}
 
     int getType();
     bool isInputType();
@@ -73,13 +95,28 @@ protected:
     int32_t processJpegBuffer(StreamBuffer& src,
                               sp<Metadata> meta);
     int32_t processFrameBuffer(StreamBuffer& src,
-                               sp<Metadata> meta);
-    int32_t convertNV12toNV21(StreamBuffer& src);
-    int32_t processBufferWithPXP(StreamBuffer& src);
-    int32_t processBufferWithIPU(StreamBuffer& src);
-    int32_t processBufferWithGPU(StreamBuffer& src);
+                               sp<Metadata> meta, ConvertJob& job);
+    int32_t processBufferWithPXP(StreamBuffer& src, ConvertJob& job);
+    int32_t processBufferWithIPU(StreamBuffer& src, ConvertJob& job);
+    int32_t waitAcquireFence(StreamBuffer* out);
+    // crop of device frame requested by SCALER_CROP_REGION,
+    // false when the whole frame is used.
+    bool getSourceCrop(sp<Metadata>& meta, sp<Stream>& device,
+                       CropRect& crop);
+
+    // scale cost weights, jpeg encoder scales on CPU.
+    static const uint32_t SCALE_COST_IPU = 1;
+    static const uint32_t SCALE_COST_PXP = 2;
+    static const uint32_t SCALE_COST_CPU = 8;
+
+    // digital zoom limit, same as SCALER_AVAILABLE_MAX_DIGITAL_ZOOM.
+    static const int32_t MAX_DIGITAL_ZOOM = 4;
+    static const uint32_t MIN_CROP_SIZE = 16;
 
-    int32_t processBufferWithCPU(StreamBuffer& src);
+    // reserve jpeg buffers which are reused across captures.
+    int32_t reserveJpegBuffers(int32_t srcFormat, uint32_t srcWidth,
+                               uint32_t srcHeight, int32_t thumbWidth,
+                               int32_t thumbHeight);
 
 protected:
     // This stream is being reused. Used in stream configuration passes
@@ -118,6 +155,25 @@ protected:
     StreamBuffer* mCurrent;
     Camera* mCamera;
     sp<JpegBuilder> mJpegBuilder;
+
+    // jpeg buffers, sized at configure time and reused by every capture.
+    ScratchBuffer mRawFrame;
+    ScratchBuffer mThumbFrame;
+    ScratchBuffer mMainScratch;
+    ScratchBuffer mThumbScratch;
+
+    int32_t mTracePath;
+
+    // source crop of current request for digital zoom.
+    CropRect mCrop;
+    bool mCropped;
+    // HAL_TRANSFORM_* of current frame, set by camera properties.
+    int32_t mTransform;
+    // rotated still frame.
+    ScratchBuffer mTransformFrame;
+    // cropped still frame at capture size.
+    ScratchBuffer mCropFrame;
+    CropScaler mCropScaler;
 };
 
 #endif // STREAM_H_
@@ -56,6 +56,7 @@ private:
 
         // configure device.
         virtual int32_t onDeviceConfigureLocked();
+        virtual bool isInterlaced() {return true;}
     };
 
 private:
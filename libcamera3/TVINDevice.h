@@ -38,6 +38,7 @@ private:
 
         // configure device.
         virtual int32_t onDeviceConfigureLocked();
+        virtual bool isInterlaced() {return true;}
     };
 
 private:
@@ -56,6 +56,7 @@ typedef struct st_IFDGroup {
     uint32_t exifOffsetIdx;       // idx for TAG_EXIF_OFFSET in g_TiffGroup.eleArray
     uint32_t gpsOffsetIdx;        // idx for TAG_GPS_OFFSET in g_TiffGroup.eleArray
     uint32_t nextIFDOffset;       // offset of next IFD, now just used in g_TiffGroup to poit 1st IFD offset
+    uint32_t valueOffset[MAX_ELE_NUM]; // where value of each element is written
 } IFDGroup;
 
 static IFDGroup g_TiffGroup;
@@ -167,9 +168,12 @@ static int WriteOneIFD(IFDGroup* pGrp, uint32_t idx, uint8_t* pDst)
     }
 
     // set value
+    uint32_t inlineOffset = pGrp->fixedLenIdx + 8;
+    pGrp->valueOffset[idx] = pGrp->variedLenIdx;
     if ((TYPE_BYTE == pIFDSpec->type) || (TYPE_SHORT == pIFDSpec->type) ||
         (TYPE_LONG == pIFDSpec->type)) {
         pIFDSpec->value = pIFDEle->val1;
+        pGrp->valueOffset[idx] = inlineOffset;
     } else if ((TYPE_RATIONAL == pIFDSpec->type) || (TYPE_RATIONAL_SIGNED == pIFDSpec->type)) {
         if ((pIFDSpec->tag == TAG_GPS_LATITUDE) || (pIFDSpec->tag == TAG_GPS_LONGITUDE) || (pIFDSpec->tag == TAG_GPS_TIMESTAMP)) {
             pIFDSpec->count = 3;
@@ -195,6 +199,7 @@ static int WriteOneIFD(IFDGroup* pGrp, uint32_t idx, uint8_t* pDst)
         pIFDSpec->value = pGrp->variedLenIdx - IFDHEAD_OFFSET;
         if (strlen(pIFDEle->strVal) < 4) {
             strcpy((char*)(&pIFDSpec->value), pIFDEle->strVal);
+            pGrp->valueOffset[idx] = inlineOffset;
         } else if (TYPE_UNDEFINED == pIFDSpec->type) {
             memcpy((char*)pDst + pGrp->variedLenIdx, pIFDEle->strVal, tag_length);
             pGrp->variedLenIdx += tag_length;
@@ -551,6 +556,58 @@ static int InsertGrp(IFDGroup* pGrp, uint8_t* pDst)
     return 0;
 }
 
+// write SOI, APP1 head and IFD groups laid out by ScanIFD.
+static int InsertHead(uint8_t* pDst)
+{
+    int ret;
+    uint32_t app1Size;
+
+    // APP1 length is 16 bits.
+    if (g_mainJpgOffset > MAX_EXIF_MAIN_OFFSET) {
+        ALOGE("%s, APP1 size %d overflow", __func__, g_mainJpgOffset - 4);
+        return -1;
+    }
+
+    // write head
+    memcpy(pDst, SOIMark, ARRAYSIZE(SOIMark));
+    memcpy(pDst + ARRAYSIZE(SOIMark), APP1Head, ARRAYSIZE(APP1Head));
+    memcpy(pDst + IFDHEAD_OFFSET, IFDHead, ARRAYSIZE(IFDHead));
+
+    app1Size = (uint16_t)g_mainJpgOffset - 4;
+    pDst[4] = (uint8_t)(app1Size >> 8);
+    pDst[5] = (uint8_t)(app1Size & 0xff);
+
+    ret = InsertGrp(&g_TiffGroup, pDst);
+    if (ret) {
+        ALOGE("%s, InsertGrp g_TiffGroup failed, ret %d", __func__, ret);
+        return ret;
+    }
+
+    ret = InsertGrp(&g_GpsGroup, pDst);
+    if (ret) {
+        ALOGE("%s, InsertGrp g_GpsGroup failed, ret %d", __func__, ret);
+        return ret;
+    }
+
+    ret = InsertGrp(&g_ExifGroup, pDst);
+    if (ret) {
+        ALOGE("%s, InsertGrp g_ExifGroup failed, ret %d", __func__, ret);
+        return ret;
+    }
+
+    ret = InsertGrp(&g_TiffGroup_1st, pDst);
+    if (ret) {
+        ALOGE("%s, InsertGrp g_TiffGroup_1st failed, ret %d", __func__, ret);
+        return ret;
+    }
+
+    ALOGV("should equal, g_ExifGroup.variedLenIdx %d, g_thumbNailOffset %d",
+          g_ExifGroup.variedLenIdx,
+          g_thumbNailOffset);
+
+    return 0;
+}
+
 int InsertEXIFAndThumbnail(IFDEle* pIFDEle,
                            uint32_t eleNum,
                            uint8_t* pThumb,
@@ -562,7 +619,6 @@ int InsertEXIFAndThumbnail(IFDEle* pIFDEle,
 {
     int ret;
     uint32_t requestSize;
-    uint32_t app1Size;
 
     if ((pIFDEle == NULL) || (eleNum == 0) || (pDst == NULL) || (dstSize == 0) ||
         (pMain == NULL) || (mainSize == 0)) {
@@ -595,55 +651,267 @@ int InsertEXIFAndThumbnail(IFDEle* pIFDEle,
         return -1;
     }
 
-    // write head
-    memcpy(pDst, SOIMark, ARRAYSIZE(SOIMark));
-    memcpy(pDst + ARRAYSIZE(SOIMark), APP1Head, ARRAYSIZE(APP1Head));
-    memcpy(pDst + IFDHEAD_OFFSET, IFDHead, ARRAYSIZE(IFDHead));
-
-    app1Size = (uint16_t)g_mainJpgOffset - 4;
-    pDst[4] = (uint8_t)(app1Size >> 8);
-    pDst[5] = (uint8_t)(app1Size & 0xff);
-
-    ret = InsertGrp(&g_TiffGroup, pDst);
+    ret = InsertHead(pDst);
     if (ret) {
-        ALOGE("%s, InsertGrp g_TiffGroup failed, ret %d", __func__, ret);
         return ret;
     }
 
-    ret = InsertGrp(&g_GpsGroup, pDst);
+    ret = InsertThumb(pThumb, thumbSize, pDst, dstSize);
     if (ret) {
-        ALOGE("%s, InsertGrp g_GpsGroup failed, ret %d", __func__, ret);
+        ALOGE("%s, InsertThumb failed, ret %d", __func__, ret);
         return ret;
     }
 
-    ret = InsertGrp(&g_ExifGroup, pDst);
+    ret = InsertMain(pMain, mainSize, pDst, dstSize);
     if (ret) {
-        ALOGE("%s, InsertGrp g_ExifGroup failed, ret %d", __func__, ret);
+        ALOGE("%s, InsertMain failed, ret %d", __func__, ret);
         return ret;
     }
 
-    ret = InsertGrp(&g_TiffGroup_1st, pDst);
-    if (ret) {
-        ALOGE("%s, InsertGrp g_TiffGroup_1st failed, ret %d", __func__, ret);
-        return ret;
+    return ret;
+}
+
+
+// bytes of string value kept by template, 0 for numeric tags.
+static uint32_t GetStrSize(const IFDEle* pIFDEle)
+{
+    if (pIFDEle->strVal == NULL)
+        return 0;
+
+    if (GetTypeFromTag(pIFDEle->tag) == TYPE_UNDEFINED) {
+        return sizeof(ExifAsciiPrefix) +
+               strlen(pIFDEle->strVal + sizeof(ExifAsciiPrefix)) + 1;
     }
 
+    return strlen(pIFDEle->strVal) + 1;
+}
 
-    ALOGV("should equal, g_ExifGroup.variedLenIdx %d, g_thumbNailOffset %d",
-          g_ExifGroup.variedLenIdx,
-          g_thumbNailOffset);
+static int FindValueOffset(uint16_t tag, uint32_t* pOffset)
+{
+    IFDGroup* groups[] = {&g_TiffGroup, &g_GpsGroup, &g_ExifGroup};
 
-    ret = InsertThumb(pThumb, thumbSize, pDst, dstSize);
+    for (uint32_t i = 0; i < ARRAYSIZE(groups); i++) {
+        for (uint32_t j = 0; j < groups[i]->eleNum; j++) {
+            if (groups[i]->eleArray[j].tag == tag) {
+                *pOffset = groups[i]->valueOffset[j];
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
+
+static bool IsSameValue(const IFDEle* pOld, const IFDEle* pNew, uint32_t strSize)
+{
+    if ((pOld->val1 != pNew->val1) || (pOld->val2 != pNew->val2) ||
+        (pOld->val3 != pNew->val3) || (pOld->val4 != pNew->val4) ||
+        (pOld->val5 != pNew->val5) || (pOld->val6 != pNew->val6))
+        return false;
+
+    return (strSize == 0) || !memcmp(pOld->strVal, pNew->strVal, strSize);
+}
+
+// rewrite value of one element at its place in serialized head.
+static void PatchOneValue(const IFDEle* pIFDEle, uint32_t strSize, uint8_t* pDst)
+{
+    uint16_t type = GetTypeFromTag(pIFDEle->tag);
+
+    if ((TYPE_BYTE == type) || (TYPE_SHORT == type) || (TYPE_LONG == type)) {
+        *(uint32_t*)pDst = pIFDEle->val1;
+    } else if ((TYPE_RATIONAL == type) || (TYPE_RATIONAL_SIGNED == type)) {
+        *(uint32_t*)pDst = pIFDEle->val1;
+        *(uint32_t*)(pDst + 4) = pIFDEle->val2;
+        if ((pIFDEle->tag == TAG_GPS_LATITUDE) || (pIFDEle->tag == TAG_GPS_LONGITUDE) ||
+            (pIFDEle->tag == TAG_GPS_TIMESTAMP)) {
+            *(uint32_t*)(pDst + 8) = pIFDEle->val3;
+            *(uint32_t*)(pDst + 12) = pIFDEle->val4;
+            *(uint32_t*)(pDst + 16) = pIFDEle->val5;
+            *(uint32_t*)(pDst + 20) = pIFDEle->val6;
+        }
+    } else if (TYPE_ASCII == type) {
+        if (strSize <= 4)
+            memset(pDst, 0, 4);
+        memcpy(pDst, pIFDEle->strVal, strSize);
+    } else if (TYPE_UNDEFINED == type) {
+        // terminator is not part of the value.
+        memcpy(pDst, pIFDEle->strVal, strSize - 1);
+    }
+}
+
+int BuildEXIFTemplate(IFDEle* pIFDEle,
+                      uint32_t eleNum,
+                      bool hasThumb,
+                      EXIFTemplate* pTmpl)
+{
+    int ret;
+    uint32_t i;
+    uint32_t strUsed = 0;
+
+    if ((pIFDEle == NULL) || (eleNum == 0) || (eleNum > MAX_EXIF_TEMPLATE_ELES) ||
+        (pTmpl == NULL)) {
+        ALOGE("%s, para err, pIFDEle %p, eleNum %d, pTmpl %p",
+              __func__, pIFDEle, eleNum, pTmpl);
+        return -1;
+    }
+
+    pTmpl->size = 0;
+
+    // real thumbnail length is written per shot, only presence of IFD1
+    // and its size matter here.
+    ret = ScanIFD(pIFDEle, eleNum, hasThumb ? 1 : 0, 0, NULL);
     if (ret) {
-        ALOGE("%s, InsertThumb failed, ret %d", __func__, ret);
+        ALOGE("%s, ScanIFD failed, ret %d", __func__, ret);
         return ret;
     }
 
-    ret = InsertMain(pMain, mainSize, pDst, dstSize);
+    if (g_thumbNailOffset > MAX_EXIF_TEMPLATE_SIZE) {
+        ALOGE("%s, head size %d overflow", __func__, g_thumbNailOffset);
+        return -1;
+    }
+
+    ret = InsertHead(pTmpl->data);
     if (ret) {
-        ALOGE("%s, InsertMain failed, ret %d", __func__, ret);
         return ret;
     }
 
-    return ret;
+    for (i = 0; i < eleNum; i++) {
+        IFDEle* pEle = &pTmpl->eles[i];
+        uint32_t strSize = GetStrSize(&pIFDEle[i]);
+
+        if (FindValueOffset(pIFDEle[i].tag, &pTmpl->valueOffset[i])) {
+            ALOGE("%s, tag 0x%x not serialized", __func__, pIFDEle[i].tag);
+            return -1;
+        }
+
+        if (strUsed + strSize > MAX_EXIF_TEMPLATE_STRINGS) {
+            ALOGE("%s, strings overflow", __func__);
+            return -1;
+        }
+
+        *pEle = pIFDEle[i];
+        if (strSize > 0) {
+            pEle->strVal = pTmpl->strings + strUsed;
+            memcpy(pEle->strVal, pIFDEle[i].strVal, strSize);
+            strUsed += strSize;
+        }
+    }
+
+    pTmpl->eleNum = eleNum;
+    pTmpl->hasThumb = hasThumb;
+    pTmpl->thumbLengthOffset = hasThumb ? g_TiffGroup_1st.valueOffset[1] : 0;
+    pTmpl->size = g_thumbNailOffset;
+
+    return 0;
+}
+
+bool MatchEXIFTemplate(const EXIFTemplate* pTmpl,
+                       IFDEle* pIFDEle,
+                       uint32_t eleNum,
+                       bool hasThumb)
+{
+    uint32_t i;
+
+    if ((pTmpl == NULL) || (pTmpl->size == 0) || (pTmpl->eleNum != eleNum) ||
+        (pTmpl->hasThumb != hasThumb))
+        return false;
+
+    for (i = 0; i < eleNum; i++) {
+        const IFDEle* pEle = &pTmpl->eles[i];
+        if (pEle->tag != pIFDEle[i].tag)
+            return false;
+        if (GetStrSize(pEle) != GetStrSize(&pIFDEle[i]))
+            return false;
+        // rationals with val6 are sized as 3 values.
+        if ((pEle->val6 != 0) != (pIFDEle[i].val6 != 0))
+            return false;
+    }
+
+    return true;
+}
+
+int PatchEXIFTemplate(EXIFTemplate* pTmpl, IFDEle* pIFDEle, uint32_t eleNum)
+{
+    uint32_t i;
+
+    if (!MatchEXIFTemplate(pTmpl, pIFDEle, eleNum, pTmpl ? pTmpl->hasThumb : false))
+        return -1;
+
+    for (i = 0; i < eleNum; i++) {
+        IFDEle* pEle = &pTmpl->eles[i];
+        uint32_t strSize = GetStrSize(pEle);
+        char* strVal = pEle->strVal;
+
+        if (IsSameValue(pEle, &pIFDEle[i], strSize))
+            continue;
+
+        PatchOneValue(&pIFDEle[i], strSize, pTmpl->data + pTmpl->valueOffset[i]);
+
+        *pEle = pIFDEle[i];
+        pEle->strVal = strVal;
+        if (strSize > 0)
+            memcpy(strVal, pIFDEle[i].strVal, strSize);
+    }
+
+    return 0;
+}
+
+int WriteEXIFTemplate(const EXIFTemplate* pTmpl,
+                      uint8_t* pThumb,
+                      uint32_t thumbSize,
+                      uint32_t thumbReserve,
+                      uint32_t mainSize,
+                      uint8_t* pDst,
+                      uint32_t dstSize)
+{
+    uint32_t mainOffset;
+    uint32_t app1Size;
+
+    if ((pTmpl == NULL) || (pTmpl->size == 0) || (pDst == NULL) || (mainSize == 0)) {
+        ALOGE("%s, para err, pTmpl %p, pDst %p, mainSize %d",
+              __func__, pTmpl, pDst, mainSize);
+        return -1;
+    }
+
+    if (!pTmpl->hasThumb)
+        thumbReserve = 0;
+    if ((pThumb == NULL) || !pTmpl->hasThumb)
+        thumbSize = 0;
+
+    mainOffset = pTmpl->size + thumbReserve;
+    if ((mainOffset > MAX_EXIF_MAIN_OFFSET) || (mainOffset + mainSize > dstSize)) {
+        ALOGE("%s, invalid main offset %d, mainSize %d", __func__, mainOffset, mainSize);
+        return -1;
+    }
+
+    if (thumbSize > thumbReserve) {
+        // thumbnail outgrew its area, move main image once.
+        ALOGW("%s, thumbSize(%d) > thumbReserve(%d)", __func__, thumbSize, thumbReserve);
+        uint32_t newOffset = pTmpl->size + thumbSize;
+        if ((newOffset > MAX_EXIF_MAIN_OFFSET) || (newOffset + mainSize > dstSize)) {
+            ALOGE("%s, no room to move main image", __func__);
+            return -1;
+        }
+        memmove(pDst + newOffset, pDst + mainOffset, mainSize);
+        thumbReserve = thumbSize;
+        mainOffset = newOffset;
+    }
+
+    memcpy(pDst, pTmpl->data, pTmpl->size);
+
+    app1Size = mainOffset - 4;
+    pDst[4] = (uint8_t)(app1Size >> 8);
+    pDst[5] = (uint8_t)(app1Size & 0xff);
+
+    // tag keeps real thumbnail length, rest of reserved area is padding.
+    if (pTmpl->thumbLengthOffset > 0) {
+        *(uint32_t*)(pDst + pTmpl->thumbLengthOffset) = thumbSize;
+    }
+
+    if (thumbSize > 0) {
+        memcpy(pDst + pTmpl->size, pThumb, thumbSize);
+    }
+    memset(pDst + pTmpl->size + thumbSize, 0, thumbReserve - thumbSize);
+
+    return (int)(mainOffset + mainSize);
 }
@@ -36,6 +36,9 @@
 #define TAG_GPS_TIMESTAMP 0x0007
 #define TAG_GPS_DATESTAMP 0x001d
 
+// APP1 length field is 16 bits, main image data offset is limited.
+#define MAX_EXIF_MAIN_OFFSET (0xffff + 4)
+
 const static char ExifAsciiPrefix[] = {0x41, 0x53, 0x43, 0x49, 0x49, 0x0, 0x0, 0x0};
 
 typedef struct st_IFDEle {
@@ -58,4 +61,49 @@ int InsertEXIFAndThumbnail(IFDEle* pIFDEle,
                            uint8_t* pDst,
                            uint32_t dstSize);
 
+// serialized EXIF head of a tag table, it is built once and following
+// shots with the same tag layout only patch values which changed.
+#define MAX_EXIF_TEMPLATE_SIZE 4096
+#define MAX_EXIF_TEMPLATE_ELES 32
+#define MAX_EXIF_TEMPLATE_STRINGS 1024
+
+typedef struct st_EXIFTemplate {
+    uint8_t data[MAX_EXIF_TEMPLATE_SIZE];
+    // head size, thumbnail starts here. 0 if template is invalid.
+    uint32_t size;
+    bool hasThumb;
+    // where thumbnail length value is, 0 without thumbnail.
+    uint32_t thumbLengthOffset;
+    uint32_t eleNum;
+    // values last serialized, strVal points into strings.
+    IFDEle eles[MAX_EXIF_TEMPLATE_ELES];
+    uint32_t valueOffset[MAX_EXIF_TEMPLATE_ELES];
+    char strings[MAX_EXIF_TEMPLATE_STRINGS];
+} EXIFTemplate;
+
+int BuildEXIFTemplate(IFDEle* pIFDEle,
+                      uint32_t eleNum,
+                      bool hasThumb,
+                      EXIFTemplate* pTmpl);
+
+// same tags in same order with same value sizes, so only values differ.
+bool MatchEXIFTemplate(const EXIFTemplate* pTmpl,
+                       IFDEle* pIFDEle,
+                       uint32_t eleNum,
+                       bool hasThumb);
+
+// rewrite changed values in place, table must match template.
+int PatchEXIFTemplate(EXIFTemplate* pTmpl, IFDEle* pIFDEle, uint32_t eleNum);
+
+// main image data is encoded at offset size + thumbReserve of pDst
+// already, write head and thumbnail in front of it.
+// returns total jpeg size or -1.
+int WriteEXIFTemplate(const EXIFTemplate* pTmpl,
+                      uint8_t* pThumb,
+                      uint32_t thumbSize,
+                      uint32_t thumbReserve,
+                      uint32_t mainSize,
+                      uint8_t* pDst,
+                      uint32_t dstSize);
+
 #endif
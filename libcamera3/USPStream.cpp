@@ -149,6 +149,7 @@ int32_t USPStream::onFrameAcquireLocked()
         ALOGE("%s: VIDIOC_DQBUF Failed", __func__);
         return -1;
     }
+    accountFrameLocked(cfilledbuffer);
 
     return cfilledbuffer.index;
 }
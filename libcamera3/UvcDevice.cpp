@@ -317,7 +317,8 @@ int32_t LogiC920::C920Stream::onFrameAcquireLocked()
 
     while (mOmitFrames > 0) {
         mOmitFrames--;
-        UvcDevice::UvcStream::onFrameReturnLocked(index, *mBuffers[index]);
+        UvcDevice::UvcStream::onFrameReturnLocked(index,
+                *getQueuedBufferLocked(index));
         index = UvcDevice::UvcStream::onFrameAcquireLocked();
 
         if (index >= MAX_STREAM_BUFFERS || index < 0) {
@@ -0,0 +1,546 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CameraHAL"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+#include <utils/Log.h>
+#include "V4l2JpegEncoder.h"
+
+namespace android {
+
+// copy encoder output without APPn and COM segments, EXIF header is
+// inserted in front of the remaining tables like libjpeg output.
+static int copyWithoutAppSegments(const uint8_t *src, uint32_t size,
+                                  uint8_t *dst, uint32_t dstSize)
+{
+    if ((size < 4) || (src[0] != 0xFF) || (src[1] != 0xD8)) {
+        return 0;
+    }
+
+    uint32_t i = 2;
+    while ((i + 4 <= size) && (src[i] == 0xFF) &&
+           (((src[i + 1] >= 0xE0) && (src[i + 1] <= 0xEF)) ||
+            (src[i + 1] == 0xFE))) {
+        i += 2 + ((src[i + 2] << 8) | src[i + 3]);
+    }
+
+    if ((i + 2 > size) || (size - i + 2 > dstSize)) {
+        return 0;
+    }
+
+    dst[0] = 0xFF;
+    dst[1] = 0xD8;
+    memcpy(dst + 2, src + i, size - i);
+    return size - i + 2;
+}
+
+V4l2JpegEncoder* V4l2JpegEncoder::probe()
+{
+    char path[32];
+    char driver[32];
+    bool mplane = false;
+
+    for (int32_t i = 0; i < MAX_VIDEO_NODES; i++) {
+        snprintf(path, sizeof(path), "/dev/video%d", i);
+        int32_t fd = open(path, O_RDWR);
+        if (fd < 0) {
+            continue;
+        }
+
+        if (isJpegEncoder(fd, &mplane, driver, sizeof(driver))) {
+            ALOGI("%s use %s %s, mplane:%d", __func__, path, driver, mplane);
+            return new V4l2JpegEncoder(fd, mplane, driver);
+        }
+        close(fd);
+    }
+
+    return NULL;
+}
+
+bool V4l2JpegEncoder::isJpegEncoder(int32_t fd, bool *mplane, char *driver,
+                                    size_t size)
+{
+    struct v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) < 0) {
+        return false;
+    }
+
+    uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ?
+                    cap.device_caps : cap.capabilities;
+    if (caps & V4L2_CAP_VIDEO_M2M_MPLANE) {
+        *mplane = true;
+    }
+    else if (caps & V4L2_CAP_VIDEO_M2M) {
+        *mplane = false;
+    }
+    else {
+        return false;
+    }
+
+    // decoder node of the same IP has raw formats on capture queue.
+    struct v4l2_fmtdesc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.type = *mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
+                          V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    while (ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0) {
+        if (desc.pixelformat == V4L2_PIX_FMT_JPEG) {
+            snprintf(driver, size, "%s", (const char *)cap.driver);
+            return true;
+        }
+        desc.index++;
+    }
+
+    return false;
+}
+
+V4l2JpegEncoder::V4l2JpegEncoder(int32_t fd, bool mplane, const char *name)
+    : mFd(fd), mMplane(mplane), mSrcFormatCount(0), mConfigured(false),
+      mFourcc(0), mWidth(0), mHeight(0), mDstSize(0), mSrcMemory(0),
+      mQuality(-1), mSrcAddr(NULL), mSrcLength(0), mDstAddr(NULL),
+      mDstLength(0)
+{
+    snprintf(mName, sizeof(mName), "%s", name);
+
+    struct v4l2_fmtdesc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.type = mMplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE :
+                          V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    while ((mSrcFormatCount < MAX_SOURCE_FORMATS) &&
+           (ioctl(mFd, VIDIOC_ENUM_FMT, &desc) == 0)) {
+        mSrcFormats[mSrcFormatCount++] = desc.pixelformat;
+        desc.index++;
+    }
+}
+
+V4l2JpegEncoder::~V4l2JpegEncoder()
+{
+    Mutex::Autolock lock(mLock);
+    releaseLocked();
+    close(mFd);
+}
+
+bool V4l2JpegEncoder::isSourceFormat(uint32_t fourcc)
+{
+    for (uint32_t i = 0; i < mSrcFormatCount; i++) {
+        if (mSrcFormats[i] == fourcc) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint32_t V4l2JpegEncoder::getFrameSize(uint32_t fourcc, uint32_t width,
+                                       uint32_t height)
+{
+    switch (fourcc) {
+        case V4L2_PIX_FMT_NV12:
+            return width * height * 3 / 2;
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_NV16:
+            return width * height * 2;
+        default:
+            return 0;
+    }
+}
+
+bool V4l2JpegEncoder::isSupported(const JpegParams *params)
+{
+    if ((params->in_width != params->out_width) ||
+        (params->in_height != params->out_height)) {
+        return false;
+    }
+
+    uint32_t fourcc = convertPixelFormatToV4L2Format(params->format);
+    return (getFrameSize(fourcc, params->out_width, params->out_height) > 0) &&
+           isSourceFormat(fourcc);
+}
+
+int32_t V4l2JpegEncoder::setFormatLocked(uint32_t type, uint32_t fourcc,
+                                         uint32_t width, uint32_t height,
+                                         uint32_t size)
+{
+    // frames from sensor are packed, encoder must not expect padding.
+    uint32_t stride = 0;
+    if (fourcc == V4L2_PIX_FMT_YUYV) {
+        stride = width * 2;
+    }
+    else if (fourcc != V4L2_PIX_FMT_JPEG) {
+        stride = width;
+    }
+
+    struct v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = type;
+    if (mMplane) {
+        fmt.fmt.pix_mp.width = width;
+        fmt.fmt.pix_mp.height = height;
+        fmt.fmt.pix_mp.pixelformat = fourcc;
+        fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+        fmt.fmt.pix_mp.num_planes = 1;
+        fmt.fmt.pix_mp.plane_fmt[0].bytesperline = stride;
+        fmt.fmt.pix_mp.plane_fmt[0].sizeimage = size;
+    }
+    else {
+        fmt.fmt.pix.width = width;
+        fmt.fmt.pix.height = height;
+        fmt.fmt.pix.pixelformat = fourcc;
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        fmt.fmt.pix.bytesperline = stride;
+        fmt.fmt.pix.sizeimage = size;
+    }
+
+    if (ioctl(mFd, VIDIOC_S_FMT, &fmt) < 0) {
+        ALOGE("%s S_FMT type %d failed: %s", __func__, type, strerror(errno));
+        return BAD_VALUE;
+    }
+
+    uint32_t w = mMplane ? fmt.fmt.pix_mp.width : fmt.fmt.pix.width;
+    uint32_t h = mMplane ? fmt.fmt.pix_mp.height : fmt.fmt.pix.height;
+    uint32_t f = mMplane ? fmt.fmt.pix_mp.pixelformat : fmt.fmt.pix.pixelformat;
+    uint32_t s = mMplane ? fmt.fmt.pix_mp.plane_fmt[0].bytesperline :
+                           fmt.fmt.pix.bytesperline;
+    if ((w != width) || (h != height) || (f != fourcc) ||
+        (mMplane && (fmt.fmt.pix_mp.num_planes != 1)) ||
+        ((stride > 0) && (s != stride))) {
+        ALOGW("%s type %d adjusted to %dx%d, stride %d", __func__, type, w, h, s);
+        return BAD_VALUE;
+    }
+
+    return NO_ERROR;
+}
+
+int32_t V4l2JpegEncoder::mapBufferLocked(uint32_t type, void **addr,
+                                         size_t *length)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    memset(&buf, 0, sizeof(buf));
+    memset(&plane, 0, sizeof(plane));
+    buf.type = type;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = 0;
+    if (mMplane) {
+        buf.m.planes = &plane;
+        buf.length = 1;
+    }
+
+    if (ioctl(mFd, VIDIOC_QUERYBUF, &buf) < 0) {
+        ALOGE("%s QUERYBUF type %d failed: %s", __func__, type, strerror(errno));
+        return BAD_VALUE;
+    }
+
+    size_t size = mMplane ? plane.length : buf.length;
+    off_t offset = mMplane ? plane.m.mem_offset : buf.m.offset;
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     mFd, offset);
+    if (ptr == MAP_FAILED) {
+        ALOGE("%s mmap type %d failed: %s", __func__, type, strerror(errno));
+        return NO_MEMORY;
+    }
+
+    *addr = ptr;
+    *length = size;
+    return NO_ERROR;
+}
+
+int32_t V4l2JpegEncoder::configureLocked(uint32_t fourcc, uint32_t width,
+                                         uint32_t height, uint32_t dstSize,
+                                         uint32_t memory)
+{
+    uint32_t srcType = mMplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE :
+                                 V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    uint32_t dstType = mMplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
+                                 V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    releaseLocked();
+
+    int32_t ret = setFormatLocked(srcType, fourcc, width, height,
+                                  getFrameSize(fourcc, width, height));
+    if (ret == NO_ERROR) {
+        ret = setFormatLocked(dstType, V4L2_PIX_FMT_JPEG, width, height,
+                              dstSize);
+    }
+    if (ret != NO_ERROR) {
+        return ret;
+    }
+
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = 1;
+    req.type = srcType;
+    req.memory = memory;
+    if (ioctl(mFd, VIDIOC_REQBUFS, &req) < 0 || req.count < 1) {
+        ALOGE("%s REQBUFS output failed: %s", __func__, strerror(errno));
+        return BAD_VALUE;
+    }
+    mSrcMemory = memory;
+
+    memset(&req, 0, sizeof(req));
+    req.count = 1;
+    req.type = dstType;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(mFd, VIDIOC_REQBUFS, &req) < 0 || req.count < 1) {
+        ALOGE("%s REQBUFS capture failed: %s", __func__, strerror(errno));
+        releaseLocked();
+        return BAD_VALUE;
+    }
+
+    if (memory == V4L2_MEMORY_MMAP) {
+        ret = mapBufferLocked(srcType, &mSrcAddr, &mSrcLength);
+    }
+    if (ret == NO_ERROR) {
+        ret = mapBufferLocked(dstType, &mDstAddr, &mDstLength);
+    }
+    if (ret != NO_ERROR) {
+        releaseLocked();
+        return ret;
+    }
+
+    int type = srcType;
+    if (ioctl(mFd, VIDIOC_STREAMON, &type) < 0) {
+        ALOGE("%s STREAMON output failed: %s", __func__, strerror(errno));
+        releaseLocked();
+        return BAD_VALUE;
+    }
+    type = dstType;
+    if (ioctl(mFd, VIDIOC_STREAMON, &type) < 0) {
+        ALOGE("%s STREAMON capture failed: %s", __func__, strerror(errno));
+        releaseLocked();
+        return BAD_VALUE;
+    }
+
+    mConfigured = true;
+    mFourcc = fourcc;
+    mWidth = width;
+    mHeight = height;
+    mDstSize = dstSize;
+    mQuality = -1;
+    ALOGI("%s %dx%d, %c%c%c%c, dmabuf:%d", __func__, width, height,
+          fourcc & 0xFF, (fourcc >> 8) & 0xFF, (fourcc >> 16) & 0xFF,
+          (fourcc >> 24) & 0xFF, memory == V4L2_MEMORY_DMABUF);
+
+    return NO_ERROR;
+}
+
+void V4l2JpegEncoder::releaseLocked()
+{
+    uint32_t srcType = mMplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE :
+                                 V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    uint32_t dstType = mMplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
+                                 V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    // stream off returns queued buffers, it's harmless when not streaming.
+    int type = srcType;
+    ioctl(mFd, VIDIOC_STREAMOFF, &type);
+    type = dstType;
+    ioctl(mFd, VIDIOC_STREAMOFF, &type);
+
+    if (mSrcAddr != NULL) {
+        munmap(mSrcAddr, mSrcLength);
+        mSrcAddr = NULL;
+        mSrcLength = 0;
+    }
+    if (mDstAddr != NULL) {
+        munmap(mDstAddr, mDstLength);
+        mDstAddr = NULL;
+        mDstLength = 0;
+    }
+
+    struct v4l2_requestbuffers req;
+    if (mSrcMemory != 0) {
+        memset(&req, 0, sizeof(req));
+        req.type = srcType;
+        req.memory = mSrcMemory;
+        ioctl(mFd, VIDIOC_REQBUFS, &req);
+        mSrcMemory = 0;
+    }
+    memset(&req, 0, sizeof(req));
+    req.type = dstType;
+    req.memory = V4L2_MEMORY_MMAP;
+    ioctl(mFd, VIDIOC_REQBUFS, &req);
+
+    mConfigured = false;
+}
+
+int32_t V4l2JpegEncoder::queueLocked(uint32_t type, uint32_t memory,
+                                     int32_t fd, uint32_t bytesused,
+                                     uint32_t length)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    memset(&buf, 0, sizeof(buf));
+    memset(&plane, 0, sizeof(plane));
+    buf.type = type;
+    buf.memory = memory;
+    buf.index = 0;
+    if (mMplane) {
+        buf.m.planes = &plane;
+        buf.length = 1;
+        plane.bytesused = bytesused;
+        plane.length = length;
+        if (memory == V4L2_MEMORY_DMABUF) {
+            plane.m.fd = fd;
+        }
+    }
+    else {
+        buf.bytesused = bytesused;
+        buf.length = length;
+        if (memory == V4L2_MEMORY_DMABUF) {
+            buf.m.fd = fd;
+        }
+    }
+
+    if (ioctl(mFd, VIDIOC_QBUF, &buf) < 0) {
+        ALOGE("%s QBUF type %d failed: %s", __func__, type, strerror(errno));
+        return BAD_VALUE;
+    }
+
+    return NO_ERROR;
+}
+
+int32_t V4l2JpegEncoder::dequeueLocked(uint32_t type, uint32_t memory,
+                                       uint32_t *bytesused)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    memset(&buf, 0, sizeof(buf));
+    memset(&plane, 0, sizeof(plane));
+    buf.type = type;
+    buf.memory = memory;
+    if (mMplane) {
+        buf.m.planes = &plane;
+        buf.length = 1;
+    }
+
+    if (ioctl(mFd, VIDIOC_DQBUF, &buf) < 0) {
+        ALOGE("%s DQBUF type %d failed: %s", __func__, type, strerror(errno));
+        return BAD_VALUE;
+    }
+
+    if (buf.flags & V4L2_BUF_FLAG_ERROR) {
+        ALOGE("%s type %d buffer error", __func__, type);
+        return BAD_VALUE;
+    }
+
+    if (bytesused != NULL) {
+        *bytesused = mMplane ? plane.bytesused : buf.bytesused;
+    }
+
+    return NO_ERROR;
+}
+
+int V4l2JpegEncoder::encode(JpegParams *params)
+{
+    uint32_t srcType = mMplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE :
+                                 V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    uint32_t dstType = mMplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
+                                 V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    uint32_t fourcc = convertPixelFormatToV4L2Format(params->format);
+    uint32_t width = params->out_width;
+    uint32_t height = params->out_height;
+    uint32_t frameSize = getFrameSize(fourcc, width, height);
+    uint32_t memory = (params->src_fd > 0) ? V4L2_MEMORY_DMABUF :
+                                             V4L2_MEMORY_MMAP;
+    uint32_t bytesused = 0;
+
+    if ((frameSize == 0) || (params->src_size > 0 &&
+                             (uint32_t)params->src_size < frameSize)) {
+        ALOGE("%s invalid source, size %d", __func__, params->src_size);
+        return 0;
+    }
+
+    Mutex::Autolock lock(mLock);
+    if (!mConfigured || (fourcc != mFourcc) || (width != mWidth) ||
+        (height != mHeight) || (memory != mSrcMemory) ||
+        ((uint32_t)params->dst_size > mDstSize)) {
+        if (configureLocked(fourcc, width, height, params->dst_size,
+                            memory) != NO_ERROR) {
+            return 0;
+        }
+    }
+
+    if (params->quality != mQuality) {
+        struct v4l2_control ctrl;
+        ctrl.id = V4L2_CID_JPEG_COMPRESSION_QUALITY;
+        ctrl.value = params->quality;
+        if (ioctl(mFd, VIDIOC_S_CTRL, &ctrl) < 0) {
+            ALOGW("%s set quality %d failed", __func__, params->quality);
+        }
+        mQuality = params->quality;
+    }
+
+    uint32_t srcLength = mSrcLength;
+    if (memory == V4L2_MEMORY_MMAP) {
+        if (mSrcLength < frameSize) {
+            releaseLocked();
+            return 0;
+        }
+        memcpy(mSrcAddr, params->src, frameSize);
+    }
+    else {
+        srcLength = (params->src_size > 0) ? params->src_size : frameSize;
+    }
+
+    if ((queueLocked(dstType, V4L2_MEMORY_MMAP, -1, 0, mDstLength) != NO_ERROR) ||
+        (queueLocked(srcType, memory, params->src_fd, frameSize,
+                     srcLength) != NO_ERROR)) {
+        releaseLocked();
+        return 0;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = mFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ret = poll(&pfd, 1, ENCODE_TIMEOUT_MS);
+    if ((ret <= 0) || !(pfd.revents & POLLIN)) {
+        ALOGE("%s encode timeout, ret %d", __func__, ret);
+        releaseLocked();
+        return 0;
+    }
+
+    // capture is done after source is consumed, so both dequeue at once.
+    if ((dequeueLocked(dstType, V4L2_MEMORY_MMAP, &bytesused) != NO_ERROR) ||
+        (dequeueLocked(srcType, memory, NULL) != NO_ERROR)) {
+        releaseLocked();
+        return 0;
+    }
+
+    if (bytesused > mDstLength) {
+        bytesused = mDstLength;
+    }
+
+    int size = copyWithoutAppSegments((const uint8_t *)mDstAddr, bytesused,
+                                      params->dst, params->dst_size);
+    if (size == 0) {
+        ALOGE("%s invalid encoder output, size %d", __func__, bytesused);
+    }
+
+    return size;
+}
+
+};
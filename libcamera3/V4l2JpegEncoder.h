@@ -0,0 +1,90 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _V4L2_JPEG_ENCODER_H
+#define _V4L2_JPEG_ENCODER_H
+
+#include <utils/threads.h>
+#include "JpegBuilder.h"
+
+namespace android {
+
+// JPEG encoder exposed as V4L2 mem2mem device, such as mxc-jpeg on i.MX8.
+// source frame is imported by dmabuf when it has one, copied otherwise.
+// the device can't scale, so only same size encode is supported.
+class V4l2JpegEncoder : public JpegEncoderBackend
+{
+public:
+    // scan video nodes for M2M device which outputs JPEG, NULL if none.
+    static V4l2JpegEncoder* probe();
+    virtual ~V4l2JpegEncoder();
+
+    virtual const char* name() {return mName;}
+    virtual bool isSupported(const JpegParams *params);
+    virtual int encode(JpegParams *params);
+
+    // bytes of source frame the device takes, 0 if fourcc isn't known.
+    static uint32_t getFrameSize(uint32_t fourcc, uint32_t width,
+                                 uint32_t height);
+
+private:
+    static const int32_t MAX_VIDEO_NODES = 64;
+    static const int32_t ENCODE_TIMEOUT_MS = 1000;
+    static const uint32_t MAX_SOURCE_FORMATS = 16;
+
+    V4l2JpegEncoder(int32_t fd, bool mplane, const char *name);
+    static bool isJpegEncoder(int32_t fd, bool *mplane, char *driver,
+                              size_t size);
+    bool isSourceFormat(uint32_t fourcc);
+
+    // both queues are set up once and kept while size, format and
+    // source memory type stay the same.
+    int32_t configureLocked(uint32_t fourcc, uint32_t width, uint32_t height,
+                            uint32_t dstSize, uint32_t memory);
+    int32_t setFormatLocked(uint32_t type, uint32_t fourcc, uint32_t width,
+                            uint32_t height, uint32_t size);
+    int32_t mapBufferLocked(uint32_t type, void **addr, size_t *length);
+    int32_t queueLocked(uint32_t type, uint32_t memory, int32_t fd,
+                        uint32_t bytesused, uint32_t length);
+    int32_t dequeueLocked(uint32_t type, uint32_t memory, uint32_t *bytesused);
+    void    releaseLocked();
+
+    Mutex mLock;
+    int32_t mFd;
+    bool mMplane;
+    char mName[32];
+    // raw formats accepted on output queue.
+    uint32_t mSrcFormats[MAX_SOURCE_FORMATS];
+    uint32_t mSrcFormatCount;
+
+    bool mConfigured;
+    uint32_t mFourcc;
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint32_t mDstSize;
+    // V4L2_MEMORY_DMABUF, or V4L2_MEMORY_MMAP when frame is copied.
+    uint32_t mSrcMemory;
+    int32_t mQuality;
+
+    void *mSrcAddr;
+    size_t mSrcLength;
+    void *mDstAddr;
+    size_t mDstLength;
+};
+
+};
+
+#endif
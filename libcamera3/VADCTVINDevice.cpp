@@ -526,6 +526,7 @@ int32_t VADCTVINDevice::VADCTVinStream::onFrameAcquireLocked()
         ALOGE("%s: VIDIOC_DQBUF Failed", __func__);
         return -1;
     }
+    accountFrameLocked(cfilledbuffer);
 
     // Do format convert and transfer converted data to stream.
     int32_t rets = convertYUV444toNV12((u8 *)mV4L2Buffers[cfilledbuffer.index]->mVirtAddr, (u8 *)mBuffers[cfilledbuffer.index]->mVirtAddr, mWidth, mHeight);
@@ -43,6 +43,7 @@ private:
             StreamBuffer* mV4L2Buffers[MAX_STREAM_BUFFERS];
             // configure device.
             virtual int32_t onDeviceConfigureLocked();
+            virtual bool isInterlaced() {return true;}
             // start device.
             virtual int32_t onDeviceStartLocked();
             // stop device.
@@ -14,16 +14,34 @@
  * limitations under the License.
  */
 
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sync/sync.h>
 #include "VideoStream.h"
 
 using namespace android;
 
 VideoStream::VideoStream(Camera* device)
     : Stream(device), mState(STATE_INVALID),
-      mChanged(false), mDev(-1),
-      mAllocatedBuffers(0)
+      mChanged(false), mInFlight(NULL), mDev(-1),
+      mAllocatedBuffers(0), mZeroCopy(false),
+      mBoundRequests(0), mZslDepth(0), mZsl(false),
+      mZslHead(0), mZslCount(0), mFrameCount(0),
+      mLastSequence(0), mLastTimestamp(0), mFrameTime(0), mDroppedFrames(0),
+      mLateFrames(0), mTimeoutFrames(0), mStallCount(0),
+      mConvertingFrames(0)
 {
     g2dHandle = NULL;
+    for (uint32_t i=0; i<MAX_STREAM_BUFFERS; i++) {
+        mSlots[i] = NULL;
+        mZslFrames[i] = NULL;
+        mZslStamps[i] = 0;
+        mConvertFrames[i].mBuffer = NULL;
+        mConvertFrames[i].mHolds = 0;
+        mConvertFrames[i].mRelease = RELEASE_NONE;
+        mConvertFrames[i].mStamp = 0;
+    }
     mMessageThread = new MessageThread(this);
 }
 
@@ -31,6 +49,8 @@ VideoStream::~VideoStream()
 {
     ALOGI("%s", __func__);
     destroyStream();
+    // jobs call back into this stream, finish them before members go.
+    mConvertQueue.stop();
     mMessageQueue.clearMessages();
     mMessageQueue.clearCommands();
     mMessageThread.clear();
@@ -49,7 +69,7 @@ void VideoStream::destroyStream()
     }
 
     if (mMessageThread != NULL && mMessageThread->isRunning()) {
-        mMessageQueue.postMessage(new CMessage(MSG_EXIT, 1), 1);
+        mMessageQueue.postMessage(MSG_EXIT, 1, 1);
         mMessageThread->requestExit();
         mMessageThread->join();
     }
@@ -75,11 +95,11 @@ int32_t VideoStream::openDev(const char* name)
     return 0;
 }
 
-int32_t VideoStream::configure(sp<Stream> stream)
+int32_t VideoStream::configure(sp<Stream> stream, uint32_t width,
+                               uint32_t height)
 {
     ALOGV("%s", __func__);
-    if ((stream->width() == 0) || (stream->height() == 0)
-         || (stream->format() == 0)) {
+    if ((width == 0) || (height == 0) || (stream->format() == 0)) {
         ALOGE("%s: invalid stream parameters", __func__);
         return BAD_VALUE;
     }
@@ -89,20 +109,60 @@ int32_t VideoStream::configure(sp<Stream> stream)
     Mutex::Autolock lock(mLock);
 
     ConfigureParam* params = new ConfigureParam();
-    params->mWidth  = stream->width();
-    params->mHeight = stream->height();
+    params->mWidth  = width;
+    params->mHeight = height;
     params->mFormat = sensorFormat;
     params->mFps = stream->fps();
     params->mBuffers = stream->bufferNum();
     params->mIsJpeg = stream->isJpeg();
+    // still stream keeps extra buffers for zero shutter lag.
+    params->mZslDepth = params->mIsJpeg ? getZslDepth() : 0;
+    params->mBuffers += params->mZslDepth;
+    params->mConverted = stream->isJpeg() || (stream->scaleCost() > 0);
 
     ALOGI("%s: w:%d, h:%d, sensor format:0x%x, stream format:0x%x, fps:%d, num:%d",
            __func__, params->mWidth, params->mHeight, params->mFormat, stream->format(), params->mFps, params->mBuffers);
-    mMessageQueue.postMessage(new CMessage(MSG_CONFIG, (uintptr_t)params), 0);
+    int32_t ret = mMessageQueue.postMessage(MSG_CONFIG, (uintptr_t)params, 0);
+    if (ret != NO_ERROR) {
+        ALOGE("%s post config message failed", __func__);
+        delete params;
+        return ret;
+    }
 
     return 0;
 }
 
+bool VideoStream::isConfigCompatibleLocked(ConfigureParam* params)
+{
+    if ((mWidth != params->mWidth) || (mHeight != params->mHeight)) {
+        return false;
+    }
+
+    if (mFormat != params->mFormat) {
+        if (!params->mConverted) {
+            return false;
+        }
+        // jpeg encoder takes only these formats.
+        if (params->mIsJpeg && (mFormat != HAL_PIXEL_FORMAT_YCbCr_420_SP) &&
+            (mFormat != HAL_PIXEL_FORMAT_YCbCr_422_I) &&
+            (mFormat != HAL_PIXEL_FORMAT_YCbCr_422_SP)) {
+            return false;
+        }
+    }
+
+    // lower frame rate is paced by requests, higher one needs new mode.
+    if (!params->mIsJpeg && ((uint32_t)params->mFps > mFps)) {
+        return false;
+    }
+
+    // more held frames need buffer reallocation.
+    if (params->mZslDepth > (int32_t)mZslDepth) {
+        return false;
+    }
+
+    return true;
+}
+
 int32_t VideoStream::handleConfigureLocked(ConfigureParam* params)
 {
     int32_t ret   = 0;
@@ -113,11 +173,12 @@ int32_t VideoStream::handleConfigureLocked(ConfigureParam* params)
         return 0;
     }
 
-    // when width&height&format are same, keep it to reduce start/stop time.
-    if ((mWidth == params->mWidth) && (mHeight == params->mHeight)
-         && (mFormat == params->mFormat)  && (params->mIsJpeg || (mFps == params->mFps))) {
-        ALOGI("%s, same config, res %dx%d, fmt 0x%x, fps %d, %d, jpg %d",
-          __func__, mWidth, mHeight, mFormat, mFps, params->mFps, params->mIsJpeg);
+    // keep streaming when conversion stage can serve the new stream
+    // from current sensor mode, it avoids stop/start and reallocation.
+    if (isConfigCompatibleLocked(params)) {
+        ALOGI("%s, keep config, res %dx%d, fmt 0x%x, 0x%x, fps %d, %d, jpg %d",
+          __func__, mWidth, mHeight, mFormat, params->mFormat, mFps,
+          params->mFps, params->mIsJpeg);
         return 0;
     }
 
@@ -145,6 +206,7 @@ int32_t VideoStream::handleConfigureLocked(ConfigureParam* params)
     mFormat = params->mFormat;
     mFps = params->mFps;
     mNumBuffers = params->mBuffers;
+    mZslDepth = params->mZslDepth;
 
     ret = onDeviceConfigureLocked();
     if (ret != 0) {
@@ -176,6 +238,25 @@ int32_t VideoStream::handleStartLocked(bool force)
         }
     }
 
+    configureDeinterlaceLocked();
+    // fields are processed in place, not in framework buffers,
+    // and rotated frames need a conversion pass.
+    mZeroCopy = isZeroCopySupported() &&
+                (mDeinterlacer.mode() == DEINTERLACE_NONE) &&
+                (mCamera->getTransform() == 0);
+    ALOGI("%s zero-copy mode:%d", __func__, mZeroCopy);
+    // held frames conflict with request bound buffers in zero-copy mode.
+    mZsl = (mZslDepth > 0) && !mZeroCopy;
+    ALOGI("%s zsl mode:%d, depth:%d", __func__, mZsl, mZslDepth);
+
+    mFrameCount = 0;
+    mLastSequence = 0;
+    mLastTimestamp = 0;
+    mDroppedFrames = 0;
+    mLateFrames = 0;
+    mTimeoutFrames = 0;
+    mStallCount = 0;
+
     ret = onDeviceStartLocked();
     if (ret != 0) {
         mState = STATE_ERROR;
@@ -194,7 +275,7 @@ int32_t VideoStream::closeDev()
     Mutex::Autolock lock(mLock);
 
     if (mState != STATE_ERROR && mMessageThread->isRunning()) {
-        mMessageQueue.postMessage(new CMessage(MSG_CLOSE, 0), 1);
+        mMessageQueue.postMessage(MSG_CLOSE, 0, 1);
     }
     else {
         ALOGI("%s thread is exit", __func__);
@@ -218,6 +299,9 @@ int32_t VideoStream::handleStopLocked(bool force)
         return 0;
     }
 
+    ALOGI("%s frames:%d, dropped:%d, late:%d, timeout:%d", __func__,
+          mFrameCount, mDroppedFrames, mLateFrames, mTimeoutFrames);
+
     ret = onDeviceStopLocked();
     if (ret < 0) {
         mState = STATE_ERROR;
@@ -227,6 +311,13 @@ int32_t VideoStream::handleStopLocked(bool force)
         mState = STATE_STOP;
     }
 
+    // stream off returns all queued buffers, requests must bind again.
+    for (uint32_t i=0; i<MAX_STREAM_BUFFERS; i++) {
+        mSlots[i] = NULL;
+    }
+    mBoundRequests = 0;
+    clearZslFramesLocked(false);
+
     if (force || mChanged) {
         ret = freeBuffersLocked();
         if (ret != 0) {
@@ -249,15 +340,187 @@ int32_t VideoStream::handleStopLocked(bool force)
 
 int32_t VideoStream::requestCapture(sp<CaptureRequest> req)
 {
-    Mutex::Autolock lock(mLock);
+    status_t ret = NO_ERROR;
+    {
+        Mutex::Autolock lock(mLock);
+
+        mRequests.push_back(req);
 
-    mRequests.push_back(req);
+        ret = mMessageQueue.postMessage(MSG_FRAME);
+        if (ret == NO_ERROR) {
+            return 0;
+        }
 
-    mMessageQueue.postMessage(new CMessage(MSG_FRAME, 0));
+        // no frame message would ever handle it.
+        List< sp<CaptureRequest> >::iterator last = mRequests.end();
+        mRequests.erase(--last);
+    }
 
+    // request is accepted, it fails through the callback.
+    ALOGE("%s post frame message failed: %d", __func__, ret);
+    req->onRequestError();
     return 0;
 }
 
+int32_t VideoStream::flush()
+{
+    ALOGI("%s", __func__);
+    List< sp<CaptureRequest> > flushed;
+    {
+        Mutex::Autolock lock(mLock);
+        mMessageQueue.removeMessages(MSG_FRAME);
+
+        // the request in process is finished by message thread.
+        while (mInFlight != NULL) {
+            if (mCaptureDone.waitRelative(mLock, FLUSH_TIMEOUT) != NO_ERROR) {
+                ALOGW("%s wait request in process timeout", __func__);
+                break;
+            }
+        }
+
+        // requests own buffers queued to V4L2 can't be returned
+        // without stream off, they are finished by sensor frames.
+        uint32_t bound = mZeroCopy ? mBoundRequests : 0;
+        uint32_t kept = 0;
+        uint32_t i = 0;
+        List< sp<CaptureRequest> >::iterator cur = mRequests.begin();
+        while (cur != mRequests.end()) {
+            if ((*cur == mInFlight) || (i < bound)) {
+                if (*cur != mInFlight) {
+                    kept++;
+                }
+                cur++;
+            }
+            else {
+                flushed.push_back(*cur);
+                cur = mRequests.erase(cur);
+            }
+            i++;
+        }
+
+        for (i=0; i<kept; i++) {
+            mMessageQueue.postMessage(MSG_FRAME);
+        }
+    }
+
+    // buffers of finished requests are still converted, a stuck job
+    // doesn't hold flush, the ones behind it fail their buffers.
+    mConvertQueue.drain(FLUSH_TIMEOUT);
+    {
+        Mutex::Autolock lock(mLock);
+        // held frames go back to V4L2.
+        clearZslFramesLocked(true);
+    }
+
+    ALOGI("%s flushed %d requests", __func__, (int32_t)flushed.size());
+    List< sp<CaptureRequest> >::iterator it;
+    for (it = flushed.begin(); it != flushed.end(); it++) {
+        (*it)->onRequestError();
+    }
+
+    return 0;
+}
+
+int32_t VideoStream::getFrameTimeoutLocked()
+{
+    if (mFrameCount == 0) {
+        return FIRST_FRAME_TIMEOUT_MS;
+    }
+
+    int32_t fps = (mFps > 0) ? mFps : 30;
+    int32_t timeout = FRAME_TIMEOUT_PERIODS * 1000 / fps;
+    if (timeout < FRAME_TIMEOUT_MIN_MS) {
+        timeout = FRAME_TIMEOUT_MIN_MS;
+    }
+
+    return timeout;
+}
+
+// mLock is released when wait, so configure/flush/close are not
+// blocked by a stalled sensor. mDev is only closed by message thread.
+int32_t VideoStream::waitFrame()
+{
+    struct pollfd pfd;
+    int32_t timeout = 0;
+    {
+        Mutex::Autolock lock(mLock);
+        pfd.fd = mDev;
+        timeout = getFrameTimeoutLocked();
+    }
+
+    if (pfd.fd <= 0) {
+        ALOGE("%s invalid fd handle", __func__);
+        return BAD_VALUE;
+    }
+
+    pfd.events = POLLIN | POLLPRI;
+    pfd.revents = 0;
+    int ret = 0;
+    do {
+        ret = poll(&pfd, 1, timeout);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if (ret == 0) {
+        Mutex::Autolock lock(mLock);
+        mTimeoutFrames++;
+        mStallCount++;
+        ALOGW("%s no frame in %d ms", __func__, timeout);
+        return TIMED_OUT;
+    }
+
+    if (ret < 0) {
+        ALOGE("%s poll failed: %s", __func__, strerror(errno));
+        return BAD_VALUE;
+    }
+
+    if (pfd.revents & POLLERR) {
+        ALOGE("%s poll error, revents:0x%x", __func__, pfd.revents);
+        return BAD_VALUE;
+    }
+
+    Mutex::Autolock lock(mLock);
+    mStallCount = 0;
+    return 0;
+}
+
+void VideoStream::accountFrameLocked(const struct v4l2_buffer& buf)
+{
+    nsecs_t stamp = (nsecs_t)buf.timestamp.tv_sec * 1000000000LL +
+                    (nsecs_t)buf.timestamp.tv_usec * 1000LL;
+
+    if (mFrameCount > 0) {
+        // some drivers don't fill sequence, gap is 0 then.
+        uint32_t gap = buf.sequence - mLastSequence;
+        if (gap > 1) {
+            mDroppedFrames += gap - 1;
+            ALOGV("%s dropped %d frames before sequence %d",
+                  __func__, gap - 1, buf.sequence);
+        }
+
+        int32_t fps = (mFps > 0) ? mFps : 30;
+        nsecs_t period = 1000000000LL / fps;
+        if ((gap <= 1) && (stamp - mLastTimestamp > period * 3 / 2)) {
+            mLateFrames++;
+            ALOGV("%s late frame, interval:%lld ns", __func__,
+                  stamp - mLastTimestamp);
+        }
+    }
+
+    mLastSequence = buf.sequence;
+    mLastTimestamp = stamp;
+    mFrameCount++;
+
+    // age of held frames is measured with it, fall back to dequeue time
+    // if driver stamps frames with another clock.
+    if (((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+            V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) && (stamp > 0)) {
+        mFrameTime = stamp;
+    }
+    else {
+        mFrameTime = systemTime();
+    }
+}
+
 StreamBuffer* VideoStream::acquireFrameLocked()
 {
     int32_t index = onFrameAcquireLocked();
@@ -266,6 +529,69 @@ StreamBuffer* VideoStream::acquireFrameLocked()
         return NULL;
     }
 
+    StreamBuffer* buf = getQueuedBufferLocked(index);
+    if (buf != NULL) {
+        buf->mInterlaced = (mDeinterlacer.mode() != DEINTERLACE_NONE);
+    }
+
+    return buf;
+}
+
+void VideoStream::configureDeinterlaceLocked()
+{
+    int32_t mode = isInterlaced() ? Deinterlacer::getConfiguredMode()
+                                  : DEINTERLACE_NONE;
+    if (mode == DEINTERLACE_NONE) {
+        mDeinterlacer.configure(mode, mFormat, mWidth, mHeight,
+                                V4L2_FIELD_NONE, false);
+        return;
+    }
+
+    // some decoders report progressive field, frames are woven anyway.
+    uint32_t field = V4L2_FIELD_INTERLACED;
+    struct v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if ((ioctl(mDev, VIDIOC_G_FMT, &fmt) == 0) &&
+            (fmt.fmt.pix.field != V4L2_FIELD_NONE) &&
+            (fmt.fmt.pix.field != V4L2_FIELD_ANY)) {
+        field = fmt.fmt.pix.field;
+    }
+
+    bool bottomFirst = false;
+    if ((field == V4L2_FIELD_INTERLACED_BT) ||
+            (field == V4L2_FIELD_SEQ_BT)) {
+        bottomFirst = true;
+    }
+    else if (field == V4L2_FIELD_INTERLACED) {
+        // field order depends on standard, NTSC transmits bottom field first.
+        v4l2_std_id std = 0;
+        if (ioctl(mDev, VIDIOC_G_STD, &std) == 0) {
+            bottomFirst = (std & V4L2_STD_525_60) != 0;
+        }
+    }
+
+    mDeinterlacer.configure(mode, mFormat, mWidth, mHeight,
+                            field, bottomFirst);
+}
+
+int32_t VideoStream::deinterlaceFrame(StreamBuffer& buf)
+{
+    int32_t ret = mDeinterlacer.process(buf);
+    buf.mInterlaced = false;
+    return ret;
+}
+
+StreamBuffer* VideoStream::getQueuedBufferLocked(int32_t index)
+{
+    if (index >= MAX_STREAM_BUFFERS || index < 0) {
+        return NULL;
+    }
+
+    if (mZeroCopy) {
+        return mSlots[index];
+    }
+
     return mBuffers[index];
 }
 
@@ -296,6 +622,10 @@ int32_t VideoStream::handleCaptureFrame()
     int32_t ret = 0;
     ALOGV("%s", __func__);
 
+    if (mZeroCopy) {
+        return handleZeroCopyFrame();
+    }
+
     List< sp<CaptureRequest> >::iterator cur;
     sp<CaptureRequest> req = NULL;
     StreamBuffer *buf = NULL;
@@ -307,6 +637,7 @@ int32_t VideoStream::handleCaptureFrame()
 
         cur = mRequests.begin();
         req = *cur;
+        mInFlight = req;
     }
     //advanced character.
     ret = processCaptureSettings(req);
@@ -317,9 +648,27 @@ int32_t VideoStream::handleCaptureFrame()
         return 0;
     }
 
+    bool fromZsl = false;
     {
+        Mutex::Autolock lock(mLock);
+        if (mZsl && isStillRequest(req)) {
+            buf = getZslFrameLocked();
+            fromZsl = (buf != NULL);
+        }
+        if (buf == NULL) {
+            waitConvertFramesLocked();
+        }
+    }
+
+    FrameTrace& trace = mCamera->getTrace();
+    nsecs_t begin = systemTime();
+    nsecs_t stamp = 0;
+    if ((buf == NULL) && (waitFrame() == 0)) {
         Mutex::Autolock lock(mLock);
         buf = acquireFrameLocked();
+        stamp = mFrameTime;
+        trace.record(req->mFrameNumber, TRACE_DQBUF, TRACE_PATH_NONE,
+                     begin, systemTime());
     }
 
     if (buf == NULL) {
@@ -330,42 +679,515 @@ int32_t VideoStream::handleCaptureFrame()
         return 0;
     }
 
-    ret = processCaptureRequest(*buf, req);
-    if (ret != 0) {
+    ConvertFrame* frame = NULL;
+    {
         Mutex::Autolock lock(mLock);
-        returnFrameLocked(*buf);
-        ALOGE("processRequest failed");
+        // frame taken from ring is used up, it goes back to V4L2.
+        frame = acquireConvertFrameLocked(buf, req, stamp,
+                (mZsl && !fromZsl) ? RELEASE_ZSL : RELEASE_RETURN);
+        if (frame == NULL) {
+            mRequests.erase(cur);
+            returnFrameLocked(*buf);
+        }
+    }
+
+    if (frame == NULL) {
+        req->onCaptureError();
         return 0;
     }
 
+    ret = processCaptureRequest(*buf, req, frame);
+
     Mutex::Autolock lock(mLock);
     mRequests.erase(cur);
-    returnFrameLocked(*buf);
+    if (ret != 0) {
+        ALOGE("processRequest failed");
+        frame->mRelease = RELEASE_RETURN;
+    }
+    // frame goes back when its queued conversions are done.
+    releaseConvertFrameLocked(frame);
+
+    return 0;
+}
+
+VideoStream::ConvertFrame* VideoStream::acquireConvertFrameLocked(
+        StreamBuffer* buf, sp<CaptureRequest>& req, nsecs_t stamp,
+        int32_t release)
+{
+    // each frame holds its own buffer, so a slot should be free.
+    ConvertFrame* frame = NULL;
+    for (uint32_t i=0; i<MAX_STREAM_BUFFERS; i++) {
+        if (mConvertFrames[i].mHolds == 0) {
+            frame = &mConvertFrames[i];
+            break;
+        }
+    }
+    if (frame == NULL) {
+        ALOGE("%s no free convert frame", __func__);
+        return NULL;
+    }
+
+    frame->mBuffer = buf;
+    frame->mRequest = req;
+    frame->mHolds = 1;
+    frame->mRelease = release;
+    frame->mStamp = stamp;
+    mConvertingFrames++;
+
+    return frame;
+}
+
+void VideoStream::releaseConvertFrameLocked(ConvertFrame* frame)
+{
+    mConvertDone.broadcast();
+    if (--frame->mHolds > 0) {
+        return;
+    }
+
+    nsecs_t begin = systemTime();
+    if (frame->mRelease == RELEASE_ZSL) {
+        pushZslFrameLocked(frame->mBuffer, frame->mStamp);
+    }
+    else if (frame->mRelease == RELEASE_RETURN) {
+        returnFrameLocked(*frame->mBuffer);
+    }
+    if (frame->mRelease != RELEASE_NONE) {
+        mCamera->getTrace().record(frame->mRequest->mFrameNumber, TRACE_QBUF,
+                                   TRACE_PATH_NONE, begin, systemTime());
+    }
+
+    frame->mBuffer = NULL;
+    frame->mRequest.clear();
+    mConvertingFrames--;
+}
+
+void VideoStream::waitConvertFramesLocked()
+{
+    // one buffer stays queued after next dequeue, besides zsl ring.
+    uint32_t limit = 1;
+    if (mNumBuffers > mZslDepth + 2) {
+        limit = mNumBuffers - mZslDepth - 2;
+    }
+    if (limit > MAX_CONVERT_FRAMES) {
+        limit = MAX_CONVERT_FRAMES;
+    }
+
+    while (mConvertingFrames >= limit) {
+        mConvertDone.wait(mLock);
+    }
+}
+
+void VideoStream::onConvertDone(ConvertJob& job)
+{
+    ConvertFrame* frame = (ConvertFrame*)job.mCookie;
+    // request is kept by frame until this job drops its hold.
+    sp<CaptureRequest>& req = frame->mRequest;
+    FrameTrace& trace = mCamera->getTrace();
+    trace.record(req->mFrameNumber, TRACE_PROCESS, job.mPath,
+                 job.mBegin, systemTime());
+
+    nsecs_t begin = systemTime();
+    if (job.mResult != NO_ERROR) {
+        req->onBufferError(job.mOut);
+    }
+    else {
+        req->onCaptureDone(job.mOut);
+    }
+    trace.record(req->mFrameNumber, TRACE_DONE, TRACE_PATH_NONE,
+                 begin, systemTime());
+
+    Mutex::Autolock lock(mLock);
+    releaseConvertFrameLocked(frame);
+}
+
+uint32_t VideoStream::getZslDepth()
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get(CAMERA_ZSL_DEPTH, value, "0");
+
+    int32_t depth = atoi(value);
+    if (depth <= 0) {
+        return 0;
+    }
+
+    // configure adds depth to stream buffers, keep it in MAX_STREAM_BUFFERS.
+    if (depth > MAX_STREAM_BUFFERS / 2) {
+        depth = MAX_STREAM_BUFFERS / 2;
+    }
+
+    return depth;
+}
+
+bool VideoStream::isStillRequest(sp<CaptureRequest>& req)
+{
+    for (uint32_t i=0; i<req->mOutBuffersNumber; i++) {
+        if (req->mOutBuffers[i]->mStream->isJpeg()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+StreamBuffer* VideoStream::getZslFrameLocked()
+{
+    if (mZslCount == 0) {
+        return NULL;
+    }
+
+    uint32_t newest = (mZslHead + mZslCount - 1) % MAX_STREAM_BUFFERS;
+    nsecs_t age = systemTime() - mZslStamps[newest];
+    // the ring only holds recent frames if requests come continuously.
+    uint32_t fps = (mFps > 0) ? mFps : 30;
+    nsecs_t maxAge = (nsecs_t)(mZslDepth + 1) * 1000000000LL / fps;
+    if (age > maxAge) {
+        ALOGI("%s zsl frame is stale, age:%lld ns", __func__, age);
+        clearZslFramesLocked(true);
+        return NULL;
+    }
+
+    ALOGV("%s zsl frame age:%lld ns", __func__, age);
+    StreamBuffer* buf = mZslFrames[newest];
+    mZslFrames[newest] = NULL;
+    mZslCount--;
+    // older frames can't serve following requests in order,
+    // so next still request dequeues a new frame.
+    clearZslFramesLocked(true);
+
+    return buf;
+}
+
+int32_t VideoStream::pushZslFrameLocked(StreamBuffer* buf, nsecs_t stamp)
+{
+    uint32_t tail = (mZslHead + mZslCount) % MAX_STREAM_BUFFERS;
+    mZslFrames[tail] = buf;
+    mZslStamps[tail] = stamp;
+    mZslCount++;
+
+    int32_t ret = 0;
+    while (mZslCount > mZslDepth) {
+        ret = returnFrameLocked(*mZslFrames[mZslHead]);
+        mZslFrames[mZslHead] = NULL;
+        mZslHead = (mZslHead + 1) % MAX_STREAM_BUFFERS;
+        mZslCount--;
+    }
+
+    return ret;
+}
+
+// requeue is false when stream off has returned held frames already.
+void VideoStream::clearZslFramesLocked(bool requeue)
+{
+    while (mZslCount > 0) {
+        if (requeue) {
+            returnFrameLocked(*mZslFrames[mZslHead]);
+        }
+        mZslFrames[mZslHead] = NULL;
+        mZslHead = (mZslHead + 1) % MAX_STREAM_BUFFERS;
+        mZslCount--;
+    }
+    mZslHead = 0;
+}
+
+// the output buffer that matches device stream is queued to V4L2,
+// so sensor writes into it directly. other requests use device buffer.
+StreamBuffer* VideoStream::findImportBufferLocked(sp<CaptureRequest>& req)
+{
+    uint32_t v4l2Width = 0, v4l2Height = 0;
+    int32_t ret = mCamera->getV4l2Res(mWidth, mHeight, &v4l2Width, &v4l2Height);
+    if (ret != 0 || v4l2Width != mWidth || v4l2Height != mHeight) {
+        return NULL;
+    }
+
+    for (uint32_t i=0; i<req->mOutBuffersNumber; i++) {
+        StreamBuffer* out = req->mOutBuffers[i];
+        sp<Stream>& stream = out->mStream;
+        if (stream->isJpeg() || (stream->width() != mWidth) ||
+            (stream->height() != mHeight) || (stream->format() != mFormat)) {
+            continue;
+        }
+
+        if (!isImportableLocked(*out)) {
+            continue;
+        }
+
+        // V4L2 will write to it, so display must have released it. the
+        // fence is only polled under mLock, buffer still in use is copied
+        // to after waitAcquireFence() without lock.
+        if (out->mAcquireFence != -1) {
+            if (sync_wait(out->mAcquireFence, 0) != 0) {
+                ALOGV("%s acquire fence not signaled, copy frame", __func__);
+                continue;
+            }
+            close(out->mAcquireFence);
+            out->mAcquireFence = -1;
+        }
+
+        return out;
+    }
+
+    return NULL;
+}
+
+int32_t VideoStream::bindRequestsLocked()
+{
+    List< sp<CaptureRequest> >::iterator cur = mRequests.begin();
+    for (uint32_t i=0; i<mBoundRequests && cur != mRequests.end(); i++) {
+        cur++;
+    }
+
+    for (; cur != mRequests.end(); cur++) {
+        int32_t index = -1;
+        for (uint32_t i=0; i<mNumBuffers; i++) {
+            if (mSlots[i] == NULL) {
+                index = i;
+                break;
+            }
+        }
+
+        if (index < 0) {
+            break;
+        }
+
+        StreamBuffer* buf = findImportBufferLocked(*cur);
+        if (buf == NULL) {
+            buf = mBuffers[index];
+        }
+
+        int32_t ret = onFrameReturnLocked(index, *buf);
+        if (ret != 0) {
+            ALOGE("%s queue buffer index:%d failed", __func__, index);
+            return ret;
+        }
+
+        mSlots[index] = buf;
+        mBoundRequests++;
+    }
+
+    return 0;
+}
+
+void VideoStream::abortBoundRequestsLocked(
+                       List< sp<CaptureRequest> >& aborted)
+{
+    ALOGE("%s no frame after %d timeouts, abort %d requests", __func__,
+          mStallCount, mBoundRequests);
+
+    for (uint32_t i=0; i<mBoundRequests && !mRequests.empty(); i++) {
+        aborted.push_back(*mRequests.begin());
+        mRequests.erase(mRequests.begin());
+    }
+
+    // stream off returns queued buffers and unbinds all requests,
+    // next frame message starts device again.
+    handleStopLocked(false);
+    mStallCount = 0;
+
+    // one frame message is left for each remaining request.
+    mMessageQueue.removeMessages(MSG_FRAME);
+    for (uint32_t i=0; i<mRequests.size(); i++) {
+        mMessageQueue.postMessage(MSG_FRAME);
+    }
+}
+
+int32_t VideoStream::handleZeroCopyFrame()
+{
+    int32_t ret = 0;
+    ALOGV("%s", __func__);
+
+    sp<CaptureRequest> req = NULL;
+    StreamBuffer *buf = NULL;
+    int32_t index = -1;
+    {
+        Mutex::Autolock lock(mLock);
+        bindRequestsLocked();
+        if (mBoundRequests == 0) {
+            return 0;
+        }
+
+        req = *mRequests.begin();
+        mInFlight = req;
+    }
+
+    FrameTrace& trace = mCamera->getTrace();
+    nsecs_t begin = systemTime();
+    // request keeps its queued buffer, try again for stalled sensor.
+    int32_t waitRet = waitFrame();
+    if (waitRet == TIMED_OUT) {
+        List< sp<CaptureRequest> > aborted;
+        {
+            Mutex::Autolock lock(mLock);
+            if (mStallCount < FRAME_TIMEOUT_LIMIT) {
+                mMessageQueue.postMessage(MSG_FRAME);
+                return 0;
+            }
+            abortBoundRequestsLocked(aborted);
+        }
+
+        // no frame was captured for them, so no result metadata either.
+        List< sp<CaptureRequest> >::iterator it;
+        for (it = aborted.begin(); it != aborted.end(); it++) {
+            (*it)->onRequestError();
+        }
+        return 0;
+    }
+
+    //advanced character.
+    ret = processCaptureSettings(req);
+
+    if (waitRet == 0) {
+        Mutex::Autolock lock(mLock);
+        index = onFrameAcquireLocked();
+        buf = getQueuedBufferLocked(index);
+        trace.record(req->mFrameNumber, TRACE_DQBUF, TRACE_PATH_NONE,
+                     begin, systemTime());
+    }
+
+    if (buf == NULL) {
+        ALOGE("acquireFrameLocked failed");
+        req->onCaptureError();
+    }
+    else if (ret == 0) {
+        ConvertFrame* frame = NULL;
+        {
+            Mutex::Autolock lock(mLock);
+            frame = acquireConvertFrameLocked(buf, req, 0, RELEASE_NONE);
+        }
+
+        if (frame == NULL) {
+            req->onCaptureError();
+        }
+        else {
+            ret = processCaptureRequest(*buf, req, frame);
+            if (ret != 0) {
+                ALOGE("processRequest failed");
+            }
+            // imported buffer is delivered after its jobs, so the slot
+            // is free now. own buffer can be bound again, wait for them.
+            Mutex::Autolock lock(mLock);
+            if (getBufferIndexLocked(*buf) >= 0) {
+                while (frame->mHolds > 1) {
+                    mConvertDone.wait(mLock);
+                }
+            }
+            releaseConvertFrameLocked(frame);
+        }
+    }
+    else {
+        ALOGE("processSettings failed");
+    }
+
+    Mutex::Autolock lock(mLock);
+    mRequests.erase(mRequests.begin());
+    mBoundRequests--;
+    if (buf != NULL) {
+        mSlots[index] = NULL;
+    }
+    begin = systemTime();
+    bindRequestsLocked();
+    trace.record(req->mFrameNumber, TRACE_QBUF, TRACE_PATH_NONE,
+                 begin, systemTime());
 
     return 0;
 }
 
 int32_t VideoStream::processCaptureRequest(StreamBuffer& src,
-                         sp<CaptureRequest> req)
+                         sp<CaptureRequest> req, ConvertFrame* frame)
 {
     int32_t ret = 0;
     ALOGV("%s", __func__);
+    FrameTrace& trace = mCamera->getTrace();
+    nsecs_t begin = 0;
+    // fields are resolved once per frame. IPU bob keeps the frame as is,
+    // so it's only left to the output when nothing else reads the frame.
+    if (src.mInterlaced && ((mDeinterlacer.mode() != DEINTERLACE_BOB) ||
+            mZsl || (req->mOutBuffersNumber != 1) ||
+            req->mOutBuffers[0]->mStream->isJpeg())) {
+        deinterlaceFrame(src);
+    }
+
+    // conversions run on queue thread while jpeg is encoded here,
+    // zero-copy output is the source of the others, it's queued last.
+    StreamBuffer* zeroCopy = NULL;
+    for (uint32_t i=0; i<req->mOutBuffersNumber; i++) {
+        StreamBuffer* out = req->mOutBuffers[i];
+        sp<Stream>& stream = out->mStream;
+        if (stream->isJpeg()) {
+            continue;
+        }
+
+        if (out->mPhyAddr == src.mPhyAddr) {
+            zeroCopy = out;
+            continue;
+        }
+        submitConvertJob(src, req, out, frame);
+    }
+
     for (uint32_t i=0; i<req->mOutBuffersNumber; i++) {
         StreamBuffer* out = req->mOutBuffers[i];
         sp<Stream>& stream = out->mStream;
+        if (!stream->isJpeg()) {
+            continue;
+        }
+
         // stream to process buffer.
+        begin = systemTime();
         stream->setCurrentBuffer(out);
-        stream->processCaptureBuffer(src, req->mSettings);
+        int32_t result = stream->processCaptureBuffer(src, req->mSettings);
         stream->setCurrentBuffer(NULL);
-        ret = req->onCaptureDone(out);
+        trace.record(req->mFrameNumber, TRACE_PROCESS, stream->tracePath(),
+                     begin, systemTime());
+
+        begin = systemTime();
+        if (result != NO_ERROR) {
+            ALOGE("%s jpeg encode failed %d", __func__, result);
+            ret = req->onBufferError(out);
+        }
+        else {
+            ret = req->onCaptureDone(out);
+        }
+        trace.record(req->mFrameNumber, TRACE_DONE, TRACE_PATH_NONE,
+                     begin, systemTime());
         if (ret != 0) {
-            return ret;
+            break;
         }
     }
 
+    if (zeroCopy != NULL) {
+        submitConvertJob(src, req, zeroCopy, frame);
+    }
+
     return ret;
 }
 
+void VideoStream::submitConvertJob(StreamBuffer& src,
+        sp<CaptureRequest>& req, StreamBuffer* out, ConvertFrame* frame)
+{
+    sp<Stream>& stream = out->mStream;
+    ConvertJob job;
+    job.mBegin = systemTime();
+    stream->setCurrentBuffer(out);
+    job.mResult = stream->prepareCaptureBuffer(src, req->mSettings, job);
+    stream->setCurrentBuffer(NULL);
+    job.mSrc = &src;
+    job.mOut = out;
+    job.mListener = this;
+    job.mCookie = frame;
+
+    {
+        Mutex::Autolock lock(mLock);
+        frame->mHolds++;
+    }
+
+    // failed job is still queued, so buffers are delivered in order.
+    int32_t ret = mConvertQueue.submit(job);
+    if (ret != NO_ERROR) {
+        ALOGE("%s submit convert job failed %d", __func__, ret);
+        job.mResult = ret;
+        onConvertDone(job);
+    }
+}
+
 // process advanced character.
 int32_t VideoStream::processCaptureSettings(sp<CaptureRequest> req)
 {
@@ -376,6 +1198,7 @@ int32_t VideoStream::processCaptureSettings(sp<CaptureRequest> req)
         return 0;
     }
     // device to do advanced character set.
+    nsecs_t begin = systemTime();
     int32_t ret = mCamera->processSettings(meta, req->mFrameNumber);
     if (ret != 0) {
         ALOGI("mCamera->processSettings failed");
@@ -383,6 +1206,8 @@ int32_t VideoStream::processCaptureSettings(sp<CaptureRequest> req)
     }
 
     ret = req->onSettingsDone(meta);
+    mCamera->getTrace().record(req->mFrameNumber, TRACE_SETTINGS,
+                     TRACE_PATH_NONE, begin, systemTime());
     if (ret != 0) {
         ALOGI("onSettingsDone failed");
         return ret;
@@ -400,16 +1225,18 @@ int32_t VideoStream::handleMessage()
 {
     int32_t ret = 0;
 
-    sp<CMessage> msg = mMessageQueue.waitMessage();
-    if (msg == 0) {
+    CMessage msg;
+    if (mMessageQueue.waitMessage(msg) != NO_ERROR) {
         ALOGE("get invalid message");
         return -1;
     }
 
-    switch (msg->what) {
+    switch (msg.what) {
         case MSG_CONFIG: {
+            // buffers may be freed, conversions must be done.
+            mConvertQueue.drain();
             Mutex::Autolock lock(mLock);
-            ConfigureParam* params = (ConfigureParam*)(uintptr_t)msg->arg0;
+            ConfigureParam* params = (ConfigureParam*)(uintptr_t)msg.arg0;
             ret = handleConfigureLocked(params);
             if (params != NULL) {
                 delete params;
@@ -418,6 +1245,7 @@ int32_t VideoStream::handleMessage()
         break;
 
         case MSG_CLOSE: {
+            mConvertQueue.drain();
             Mutex::Autolock lock(mLock);
             ret = handleStopLocked(true);
             if (mDev > 0) {
@@ -428,22 +1256,31 @@ int32_t VideoStream::handleMessage()
         break;
 
         case MSG_FRAME: {
-            Mutex::Autolock lock(mLock);
-            // to start device automically.
-            if (mState != STATE_START) {
-                ALOGV("state:0x%x when handle frame message", mState);
-                ret = handleStartLocked(false);
-                if (ret != 0) {
-                    ALOGE("%s handleStartLocked failed", __func__);
-                    return ret;
+            {
+                Mutex::Autolock lock(mLock);
+                // to start device automically.
+                if (mState != STATE_START) {
+                    ALOGV("state:0x%x when handle frame message", mState);
+                    ret = handleStartLocked(false);
+                    if (ret != 0) {
+                        ALOGE("%s handleStartLocked failed", __func__);
+                    }
                 }
             }
 
+            if (ret == 0) {
+                ret = handleCaptureFrame();
+            }
+
+            // flush waits for it on every exit path.
+            Mutex::Autolock lock(mLock);
+            mInFlight = NULL;
+            mCaptureDone.broadcast();
         }
-        ret = handleCaptureFrame();
         break;
 
         case MSG_EXIT: {
+            mConvertQueue.drain();
             Mutex::Autolock lock(mLock);
             ALOGI("capture thread exit...");
             if (mState == STATE_START) {
@@ -455,7 +1292,7 @@ int32_t VideoStream::handleMessage()
         break;
 
         default: {
-            ALOGE("%s invalid message what:%d", __func__, msg->what);
+            ALOGE("%s invalid message what:%d", __func__, msg.what);
         }
         break;
     }
@@ -18,13 +18,18 @@
 #define _VIDEO_STREAM_H
 
 #include <utils/threads.h>
+#include <linux/videodev2.h>
 #include "MessageQueue.h"
 #include "CameraUtils.h"
 #include "Stream.h"
 #include "Camera.h"
+#include "ConvertQueue.h"
 
 using namespace android;
 
+// zero shutter lag depth, 0 means disabled.
+#define CAMERA_ZSL_DEPTH "rw.camera.zsl"
+
 class Camera;
 
 class ConfigureParam
@@ -36,19 +41,24 @@ public:
     int32_t mFps;
     int32_t mBuffers;
     int32_t mIsJpeg;
+    int32_t mZslDepth;
+    // stream goes through converter, it accepts other sensor formats.
+    int32_t mConverted;
 };
 
-class VideoStream : public Stream
+class VideoStream : public Stream, public ConvertListener
 {
 public:
     VideoStream(Camera* device);
     virtual ~VideoStream();
     void destroyStream();
 
-    // configure device stream.
-    int32_t configure(sp<Stream> stream);
+    // configure device stream to sensor mode for stream.
+    int32_t configure(sp<Stream> stream, uint32_t width, uint32_t height);
     //send capture request for stream.
     int32_t requestCapture(sp<CaptureRequest> req);
+    // return pending requests with error without stream restart.
+    int32_t flush();
 
     // open/close device stream.
     int32_t openDev(const char* name);
@@ -56,6 +66,16 @@ public:
 
     virtual void* getG2dHandle() {return g2dHandle;}
 
+    // number of recent frames kept for zero shutter lag.
+    uint32_t getZslDepth();
+
+    virtual int32_t deinterlaceFrame(StreamBuffer& buf);
+    virtual int32_t deinterlaceMode() {return mDeinterlacer.mode();}
+    virtual bool isBottomFieldFirst() {return mDeinterlacer.isBottomFirst();}
+
+    // output buffer is converted, called on convert queue thread.
+    virtual void onConvertDone(ConvertJob& job);
+
 private:
     // message type.
     static const int32_t MSG_CONFIG = 0x100;
@@ -70,9 +90,38 @@ private:
     static const int32_t STATE_STOP  = 0x204;
     static const int32_t STATE_ERROR  = 0x205;
 
+    // flush waits request in process up to this time.
+    static const nsecs_t FLUSH_TIMEOUT = 500000000LL;
+
+    // frame wait timeout, sensor takes longer to output first frame.
+    static const int32_t FIRST_FRAME_TIMEOUT_MS = 2000;
+    static const int32_t FRAME_TIMEOUT_MIN_MS = 500;
+    static const int32_t FRAME_TIMEOUT_PERIODS = 8;
+    // zero-copy requests are aborted after this many timeouts in a row.
+    static const uint32_t FRAME_TIMEOUT_LIMIT = 3;
+
+    // frames converted at once, more only add latency.
+    static const uint32_t MAX_CONVERT_FRAMES = 2;
+    // what is done with frame when its conversions are done.
+    static const int32_t RELEASE_NONE = 0;
+    static const int32_t RELEASE_RETURN = 1;
+    static const int32_t RELEASE_ZSL = 2;
+
+    // frame whose outputs are on convert queue.
+    struct ConvertFrame {
+        StreamBuffer* mBuffer;
+        sp<CaptureRequest> mRequest;
+        // queued jobs plus one for message thread.
+        uint32_t mHolds;
+        int32_t mRelease;
+        nsecs_t mStamp;
+    };
+
 protected:
     // handle configure message internally.
     int32_t handleConfigureLocked(ConfigureParam* params);
+    // current sensor mode can serve params without restart.
+    bool isConfigCompatibleLocked(ConfigureParam* params);
     virtual int32_t onDeviceConfigureLocked() = 0;
     // handle start message internally.
     int32_t handleStartLocked(bool force);
@@ -84,9 +133,24 @@ protected:
     int32_t handleCaptureFrame();
 
     // process capture request with lock.
-    int32_t processCaptureRequest(StreamBuffer& src, sp<CaptureRequest> req);
+    int32_t processCaptureRequest(StreamBuffer& src, sp<CaptureRequest> req,
+                                  ConvertFrame* frame);
+    void submitConvertJob(StreamBuffer& src, sp<CaptureRequest>& req,
+                          StreamBuffer* out, ConvertFrame* frame);
+    ConvertFrame* acquireConvertFrameLocked(StreamBuffer* buf,
+                          sp<CaptureRequest>& req, nsecs_t stamp,
+                          int32_t release);
+    // frame is released when its last hold is dropped.
+    void releaseConvertFrameLocked(ConvertFrame* frame);
+    // frames in conversion are not queued to V4L2, keep enough queued.
+    void waitConvertFramesLocked();
     // process capture advanced settings with lock.
     int32_t processCaptureSettings(sp<CaptureRequest> req);
+    // wait frame ready on device without lock.
+    virtual int32_t waitFrame();
+    int32_t getFrameTimeoutLocked();
+    // update drop/late statistics with dequeued V4L2 buffer.
+    void accountFrameLocked(const struct v4l2_buffer& buf);
     // get buffer from V4L2.
     StreamBuffer* acquireFrameLocked();
     virtual int32_t onFrameAcquireLocked() = 0;
@@ -95,6 +159,30 @@ protected:
     virtual int32_t onFrameReturnLocked(int32_t index, StreamBuffer& buf) = 0;
     // get buffer index.
     int32_t getBufferIndexLocked(StreamBuffer& buf);
+    // get buffer which is queued to V4L2 at index.
+    StreamBuffer* getQueuedBufferLocked(int32_t index);
+
+    // zero-copy: framework buffers are queued to V4L2 directly.
+    virtual bool isZeroCopySupported() {return false;}
+    virtual bool isImportableLocked(StreamBuffer& /*buf*/) {return false;}
+    // handle frame message in zero-copy mode.
+    int32_t handleZeroCopyFrame();
+    // queue one buffer to V4L2 for each pending request.
+    int32_t bindRequestsLocked();
+    // stream off for stalled sensor, bound requests are moved to aborted.
+    void abortBoundRequestsLocked(List< sp<CaptureRequest> >& aborted);
+    StreamBuffer* findImportBufferLocked(sp<CaptureRequest>& req);
+
+    // zero shutter lag: recent frames are held back from V4L2,
+    // still request takes the newest one out of the ring.
+    bool isStillRequest(sp<CaptureRequest>& req);
+    StreamBuffer* getZslFrameLocked();
+    int32_t pushZslFrameLocked(StreamBuffer* buf, nsecs_t stamp);
+    void clearZslFramesLocked(bool requeue);
+
+    // interlaced device, such as TV decoder, captures two fields per frame.
+    virtual bool isInterlaced() {return false;}
+    void configureDeinterlaceLocked();
 
     // allocate buffers.
     virtual int32_t allocateBuffersLocked() = 0;
@@ -149,11 +237,50 @@ protected:
 
     List< sp<CaptureRequest> > mRequests;
     int32_t mChanged;
+    // head of mRequests taken by message thread, it is set with mLock
+    // held when the request is read, so flush never returns it.
+    sp<CaptureRequest> mInFlight;
+    Condition mCaptureDone;
 
     // camera dev node.
     int32_t mDev;
     void *g2dHandle;
     uint32_t mAllocatedBuffers;
+
+    // zero-copy mode state.
+    bool mZeroCopy;
+    // buffer queued to V4L2 for each index, NULL if index is free.
+    StreamBuffer* mSlots[MAX_STREAM_BUFFERS];
+    // requests at the head of mRequests which own a queued buffer.
+    uint32_t mBoundRequests;
+
+    // zero shutter lag state.
+    uint32_t mZslDepth;
+    bool mZsl;
+    // ring of held frames, mZslHead is the oldest one.
+    StreamBuffer* mZslFrames[MAX_STREAM_BUFFERS];
+    nsecs_t mZslStamps[MAX_STREAM_BUFFERS];
+    uint32_t mZslHead;
+    uint32_t mZslCount;
+
+    // frame statistics since stream on.
+    uint32_t mFrameCount;
+    uint32_t mLastSequence;
+    nsecs_t mLastTimestamp;
+    // monotonic capture time of the last dequeued frame.
+    nsecs_t mFrameTime;
+    uint32_t mDroppedFrames;
+    uint32_t mLateFrames;
+    uint32_t mTimeoutFrames;
+    // timeouts since the last frame.
+    uint32_t mStallCount;
+
+    Deinterlacer mDeinterlacer;
+
+    ConvertFrame mConvertFrames[MAX_STREAM_BUFFERS];
+    uint32_t mConvertingFrames;
+    Condition mConvertDone;
+    ConvertQueue mConvertQueue;
 };
 
 #endif
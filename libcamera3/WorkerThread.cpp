@@ -0,0 +1,152 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CameraHAL"
+
+#include <utils/Log.h>
+#include <utils/Errors.h>
+#include "WorkerThread.h"
+
+using namespace android;
+
+WorkerThread::WorkerThread(Handler *handler, const char *name)
+    : Thread(false), mHandler(handler), mName(name), mArg(NULL),
+      mResult(NO_ERROR), mBusy(false)
+{
+}
+
+void WorkerThread::onFirstRef()
+{
+    run(mName, PRIORITY_URGENT_DISPLAY);
+}
+
+status_t WorkerThread::post(void *arg)
+{
+    Mutex::Autolock lock(mLock);
+    if (mBusy || exitPending() || !isRunning()) {
+        return INVALID_OPERATION;
+    }
+
+    mArg = arg;
+    mBusy = true;
+    mCondition.broadcast();
+    return NO_ERROR;
+}
+
+status_t WorkerThread::waitDone()
+{
+    Mutex::Autolock lock(mLock);
+    while (mBusy) {
+        mCondition.wait(mLock);
+    }
+
+    return mResult;
+}
+
+void WorkerThread::stop()
+{
+    {
+        Mutex::Autolock lock(mLock);
+        requestExit();
+        mCondition.broadcast();
+    }
+    join();
+}
+
+bool WorkerThread::threadLoop()
+{
+    void *arg = NULL;
+    {
+        Mutex::Autolock lock(mLock);
+        while (!mBusy && !exitPending()) {
+            mCondition.wait(mLock);
+        }
+
+        if (!mBusy) {
+            return false;
+        }
+        arg = mArg;
+    }
+
+    status_t ret = mHandler->handleWork(arg);
+
+    Mutex::Autolock lock(mLock);
+    mResult = ret;
+    mBusy = false;
+    mCondition.broadcast();
+
+    return true;
+}
+
+//--------------------WorkerPool----------------------
+WorkerPool::WorkerPool(WorkerThread::Handler *handler, const char *name,
+                       uint32_t workers)
+    : mHandler(handler), mName(name),
+      mCount((workers < MAX_WORKERS) ? workers : MAX_WORKERS)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+void WorkerPool::stop()
+{
+    for (uint32_t i = 0; i < mCount; i++) {
+        if (mWorkers[i] != NULL) {
+            mWorkers[i]->stop();
+            mWorkers[i].clear();
+        }
+    }
+}
+
+status_t WorkerPool::run(void **args, uint32_t count)
+{
+    bool posted[MAX_WORKERS];
+    status_t ret = NO_ERROR;
+    status_t res = NO_ERROR;
+
+    for (uint32_t i = 1; i < count; i++) {
+        uint32_t w = i - 1;
+        bool queued = false;
+        if (w < mCount) {
+            if (mWorkers[w] == NULL) {
+                mWorkers[w] = new WorkerThread(mHandler, mName);
+            }
+            queued = (mWorkers[w]->post(args[i]) == NO_ERROR);
+            posted[w] = queued;
+        }
+        if (!queued) {
+            res = mHandler->handleWork(args[i]);
+            ret = (ret == NO_ERROR) ? res : ret;
+        }
+    }
+
+    if (count > 0) {
+        res = mHandler->handleWork(args[0]);
+        ret = (ret == NO_ERROR) ? res : ret;
+    }
+
+    for (uint32_t w = 0; (w + 1 < count) && (w < mCount); w++) {
+        if (posted[w]) {
+            res = mWorkers[w]->waitDone();
+            ret = (ret == NO_ERROR) ? res : ret;
+        }
+    }
+
+    return ret;
+}
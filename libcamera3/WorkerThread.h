@@ -0,0 +1,80 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _WORKER_THREAD_H
+#define _WORKER_THREAD_H
+
+#include <stdint.h>
+#include <utils/threads.h>
+
+// runs one posted job at a time, so part of a frame is processed in
+// parallel with the caller.
+class WorkerThread : public android::Thread
+{
+public:
+    class Handler
+    {
+    public:
+        virtual ~Handler() {}
+        // called on worker thread with the posted arg.
+        virtual android::status_t handleWork(void *arg) = 0;
+    };
+
+    WorkerThread(Handler *handler, const char *name);
+
+    virtual void onFirstRef();
+    virtual bool threadLoop();
+
+    // post job, fails if the last one is not done or thread exits.
+    android::status_t post(void *arg);
+    // wait for posted job, returns its result.
+    android::status_t waitDone();
+    void stop();
+
+private:
+    Handler            *mHandler;
+    const char         *mName;
+    void               *mArg;
+    android::status_t   mResult;
+    bool                mBusy;
+    android::Mutex      mLock;
+    android::Condition  mCondition;
+};
+
+// splits jobs between caller and worker threads, which are created on
+// first use. jobs which can't be posted run on caller.
+class WorkerPool
+{
+public:
+    static const uint32_t MAX_WORKERS = 4;
+
+    WorkerPool(WorkerThread::Handler *handler, const char *name,
+               uint32_t workers);
+    ~WorkerPool();
+
+    uint32_t workers() {return mCount;}
+    // job 0 runs on caller, the others on workers, returns first failure.
+    android::status_t run(void **args, uint32_t count);
+    void stop();
+
+private:
+    WorkerThread::Handler *mHandler;
+    const char *mName;
+    uint32_t mCount;
+    android::sp<WorkerThread> mWorkers[MAX_WORKERS];
+};
+
+#endif
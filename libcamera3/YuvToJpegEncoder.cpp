@@ -15,13 +15,22 @@
  * limitations under the License.
  */
 
+// no HAL headers here, host benchmark builds the encoder too.
+#define LOG_TAG "FslCameraHAL"
+
 #include "YuvToJpegEncoder.h"
-#include <ui/PixelFormat.h>
-#include <hardware/hardware.h>
-#include "NV12_resize.h"
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
 
 #ifdef BOARD_HAVE_VPU
 #include "vpu_wrapper.h"
+#include <utils/Mutex.h>
+
+// thumbnail and main image may be encoded at the same time,
+// VPU load/unload is global and must be serialized.
+static android::Mutex sVpuLock;
 #endif
 
 #define Align(ptr,align)	(((uintptr_t)ptr+(align)-1)/(align)*(align))
@@ -267,68 +276,114 @@ failure:
 	return 0;
 }
 
-int vpu_encode(void *inYuv,
-                             void* inYuvPhy,
-                             int   Width,
-                             int   Height,
-                             int   /*quality*/,
-                             int   color,
-                             void *outBuf,
-                             int   outSize,
-                             int colorFormat)
-{
-	VpuEncRetCode ret;
-	int size=0;
-	VpuVersionInfo ver;
-	VpuWrapperVersionInfo w_ver;
-	VpuEncHandle handle=0;
-	VpuMemInfo sMemInfo;
-	EncMemInfo sEncMemInfo;
-	VpuEncOpenParamSimp sEncOpenParamSimp;
-	VpuEncInitInfo sEncInitInfo;
-	VpuFrameBuffer sFrameBuf[MAX_FRAME_NUM];
-	int nBufNum;
-	int nSrcStride;
-	VpuEncEncParam sEncEncParam;
-	char* tempOut=0;
-	static FILE* fpjpg=0;
+// VPU load is global and shared by main and thumbnail sessions.
+static int sVpuLoadCount = 0;
 
-	memset(&sMemInfo,0,sizeof(VpuMemInfo));
-	memset(&sEncMemInfo,0,sizeof(EncMemInfo));
-	memset(&sFrameBuf,0,sizeof(VpuFrameBuffer)*MAX_FRAME_NUM);
+static bool vpuLoadLocked()
+{
+	if (sVpuLoadCount > 0) {
+		sVpuLoadCount++;
+		return true;
+	}
 
-	ret=VPU_EncLoad();
+	VpuEncRetCode ret=VPU_EncLoad();
 	if (ret!=VPU_ENC_RET_SUCCESS){
 		ALOGE("load vpu encoder failure !");
-		return 0;
+		return false;
 	}
+
+	VpuVersionInfo ver;
 	ret=VPU_EncGetVersionInfo(&ver);
-	if (ret!=VPU_ENC_RET_SUCCESS){
-		ALOGE("vpu get version info failure: ret=%d ",ret);
-		goto finish;
+	if (ret==VPU_ENC_RET_SUCCESS){
+		ALOGI("vpu lib version : major.minor.rel=%d.%d.%d ",ver.nLibMajor,ver.nLibMinor,ver.nLibRelease);
+		ALOGI("vpu fw version : major.minor.rel_rcode=%d.%d.%d_r%d ",ver.nFwMajor,ver.nFwMinor,ver.nFwRelease,ver.nFwCode);
+	}
+
+	sVpuLoadCount = 1;
+	return true;
+}
+
+static void vpuUnloadLocked()
+{
+	if (sVpuLoadCount <= 0 || --sVpuLoadCount > 0) {
+		return;
 	}
-	ALOGI("vpu lib version : major.minor.rel=%d.%d.%d ",ver.nLibMajor,ver.nLibMinor,ver.nLibRelease);
-	ALOGI("vpu fw version : major.minor.rel_rcode=%d.%d.%d_r%d ",ver.nFwMajor,ver.nFwMinor,ver.nFwRelease,ver.nFwCode);
 
-	ret=(VpuEncRetCode)VPU_EncGetWrapperVersionInfo(&w_ver);
+	VpuEncRetCode ret=VPU_EncUnLoad();
 	if (ret!=VPU_ENC_RET_SUCCESS){
-		ALOGE("%s: vpu get wrapper version failure: ret=%d ",__FUNCTION__,ret);
-		goto finish;
+		ALOGE("%s: vpu unload failure: ret=%d \r\n",__FUNCTION__,ret);
+	}
+}
+
+// VPU jpeg encoder instance which stays open across captures,
+// it is reopened only when resolution or color format changes.
+class VpuJpegSession
+{
+public:
+	VpuJpegSession();
+	~VpuJpegSession();
+
+	int encode(void *inYuv, void* inYuvPhy, int Width, int Height,
+	           int color, void *outBuf, int outSize, int colorFormat);
+
+private:
+	bool open(int Width, int Height, int color, int outSize, int colorFormat);
+	void close();
+
+	bool mLoaded;
+	VpuEncHandle mHandle;
+	EncMemInfo mMemInfo;
+	VpuFrameBuffer mFrameBuf[MAX_FRAME_NUM];
+	unsigned char* mOutPhy;
+	unsigned char* mOutVirt;
+	int mOutSize;
+	int mWidth;
+	int mHeight;
+	int mColor;
+	int mColorFormat;
+};
+
+VpuJpegSession::VpuJpegSession()
+	: mLoaded(false), mHandle(0), mOutPhy(NULL), mOutVirt(NULL),
+	  mOutSize(0), mWidth(0), mHeight(0), mColor(0), mColorFormat(0)
+{
+	memset(&mMemInfo,0,sizeof(EncMemInfo));
+	memset(mFrameBuf,0,sizeof(mFrameBuf));
+}
+
+VpuJpegSession::~VpuJpegSession()
+{
+	android::Mutex::Autolock lock(sVpuLock);
+	close();
+}
+
+bool VpuJpegSession::open(int Width, int Height, int color, int outSize, int colorFormat)
+{
+	VpuEncRetCode ret;
+	VpuMemInfo sMemInfo;
+	VpuEncOpenParamSimp sEncOpenParamSimp;
+	VpuEncInitInfo sEncInitInfo;
+	int nBufNum;
+	int nSrcStride;
+
+	if (!vpuLoadLocked()) {
+		return false;
 	}
-	//ALOGI("vpu wrapper version : major.minor.rel=%d.%d.%d: %s ",w_ver.nMajor,w_ver.nMinor,w_ver.nRelease,w_ver.pBinary);
+	mLoaded = true;
 
 	//query memory
+	memset(&sMemInfo,0,sizeof(VpuMemInfo));
 	ret=VPU_EncQueryMem(&sMemInfo);
 	if (ret!=VPU_ENC_RET_SUCCESS){
 		ALOGE("%s: vpu query memory failure: ret=0x%X ",__FUNCTION__,ret);
-		goto finish;
+		return false;
 	}
 
 	//malloc memory for vpu
-	if(0==EncMallocMemBlock(&sMemInfo,&sEncMemInfo))
+	if(0==EncMallocMemBlock(&sMemInfo,&mMemInfo))
 	{
 		ALOGE("%s: malloc memory failure: ",__FUNCTION__);
-		goto finish;
+		return false;
 	}
 
 	memset(&sEncOpenParamSimp,0,sizeof(VpuEncOpenParamSimp));
@@ -341,46 +396,108 @@ int vpu_encode(void *inYuv,
 	sEncOpenParamSimp.nBitRate=0;
 	sEncOpenParamSimp.nGOPSize=30;
 	sEncOpenParamSimp.nChromaInterleave=1;
-    sEncOpenParamSimp.eColorFormat=(VpuColorFormat)colorFormat;
+	sEncOpenParamSimp.eColorFormat=(VpuColorFormat)colorFormat;
 
 	//open vpu
-	ret=VPU_EncOpenSimp(&handle, &sMemInfo,&sEncOpenParamSimp);
+	ret=VPU_EncOpenSimp(&mHandle, &sMemInfo,&sEncOpenParamSimp);
 	if (ret!=VPU_ENC_RET_SUCCESS){
 		ALOGE("%s: vpu open failure: ret=0x%X ",__FUNCTION__,ret);
-		goto finish;
+		mHandle=0;
+		return false;
 	}
 
 	//get initinfo
-	ret=VPU_EncGetInitialInfo(handle,&sEncInitInfo);
+	ret=VPU_EncGetInitialInfo(mHandle,&sEncInitInfo);
 	if(VPU_ENC_RET_SUCCESS!=ret){
 		ALOGE("%s: init vpu failure ",__FUNCTION__);
-		goto finish;
+		return false;
 	}
 
 	nBufNum=sEncInitInfo.nMinFrameBufferCount;
-//	ALOGI("==== Init OK: min buffer cnt: %d, alignment: %d ",sEncInitInfo.nMinFrameBufferCount,sEncInitInfo.nAddressAlignment);
 	//fill frameBuf[]
-	if(-1==EncOutFrameBufCreateRegisterFrame(sEncOpenParamSimp.eFormat,color,sFrameBuf, nBufNum,Width, Height, &sEncMemInfo,0,&nSrcStride,sEncInitInfo.nAddressAlignment,0)){
+	if(-1==EncOutFrameBufCreateRegisterFrame(sEncOpenParamSimp.eFormat,color,mFrameBuf, nBufNum,Width, Height, &mMemInfo,0,&nSrcStride,sEncInitInfo.nAddressAlignment,0)){
 		ALOGE("%s: allocate vpu frame buffer failure ",__FUNCTION__);
-		goto finish;
+		return false;
 	}
 
 	//register frame buffs
-	ret=VPU_EncRegisterFrameBuffer(handle, sFrameBuf, nBufNum,nSrcStride);
+	ret=VPU_EncRegisterFrameBuffer(mHandle, mFrameBuf, nBufNum,nSrcStride);
 	if(VPU_ENC_RET_SUCCESS!=ret){
 		ALOGE("%s: vpu register frame failure: ret=0x%X ",__FUNCTION__,ret);
-		goto finish;
+		return false;
 	}
 
-	//allocate temporary physical output buffer
+	//allocate physical output buffer
 	memset(&sMemInfo,0,sizeof(VpuMemInfo));
 	sMemInfo.nSubBlockNum=1;
 	sMemInfo.MemSubBlock[0].MemType=VPU_MEM_PHY;
 	sMemInfo.MemSubBlock[0].nAlignment=sEncInitInfo.nAddressAlignment;//8;
 	sMemInfo.MemSubBlock[0].nSize=outSize;
-	if(0==EncMallocMemBlock(&sMemInfo,&sEncMemInfo))	{
+	if(0==EncMallocMemBlock(&sMemInfo,&mMemInfo))	{
 		ALOGE("%s: malloc memory failure: ",__FUNCTION__);
-		goto finish;
+		return false;
+	}
+	mOutPhy=sMemInfo.MemSubBlock[0].pPhyAddr;
+	mOutVirt=sMemInfo.MemSubBlock[0].pVirtAddr;
+
+	mOutSize=outSize;
+	mWidth=Width;
+	mHeight=Height;
+	mColor=color;
+	mColorFormat=colorFormat;
+	ALOGI("%s: vpu jpeg session %dx%d, color format %d",__FUNCTION__,Width,Height,colorFormat);
+
+	return true;
+}
+
+void VpuJpegSession::close()
+{
+	VpuEncRetCode ret;
+
+	//close vpu
+	if(mHandle!=0){
+		ret=VPU_EncClose(mHandle);
+		if (ret!=VPU_ENC_RET_SUCCESS){
+			ALOGE("%s: vpu close failure: ret=%d ",__FUNCTION__,ret);
+		}
+		mHandle=0;
+	}
+
+	//release mem
+	if(0==EncFreeMemBlock(&mMemInfo)){
+		ALOGE("%s: free memory failure:  ",__FUNCTION__);
+	}
+	memset(&mMemInfo,0,sizeof(EncMemInfo));
+	memset(mFrameBuf,0,sizeof(mFrameBuf));
+
+	//unload
+	if (mLoaded) {
+		vpuUnloadLocked();
+		mLoaded = false;
+	}
+
+	mOutPhy=NULL;
+	mOutVirt=NULL;
+	mOutSize=0;
+	mWidth=0;
+	mHeight=0;
+}
+
+// called with sVpuLock.
+int VpuJpegSession::encode(void *inYuv, void* inYuvPhy, int Width, int Height,
+                           int color, void *outBuf, int outSize, int colorFormat)
+{
+	VpuEncRetCode ret;
+	VpuEncEncParam sEncEncParam;
+	int size=0;
+
+	if ((mHandle==0) || (Width!=mWidth) || (Height!=mHeight) ||
+	    (color!=mColor) || (colorFormat!=mColorFormat) || (outSize>mOutSize)) {
+		close();
+		if (!open(Width, Height, color, outSize, colorFormat)) {
+			close();
+			return 0;
+		}
 	}
 
 	//encode frame
@@ -393,49 +510,42 @@ int vpu_encode(void *inYuv,
 	sEncEncParam.nInPhyInput=(uintptr_t)inYuvPhy;
 	sEncEncParam.nInVirtInput=(uintptr_t)inYuv;
 	sEncEncParam.nInInputSize=(color==0)?(Width*Height*3/2):(Width*Height*2);
-	sEncEncParam.nInPhyOutput=(uintptr_t)sMemInfo.MemSubBlock[0].pPhyAddr;
-	sEncEncParam.nInVirtOutput=(uintptr_t)sMemInfo.MemSubBlock[0].pVirtAddr;
+	sEncEncParam.nInPhyOutput=(uintptr_t)mOutPhy;
+	sEncEncParam.nInVirtOutput=(uintptr_t)mOutVirt;
 	sEncEncParam.nInOutputBufLen=outSize;
 
-	ret=VPU_EncEncodeFrame(handle, &sEncEncParam);
+	ret=VPU_EncEncodeFrame(mHandle, &sEncEncParam);
 	if(VPU_ENC_RET_SUCCESS!=ret){
 		ALOGE("%s, vpu encode frame failure: ret=0x%X ",__FUNCTION__,ret);
 		if(VPU_ENC_RET_FAILURE_TIMEOUT==ret){
-			VPU_EncReset(handle);
+			VPU_EncReset(mHandle);
 		}
+		// instance state is unknown, open it again next time.
+		close();
+		return 0;
 	}
 
 	if((sEncEncParam.eOutRetCode & VPU_ENC_OUTPUT_DIS)||(sEncEncParam.eOutRetCode & VPU_ENC_OUTPUT_SEQHEADER)){
-		size=sEncEncParam.nOutOutputSize;
-		//ALOGI("encode succeed, output size: %d ",size);
+		// keep SOI and skip to first DQT/DRI marker, output has no APPn
+		// segment like libjpeg output so EXIF header goes in front of it.
+		uint8_t *out=(uint8_t *)(uintptr_t)sEncEncParam.nInVirtOutput;
+		int total=sEncEncParam.nOutOutputSize;
+		int i=2;
+		while((i+2<=total) && !((out[i]==0xFF) && ((out[i+1]==0xDB)||(out[i+1]==0xDD))))
+			i++;
+		if((i+2>total) || (total-i+2>outSize)){
+			ALOGE("%s, invalid vpu output, size %d",__FUNCTION__,total);
+			return 0;
+		}
+		((uint8_t *)outBuf)[0]=0xFF;
+		((uint8_t *)outBuf)[1]=0xD8;
+		memcpy((uint8_t *)outBuf+2,out+i,total-i);
+		size=total-i+2;
 	}
 	else{
 		ALOGE("%s, vpu encode frame failure: no output,  ret=0x%X ",__FUNCTION__,sEncEncParam.eOutRetCode);
 	}
 
-	memcpy(outBuf,(void*)(uintptr_t)sEncEncParam.nInVirtOutput,sEncEncParam.nOutOutputSize);
-
-finish:
-
-	//close vpu
-	if(handle!=0){
-		ret=VPU_EncClose(handle);
-		if (ret!=VPU_ENC_RET_SUCCESS){
-			ALOGE("%s: vpu close failure: ret=%d ",__FUNCTION__,ret);
-		}
-	}
-
-	//unload
-	ret=VPU_EncUnLoad();
-	if (ret!=VPU_ENC_RET_SUCCESS){
-		ALOGE("%s: vpu unload failure: ret=%d \r\n",__FUNCTION__,ret);
-	}
-
-	//release mem
-	if(0==EncFreeMemBlock(&sEncMemInfo)){
-		ALOGE("%s: free memory failure:  ",__FUNCTION__);
-	}
-
 	return size;
 }
 #endif
@@ -443,25 +553,67 @@ finish:
 YuvToJpegEncoder * YuvToJpegEncoder::create(int format) {
     // Only ImageFormat.NV21 and ImageFormat.YUY2 are supported
     // for now.
+    YuvToJpegEncoder *encoder = NULL;
     if (format == HAL_PIXEL_FORMAT_YCbCr_420_SP) {
-        return new Yuv420SpToJpegEncoder();
+        encoder = new Yuv420SpToJpegEncoder();
     } else if (format == HAL_PIXEL_FORMAT_YCbCr_422_I) {
-        return new Yuv422IToJpegEncoder();
+        encoder = new Yuv422IToJpegEncoder();
     } else if (format == HAL_PIXEL_FORMAT_YCbCr_422_SP) {
-        return new Yuv422SpToJpegEncoder();
+        encoder = new Yuv422SpToJpegEncoder();
     } else {
         ALOGE("YuvToJpegEncoder:create format:%d not support", format);
         return NULL;
     }
+
+    encoder->mPixelFormat = format;
+    return encoder;
 }
 
 YuvToJpegEncoder::YuvToJpegEncoder()
-    : supportVpu(false),
-      fNumPlanes(1),
+    : fNumPlanes(1),
       color(1),
-      mColorFormat(0)
+      mColorFormat(0),
+      mChromaVShift(0),
+      supportVpu(false),
+      mPixelFormat(0),
+      mVpuSession(NULL),
+      mSlicePool(this, "JpegSliceThread", MAX_SLICES - 1)
 {}
 
+YuvToJpegEncoder::~YuvToJpegEncoder()
+{
+    mSlicePool.stop();
+#ifdef BOARD_HAVE_VPU
+    delete mVpuSession;
+#endif
+}
+
+// row buffers hold 16 lines of Y, U and V for compress.
+static int getRowBufferSize(int width)
+{
+    return 16 * (int)Align(width, 16) * 2;
+}
+
+// 2 bytes per pixel is enough for both 420 and 422 planar resize output.
+static int getResizeBufferSize(int width, int height)
+{
+    return (int)Align(width, 16) * (int)Align(height, 16) * 2;
+}
+
+int YuvToJpegEncoder::getScratchSize(int inWidth,
+                                     int inHeight,
+                                     int outWidth,
+                                     int outHeight)
+{
+    // each slice has own row buffers.
+    int size = getRowBufferSize(outWidth) * MAX_SLICES;
+    if ((inWidth != outWidth) || (inHeight != outHeight)) {
+        size += getResizeBufferSize(outWidth, outHeight);
+    }
+
+    return size;
+}
+
 int YuvToJpegEncoder::encode(void *inYuv,
                              void* inYuvPhy,
                              int   inWidth,
@@ -470,51 +622,531 @@ int YuvToJpegEncoder::encode(void *inYuv,
                              void *outBuf,
                              int   outSize,
                              int   outWidth,
-                             int   outHeight) {
+                             int   outHeight,
+                             uint8_t *scratch,
+                             int   scratchSize) {
 #ifdef BOARD_HAVE_VPU
     //use vpu to encode
-	if((inWidth == outWidth) && (inHeight == outHeight) && supportVpu){
-		int size;
-		size=vpu_encode(inYuv, inYuvPhy, outWidth, outHeight,quality,color,outBuf,outSize, mColorFormat);
-		return size;
+	if((inWidth == outWidth) && (inHeight == outHeight) && supportVpu &&
+	   (inYuvPhy != NULL)){
+		android::Mutex::Autolock lock(sVpuLock);
+		if (mVpuSession == NULL) {
+			mVpuSession = new VpuJpegSession();
+		}
+		return mVpuSession->encode(inYuv, inYuvPhy, outWidth, outHeight,
+		                           color, outBuf, outSize, mColorFormat);
 	}
+#else
+    (void)inYuvPhy;
 #endif
 
-    jpeg_compress_struct  cinfo;
-    jpegBuilder_error_mgr sk_err;
-    uint8_t *resize_src = NULL;
-    jpegBuilder_destination_mgr dest_mgr((uint8_t *)outBuf, outSize);
-
+    uint8_t *allocated = NULL;
+    uint8_t *rowBuf = NULL;
+    bool planar = false;
+    int size = 0;
+
+    int needed = getScratchSize(inWidth, inHeight, outWidth, outHeight);
+    if ((scratch == NULL) || (scratchSize < needed)) {
+        ALOGW("%s scratch %d too small, need %d", __func__, scratchSize, needed);
+        allocated = (uint8_t *)malloc(needed);
+        if (allocated == NULL) {
+            ALOGE("%s malloc scratch failed", __func__);
+            return 0;
+        }
+        scratch = allocated;
+    }
+    rowBuf = scratch;
 
-    memset(&cinfo, 0, sizeof(cinfo));
     if ((inWidth != outWidth) || (inHeight != outHeight)) {
-        resize_src = (uint8_t *)malloc(outSize);
-        yuvResize((uint8_t *)inYuv,
-                  inWidth,
-                  inHeight,
-                  resize_src,
-                  outWidth,
-                  outHeight);
+        uint8_t *resize_src = scratch;
+        rowBuf = scratch + getResizeBufferSize(outWidth, outHeight);
+        if (resizePlanar((uint8_t *)inYuv,
+                         inWidth,
+                         inHeight,
+                         resize_src,
+                         outWidth,
+                         outHeight) != 0) {
+            ALOGE("%s resize %dx%d to %dx%d failed", __func__,
+                  inWidth, inHeight, outWidth, outHeight);
+            if (allocated != NULL) {
+                free(allocated);
+            }
+            return 0;
+        }
         inYuv = resize_src;
+        planar = true;
+    }
+
+    int count = getSliceCount(outWidth, outHeight);
+    if (count > 1) {
+        size = encodeSlices((uint8_t *)inYuv, outWidth, outHeight, quality,
+                            (uint8_t *)outBuf, outSize, rowBuf, count,
+                            planar);
+        if (size == 0) {
+            ALOGW("%s sliced encode failed, encode whole frame", __func__);
+        }
+    }
+
+    if (size == 0) {
+        JpegSlice whole;
+        memset(&whole, 0, sizeof(whole));
+        whole.yuv = (uint8_t *)inYuv;
+        whole.width = outWidth;
+        whole.frameHeight = outHeight;
+        whole.rows = outHeight;
+        whole.quality = quality;
+        whole.out = (uint8_t *)outBuf;
+        whole.outSize = outSize;
+        whole.rowBuf = rowBuf;
+        whole.planar = planar;
+        size = encodeSlice(&whole);
+        if (size == 0) {
+            ALOGE("%s output buffer %d too small", __func__, outSize);
+        }
+    }
+
+    if (allocated != NULL) {
+        free(allocated);
+    }
+
+    return size;
+}
+
+int YuvToJpegEncoder::getSliceCount(int width, int height)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = height / MIN_SLICE_ROWS;
+
+    if (count > cpus) {
+        count = cpus;
     }
+    if (count > MAX_SLICES) {
+        count = MAX_SLICES;
+    }
+    if (count < 1) {
+        count = 1;
+    }
+
+    // restart interval is 16 bits.
+    int mcuRows = (height + MCU_SIZE - 1) / MCU_SIZE;
+    int mcuCols = (width + MCU_SIZE - 1) / MCU_SIZE;
+    if (((mcuRows + count - 1) / count) * mcuCols > 0xffff) {
+        count = 1;
+    }
+
+    return count;
+}
+
+int YuvToJpegEncoder::encodeSlice(JpegSlice *slice)
+{
+    jpeg_compress_struct  cinfo;
+    jpegBuilder_error_mgr sk_err;
+    jpegBuilder_destination_mgr dest_mgr(slice->out, slice->outSize);
 
+    memset(&cinfo, 0, sizeof(cinfo));
     cinfo.err = jpeg_std_error(&sk_err);
     jpeg_create_compress(&cinfo);
 
     cinfo.dest = &dest_mgr;
 
-    setJpegCompressStruct(&cinfo, outWidth, outHeight, quality);
+    setJpegCompressStruct(&cinfo, slice->width, slice->rows, slice->quality);
+    cinfo.restart_interval = slice->restartInterval;
 
     jpeg_start_compress(&cinfo, TRUE);
 
-    compress(&cinfo, (uint8_t *)inYuv);
+    if (slice->planar) {
+        compressPlanar(&cinfo, slice->yuv, slice->firstRow, slice->frameHeight);
+    }
+    else {
+        compress(&cinfo, slice->yuv, slice->rowBuf, slice->firstRow,
+                 slice->frameHeight);
+    }
     jpeg_finish_compress(&cinfo);
     jpeg_destroy_compress(&cinfo);
-    if (resize_src != NULL) {
-        free(resize_src);
+
+    slice->size = dest_mgr.overflow ? 0 : (int)dest_mgr.jpegsize;
+    return slice->size;
+}
+
+// offset of marker segment in jpeg header, -1 if not found before SOS.
+static int findMarker(const uint8_t *jpeg, int size, uint8_t marker)
+{
+    int i = 2;
+    while ((i + 4 <= size) && (jpeg[i] == 0xFF)) {
+        if (jpeg[i + 1] == marker) {
+            return i;
+        }
+        if (jpeg[i + 1] == 0xDA) {
+            break;
+        }
+        i += 2 + ((jpeg[i + 2] << 8) | jpeg[i + 3]);
+    }
+
+    return -1;
+}
+
+int YuvToJpegEncoder::encodeSlices(uint8_t *yuv,
+                                   int      width,
+                                   int      height,
+                                   int      quality,
+                                   uint8_t *outBuf,
+                                   int      outSize,
+                                   uint8_t *rowBuf,
+                                   int      count,
+                                   bool     planar)
+{
+    JpegSlice slices[MAX_SLICES];
+    void *args[MAX_SLICES];
+    int mcuRows = (height + MCU_SIZE - 1) / MCU_SIZE;
+    int sliceMcuRows = (mcuRows + count - 1) / count;
+    int interval = sliceMcuRows * ((width + MCU_SIZE - 1) / MCU_SIZE);
+    count = (mcuRows + sliceMcuRows - 1) / sliceMcuRows;
+    if (count < 2) {
+        return 0;
+    }
+
+    // first slice is encoded to outBuf, others to own buffers.
+    int sliceOutSize = outSize / count + SLICE_OUTPUT_MARGIN;
+    uint8_t *sliceOut = mSliceOutput.reserve(sliceOutSize * (count - 1));
+    if (sliceOut == NULL) {
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        JpegSlice &slice = slices[i];
+        slice.yuv = yuv;
+        slice.width = width;
+        slice.frameHeight = height;
+        slice.firstRow = i * sliceMcuRows * MCU_SIZE;
+        slice.rows = height - slice.firstRow;
+        if (slice.rows > sliceMcuRows * MCU_SIZE) {
+            slice.rows = sliceMcuRows * MCU_SIZE;
+        }
+        slice.quality = quality;
+        slice.restartInterval = (i == 0) ? interval : 0;
+        slice.out = (i == 0) ? outBuf : sliceOut + (i - 1) * sliceOutSize;
+        slice.outSize = (i == 0) ? outSize : sliceOutSize;
+        slice.rowBuf = rowBuf + i * getRowBufferSize(width);
+        slice.planar = planar;
+        slice.size = 0;
+        args[i] = &slice;
+    }
+
+    // first slice is encoded on caller thread.
+    mSlicePool.run(args, count);
+
+    // first slice header is for whole frame, patch SOF0 height.
+    int sof = findMarker(outBuf, slices[0].size, 0xC0);
+    if ((slices[0].size == 0) || (sof < 0)) {
+        return 0;
+    }
+    outBuf[sof + 5] = (uint8_t)(height >> 8);
+    outBuf[sof + 6] = (uint8_t)(height & 0xff);
+
+    // replace EOI of each slice with RSTn and append scan data of next one.
+    int pos = slices[0].size - 2;
+    for (int i = 1; i < count; i++) {
+        JpegSlice &slice = slices[i];
+        int sos = findMarker(slice.out, slice.size, 0xDA);
+        if ((slice.size == 0) || (sos < 0)) {
+            return 0;
+        }
+
+        int start = sos + 2 + ((slice.out[sos + 2] << 8) | slice.out[sos + 3]);
+        int len = slice.size - 2 - start;
+        if ((len <= 0) || (pos + 2 + len + 2 > outSize)) {
+            return 0;
+        }
+
+        outBuf[pos++] = 0xFF;
+        outBuf[pos++] = 0xD0 + ((i - 1) & 7);
+        memcpy(outBuf + pos, slice.out + start, len);
+        pos += len;
+    }
+    outBuf[pos++] = 0xFF;
+    outBuf[pos++] = 0xD9;
+
+    return pos;
+}
+
+android::status_t YuvToJpegEncoder::handleWork(void *arg)
+{
+    // failed slice has no size, which is checked when merging.
+    encodeSlice((JpegSlice *)arg);
+    return android::NO_ERROR;
+}
+
+// split count interleaved U/V pairs into u and v.
+static void splitUV(const uint8_t *uv, uint8_t *u, uint8_t *v, int count)
+{
+    int i = 0;
+#ifdef __ARM_NEON
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x2_t pair = vld2q_u8(uv + 2 * i);
+        vst1q_u8(u + i, pair.val[0]);
+        vst1q_u8(v + i, pair.val[1]);
+    }
+#endif
+    for (; i < count; i++) {
+        u[i] = uv[2 * i];
+        v[i] = uv[2 * i + 1];
+    }
+}
+
+// split count YUYV pixel pairs into y, u and v.
+static void splitYUYV(const uint8_t *yuyv, uint8_t *y, uint8_t *u,
+                      uint8_t *v, int count)
+{
+    int i = 0;
+#ifdef __ARM_NEON
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x4_t quad = vld4q_u8(yuyv + 4 * i);
+        uint8x16x2_t luma;
+        luma.val[0] = quad.val[0];
+        luma.val[1] = quad.val[2];
+        vst2q_u8(y + 2 * i, luma);
+        vst1q_u8(u + i, quad.val[1]);
+        vst1q_u8(v + i, quad.val[3]);
+    }
+#endif
+    for (; i < count; i++) {
+        y[2 * i]     = yuyv[4 * i];
+        y[2 * i + 1] = yuyv[4 * i + 2];
+        u[i]         = yuyv[4 * i + 1];
+        v[i]         = yuyv[4 * i + 3];
+    }
+}
+
+void YuvToJpegEncoder::getPlanarLayout(uint8_t  *yuv,
+                                       int       width,
+                                       int       height,
+                                       YuvPlane *planes)
+{
+    // strides are 16 aligned, libjpeg reads whole 8x8 blocks.
+    int stride = (int)Align(width, 16);
+    int chromaHeight = (height + mChromaVShift) >> mChromaVShift;
+    uint8_t *u = yuv + stride * height;
+    uint8_t *v = u + (stride >> 1) * chromaHeight;
+
+    YuvPlane y = {yuv, 0, stride, 1, width, height};
+    YuvPlane cb = {u, 0, stride >> 1, 1, (width + 1) >> 1, chromaHeight};
+    YuvPlane cr = {v, 0, stride >> 1, 1, (width + 1) >> 1, chromaHeight};
+    planes[0] = y;
+    planes[1] = cb;
+    planes[2] = cr;
+}
+
+void YuvToJpegEncoder::compressPlanar(jpeg_compress_struct *cinfo,
+                                      uint8_t              *yuv,
+                                      int                   firstRow,
+                                      int                   frameHeight)
+{
+    JSAMPROW   y[16];
+    JSAMPROW   cb[16];
+    JSAMPROW   cr[16];
+    JSAMPARRAY planes[3];
+    YuvPlane   layout[3];
+
+    planes[0] = y;
+    planes[1] = cb;
+    planes[2] = cr;
+    getPlanarLayout(yuv, cinfo->image_width, frameHeight, layout);
+
+    // rows below frame repeat the last row.
+    while (cinfo->next_scanline < cinfo->image_height) {
+        int row = firstRow + cinfo->next_scanline;
+        for (int i = 0; i < 16; i++) {
+            int r = row + i;
+            if (r >= layout[0].height) {
+                r = layout[0].height - 1;
+            }
+            y[i] = layout[0].base + r * layout[0].stride;
+        }
+
+        int chromaRows = 16 >> mChromaVShift;
+        for (int i = 0; i < chromaRows; i++) {
+            int r = (row >> mChromaVShift) + i;
+            if (r >= layout[1].height) {
+                r = layout[1].height - 1;
+            }
+            cb[i] = layout[1].base + r * layout[1].stride;
+            cr[i] = layout[2].base + r * layout[2].stride;
+        }
+
+        jpeg_write_raw_data(cinfo, planes, 16);
+    }
+}
+
+// weights of source samples covered by box i when srcLen samples are
+// mapped to dstLen boxes, weights sum to 256. returns sample count.
+static int getBoxWeights(int srcLen, int dstLen, int i, int *first,
+                         uint16_t *weights)
+{
+    // box bounds in 16.16 fixed point.
+    uint64_t a = ((uint64_t)i * srcLen << 16) / dstLen;
+    uint64_t b = ((uint64_t)(i + 1) * srcLen << 16) / dstLen;
+    int j0 = (int)(a >> 16);
+    int j1 = (int)((b + 0xffff) >> 16);
+    if (j1 > srcLen) {
+        j1 = srcLen;
+    }
+    if (j1 <= j0) {
+        j1 = j0 + 1;
     }
 
-    return dest_mgr.jpegsize;
+    int total = 0;
+    for (int j = j0; j < j1; j++) {
+        uint64_t lo = ((uint64_t)j << 16) > a ? ((uint64_t)j << 16) : a;
+        uint64_t hi = ((uint64_t)(j + 1) << 16) < b ? ((uint64_t)(j + 1) << 16) : b;
+        int w = (hi > lo) ? (int)(((hi - lo) << 8) / (b - a)) : 0;
+        weights[j - j0] = w;
+        total += w;
+    }
+    weights[j1 - j0 - 1] += 256 - total;
+
+    *first = j0;
+    return j1 - j0;
+}
+
+// acc += src * weight.
+static void accumulateRow(uint16_t *acc, const uint8_t *src, int size,
+                          uint16_t weight)
+{
+    int i = 0;
+#ifdef __ARM_NEON
+    for (; i + 8 <= size; i += 8) {
+        vst1q_u16(acc + i, vmlaq_n_u16(vld1q_u16(acc + i),
+                                       vmovl_u8(vld1_u8(src + i)), weight));
+    }
+#endif
+    for (; i < size; i++) {
+        acc[i] += src[i] * weight;
+    }
+}
+
+int YuvToJpegEncoder::resizePlanar(uint8_t *srcBuf,
+                                   int      srcWidth,
+                                   int      srcHeight,
+                                   uint8_t *dstBuf,
+                                   int      dstWidth,
+                                   int      dstHeight)
+{
+    YuvPlane src[3], dst[3];
+    int cx[3], cy[3], cw[3], ch[3];
+
+    if (!srcBuf || !dstBuf || srcWidth <= 0 || srcHeight <= 0 ||
+        dstWidth <= 0 || dstHeight <= 0) {
+        return -1;
+    }
+
+    getSourcePlanes(srcBuf, srcWidth, srcHeight, src);
+    getPlanarLayout(dstBuf, dstWidth, dstHeight, dst);
+
+    // center crop source to output aspect ratio.
+    int cropX = 0, cropY = 0, cropW = srcWidth, cropH = srcHeight;
+    if ((int64_t)srcWidth * dstHeight > (int64_t)srcHeight * dstWidth) {
+        cropW = (int)((int64_t)srcHeight * dstWidth / dstHeight) & ~1;
+        cropX = ((srcWidth - cropW) / 2) & ~1;
+    }
+    else if ((int64_t)srcWidth * dstHeight < (int64_t)srcHeight * dstWidth) {
+        cropH = (int)((int64_t)srcWidth * dstHeight / dstWidth) & ~1;
+        cropY = ((srcHeight - cropH) / 2) & ~1;
+    }
+
+    // crop in samples of each plane.
+    for (int p = 0; p < 3; p++) {
+        cx[p] = (int)((int64_t)cropX * src[p].width / srcWidth);
+        cy[p] = (int)((int64_t)cropY * src[p].height / srcHeight);
+        cw[p] = (int)((int64_t)cropW * src[p].width / srcWidth);
+        ch[p] = (int)((int64_t)cropH * src[p].height / srcHeight);
+        if (cw[p] < 1 || ch[p] < 1) {
+            return -1;
+        }
+    }
+
+    // row sums cover one source row, box tables of each plane cover
+    // its output columns and one output row.
+    int maxLen = srcWidth > srcHeight ? srcWidth : srcHeight;
+    size_t sumSize = Align(src[0].stride, 16) * sizeof(uint16_t);
+    size_t boxSize = (dstWidth + 1) * 2 * sizeof(int);
+    size_t weightSize = (srcWidth + 2 * dstWidth + 2) * sizeof(uint16_t);
+    size_t rowSize = (maxLen + 2) * sizeof(uint16_t);
+    uint8_t *tables = mResizeTables.reserve(sumSize + 3 * (boxSize + weightSize) + rowSize);
+    if (tables == NULL) {
+        return -1;
+    }
+    uint16_t *sums = (uint16_t *)tables;
+    uint16_t *rowWeights = (uint16_t *)(tables + sumSize);
+    int *colFirst[3], *colCount[3];
+    uint16_t *colWeights[3];
+    uint8_t *next = tables + sumSize + rowSize;
+    for (int p = 0; p < 3; p++) {
+        colFirst[p] = (int *)next;
+        colCount[p] = colFirst[p] + dstWidth + 1;
+        colWeights[p] = (uint16_t *)(next + boxSize);
+        next += boxSize + weightSize;
+
+        uint16_t *weights = colWeights[p];
+        for (int x = 0; x < dst[p].width; x++) {
+            colCount[p][x] = getBoxWeights(cw[p], dst[p].width, x,
+                                           &colFirst[p][x], weights);
+            weights += colCount[p][x];
+        }
+    }
+
+    for (int p = 0; p < 3; ) {
+        // planes in the same source rows, such as U and V of NV12 or
+        // all of YUYV, share one vertical pass.
+        int last = p;
+        while ((last + 1 < 3) && (src[last + 1].base == src[p].base) &&
+               (src[last + 1].stride == src[p].stride) &&
+               (cy[last + 1] == cy[p]) && (ch[last + 1] == ch[p]) &&
+               (dst[last + 1].height == dst[p].height)) {
+            last++;
+        }
+
+        // byte span of cropped samples in a row of the group, bytes of
+        // other samples are summed too but it keeps the loop vectorized.
+        int spanStart = src[p].stride, spanEnd = 0;
+        for (int q = p; q <= last; q++) {
+            int start = src[q].offset + cx[q] * src[q].step;
+            int end = start + (cw[q] - 1) * src[q].step + 1;
+            spanStart = (start < spanStart) ? start : spanStart;
+            spanEnd = (end > spanEnd) ? end : spanEnd;
+        }
+        int spanSize = spanEnd - spanStart;
+
+        for (int y = 0; y < dst[p].height; y++) {
+            int first;
+            int n = getBoxWeights(ch[p], dst[p].height, y, &first, rowWeights);
+            memset(sums, 0, spanSize * sizeof(uint16_t));
+            for (int j = 0; j < n; j++) {
+                const uint8_t *row = src[p].base +
+                                     (cy[p] + first + j) * src[p].stride + spanStart;
+                accumulateRow(sums, row, spanSize, rowWeights[j]);
+            }
+
+            for (int q = p; q <= last; q++) {
+                const YuvPlane &s = src[q];
+                uint8_t *out = dst[q].base + y * dst[q].stride;
+                const uint16_t *weights = colWeights[q];
+                const uint16_t *base = sums + s.offset + cx[q] * s.step - spanStart;
+                for (int x = 0; x < dst[q].width; x++) {
+                    const uint16_t *col = base + colFirst[q][x] * s.step;
+                    uint32_t sum = 0;
+                    for (int k = 0; k < colCount[q][x]; k++) {
+                        sum += weights[k] * col[k * s.step];
+                    }
+                    weights += colCount[q][x];
+                    out[x] = (uint8_t)((sum + 0x8000) >> 16);
+                }
+            }
+        }
+
+        p = last + 1;
+    }
+
+    return 0;
 }
 
 void YuvToJpegEncoder::setJpegCompressStruct(jpeg_compress_struct *cinfo,
@@ -531,6 +1163,8 @@ void YuvToJpegEncoder::setJpegCompressStruct(jpeg_compress_struct *cinfo,
     jpeg_set_colorspace(cinfo, JCS_YCbCr);
     cinfo->raw_data_in = TRUE;
     cinfo->dct_method  = JDCT_IFAST;
+    // output is SOI followed by tables, EXIF APP1 replaces JFIF APP0.
+    cinfo->write_JFIF_header = FALSE;
     configSamplingFactors(cinfo);
 }
 
@@ -539,6 +1173,7 @@ Yuv420SpToJpegEncoder::Yuv420SpToJpegEncoder() :
     YuvToJpegEncoder() {
     fNumPlanes = 2;
     color=0;
+    mChromaVShift = 1;
 #ifdef BOARD_HAVE_VPU
     supportVpu = true;
     mColorFormat = VPU_COLOR_420;
@@ -546,7 +1181,10 @@ Yuv420SpToJpegEncoder::Yuv420SpToJpegEncoder() :
 }
 
 void Yuv420SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
-                                     uint8_t              *yuv) {
+                                     uint8_t              *yuv,
+                                     uint8_t              *rowBuf,
+                                     int                   firstRow,
+                                     int                   frameHeight) {
     JSAMPROW   y[16];
     JSAMPROW   cb[8];
     JSAMPROW   cr[8];
@@ -557,20 +1195,21 @@ void Yuv420SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
     planes[2] = cr;
 
     int width         = cinfo->image_width;
-    int height        = cinfo->image_height;
     uint8_t *yPlanar  = yuv;
-    uint8_t *vuPlanar = yuv + width * height;
-    uint8_t *uRows    = new uint8_t[8 * (width >> 1)];
-    uint8_t *vRows    = new uint8_t[8 * (width >> 1)];
+    uint8_t *vuPlanar = yuv + width * frameHeight;
+    uint8_t *uRows    = rowBuf;
+    uint8_t *vRows    = rowBuf + 8 * (width >> 1);
 
     // process 16 lines of Y and 8 lines of U/V each time.
     while (cinfo->next_scanline < cinfo->image_height) {
-        // deitnerleave u and v
-        deinterleave(vuPlanar, uRows, vRows, cinfo->next_scanline, width, height);
+        int row = firstRow + cinfo->next_scanline;
+        // Y rows are used in place, only U/V are split.
+        deinterleave(vuPlanar, uRows, vRows, row, width, frameHeight);
 
         for (int i = 0; i < 16; i++) {
-            // y row
-            y[i] = yPlanar + (cinfo->next_scanline + i) * width;
+            // y row, rows below frame repeat the last row.
+            int r = (row + i < frameHeight) ? row + i : frameHeight - 1;
+            y[i] = yPlanar + r * width;
 
             // construct u row and v row
             if ((i & 1) == 0) {
@@ -582,8 +1221,6 @@ void Yuv420SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
         }
         jpeg_write_raw_data(cinfo, planes, 16);
     }
-    delete[] uRows;
-    delete[] vRows;
 }
 
 void Yuv420SpToJpegEncoder::deinterleave(uint8_t *vuPlanar,
@@ -597,14 +1234,10 @@ void Yuv420SpToJpegEncoder::deinterleave(uint8_t *vuPlanar,
         if (hoff >= (height >> 1)) {
             return;
         }
-        int offset  = hoff * width;
-        uint8_t *vu = vuPlanar + offset;
-        for (int i = 0; i < (width >> 1); ++i) {
-            int index = row * (width >> 1) + i;
-            uRows[index] = vu[0];
-            vRows[index] = vu[1];
-            vu          += 2;
-        }
+        splitUV(vuPlanar + hoff * width,
+                uRows + row * (width >> 1),
+                vRows + row * (width >> 1),
+                width >> 1);
     }
 }
 
@@ -619,40 +1252,19 @@ void Yuv420SpToJpegEncoder::configSamplingFactors(jpeg_compress_struct *cinfo) {
     cinfo->comp_info[2].v_samp_factor = 1;
 }
 
-int Yuv420SpToJpegEncoder::yuvResize(uint8_t *srcBuf,
-                                     int      srcWidth,
-                                     int      srcHeight,
-                                     uint8_t *dstBuf,
-                                     int      dstWidth,
-                                     int      dstHeight)
+void Yuv420SpToJpegEncoder::getSourcePlanes(uint8_t  *yuv,
+                                            int       width,
+                                            int       height,
+                                            YuvPlane *planes)
 {
-    if (!srcBuf || !dstBuf) {
-        return -1;
-    }
-
-    structConvImage o_img_ptr, i_img_ptr;
-    memset(&o_img_ptr, 0, sizeof(o_img_ptr));
-    memset(&i_img_ptr, 0, sizeof(i_img_ptr));
-
-    // input
-    i_img_ptr.uWidth  =  srcWidth;
-    i_img_ptr.uStride =  i_img_ptr.uWidth;
-    i_img_ptr.uHeight =  srcHeight;
-    i_img_ptr.eFormat = IC_FORMAT_YCbCr420_lp;
-    i_img_ptr.imgPtr  = srcBuf;
-    i_img_ptr.clrPtr  = i_img_ptr.imgPtr + (i_img_ptr.uWidth * i_img_ptr.uHeight);
-
-    // ouput
-    o_img_ptr.uWidth  = dstWidth;
-    o_img_ptr.uStride = o_img_ptr.uWidth;
-    o_img_ptr.uHeight = dstHeight;
-    o_img_ptr.eFormat = IC_FORMAT_YCbCr420_lp;
-    o_img_ptr.imgPtr  = dstBuf;
-    o_img_ptr.clrPtr  = o_img_ptr.imgPtr + (o_img_ptr.uWidth * o_img_ptr.uHeight);
-
-    VT_resizeFrame_Video_opt2_lp(&i_img_ptr, &o_img_ptr, NULL, 0);
-
-    return 0;
+    // NV12, U and V are interleaved in half height plane after Y.
+    uint8_t *uv = yuv + width * height;
+    YuvPlane y = {yuv, 0, width, 1, width, height};
+    YuvPlane u = {uv, 0, width, 2, width >> 1, height >> 1};
+    YuvPlane v = {uv, 1, width, 2, width >> 1, height >> 1};
+    planes[0] = y;
+    planes[1] = u;
+    planes[2] = v;
 }
 
 // /////////////////////////////////////////////////////////////////////////////
@@ -666,7 +1278,10 @@ Yuv422IToJpegEncoder::Yuv422IToJpegEncoder() :
 }
 
 void Yuv422IToJpegEncoder::compress(jpeg_compress_struct *cinfo,
-                                    uint8_t              *yuv) {
+                                    uint8_t              *yuv,
+                                    uint8_t              *rowBuf,
+                                    int                   firstRow,
+                                    int                   frameHeight) {
     JSAMPROW   y[16];
     JSAMPROW   cb[16];
     JSAMPROW   cr[16];
@@ -677,10 +1292,9 @@ void Yuv422IToJpegEncoder::compress(jpeg_compress_struct *cinfo,
     planes[2] = cr;
 
     int width      = cinfo->image_width;
-    int height     = cinfo->image_height;
-    uint8_t *yRows = new uint8_t[16 * width];
-    uint8_t *uRows = new uint8_t[16 * (width >> 1)];
-    uint8_t *vRows = new uint8_t[16 * (width >> 1)];
+    uint8_t *yRows = rowBuf;
+    uint8_t *uRows = yRows + 16 * width;
+    uint8_t *vRows = uRows + 16 * (width >> 1);
 
     uint8_t *yuvOffset = yuv;
 
@@ -690,9 +1304,9 @@ void Yuv422IToJpegEncoder::compress(jpeg_compress_struct *cinfo,
                      yRows,
                      uRows,
                      vRows,
-                     cinfo->next_scanline,
+                     firstRow + cinfo->next_scanline,
                      width,
-                     height);
+                     frameHeight);
 
         for (int i = 0; i < 16; i++) {
             // y row
@@ -707,9 +1321,6 @@ void Yuv422IToJpegEncoder::compress(jpeg_compress_struct *cinfo,
 
         jpeg_write_raw_data(cinfo, planes, 16);
     }
-    delete[] yRows;
-    delete[] uRows;
-    delete[] vRows;
 }
 
 void Yuv422IToJpegEncoder::deinterleave(uint8_t *yuv,
@@ -718,18 +1329,15 @@ void Yuv422IToJpegEncoder::deinterleave(uint8_t *yuv,
                                         uint8_t *vRows,
                                         int      rowIndex,
                                         int      width,
-                                        int      /*height*/) {
+                                        int      height) {
     for (int row = 0; row < 16; ++row) {
-        uint8_t *yuvSeg = yuv + (rowIndex + row) * width * 2;
-        for (int i = 0; i < (width >> 1); ++i) {
-            int indexY = row * width + (i << 1);
-            int indexU = row * (width >> 1) + i;
-            yRows[indexY]     = yuvSeg[0];
-            yRows[indexY + 1] = yuvSeg[2];
-            uRows[indexU]     = yuvSeg[1];
-            vRows[indexU]     = yuvSeg[3];
-            yuvSeg           += 4;
-        }
+        // rows below frame repeat the last row.
+        int r = (rowIndex + row < height) ? rowIndex + row : height - 1;
+        splitYUYV(yuv + r * width * 2,
+                  yRows + row * width,
+                  uRows + row * (width >> 1),
+                  vRows + row * (width >> 1),
+                  width >> 1);
     }
 }
 
@@ -744,79 +1352,18 @@ void Yuv422IToJpegEncoder::configSamplingFactors(jpeg_compress_struct *cinfo) {
     cinfo->comp_info[2].v_samp_factor = 2;
 }
 
-int Yuv422IToJpegEncoder::yuvResize(uint8_t *srcBuf,
-                                    int      srcWidth,
-                                    int      srcHeight,
-                                    uint8_t *dstBuf,
-                                    int      dstWidth,
-                                    int      dstHeight)
+void Yuv422IToJpegEncoder::getSourcePlanes(uint8_t  *yuv,
+                                           int       width,
+                                           int       height,
+                                           YuvPlane *planes)
 {
-    int i, j, s;
-    int h_offset;
-    int v_offset;
-    unsigned char *ptr, cc;
-    int h_scale_ratio;
-    int v_scale_ratio;
-
-    int srcStride;
-    int dstStride;
-
-    if (!dstWidth) return -1;
-
-    if (!dstHeight) return -1;
-
-    h_scale_ratio = srcWidth / dstWidth;
-    if (!h_scale_ratio) return -1;
-
-    v_scale_ratio = srcHeight / dstHeight;
-    if (!v_scale_ratio) return -1;
-
-    h_offset = (srcWidth - dstWidth * h_scale_ratio) / 2;
-    v_offset = (srcHeight - dstHeight * v_scale_ratio) / 2;
-
-    srcStride = srcWidth * 2;
-    dstStride = dstWidth * 2;
-
-    //for Y
-    for (i = 0; i < dstHeight * v_scale_ratio; i += v_scale_ratio)
-    {
-        for (j = 0; j < dstStride * h_scale_ratio; j += 2 * h_scale_ratio)
-        {
-            ptr = srcBuf + i * srcStride + j + v_offset * srcStride + h_offset * 2;
-            cc  = ptr[0];
-
-            ptr    = dstBuf + (i / v_scale_ratio) * dstStride + (j / h_scale_ratio);
-            ptr[0] = cc;
-        }
-    }
-
-    //for U
-    for (i = 0; i < dstHeight * v_scale_ratio; i += v_scale_ratio)
-    {
-        for (j = 0; j < dstStride * h_scale_ratio; j += 4 * h_scale_ratio)
-        {
-            ptr = srcBuf + 1 + i * srcStride + j + v_offset * srcStride + h_offset * 2;
-            cc  = ptr[0];
-
-            ptr    = dstBuf + 1 + (i / v_scale_ratio) * dstStride + (j / h_scale_ratio);
-            ptr[0] = cc;
-        }
-    }
-
-    //for V
-    for (i = 0; i < dstHeight * v_scale_ratio; i += v_scale_ratio)
-    {
-        for (j = 0; j < dstStride * h_scale_ratio; j += 4 * h_scale_ratio)
-        {
-            ptr = srcBuf + 3 + i * srcStride + j + v_offset * srcStride + h_offset * 2;
-            cc  = ptr[0];
-
-            ptr    = dstBuf + 3 + (i / v_scale_ratio) * dstStride + (j / h_scale_ratio);
-            ptr[0] = cc;
-        }
-    }
-
-    return 0;
+    // YUYV, all samples share the rows.
+    YuvPlane y = {yuv, 0, width * 2, 2, width, height};
+    YuvPlane u = {yuv, 1, width * 2, 4, width >> 1, height};
+    YuvPlane v = {yuv, 3, width * 2, 4, width >> 1, height};
+    planes[0] = y;
+    planes[1] = u;
+    planes[2] = v;
 }
 
 // /////////////////////////////////////////////////////////////////////////////////////////////
@@ -831,7 +1378,10 @@ Yuv422SpToJpegEncoder::Yuv422SpToJpegEncoder() :
     }
 
 void Yuv422SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
-        uint8_t              *yuv) {
+        uint8_t              *yuv,
+        uint8_t              *rowBuf,
+        int                   firstRow,
+        int                   frameHeight) {
     JSAMPROW   y[16];
     JSAMPROW   cb[16];
     JSAMPROW   cr[16];
@@ -841,27 +1391,22 @@ void Yuv422SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
     planes[1] = cb;
     planes[2] = cr;
 
-    int width      = cinfo->image_width;
-    int height     = cinfo->image_height;
-    uint8_t *yRows = new uint8_t[16 * width];
-    uint8_t *uRows = new uint8_t[16 * (width >> 1)];
-    uint8_t *vRows = new uint8_t[16 * (width >> 1)];
-
-    uint8_t *yuvOffset = yuv;
+    int width         = cinfo->image_width;
+    uint8_t *yPlanar  = yuv;
+    uint8_t *uvPlanar = yuv + width * frameHeight;
+    uint8_t *uRows    = rowBuf;
+    uint8_t *vRows    = uRows + 16 * (width >> 1);
 
-    // process 16 lines of Y and 16 lines of U/V each time.
+    // NV16, process 16 lines of Y and 16 lines of U/V each time.
     while (cinfo->next_scanline < cinfo->image_height) {
-        deinterleave(yuvOffset,
-                yRows,
-                uRows,
-                vRows,
-                cinfo->next_scanline,
-                width,
-                height);
+        int row = firstRow + cinfo->next_scanline;
+        // Y rows are used in place, only U/V are split.
+        deinterleave(uvPlanar, uRows, vRows, row, width, frameHeight);
 
         for (int i = 0; i < 16; i++) {
-            // y row
-            y[i] = yRows + i * width;
+            // y row, rows below frame repeat the last row.
+            int r = (row + i < frameHeight) ? row + i : frameHeight - 1;
+            y[i] = yPlanar + r * width;
 
             // construct u row and v row
             // width is halved because of downsampling
@@ -872,29 +1417,21 @@ void Yuv422SpToJpegEncoder::compress(jpeg_compress_struct *cinfo,
 
         jpeg_write_raw_data(cinfo, planes, 16);
     }
-    delete[] yRows;
-    delete[] uRows;
-    delete[] vRows;
 }
 
-void Yuv422SpToJpegEncoder::deinterleave(uint8_t *yuv,
-        uint8_t *yRows,
+void Yuv422SpToJpegEncoder::deinterleave(uint8_t *uvPlanar,
         uint8_t *uRows,
         uint8_t *vRows,
         int      rowIndex,
         int      width,
-        int      /*height*/) {
+        int      height) {
     for (int row = 0; row < 16; ++row) {
-        uint8_t *yuvSeg = yuv + (rowIndex + row) * width * 2;
-        for (int i = 0; i < (width >> 1); ++i) {
-            int indexY = row * width + (i << 1);
-            int indexU = row * (width >> 1) + i;
-            yRows[indexY]     = yuvSeg[0];
-            yRows[indexY + 1] = yuvSeg[2];
-            uRows[indexU]     = yuvSeg[1];
-            vRows[indexU]     = yuvSeg[3];
-            yuvSeg           += 4;
-        }
+        // rows below frame repeat the last row.
+        int r = (rowIndex + row < height) ? rowIndex + row : height - 1;
+        splitUV(uvPlanar + r * width,
+                uRows + row * (width >> 1),
+                vRows + row * (width >> 1),
+                width >> 1);
     }
 }
 
@@ -909,67 +1446,19 @@ void Yuv422SpToJpegEncoder::configSamplingFactors(jpeg_compress_struct *cinfo) {
     cinfo->comp_info[2].v_samp_factor = 2;
 }
 
-int Yuv422SpToJpegEncoder::yuvResize(uint8_t *srcBuf,
-        int      srcWidth,
-        int      srcHeight,
-        uint8_t *dstBuf,
-        int      dstWidth,
-        int      dstHeight)
+void Yuv422SpToJpegEncoder::getSourcePlanes(uint8_t  *yuv,
+        int       width,
+        int       height,
+        YuvPlane *planes)
 {
-    int i, j, s;
-    int h_offset;
-    int v_offset;
-    unsigned char *ptr, cc;
-    int h_scale_ratio;
-    int v_scale_ratio;
-
-    s = 0;
-
-_resize_begin:
-
-    if (!dstWidth) return -1;
-
-    if (!dstHeight) return -1;
-
-    h_scale_ratio = srcWidth / dstWidth;
-    if (!h_scale_ratio) return -1;
-
-    v_scale_ratio = srcHeight / dstHeight;
-    if (!v_scale_ratio) return -1;
-
-    h_offset = (srcWidth - dstWidth * h_scale_ratio) / 2;
-    v_offset = (srcHeight - dstHeight * v_scale_ratio) / 2;
-
-    for (i = 0; i < dstHeight * v_scale_ratio; i += v_scale_ratio)
-    {
-        for (j = 0; j < dstWidth * h_scale_ratio; j += h_scale_ratio)
-        {
-            ptr = srcBuf + i * srcWidth + j + v_offset * srcWidth + h_offset;
-            cc  = ptr[0];
-
-            ptr    = dstBuf + (i / v_scale_ratio) * dstWidth + (j / h_scale_ratio);
-            ptr[0] = cc;
-        }
-    }
-
-    srcBuf += srcWidth * srcHeight;
-    dstBuf += dstWidth * dstHeight;
-
-    if (s < 2)
-    {
-        if (!s++)
-        {
-            srcWidth  >>= 1;
-            srcHeight >>= 1;
-
-            dstWidth  >>= 1;
-            dstHeight >>= 1;
-        }
-
-        goto _resize_begin;
-    }
-
-    return 0;
+    // NV16, U and V are interleaved in full height plane after Y.
+    uint8_t *uv = yuv + width * height;
+    YuvPlane y = {yuv, 0, width, 1, width, height};
+    YuvPlane u = {uv, 0, width, 2, width >> 1, height};
+    YuvPlane v = {uv, 1, width, 2, width >> 1, height};
+    planes[0] = y;
+    planes[1] = u;
+    planes[2] = v;
 }
 
 
@@ -992,15 +1481,18 @@ static void jpegBuilder_init_destination(j_compress_ptr cinfo) {
     dest->next_output_byte = dest->buf;
     dest->free_in_buffer   = dest->bufsize;
     dest->jpegsize         = 0;
+    dest->overflow         = false;
 }
 
 static boolean jpegBuilder_empty_output_buffer(j_compress_ptr cinfo) {
     jpegBuilder_destination_mgr *dest =
         (jpegBuilder_destination_mgr *)cinfo->dest;
 
+    // output doesn't fit, restart at buffer head and report failure.
     dest->next_output_byte = dest->buf;
     dest->free_in_buffer   = dest->bufsize;
-    return TRUE; // ?
+    dest->overflow         = true;
+    return TRUE;
 }
 
 static void jpegBuilder_term_destination(j_compress_ptr cinfo) {
@@ -1020,5 +1512,6 @@ jpegBuilder_destination_mgr::jpegBuilder_destination_mgr(uint8_t *input,
     this->bufsize = size;
 
     jpegsize = 0;
+    overflow = false;
 }
 
@@ -24,12 +24,15 @@
 #include <dlfcn.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <linux/time.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
-#include "CameraUtils.h"
+#include <utils/threads.h>
+#include <utils/Log.h>
+#include <system/graphics.h>
+#include "ScratchBuffer.h"
+#include "WorkerThread.h"
 
 extern "C" {
     #include "jpeglib.h"
@@ -37,7 +40,40 @@ extern "C" {
 }
 #include <setjmp.h>
 
-class YuvToJpegEncoder {
+class VpuJpegSession;
+
+// rows of frame encoded as one JPEG scan, slices are joined in order
+// with restart markers.
+struct JpegSlice {
+    uint8_t *yuv;
+    int      width;
+    int      frameHeight;
+    int      firstRow;
+    int      rows;
+    int      quality;
+    // written to DRI of first slice, 0 for others.
+    int      restartInterval;
+    uint8_t *out;
+    int      outSize;
+    uint8_t *rowBuf;
+    // yuv is planar resize output instead of source format.
+    bool     planar;
+    // encoded size, 0 on failure.
+    int      size;
+};
+
+// one plane of a frame, sample (x, y) is at
+// base[y * stride + offset + x * step].
+struct YuvPlane {
+    uint8_t *base;
+    int      offset;
+    int      stride;
+    int      step;
+    int      width;
+    int      height;
+};
+
+class YuvToJpegEncoder : public WorkerThread::Handler {
 public:
     /** Create an encoder based on the YUV format.
      */
@@ -46,6 +82,8 @@ public:
     YuvToJpegEncoder();
 
     /** Encode YUV data to jpeg,  which is output to a stream.
+     *  scratch is used for resize and row buffers when it is large
+     *  enough, see getScratchSize().
      */
     int encode(void *inYuv,
                void* inYuvPhy,
@@ -55,30 +93,96 @@ public:
                void *outBuf,
                int   outSize,
                int   outWidth,
-               int   outHeight);
+               int   outHeight,
+               uint8_t *scratch = NULL,
+               int   scratchSize = 0);
+
+    /** Scratch size required by encode.
+     */
+    static int getScratchSize(int inWidth,
+                              int inHeight,
+                              int outWidth,
+                              int outHeight);
 
-    virtual ~YuvToJpegEncoder() {}
+    /** Encoder is kept across captures, VPU session is closed here.
+     */
+    virtual ~YuvToJpegEncoder();
     int getColorFormat() {return mColorFormat;}
+    int getPixelFormat() {return mPixelFormat;}
 
 protected:
+    // software encode is split into up to MAX_SLICES slices of at least
+    // MIN_SLICE_ROWS rows, one runs on caller thread.
+    static const int MAX_SLICES = 4;
+    static const int MIN_SLICE_ROWS = 128;
+    // all formats use 16x16 MCU.
+    static const int MCU_SIZE = 16;
+    // extra output room of each slice over its share of output size.
+    static const int SLICE_OUTPUT_MARGIN = 16384;
+
     int fNumPlanes;
     int color;
     int mColorFormat;
+    // chroma rows are halved for 420, kept for 422.
+    int mChromaVShift;
+
+    int  getSliceCount(int width, int height);
+    int  encodeSlice(JpegSlice *slice);
+    int  encodeSlices(uint8_t *yuv,
+                      int      width,
+                      int      height,
+                      int      quality,
+                      uint8_t *outBuf,
+                      int      outSize,
+                      uint8_t *rowBuf,
+                      int      count,
+                      bool     planar);
 
     void setJpegCompressStruct(jpeg_compress_struct *cinfo,
                                int                   width,
                                int                   height,
                                int                   quality);
     virtual void configSamplingFactors(jpeg_compress_struct *cinfo) = 0;
+    // encode rows from firstRow of frame which has frameHeight rows.
     virtual void compress(jpeg_compress_struct *cinfo,
-                          uint8_t              *yuv)                = 0;
-    virtual int  yuvResize(uint8_t *srcBuf,
-                           int      srcWidth,
-                           int      srcHeight,
-                           uint8_t *dstBuf,
-                           int      dstWidth,
-                           int      dstHeight) = 0;
+                          uint8_t              *yuv,
+                          uint8_t              *rowBuf,
+                          int                   firstRow,
+                          int                   frameHeight)        = 0;
+    // Y, U and V planes of frame in source format.
+    virtual void getSourcePlanes(uint8_t  *yuv,
+                                 int       width,
+                                 int       height,
+                                 YuvPlane *planes) = 0;
+
+    // planar Y, U, V layout of resize output, chroma is subsampled like
+    // jpeg components so compressPlanar passes rows to libjpeg directly.
+    void getPlanarLayout(uint8_t *yuv, int width, int height, YuvPlane *planes);
+    void compressPlanar(jpeg_compress_struct *cinfo,
+                        uint8_t              *yuv,
+                        int                   firstRow,
+                        int                   frameHeight);
+    // area-averaging resize of source center cropped to output aspect
+    // ratio, output is planar.
+    int  resizePlanar(uint8_t *srcBuf,
+                      int      srcWidth,
+                      int      srcHeight,
+                      uint8_t *dstBuf,
+                      int      dstWidth,
+                      int      dstHeight);
     bool supportVpu;
+    int mPixelFormat;
+    VpuJpegSession *mVpuSession;
+
+private:
+    // encode posted slice on worker thread.
+    virtual android::status_t handleWork(void *arg);
+
+    WorkerPool mSlicePool;
+    // output of slices after the first one.
+    ScratchBuffer mSliceOutput;
+    // row sums and box weights of resizePlanar.
+    ScratchBuffer mResizeTables;
 };
 
 class Yuv420SpToJpegEncoder : public YuvToJpegEncoder {
@@ -101,13 +205,14 @@ private:
                       int      width,
                       int      height);
     void        compress(jpeg_compress_struct *cinfo,
-                         uint8_t              *yuv);
-    virtual int yuvResize(uint8_t *srcBuf,
-                          int      srcWidth,
-                          int      srcHeight,
-                          uint8_t *dstBuf,
-                          int      dstWidth,
-                          int      dstHeight);
+                         uint8_t              *yuv,
+                         uint8_t              *rowBuf,
+                         int                   firstRow,
+                         int                   frameHeight);
+    void getSourcePlanes(uint8_t  *yuv,
+                         int       width,
+                         int       height,
+                         YuvPlane *planes);
 };
 
 class Yuv422IToJpegEncoder : public YuvToJpegEncoder {
@@ -118,7 +223,10 @@ public:
 private:
     void configSamplingFactors(jpeg_compress_struct *cinfo);
     void compress(jpeg_compress_struct *cinfo,
-                  uint8_t              *yuv);
+                  uint8_t              *yuv,
+                  uint8_t              *rowBuf,
+                  int                   firstRow,
+                  int                   frameHeight);
     void deinterleave(uint8_t *yuv,
                       uint8_t *yRows,
                       uint8_t *uRows,
@@ -126,12 +234,10 @@ private:
                       int      rowIndex,
                       int      width,
                       int      height);
-    virtual int yuvResize(uint8_t *srcBuf,
-                          int      srcWidth,
-                          int      srcHeight,
-                          uint8_t *dstBuf,
-                          int      dstWidth,
-                          int      dstHeight);
+    void getSourcePlanes(uint8_t  *yuv,
+                         int       width,
+                         int       height,
+                         YuvPlane *planes);
 };
 
 class Yuv422SpToJpegEncoder : public YuvToJpegEncoder {
@@ -142,20 +248,20 @@ class Yuv422SpToJpegEncoder : public YuvToJpegEncoder {
     private:
         void configSamplingFactors(jpeg_compress_struct *cinfo);
         void compress(jpeg_compress_struct *cinfo,
-                uint8_t              *yuv);
-        void deinterleave(uint8_t *yuv,
-                uint8_t *yRows,
+                uint8_t              *yuv,
+                uint8_t              *rowBuf,
+                int                   firstRow,
+                int                   frameHeight);
+        void deinterleave(uint8_t *uvPlanar,
                 uint8_t *uRows,
                 uint8_t *vRows,
                 int      rowIndex,
                 int      width,
                 int      height);
-        virtual int yuvResize(uint8_t *srcBuf,
-                int      srcWidth,
-                int      srcHeight,
-                uint8_t *dstBuf,
-                int      dstWidth,
-                int      dstHeight);
+        void getSourcePlanes(uint8_t  *yuv,
+                         int       width,
+                         int       height,
+                         YuvPlane *planes);
 };
 
 struct jpegBuilder_destination_mgr : jpeg_destination_mgr {
@@ -165,6 +271,8 @@ struct jpegBuilder_destination_mgr : jpeg_destination_mgr {
     uint8_t *buf;
     int      bufsize;
     size_t   jpegsize;
+    // encoded data exceeded bufsize.
+    bool     overflow;
 };
 
 
@@ -0,0 +1,77 @@
+# Copyright 2017 NXP
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+LOCAL_PATH := $(call my-dir)
+
+# message queue throughput and latency, runs on target and host.
+define camera3-msgqueue-bench
+include $(CLEAR_VARS)
+LOCAL_MODULE := camera3_msgqueue_bench
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+LOCAL_SRC_FILES := \
+    MessageQueueBench.cpp \
+    ../MessageQueue.cpp
+LOCAL_SHARED_LIBRARIES := \
+    liblog \
+    libutils
+LOCAL_CFLAGS += -Wall -Wextra
+LOCAL_MODULE_TAGS := optional
+endef
+
+$(eval $(camera3-msgqueue-bench))
+LOCAL_VENDOR_MODULE := true
+include $(BUILD_EXECUTABLE)
+
+$(eval $(camera3-msgqueue-bench))
+LOCAL_MODULE_HOST_OS := linux
+include $(BUILD_HOST_EXECUTABLE)
+
+# still capture encode time per encoder, format and quality. target one
+# runs JpegBuilder with hardware encoders, it needs gralloc, ion and pxp
+# headers of the HAL.
+include $(CLEAR_VARS)
+LOCAL_MODULE := camera3_jpeg_bench
+LOCAL_VENDOR_MODULE := true
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/.. \
+    $(CAMERA3_C_INCLUDES)
+LOCAL_SRC_FILES := \
+    JpegBench.cpp \
+    $(addprefix ../,$(CAMERA3_SRC_FILES))
+LOCAL_SHARED_LIBRARIES := $(CAMERA3_SHARED_LIBRARIES)
+LOCAL_CFLAGS += $(CAMERA3_CFLAGS)
+LOCAL_CPPFLAGS += $(CAMERA3_CPPFLAGS)
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_EXECUTABLE)
+
+# host one runs libjpeg encoder only, without VPU and V4L2 encoders.
+include $(CLEAR_VARS)
+LOCAL_MODULE := camera3_jpeg_bench
+LOCAL_MODULE_HOST_OS := linux
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/.. \
+    system/core/include \
+    external/jpeg
+LOCAL_SRC_FILES := \
+    JpegBench.cpp \
+    ../YuvToJpegEncoder.cpp \
+    ../WorkerThread.cpp \
+    ../ScratchBuffer.cpp
+LOCAL_SHARED_LIBRARIES := \
+    liblog \
+    libutils \
+    libjpeg
+LOCAL_CFLAGS += -Wall -Wextra -DSOFTWARE_JPEG_ONLY
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,352 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// still capture encode time, synthetic frames go through encodeImage and
+// buildImage of JpegBuilder with thumbnail and EXIF like Stream does.
+// SOFTWARE_JPEG_ONLY build runs libjpeg encoder alone, so it runs on host.
+
+#define LOG_TAG "CameraHAL"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/RefBase.h>
+#include <utils/Timers.h>
+#include "YuvToJpegEncoder.h"
+#ifndef SOFTWARE_JPEG_ONLY
+#include <cutils/properties.h>
+#include "CameraUtils.h"
+#include "JpegBuilder.h"
+#include "Metadata.h"
+#include "Stream.h"
+#endif
+
+using namespace android;
+
+static const int32_t THUMB_WIDTH = 320;
+static const int32_t THUMB_HEIGHT = 240;
+static const int32_t THUMB_QUALITY = 90;
+
+struct BenchFormat {
+    const char* name;
+    int32_t format;
+    // bytes per pixel as fraction.
+    uint32_t num;
+    uint32_t den;
+};
+
+struct BenchSize {
+    const char* name;
+    uint32_t width;
+    uint32_t height;
+};
+
+// synthetic frame with main and thumbnail output buffers.
+struct BenchFrame {
+    int32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t size;
+    ScratchBuffer frame;
+    ScratchBuffer output;
+    // main output, main scratch, thumbnail output, thumbnail scratch.
+    ScratchBuffer buffers[4];
+};
+
+// gradient with moving edges, flat frames compress unrealistically well.
+static void fillFrame(uint8_t* frame, int32_t format, uint32_t width,
+                      uint32_t height)
+{
+    uint32_t stride = (format == HAL_PIXEL_FORMAT_YCbCr_422_I) ? width * 2
+                                                               : width;
+    for (uint32_t y = 0; y < height; y++) {
+        uint8_t* line = frame + y * stride;
+        for (uint32_t x = 0; x < stride; x++) {
+            line[x] = (uint8_t)((x + y) ^ ((x * y) >> 6));
+        }
+    }
+
+    if (format == HAL_PIXEL_FORMAT_YCbCr_422_I) {
+        return;
+    }
+
+    // chroma plane, half height for NV12, full height for NV16.
+    uint32_t lines = (format == HAL_PIXEL_FORMAT_YCbCr_420_SP) ? height / 2
+                                                               : height;
+    uint8_t* uv = frame + width * height;
+    for (uint32_t y = 0; y < lines; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            uv[y * width + x] = (uint8_t)(128 + ((x >> 3) - (y >> 3)));
+        }
+    }
+}
+
+static bool prepareFrame(BenchFrame& bench, const BenchFormat& format,
+                         const BenchSize& size)
+{
+    uint32_t width = size.width;
+    uint32_t height = size.height;
+    uint32_t maxSize = width * height * 3;
+
+    bench.format = format.format;
+    bench.width = width;
+    bench.height = height;
+    bench.size = width * height * format.num / format.den;
+    if ((bench.frame.reserve(bench.size) == NULL) ||
+        (bench.output.reserve(maxSize) == NULL) ||
+        (bench.buffers[0].reserve(maxSize) == NULL) ||
+        (bench.buffers[1].reserve(YuvToJpegEncoder::getScratchSize(
+                width, height, width, height)) == NULL) ||
+        (bench.buffers[2].reserve(THUMB_WIDTH * THUMB_HEIGHT * 3) == NULL) ||
+        (bench.buffers[3].reserve(YuvToJpegEncoder::getScratchSize(
+                width, height, THUMB_WIDTH, THUMB_HEIGHT)) == NULL)) {
+        return false;
+    }
+
+    fillFrame(bench.frame.data(), bench.format, width, height);
+    return true;
+}
+
+#ifdef SOFTWARE_JPEG_ONLY
+// main image and thumbnail by libjpeg encoder, no EXIF.
+class BenchEncoder
+{
+public:
+    BenchEncoder() : mEncoder(NULL) {}
+    ~BenchEncoder() {delete mEncoder;}
+
+    const char* name() {return "software";}
+
+    // returns time of main image and thumbnail encode, or -1 on error.
+    nsecs_t encode(BenchFrame& bench, int32_t quality, size_t* outSize)
+    {
+        if ((mEncoder == NULL) ||
+            (mEncoder->getPixelFormat() != bench.format)) {
+            delete mEncoder;
+            mEncoder = YuvToJpegEncoder::create(bench.format);
+            if (mEncoder == NULL) {
+                return -1;
+            }
+        }
+
+        nsecs_t begin = systemTime();
+        int size = mEncoder->encode(bench.frame.data(), NULL, bench.width,
+                bench.height, quality, bench.buffers[0].data(),
+                bench.buffers[0].size(), bench.width, bench.height,
+                bench.buffers[1].data(), bench.buffers[1].size());
+        int thumb = mEncoder->encode(bench.frame.data(), NULL, bench.width,
+                bench.height, THUMB_QUALITY, bench.buffers[2].data(),
+                bench.buffers[2].size(), THUMB_WIDTH, THUMB_HEIGHT,
+                bench.buffers[3].data(), bench.buffers[3].size());
+        nsecs_t duration = systemTime() - begin;
+
+        *outSize = size + thumb;
+        return ((size > 0) && (thumb > 0)) ? duration : -1;
+    }
+
+    void dump() {}
+
+private:
+    YuvToJpegEncoder* mEncoder;
+};
+#else
+// JpegBuilder with encoder selection as rw.camera.jpeg.encoder, "auto"
+// takes the hardware encoder when the board has one.
+class BenchEncoder
+{
+public:
+    BenchEncoder(const char* encoder) : mName(encoder)
+    {
+        property_set(CAMERA_JPEG_ENCODER, encoder);
+        mBuilder = new JpegBuilder();
+    }
+
+    const char* name() {return mName;}
+
+    // one still capture as Stream::processJpegBuffer does it, returns
+    // time of encodeImage and buildImage, or -1 on error.
+    nsecs_t encode(BenchFrame& bench, int32_t quality, size_t* outSize)
+    {
+        // callback stream carries frame size and format for EXIF.
+        camera3_stream_t stream;
+        memset(&stream, 0, sizeof(stream));
+        stream.stream_type = CAMERA3_STREAM_OUTPUT;
+        stream.width = bench.width;
+        stream.height = bench.height;
+        stream.format = bench.format;
+
+        StreamBuffer src, dst;
+        src.mStream = new Stream(0, &stream, NULL);
+        src.mVirtAddr = bench.frame.data();
+        src.mSize = bench.size;
+        dst.mStream = src.mStream;
+        dst.mVirtAddr = bench.output.data();
+        dst.mSize = bench.output.size();
+
+        JpegParams mainJpeg(bench.frame.data(), NULL, bench.size,
+                            bench.buffers[0].data(), bench.buffers[0].size(),
+                            quality, bench.width, bench.height,
+                            bench.width, bench.height, bench.format);
+        mainJpeg.scratch = bench.buffers[1].data();
+        mainJpeg.scratch_size = bench.buffers[1].size();
+
+        JpegParams thumbJpeg(bench.frame.data(), NULL, bench.size,
+                             bench.buffers[2].data(), bench.buffers[2].size(),
+                             THUMB_QUALITY, bench.width, bench.height,
+                             THUMB_WIDTH, THUMB_HEIGHT, bench.format);
+        thumbJpeg.scratch = bench.buffers[3].data();
+        thumbJpeg.scratch_size = bench.buffers[3].size();
+
+        sp<Metadata> meta = createMetadata(quality);
+        mBuilder->reset();
+        mBuilder->setMetadata(meta);
+        mBuilder->prepareImage(&src);
+        mBuilder->prepareOutput(&dst, &mainJpeg, &thumbJpeg);
+
+        nsecs_t begin = systemTime();
+        int32_t ret = mBuilder->encodeImage(&mainJpeg, &thumbJpeg);
+        if (ret == NO_ERROR) {
+            ret = mBuilder->buildImage(&dst);
+        }
+        nsecs_t duration = systemTime() - begin;
+
+        *outSize = mBuilder->getImageSize();
+        mBuilder->setMetadata(NULL);
+        return (ret == NO_ERROR) ? duration : -1;
+    }
+
+    // statistics per backend and quality.
+    void dump() {mBuilder->dump(STDOUT_FILENO);}
+
+private:
+    static sp<Metadata> createMetadata(int32_t quality)
+    {
+        sp<Metadata> meta = new Metadata();
+        int32_t thumbSize[] = {THUMB_WIDTH, THUMB_HEIGHT};
+        int32_t orientation = 0;
+        float focalLength = 3.37f;
+        double gps[] = {31.2304, 121.4737, 12.0};
+        int64_t gpsTime = 1500000000LL;
+        const char method[] = "GPS";
+
+        meta->add1UInt8(ANDROID_JPEG_QUALITY, (uint8_t)quality);
+        meta->add1UInt8(ANDROID_JPEG_THUMBNAIL_QUALITY, THUMB_QUALITY);
+        meta->addInt32(ANDROID_JPEG_THUMBNAIL_SIZE, 2, thumbSize);
+        meta->addInt32(ANDROID_JPEG_ORIENTATION, 1, &orientation);
+        meta->addFloat(ANDROID_LENS_FOCAL_LENGTH, 1, &focalLength);
+        meta->addDouble(ANDROID_JPEG_GPS_COORDINATES, 3, gps);
+        meta->addInt64(ANDROID_JPEG_GPS_TIMESTAMP, 1, &gpsTime);
+        meta->addUInt8(ANDROID_JPEG_GPS_PROCESSING_METHOD, sizeof(method),
+                       (const uint8_t*)method);
+        return meta;
+    }
+
+    const char* mName;
+    sp<JpegBuilder> mBuilder;
+};
+#endif
+
+static void runBackend(BenchEncoder& encoder, uint32_t iterations)
+{
+    const BenchFormat formats[] = {
+        {"NV12", HAL_PIXEL_FORMAT_YCbCr_420_SP, 3, 2},
+        {"YUYV", HAL_PIXEL_FORMAT_YCbCr_422_I, 2, 1},
+        {"NV16", HAL_PIXEL_FORMAT_YCbCr_422_SP, 2, 1},
+    };
+    const BenchSize sizes[] = {
+        {"1MP", 1280, 720},
+        {"2MP", 1920, 1080},
+        {"5MP", 2592, 1944},
+        {"8MP", 3264, 2448},
+        {"12MP", 4000, 3000},
+    };
+    const int32_t qualities[] = {50, 80, 95};
+    BenchFrame bench;
+
+    printf("encoder %s\n", encoder.name());
+    printf("%-5s %-5s %4s %9s %9s %9s\n", "fmt", "size", "q", "ms",
+           "bytes", "MB/s");
+    for (uint32_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            if (!prepareFrame(bench, formats[f], sizes[s])) {
+                fprintf(stderr, "%s %s: out of memory\n", formats[f].name,
+                        sizes[s].name);
+                continue;
+            }
+
+            for (uint32_t q = 0; q < sizeof(qualities) / sizeof(qualities[0]);
+                 q++) {
+                nsecs_t total = 0;
+                size_t bytes = 0;
+                uint32_t i = 0;
+                for (; i < iterations; i++) {
+                    nsecs_t duration = encoder.encode(bench, qualities[q],
+                                                      &bytes);
+                    if (duration < 0) {
+                        break;
+                    }
+                    total += duration;
+                }
+                if (i < iterations) {
+                    printf("%-5s %-5s %4d    failed\n", formats[f].name,
+                           sizes[s].name, qualities[q]);
+                    continue;
+                }
+
+                int64_t us = total / iterations / 1000;
+                printf("%-5s %-5s %4d %9.1f %9zu %9.1f\n", formats[f].name,
+                       sizes[s].name, qualities[q], us / 1000.0, bytes,
+                       (us > 0) ? (double)bench.size / us : 0.0);
+            }
+        }
+    }
+
+    encoder.dump();
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t iterations = 5;
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+    }
+    if (iterations < 1) {
+        fprintf(stderr, "usage: %s [iterations >= 1]\n", argv[0]);
+        return 1;
+    }
+
+#ifdef SOFTWARE_JPEG_ONLY
+    BenchEncoder software;
+    runBackend(software, iterations);
+#else
+    char value[PROPERTY_VALUE_MAX];
+    property_get(CAMERA_JPEG_ENCODER, value, "auto");
+
+    {
+        BenchEncoder automatic("auto");
+        runBackend(automatic, iterations);
+    }
+    {
+        BenchEncoder software("software");
+        runBackend(software, iterations);
+    }
+
+    property_set(CAMERA_JPEG_ENCODER, value);
+#endif
+    return 0;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2017 NXP
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// post/wait throughput and latency of CMessageQueue, compared with the
+// list and mutex queue it replaced.
+
+#define LOG_TAG "CameraHAL"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <utils/List.h>
+#include <utils/RefBase.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include "MessageQueue.h"
+
+using namespace android;
+
+static const int32_t MSG_FRAME = 0x103;
+// producers keep at most this many messages queued, below ring size,
+// so both queues are measured without overflow.
+static const uint32_t MAX_QUEUED = 32;
+
+// previous CMessageQueue: refcounted messages in lists under one mutex.
+class LegacyMessage : public LightRefBase<LegacyMessage>
+{
+public:
+    LegacyMessage(int32_t what, int32_t arg0) : what(what), arg0(arg0) {}
+
+    int32_t what;
+    int32_t arg0;
+};
+
+class LegacyMessageQueue
+{
+public:
+    status_t postMessage(int32_t what, uintptr_t arg0, int32_t flags)
+    {
+        sp<LegacyMessage> message = new LegacyMessage(what, (int32_t)arg0);
+        Mutex::Autolock _l(mLock);
+        if (flags == 0) {
+            mMessages.push_back(message);
+        }
+        else {
+            mCommands.push_back(message);
+        }
+        mCondition.signal();
+        return NO_ERROR;
+    }
+
+    status_t waitMessage(CMessage& message)
+    {
+        sp<LegacyMessage> result;
+        Mutex::Autolock _l(mLock);
+        while (true) {
+            List< sp<LegacyMessage> >* list = NULL;
+            if (!mCommands.empty()) {
+                list = &mCommands;
+            }
+            else if (!mMessages.empty()) {
+                list = &mMessages;
+            }
+
+            if (list != NULL) {
+                result = *list->begin();
+                list->erase(list->begin());
+                message.what = result->what;
+                message.arg0 = result->arg0;
+                return NO_ERROR;
+            }
+            mCondition.wait(mLock);
+        }
+    }
+
+private:
+    Mutex mLock;
+    Condition mCondition;
+    List< sp<LegacyMessage> > mMessages;
+    List< sp<LegacyMessage> > mCommands;
+};
+
+struct BenchCase
+{
+    const char* name;
+    uint32_t producers;
+    uint32_t messages;
+    // post interval of each producer, 0 posts as fast as possible.
+    nsecs_t interval;
+};
+
+struct BenchResult
+{
+    nsecs_t elapsed;
+    // latency from post to wait return, sorted.
+    std::vector<nsecs_t> latency;
+};
+
+static void sleepUntil(nsecs_t when)
+{
+    nsecs_t now = systemTime();
+    if (when <= now) {
+        return;
+    }
+
+    struct timespec ts;
+    ts.tv_sec = (when - now) / 1000000000LL;
+    ts.tv_nsec = (when - now) % 1000000000LL;
+    nanosleep(&ts, NULL);
+}
+
+template <class Queue>
+static void runCase(const BenchCase& bench, BenchResult& result)
+{
+    Queue queue;
+    std::vector<nsecs_t> stamps(bench.messages);
+    std::atomic<uint32_t> queued(0);
+    uint32_t perProducer = bench.messages / bench.producers;
+    uint32_t total = perProducer * bench.producers;
+
+    result.latency.resize(total);
+    nsecs_t begin = systemTime();
+
+    std::thread consumer([&]() {
+        CMessage message;
+        for (uint32_t i = 0; i < total; i++) {
+            queue.waitMessage(message);
+            nsecs_t now = systemTime();
+            result.latency[i] = now - stamps[message.arg0];
+            queued.fetch_sub(1, std::memory_order_relaxed);
+        }
+    });
+
+    std::vector<std::thread> producers;
+    for (uint32_t p = 0; p < bench.producers; p++) {
+        producers.push_back(std::thread([&, p]() {
+            nsecs_t start = systemTime();
+            for (uint32_t i = 0; i < perProducer; i++) {
+                uint32_t index = p * perProducer + i;
+                if (bench.interval > 0) {
+                    sleepUntil(start + bench.interval * i);
+                }
+                while (queued.load(std::memory_order_relaxed) >= MAX_QUEUED) {
+                    sched_yield();
+                }
+                queued.fetch_add(1, std::memory_order_relaxed);
+                stamps[index] = systemTime();
+                while (queue.postMessage(MSG_FRAME, index, 0) != NO_ERROR) {
+                    sched_yield();
+                }
+            }
+        }));
+    }
+
+    for (uint32_t p = 0; p < producers.size(); p++) {
+        producers[p].join();
+    }
+    consumer.join();
+
+    result.elapsed = systemTime() - begin;
+    std::sort(result.latency.begin(), result.latency.end());
+}
+
+static double percentileUs(const std::vector<nsecs_t>& sorted, double pct)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    size_t i = (size_t)(pct / 100.0 * (sorted.size() - 1));
+    return sorted[i] / 1000.0;
+}
+
+static void printResult(const char* queue, const BenchCase& bench,
+                        const BenchResult& result)
+{
+    double seconds = result.elapsed / 1e9;
+    printf("%-8s %-14s %9zu %10.0f %9.1f %9.1f %9.1f %9.1f\n", queue,
+           bench.name, result.latency.size(),
+           result.latency.size() / seconds,
+           percentileUs(result.latency, 50),
+           percentileUs(result.latency, 99),
+           percentileUs(result.latency, 99.9),
+           percentileUs(result.latency, 100));
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t messages = 200000;
+    if (argc > 1) {
+        messages = atoi(argv[1]);
+    }
+    if (messages < 100) {
+        fprintf(stderr, "usage: %s [messages >= 100]\n", argv[0]);
+        return 1;
+    }
+
+    // frame messages come from framework threads, paced one mimics 60fps
+    // preview with another client, burst ones measure queue overhead.
+    const BenchCase cases[] = {
+        {"burst-1p", 1, messages, 0},
+        {"burst-4p", 4, messages, 0},
+        {"paced-2p", 2, messages / 100, 16666666LL / 4},
+    };
+
+    printf("%-8s %-14s %9s %10s %9s %9s %9s %9s\n", "queue", "case", "msgs",
+           "msgs/s", "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+    for (uint32_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        BenchResult legacy, ring;
+        runCase<LegacyMessageQueue>(cases[i], legacy);
+        printResult("list", cases[i], legacy);
+        runCase<CMessageQueue>(cases[i], ring);
+        printResult("ring", cases[i], ring);
+    }
+
+    return 0;
+}